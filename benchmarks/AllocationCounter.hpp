@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+//Replaces the global operator new of the benchmark executable to count heap allocations
+//Must only be included by one translation unit per executable
+namespace allocation_counter {
+    inline std::atomic<uint64_t> allocations{ 0 };
+
+    inline uint64_t get() {
+        return allocations.load(std::memory_order_relaxed);
+    }
+}
+
+void* operator new(std::size_t size) {
+    allocation_counter::allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
@@ -0,0 +1,84 @@
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "node/KeyHash.hpp"
+
+constexpr int ITERATIONS = 200;
+constexpr int KEYS = 10'000;
+
+//Hashing as it was done before, std::hash of the tag truncated to 16 bits
+uint16_t get_key_hash_std(std::string_view key) {
+    if (key.find('{') == std::string_view::npos || key.find('}') == std::string_view::npos) {
+        return std::hash<std::string_view>{}(key);
+    }
+    auto start = key.find('{') + 1;
+    auto end = key.find('}', start);
+    if (start < end && end != std::string_view::npos) {
+        return std::hash<std::string_view>{}(std::string(key.substr(start, end - start)));
+    }
+    return std::hash<std::string_view>{}(key);
+}
+
+template<typename F>
+void run(const std::string& name, F&& f) {
+    uint64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < ITERATIONS; ++i) {
+        checksum += f();
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    std::cout << name << ": "
+        << static_cast<double>(ns) / (static_cast<double>(ITERATIONS) * KEYS) << " ns/key"
+        << " (checksum " << checksum << ")" << std::endl;
+}
+
+void run_keys(const std::string& name, const std::vector<std::string>& keys) {
+    std::vector<std::string_view> views(keys.begin(), keys.end());
+    std::vector<uint16_t> hashes(views.size());
+
+    run(name + " std::hash", [&]() {
+        uint64_t sum = 0;
+        for (std::string_view key : views) {
+            sum += get_key_hash_std(key);
+        }
+        return sum;
+    });
+
+    run(name + " crc16", [&]() {
+        uint64_t sum = 0;
+        for (std::string_view key : views) {
+            sum += node::cluster::get_key_hash(key);
+        }
+        return sum;
+    });
+
+    run(name + " crc16 batch", [&]() {
+        node::cluster::get_key_hashes(views, hashes);
+        uint64_t sum = 0;
+        for (uint16_t hash : hashes) {
+            sum += hash;
+        }
+        return sum;
+    });
+}
+
+int main() {
+    std::vector<std::string> short_keys, long_keys, tagged_keys;
+    for (int i = 0; i < KEYS; i++) {
+        short_keys.emplace_back("key:" + std::to_string(i));
+        long_keys.emplace_back("session:" + std::string(48, 'x') + ":" + std::to_string(i));
+        tagged_keys.emplace_back("{user" + std::to_string(i % 100) + "}.followers:" + std::to_string(i));
+    }
+
+    run_keys("short", short_keys);
+    run_keys("long", long_keys);
+    run_keys("tagged", tagged_keys);
+}
@@ -0,0 +1,83 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+#include "AllocationCounter.hpp"
+#include "node/ProtocolHandler.hpp"
+#include "net/Connection.hpp"
+#include "net/FileDescriptor.hpp"
+
+using namespace node; // NOLINT
+
+constexpr int ITERATIONS = 1'000'000;
+constexpr int SOCKET_ITERATIONS = 100'000;
+
+//Decoding as it was done before CommandView, one std::string per field
+protocol::Command parse_command_owning(std::span<const char> data, uint16_t argc) {
+    protocol::Command command(argc);
+    uint64_t offset = 0;
+    for (int i = 0; i < argc; ++i) {
+        uint64_t size;
+        std::memcpy(&size, data.data() + offset, sizeof(uint64_t));
+        size = be64toh(size);
+        offset += sizeof(uint64_t);
+        command[i] = std::string(data.data() + offset, size);
+        offset += size;
+    }
+    return command;
+}
+
+template<typename F>
+void run(const std::string& name, int iterations, F&& f) {
+    uint64_t checksum = 0;
+    uint64_t allocations_before = allocation_counter::get();
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; ++i) {
+        checksum += f();
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    uint64_t allocations = allocation_counter::get() - allocations_before;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    std::cout << name << ": "
+        << static_cast<double>(ns) / iterations << " ns/request, "
+        << static_cast<double>(allocations) / iterations << " allocations/request"
+        << " (checksum " << checksum << ")" << std::endl;
+}
+
+int main() {
+    //Key longer than the small string optimization to show the allocation per field
+    protocol::Command put_command{ "a-key-that-does-not-fit-into-sso", "1024", "0" };
+    std::vector<char> data(protocol::get_command_size(put_command));
+    protocol::serialize_command(put_command, data);
+
+    run("parse_command_owning", ITERATIONS, [&]() {
+        protocol::Command command = parse_command_owning(data, 3);
+        return command[0].size() + command[1].size();
+    });
+
+    run("parse_command", ITERATIONS, [&]() {
+        protocol::CommandView command = protocol::parse_command(data, 3);
+        return command[0].size() + command[1].size();
+    });
+
+    //Full decoding path through the receive buffer of a connection
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        std::cerr << "Failed to create socketpair" << std::endl;
+        return 1;
+    }
+    net::Connection sender{ net::FileDescriptor{ fds[0] } };
+    net::Connection receiver{ net::FileDescriptor{ fds[1] } };
+
+    run("get_command", SOCKET_ITERATIONS, [&]() {
+        sender.send(data.data(), data.size());
+        protocol::CommandView command = protocol::get_command(receiver, 3, data.size());
+        return command[0].size() + command[1].size();
+    });
+}
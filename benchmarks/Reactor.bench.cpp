@@ -0,0 +1,214 @@
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "client/Client.hpp"
+#include "net/IReactor.hpp"
+#include "net/Socket.hpp"
+#include "node/Node.hpp"
+#include "node/ProtocolHandler.hpp"
+
+using namespace node; // NOLINT
+using namespace std::chrono_literals;
+
+//Small GET requests on a single connection, the cost is dominated by the syscalls per request
+constexpr int REQUESTS = 100'000;
+constexpr int TRACED_REQUESTS = 10'000;
+constexpr uint16_t CLIENT_PORT = 7080;
+constexpr uint16_t CLUSTER_PORT = 7081;
+const std::string UNIX_SOCKET_PATH = "/tmp/kvs_reactor_bench.sock";
+
+const std::map<long, std::string> NETWORKING_SYSCALLS{
+    { SYS_epoll_wait, "epoll_wait" },
+    { SYS_epoll_pwait, "epoll_pwait" },
+    { SYS_epoll_ctl, "epoll_ctl" },
+    { SYS_recvfrom, "recvfrom" },
+    { SYS_recvmsg, "recvmsg" },
+    { SYS_sendto, "sendto" },
+    { SYS_sendmsg, "sendmsg" },
+    { SYS_accept, "accept" },
+    { SYS_io_uring_enter, "io_uring_enter" },
+};
+
+enum class Transport : uint8_t {
+    c_TCP = 0,
+    c_UNIX_SOCKET = 1,
+    c_SHARED_MEMORY = 2,
+    enum_size = 3
+};
+
+std::string backend_name(net::ReactorBackend backend) {
+    return backend == net::ReactorBackend::c_IO_URING ? "io_uring" : "epoll";
+}
+
+std::string transport_name(Transport transport) {
+    switch (transport) {
+    case Transport::c_UNIX_SOCKET:
+        return "unix socket";
+    case Transport::c_SHARED_MEMORY:
+        return "shared memory";
+    default:
+        return "tcp";
+    }
+}
+
+net::Connection connect_when_listening(uint16_t port, Transport transport = Transport::c_TCP) {
+    for (int attempt = 0;; attempt++) {
+        try {
+            if (transport == Transport::c_SHARED_MEMORY) {
+                client::Client client{};
+                Status status = client.connect_to_node_over_shared_memory("127.0.0.1", port, UNIX_SOCKET_PATH);
+                if (!status.is_ok()) {
+                    throw std::runtime_error(status.get_msg());
+                }
+                //The copy shares the channel, so it stays open after the client is gone
+                return client.get_nodes_connections().begin()->second;
+            }
+            if (transport == Transport::c_UNIX_SOCKET) {
+                net::Socket socket{ net::SocketFamily::c_UNIX };
+                return socket.connect(UNIX_SOCKET_PATH);
+            }
+            net::Socket socket{};
+            return socket.connect(port);
+        }
+        catch (const std::runtime_error& e) {
+            if (attempt == 100) {
+                throw;
+            }
+            std::this_thread::sleep_for(10ms);
+        }
+    }
+}
+
+void receive_response(net::Connection& connection) {
+    protocol::MetaData meta_data = protocol::get_metadata(connection);
+    //Only drains the command, the benchmark doesn't look at the response
+    protocol::get_command(connection, meta_data.argc, meta_data.command_size);
+    if (meta_data.payload_size > 0) {
+        std::span<char> payload = connection.receive_buffer(meta_data.payload_size);
+        protocol::get_payload(connection, payload.data(), meta_data.payload_size);
+    }
+}
+
+void run_client(uint16_t port, int requests, Transport transport = Transport::c_TCP) {
+    net::Connection connection = connect_when_listening(port, transport);
+    protocol::send_instruction(connection, { "key", "5", "0" }, protocol::Instruction::c_PUT, std::string("value"));
+    receive_response(connection);
+
+    protocol::Command get{ "key", "0", "0", "false" };
+    for (int i = 0; i < requests; i++) {
+        protocol::send_instruction(connection, get, protocol::Instruction::c_GET);
+        receive_response(connection);
+    }
+}
+
+void run_node(net::ReactorBackend backend, uint16_t client_port, uint16_t cluster_port) {
+    Node node = Node::new_in_memory_node("bench", client_port, cluster_port, "127.0.0.1", true);
+    node.set_reactor_backend(backend);
+    node.start();
+}
+
+void measure_latency(net::ReactorBackend backend, Transport transport = Transport::c_TCP) {
+    std::string name = backend_name(backend) + " (" + transport_name(transport) + ")";
+    Node node = Node::new_in_memory_node("bench", CLIENT_PORT, CLUSTER_PORT, "127.0.0.1", true);
+    node.set_reactor_backend(backend);
+    if (node.get_reactor().get_backend() != backend) {
+        std::cout << name << ": not supported, skipped" << std::endl;
+        return;
+    }
+    if (transport != Transport::c_TCP) {
+        node.set_unix_socket_path(UNIX_SOCKET_PATH);
+    }
+    std::thread node_thread(&Node::start, &node);
+
+    auto start = std::chrono::steady_clock::now();
+    run_client(CLIENT_PORT, REQUESTS, transport);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    node.stop();
+    node_thread.join();
+    std::cout << name << ": " << static_cast<double>(ns) / REQUESTS << " ns/request" << std::endl;
+}
+
+//The node runs in a child process that is traced, every syscall entry of its threads is counted until the client is done
+void measure_syscalls(net::ReactorBackend backend, uint16_t client_port, uint16_t cluster_port) {
+    pid_t node_pid = fork();
+    if (node_pid == 0) {
+        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        raise(SIGSTOP);
+        run_node(backend, client_port, cluster_port);
+        _exit(0);
+    }
+
+    int status;
+    waitpid(node_pid, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, node_pid, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, node_pid, nullptr, nullptr);
+
+    pid_t client_pid = fork();
+    if (client_pid == 0) {
+        run_client(client_port, TRACED_REQUESTS);
+        _exit(0);
+    }
+
+    std::map<long, uint64_t> syscalls;
+    while (true) {
+        pid_t pid = waitpid(-1, &status, __WALL);
+        if (pid == client_pid || pid < 0) {
+            break;
+        }
+        if (!WIFSTOPPED(status)) {
+            continue;
+        }
+
+        int signal = 0;
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            __ptrace_syscall_info info{};
+            ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info);
+            if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+                syscalls[static_cast<long>(info.entry.nr)]++;
+            }
+        }
+        //Forward real signals, but not the stops caused by tracing new threads
+        else if (WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != SIGSTOP) {
+            signal = WSTOPSIG(status);
+        }
+        ptrace(PTRACE_SYSCALL, pid, nullptr, signal);
+    }
+    kill(node_pid, SIGKILL);
+    while (waitpid(-1, &status, __WALL) > 0) {}
+
+    uint64_t total = 0;
+    std::string breakdown;
+    for (const auto& [number, name] : NETWORKING_SYSCALLS) {
+        if (syscalls[number] == 0) {
+            continue;
+        }
+        total += syscalls[number];
+        breakdown += " " + name + ": " + std::to_string(static_cast<double>(syscalls[number]) / TRACED_REQUESTS);
+    }
+    std::cout << backend_name(backend) << ": " << static_cast<double>(total) / TRACED_REQUESTS
+        << " networking syscalls/request (" << breakdown << " )" << std::endl;
+}
+
+int main() {
+    std::cout << "Latency of " << REQUESTS << " sequential GET requests" << std::endl;
+    measure_latency(net::ReactorBackend::c_EPOLL);
+    measure_latency(net::ReactorBackend::c_IO_URING);
+    measure_latency(net::ReactorBackend::c_EPOLL, Transport::c_UNIX_SOCKET);
+    measure_latency(net::ReactorBackend::c_IO_URING, Transport::c_UNIX_SOCKET);
+    measure_latency(net::ReactorBackend::c_EPOLL, Transport::c_SHARED_MEMORY);
+    measure_latency(net::ReactorBackend::c_IO_URING, Transport::c_SHARED_MEMORY);
+
+    std::cout << std::endl << "Syscalls of the node for " << TRACED_REQUESTS << " GET requests" << std::endl;
+    measure_syscalls(net::ReactorBackend::c_EPOLL, CLIENT_PORT + 2, CLUSTER_PORT + 2);
+    measure_syscalls(net::ReactorBackend::c_IO_URING, CLIENT_PORT + 4, CLUSTER_PORT + 4);
+}
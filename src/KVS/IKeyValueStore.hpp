@@ -4,11 +4,31 @@
 #include "../utils/ByteArray.hpp"
 #include "../utils/Options.hpp"
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 
 namespace key_value_store
 {
 
+    //Like the iterators of leveldb, it is invalidated by any change of the store
+    class IKeyIterator
+    {
+    public:
+        IKeyIterator() = default;
+        virtual ~IKeyIterator() = default;
+
+        IKeyIterator(const IKeyIterator&) = delete;
+        IKeyIterator& operator=(const IKeyIterator&) = delete;
+
+        virtual bool valid() const = 0;
+        virtual void next() = 0;
+        //Only called while valid
+        virtual std::string_view key() const = 0;
+        virtual const ByteArray& value() const = 0;
+    };
+
     class IKeyValueStore
     {
     public:
@@ -21,10 +41,18 @@ namespace key_value_store
         IKeyValueStore(IKeyValueStore&&) noexcept = default;
         IKeyValueStore& operator=(IKeyValueStore&&) noexcept = default;
 
-        virtual Status put(const std::string& key, const ByteArray& value, const WriteOptions& options = WriteOptions{}) noexcept = 0;
-        virtual Status get(const std::string& key, ByteArray& value, const ReadOptions& options = ReadOptions{}) const noexcept = 0;
-        virtual Status erase(const std::string& key, const WriteOptions& options = WriteOptions{}) noexcept = 0;
-        virtual bool contains_key(const std::string& key) const noexcept = 0;
+        virtual Status put(std::string_view key, const ByteArray& value, const WriteOptions& options = WriteOptions{}) noexcept = 0;
+        virtual Status get(std::string_view key, ByteArray& value, const ReadOptions& options = ReadOptions{}) const noexcept = 0;
+        virtual Status erase(std::string_view key, const WriteOptions& options = WriteOptions{}) noexcept = 0;
+        virtual bool contains_key(std::string_view key) const noexcept = 0;
+
+        //Iterates over the keys of the slot in time proportional to their amount
+        virtual std::unique_ptr<IKeyIterator> new_slot_iterator(uint16_t slot, const ReadOptions& options = ReadOptions{}) const = 0;
+
+        virtual uint64_t get_slot_size(uint16_t slot) const = 0;
+
+        //Size of the keys and values of the slot
+        virtual uint64_t get_slot_bytes(uint16_t slot) const = 0;
 
         virtual uint64_t get_size() const = 0;
     };
@@ -1,33 +1,124 @@
+#include <algorithm>
+
 #include "InMemoryKVS.hpp"
 
 using InMemoryKVS = key_value_store::InMemoryKVS;
 
+class InMemoryKVS::SlotIterator : public IKeyIterator {
+public:
+    explicit SlotIterator(const Item* item) : item_(item) {
+    }
+
+    bool valid() const override {
+        return item_ != nullptr;
+    }
+
+    void next() override {
+        item_ = item_->second.next;
+    }
+
+    std::string_view key() const override {
+        return item_->first;
+    }
+
+    const ByteArray& value() const override {
+        return item_->second.value;
+    }
+
+private:
+    const Item* item_;
+};
+
+InMemoryKVS::InMemoryKVS() : InMemoryKVS([](std::string_view) -> uint16_t { return 0; }, 1) {
+}
+
+InMemoryKVS::InMemoryKVS(SlotFunction get_slot, uint16_t amount_of_slots) : get_slot_(get_slot), slots_(std::max<uint16_t>(amount_of_slots, 1)) {
+}
+
 // NOLINTNEXTLINE
-Status InMemoryKVS::put(const std::string& key, const ByteArray& value, const WriteOptions& options) noexcept {
-    mapping_[key] = ByteArray(std::move(value));
+Status InMemoryKVS::put(std::string_view key, const ByteArray& value, const WriteOptions& options) noexcept {
+    //Only allocate a new key if it isn't stored yet
+    auto it = mapping_.find(key);
+    if (it != mapping_.end()) {
+        uint64_t bytes = key.size() + value.size();
+        slots_[it->second.slot].bytes += bytes - it->second.bytes;
+        it->second.value = value;
+        it->second.bytes = bytes;
+        return Status::new_ok();
+    }
+
+    auto [inserted, success] = mapping_.emplace(std::string(key), Entry{ value, key.size() + value.size() });
+    link(*inserted);
     return Status::new_ok();
 }
 
 // NOLINTNEXTLINE
-Status InMemoryKVS::get(const std::string& key, ByteArray& value, const ReadOptions& options) const noexcept {
-    if (!mapping_.contains(key)) {
+Status InMemoryKVS::get(std::string_view key, ByteArray& value, const ReadOptions& options) const noexcept {
+    auto it = mapping_.find(key);
+    if (it == mapping_.end()) {
         return Status::new_not_found("The given key was not found");
     }
 
-    value = mapping_.at(key);
+    value = it->second.value;
     return Status::new_ok();
 }
 
 // NOLINTNEXTLINE
-Status InMemoryKVS::erase(const std::string& key, const WriteOptions& options) noexcept {
-    if (!mapping_.contains(key)) {
+Status InMemoryKVS::erase(std::string_view key, const WriteOptions& options) noexcept {
+    auto it = mapping_.find(key);
+    if (it == mapping_.end()) {
         return Status::new_not_found("The given key was not found");
     }
 
-    mapping_.erase(key);
+    unlink(*it);
+    mapping_.erase(it);
     return Status::new_ok();
 }
 
-bool InMemoryKVS::contains_key(const std::string& key) const noexcept{
+bool InMemoryKVS::contains_key(std::string_view key) const noexcept{
     return mapping_.contains(key);
 }
+
+// NOLINTNEXTLINE
+std::unique_ptr<key_value_store::IKeyIterator> InMemoryKVS::new_slot_iterator(uint16_t slot, const ReadOptions& options) const {
+    return std::make_unique<SlotIterator>(slot < slots_.size() ? slots_[slot].first : nullptr);
+}
+
+uint64_t InMemoryKVS::get_slot_size(uint16_t slot) const {
+    return slot < slots_.size() ? slots_[slot].size : 0;
+}
+
+uint64_t InMemoryKVS::get_slot_bytes(uint16_t slot) const {
+    return slot < slots_.size() ? slots_[slot].bytes : 0;
+}
+
+void InMemoryKVS::link(Item& item) {
+    //Slots out of range share the last one, so every key is linked
+    uint16_t slot = get_slot_(item.first);
+    item.second.slot = std::min<uint16_t>(slot, slots_.size() - 1);
+
+    //New keys go first, so linking never walks the list
+    SlotKeys& keys = slots_[item.second.slot];
+    item.second.next = keys.first;
+    if (keys.first != nullptr) {
+        keys.first->second.previous = &item;
+    }
+    keys.first = &item;
+    keys.size++;
+    keys.bytes += item.second.bytes;
+}
+
+void InMemoryKVS::unlink(Item& item) {
+    SlotKeys& keys = slots_[item.second.slot];
+    if (item.second.previous != nullptr) {
+        item.second.previous->second.next = item.second.next;
+    }
+    else {
+        keys.first = item.second.next;
+    }
+    if (item.second.next != nullptr) {
+        item.second.next->second.previous = item.second.previous;
+    }
+    keys.size--;
+    keys.bytes -= item.second.bytes;
+}
@@ -6,27 +6,74 @@
 
 #include <unordered_map>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 namespace key_value_store {
 
+    //Transparent hash, allows looking up keys by std::string_view without constructing a std::string
+    struct StringHash {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view key) const {
+            return std::hash<std::string_view>{}(key);
+        }
+    };
+
     class InMemoryKVS: public IKeyValueStore {
     public:
-        InMemoryKVS() = default;
+        //Maps a key to its slot, the keys of every slot are linked to each other, so a slot is iterated without a scan
+        using SlotFunction = uint16_t(*)(std::string_view key);
+
+        //All keys are in slot 0
+        InMemoryKVS();
+        InMemoryKVS(SlotFunction get_slot, uint16_t amount_of_slots);
         InMemoryKVS(const InMemoryKVS&) = delete;
         InMemoryKVS& operator=(const InMemoryKVS&) = delete;
         ~InMemoryKVS() override = default;
 
-        Status put(const std::string& key, const ByteArray& value, const WriteOptions& options = WriteOptions{}) noexcept override;
-        Status get(const std::string& key, ByteArray& value, const ReadOptions& options = ReadOptions{}) const noexcept override;
-        Status erase(const std::string& key, const WriteOptions& options = WriteOptions{}) noexcept override;
-        bool contains_key(const std::string& key) const noexcept override;
+        Status put(std::string_view key, const ByteArray& value, const WriteOptions& options = WriteOptions{}) noexcept override;
+        Status get(std::string_view key, ByteArray& value, const ReadOptions& options = ReadOptions{}) const noexcept override;
+        Status erase(std::string_view key, const WriteOptions& options = WriteOptions{}) noexcept override;
+        bool contains_key(std::string_view key) const noexcept override;
+        std::unique_ptr<IKeyIterator> new_slot_iterator(uint16_t slot, const ReadOptions& options = ReadOptions{}) const override;
+        uint64_t get_slot_size(uint16_t slot) const override;
+        uint64_t get_slot_bytes(uint16_t slot) const override;
 
         uint64_t get_size() const {
             return mapping_.size();
         }
 
     private:
-        std::unordered_map<std::string, ByteArray> mapping_;
+        struct Entry;
+        //The elements of the map don't move when it rehashes, so they can point at each other
+        using Item = std::pair<const std::string, Entry>;
+
+        struct Entry {
+            ByteArray value;
+            //Of the key and the value when it was put, values changed in place are accounted once they are put again
+            uint64_t bytes = 0;
+            uint16_t slot = 0;
+            Item* previous = nullptr;
+            Item* next = nullptr;
+        };
+
+        struct SlotKeys {
+            Item* first = nullptr;
+            uint64_t size = 0;
+            uint64_t bytes = 0;
+        };
+
+        class SlotIterator;
+
+        void link(Item& item);
+        void unlink(Item& item);
+
+        SlotFunction get_slot_;
+        std::vector<SlotKeys> slots_;
+        std::unordered_map<std::string, Entry, StringHash, std::equal_to<>> mapping_;
     };
 
-}
\ No newline at end of file
+}
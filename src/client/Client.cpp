@@ -1,5 +1,8 @@
 #include "Client.hpp"
+#include "../node/Migration.hpp"
 
+#include <poll.h>
+#include <algorithm>
 #include <random>
 #include <stdexcept>
 #include <sstream>
@@ -27,8 +30,49 @@ namespace client {
         return Status::new_ok();
     }
 
+    Status Client::connect_to_node(const std::string& ip, uint16_t port, const std::string& unix_socket_path) {
+        std::string ip_port = get_ip_port(ip, port);
+        try {
+            net::Socket socket{ net::SocketFamily::c_UNIX };
+            nodes_connections_.emplace(ip_port, socket.connect(unix_socket_path));
+        }
+        catch (std::runtime_error& e) {
+            return Status::new_error(e.what());
+        }
+        return Status::new_ok();
+    }
+
+    Status Client::connect_to_node_over_shared_memory(const std::string& ip, uint16_t port, const std::string& unix_socket_path, uint64_t ring_size) {
+        std::string ip_port = get_ip_port(ip, port);
+        try {
+            net::Socket socket{ net::SocketFamily::c_UNIX };
+            net::Connection control = socket.connect(unix_socket_path);
+            send_instruction(control, { std::to_string(ring_size) }, Instruction::c_SHARED_MEMORY);
+
+            MetaData meta_data = get_metadata(control, "Shared memory setup failed");
+            get_command(control, meta_data.argc, meta_data.command_size);
+            ByteArray payload = get_payload(control, meta_data.payload_size);
+            if (meta_data.instruction != Instruction::c_OK_RESPONSE) {
+                return Status::new_error(payload.to_string());
+            }
+
+            //The socket stays open, the node closes the channel together with it
+            std::vector<net::FileDescriptor> file_descriptors = net::receive_file_descriptors(control.fd(), net::shared_memory_file_descriptors);
+            std::shared_ptr<net::SharedMemoryChannel> channel = net::SharedMemoryChannel::attach(std::move(file_descriptors), std::move(control));
+            nodes_connections_.emplace(ip_port, net::Connection{ std::move(channel) });
+        }
+        catch (std::runtime_error& e) {
+            return Status::new_error(e.what());
+        }
+        return Status::new_ok();
+    }
+
     void Client::disconnect_all() {
         nodes_connections_.clear();
+        read_only_nodes_.clear();
+        slot_updates_.reset();
+        slot_map_version_ = 0;
+        slot_map_digest_ = 0;
     }
 
     observer_ptr<net::Connection> Client::get_random_connection() {
@@ -48,7 +92,7 @@ namespace client {
         ByteArray received_payload;
 
         if (received_meta_data.command_size > 0) {
-            received_cmd = get_command(connection, received_meta_data.argc, received_meta_data.command_size);
+            received_cmd = get_command(connection, received_meta_data.argc, received_meta_data.command_size).to_command();
         }
         if (received_meta_data.payload_size > 0) {
             received_payload = get_payload(connection, received_meta_data.payload_size);
@@ -71,11 +115,21 @@ namespace client {
             }
         }
         slots_nodes_[slot] = ip_port;
+        //The table differs from the map the digest belongs to now
+        slot_map_digest_ = 0;
         return true;
     }
 
     //This function retrieves the connection of the node that handles the given slot
     observer_ptr<net::Connection> Client::get_node_connection_by_slot(uint16_t slot_number) {
+        apply_slot_updates();
+        //The subscription names owners before any node redirected there
+        if (slot_updates_.has_value() && !slots_nodes_[slot_number].empty()) {
+            observer_ptr<net::Connection> owner = get_node_connection(slots_nodes_[slot_number]);
+            if (owner != nullptr) {
+                return owner;
+            }
+        }
         observer_ptr<net::Connection> link = nullptr;
         //Slot handled by unknown node, but another random node available
         if (!nodes_connections_.empty() && (slots_nodes_[slot_number].empty() || !nodes_connections_.contains(slots_nodes_[slot_number]))) {
@@ -101,7 +155,7 @@ namespace client {
     }
 
     Status Client::put_value(observer_ptr<net::Connection> link, const std::string& key, const char* value, uint64_t size, int offset) {
-        uint16_t slot_number = node::cluster::get_key_hash(key) % node::cluster::CLUSTER_AMOUNT_OF_SLOTS;
+        uint16_t slot_number = node::cluster::get_key_slot(key);
         //No node available
         if (link == nullptr) {
             return Status::new_error("Not connected to any node");
@@ -165,7 +219,7 @@ namespace client {
     }
 
     Status Client::put_value(const std::string& key, const char* value, uint64_t size, int offset) {
-        uint16_t slot_number = node::cluster::get_key_hash(key) % node::cluster::CLUSTER_AMOUNT_OF_SLOTS;
+        uint16_t slot_number = node::cluster::get_key_slot(key);
         observer_ptr<net::Connection> link = get_node_connection_by_slot(slot_number);
         return put_value(link, key, value, size, offset);
     }
@@ -204,7 +258,7 @@ namespace client {
     }
 
     Status Client::get_value(observer_ptr<net::Connection> link, const std::string& key, ByteArray& value, int offset, int size, bool asking) {
-        uint16_t slot_number = node::cluster::get_key_hash(key) % node::cluster::CLUSTER_AMOUNT_OF_SLOTS;
+        uint16_t slot_number = node::cluster::get_key_slot(key);
 
         //No node available
         if (link == nullptr) {
@@ -220,7 +274,7 @@ namespace client {
         Command received_cmd;
         try {
             received_meta_data = get_metadata(*link, "Get failed");
-            received_cmd = get_command(*link, received_meta_data.argc, received_meta_data.command_size);
+            received_cmd = get_command(*link, received_meta_data.argc, received_meta_data.command_size).to_command();
         }
         catch (std::exception& e) {
             return Status::new_error(e.what());
@@ -229,11 +283,11 @@ namespace client {
         switch (received_meta_data.instruction) {
         case Instruction::c_GET_RESPONSE:
         {
-            uint64_t total_payload_size = received_meta_data.payload_size;
-            uint64_t current_payload_size = std::stoull(received_cmd[to_integral(CommandFieldsGetResponse::c_SIZE)]);
+            //The payload is the part of the value starting at the offset
+            uint64_t current_payload_size = received_meta_data.payload_size;
             uint64_t current_offset = std::stoull(received_cmd[to_integral(CommandFieldsGetResponse::c_OFFSET)]);
 
-            value.resize(total_payload_size);
+            value.resize(current_offset + current_payload_size);
             get_payload(*link, value.data() + current_offset, current_payload_size);
             return Status::new_ok();
         }
@@ -285,14 +339,17 @@ namespace client {
     }
 
     Status Client::get_value(const std::string& key, ByteArray& value, int offset, int size) {
-        uint16_t slot_number = node::cluster::get_key_hash(key) % node::cluster::CLUSTER_AMOUNT_OF_SLOTS;
-        observer_ptr<net::Connection> link = get_node_connection_by_slot(slot_number);
+        uint16_t slot_number = node::cluster::get_key_slot(key);
+        observer_ptr<net::Connection> link = stale_reads_ ? get_stale_read_connection(slot_number) : nullptr;
+        if (link == nullptr) {
+            link = get_node_connection_by_slot(slot_number);
+        }
 
         return get_value(link, key, value, offset, size, false);
     }
 
     Status Client::erase_value(observer_ptr<net::Connection> link, const std::string& key, bool asking) {
-        uint16_t slot_number = node::cluster::get_key_hash(key) % node::cluster::CLUSTER_AMOUNT_OF_SLOTS;
+        uint16_t slot_number = node::cluster::get_key_slot(key);
         //No node available
         if (link == nullptr) {
             return Status::new_error("Not connected to any node");
@@ -353,18 +410,94 @@ namespace client {
     }
 
     Status Client::erase_value(const std::string& key) {
-        uint16_t slot_number = node::cluster::get_key_hash(key) % node::cluster::CLUSTER_AMOUNT_OF_SLOTS;
+        uint16_t slot_number = node::cluster::get_key_slot(key);
         observer_ptr<net::Connection> link = get_node_connection_by_slot(slot_number);
 
         return erase_value(link, key, false);
     }
 
+    Status Client::request_multi_key(Instruction instruction, const std::vector<std::string>& keys, const std::vector<ByteArray>& values,
+        ResponseData& response) {
+        if (keys.empty()) {
+            return Status::new_invalid_argument("No keys given");
+        }
+        observer_ptr<net::Connection> link = get_node_connection_by_slot(node::cluster::get_key_slot(keys[0]));
+        if (link == nullptr) {
+            return Status::new_error("Not connected to any node");
+        }
+
+        std::vector<char> payload;
+        for (size_t i = 0; i < keys.size(); i++) {
+            const char* value = values.empty() ? nullptr : values[i].data();
+            node::cluster::append_migrated_key(payload, keys[i], value, values.empty() ? 0 : values[i].size(), false);
+        }
+        send_instruction(*link, { std::to_string(keys.size()), "false" }, instruction, payload.data(), payload.size());
+        try {
+            response = get_response(*link);
+        }
+        catch (std::exception& e) {
+            return Status::new_error(e.what());
+        }
+        MetaData& received_meta_data = std::get<to_integral(ResponseDataFields::c_METADATA)>(response);
+        if (received_meta_data.instruction == Instruction::c_ERROR_RESPONSE) {
+            return Status::new_error(std::get<to_integral(ResponseDataFields::c_PAYLOAD)>(response).to_string());
+        }
+        return Status::new_ok();
+    }
+
+    Status Client::get_values(const std::vector<std::string>& keys, std::vector<std::optional<ByteArray>>& values) {
+        ResponseData response;
+        Status state = request_multi_key(Instruction::c_MGET, keys, {}, response);
+        if (!state.is_ok()) {
+            return state;
+        }
+        if (std::get<to_integral(ResponseDataFields::c_METADATA)>(response).instruction != Instruction::c_MGET_RESPONSE) {
+            return Status::new_unknown_response("Unknown response");
+        }
+
+        ByteArray& payload = std::get<to_integral(ResponseDataFields::c_PAYLOAD)>(response);
+        std::vector<node::cluster::MigratedKey> received;
+        try {
+            received = node::cluster::parse_migrated_keys(std::span<const char>(payload.data(), payload.size()));
+        }
+        catch (std::runtime_error& e) {
+            return Status::new_error(e.what());
+        }
+        if (received.size() != keys.size()) {
+            return Status::new_error("Invalid amount of values");
+        }
+        values.clear();
+        for (node::cluster::MigratedKey& key : received) {
+            values.push_back(key.erased ? std::nullopt : std::optional<ByteArray>(std::move(key.value)));
+        }
+        return Status::new_ok();
+    }
+
+    Status Client::put_values(const std::vector<std::string>& keys, const std::vector<ByteArray>& values) {
+        if (keys.size() != values.size()) {
+            return Status::new_invalid_argument("Every key needs a value");
+        }
+        ResponseData response;
+        Status state = request_multi_key(Instruction::c_MSET, keys, values, response);
+        if (!state.is_ok()) {
+            return state;
+        }
+        if (std::get<to_integral(ResponseDataFields::c_METADATA)>(response).instruction != Instruction::c_OK_RESPONSE) {
+            return Status::new_unknown_response("Unknown response");
+        }
+        return Status::new_ok();
+    }
+
     //This function takes in a string of the form
-    //slot_number_begin slot_number_end ip:port
+    //slot_number_begin slot_number_end ip:port [replica_ip:port ...]
     //and updates the slot info
-    void Client::update_slot_info(ByteArray& data) {
+    void Client::update_slot_info(ByteArray& data, bool partial) {
         std::stringstream stream(data.to_string());
         std::string current_line;
+        std::unordered_set<std::string> updated;
+        if (!partial) {
+            replicas_.clear();
+        }
 
         //Split the string by new line
         while (std::getline(stream, current_line, '\n')) {
@@ -377,9 +510,21 @@ namespace client {
             current_line_ss >> slot_number_begin;
             current_line_ss >> slot_number_end;
             current_line_ss >> ip_port;
-            
-            //Update the slot info
-            for (uint16_t slot_number = slot_number_begin; slot_number <= slot_number_end; ++slot_number) {
+            //The line lists all replicas of the owner
+            if (partial && updated.insert(ip_port).second) {
+                replicas_.erase(ip_port);
+            }
+            std::string replica;
+            while (current_line_ss >> replica) {
+                std::vector<std::string>& replicas = replicas_[ip_port];
+                if (std::find(replicas.begin(), replicas.end(), replica) == replicas.end()) {
+                    replicas.push_back(replica);
+                }
+            }
+
+            //Update the slot info, ranges beyond the slots known by this client are ignored
+            size_t end = std::min<size_t>(static_cast<size_t>(slot_number_end) + 1, slots_nodes_.size());
+            for (size_t slot_number = slot_number_begin; slot_number < end; ++slot_number) {
                 if (ip_port != "NULL") {
                     slots_nodes_[slot_number] = ip_port;
                 }
@@ -390,6 +535,24 @@ namespace client {
         }
     }
 
+    void Client::update_slot_info(const SlotMap& map) {
+        replicas_.clear();
+        for (const SlotMapNode& node : map.nodes) {
+            if (node.primary != SLOT_MAP_NO_NODE) {
+                replicas_[map.nodes[node.primary].address].push_back(node.address);
+            }
+        }
+        for (const SlotMapRange& range : map.ranges) {
+            size_t end = std::min<size_t>(static_cast<size_t>(range.last_slot) + 1, slots_nodes_.size());
+            const std::string& ip_port = range.node == SLOT_MAP_NO_NODE ? "" : map.nodes[range.node].address;
+            for (size_t slot_number = range.first_slot; slot_number < end; ++slot_number) {
+                slots_nodes_[slot_number] = ip_port;
+            }
+        }
+        slot_map_epoch_ = map.config_epoch;
+        slot_map_digest_ = map.digest;
+    }
+
     //This function makes the request to a random node to get the slot info of the cluster
     Status Client::get_update_slot_info() {
         observer_ptr<net::Connection> link = get_random_connection();
@@ -397,8 +560,9 @@ namespace client {
             return Status::new_error("Not connected to any node");
         }
 
-        Command cmd{};
-        send_instruction(*link, cmd, Instruction::c_GET_SLOTS);
+        //The node leaves the map out if it is the one the client has
+        Command cmd{ std::to_string(slot_map_digest_) };
+        send_instruction(*link, cmd, Instruction::c_GET_SLOT_MAP);
 
         //handle response
         ResponseData response;
@@ -421,7 +585,15 @@ namespace client {
 
         case Instruction::c_OK_RESPONSE:
         {
-            update_slot_info(received_payload);
+            if (received_meta_data.payload_size == 0) {
+                return Status::new_ok();
+            }
+            try {
+                update_slot_info(parse_slot_map(std::span<const char>(received_payload.data(), received_meta_data.payload_size)));
+            }
+            catch (std::runtime_error& e) {
+                return Status::new_error(e.what());
+            }
             return Status::new_ok();
         }
 
@@ -432,6 +604,85 @@ namespace client {
         }
     }
 
+    Status Client::subscribe_slot_updates() {
+        if (nodes_connections_.empty()) {
+            return Status::new_error("Not connected to any node");
+        }
+        std::mt19937 random_engine(std::random_device{}());
+        std::uniform_int_distribution<size_t> dist(0, nodes_connections_.size() - 1);
+        std::string ip_port = std::next(nodes_connections_.begin(), dist(random_engine))->first;
+        size_t separator = ip_port.rfind(':');
+
+        //The node might push at any time, so the updates can't share a connection with the requests
+        ResponseData response;
+        try {
+            net::Connection connection = net::Socket{}.connect(ip_port.substr(0, separator), std::stoi(ip_port.substr(separator + 1)));
+            send_instruction(connection, {}, Instruction::c_SUBSCRIBE_SLOTS);
+            ResponseData subscribed = get_response(connection);
+            MetaData& subscribed_meta_data = std::get<to_integral(ResponseDataFields::c_METADATA)>(subscribed);
+            if (subscribed_meta_data.instruction == Instruction::c_ERROR_RESPONSE) {
+                return Status::new_error(std::get<to_integral(ResponseDataFields::c_PAYLOAD)>(subscribed).to_string());
+            }
+            if (subscribed_meta_data.instruction != Instruction::c_OK_RESPONSE) {
+                return Status::new_unknown_response("Unknown response");
+            }
+            response = get_response(connection);
+            slot_updates_ = std::move(connection);
+        }
+        catch (std::exception& e) {
+            return Status::new_error(e.what());
+        }
+        slot_map_version_ = 0;
+        Status state = apply_slot_update(response);
+        if (!state.is_ok()) {
+            slot_updates_.reset();
+        }
+        return state;
+    }
+
+    void Client::apply_slot_updates() {
+        while (slot_updates_.has_value()) {
+            pollfd updates{ slot_updates_->fd(), POLLIN, 0 };
+            if (::poll(&updates, 1, 0) <= 0) {
+                return;
+            }
+            //The rest of an update that arrived in part follows right away
+            ResponseData response;
+            try {
+                response = get_response(*slot_updates_);
+            }
+            catch (std::exception& e) {
+                //Redirects still lead to the owners, a new subscription has to be made
+                slot_updates_.reset();
+                return;
+            }
+            if (!apply_slot_update(response).is_ok()) {
+                slot_updates_.reset();
+            }
+        }
+    }
+
+    Status Client::apply_slot_update(ResponseData& response) {
+        MetaData& received_meta_data = std::get<to_integral(ResponseDataFields::c_METADATA)>(response);
+        Command& received_cmd = std::get<to_integral(ResponseDataFields::c_COMMAND)>(response);
+        ByteArray& received_payload = std::get<to_integral(ResponseDataFields::c_PAYLOAD)>(response);
+        if (received_meta_data.instruction != Instruction::c_SLOT_MAP_UPDATE
+            || received_cmd.size() != to_integral(CommandFieldsSlotMapUpdate::enum_size)) {
+            return Status::new_unknown_response("Unknown response");
+        }
+
+        uint64_t version = std::stoull(received_cmd[to_integral(CommandFieldsSlotMapUpdate::c_VERSION)]);
+        uint64_t base_version = std::stoull(received_cmd[to_integral(CommandFieldsSlotMapUpdate::c_BASE_VERSION)]);
+        //Changes of a version the client doesn't have can't be applied
+        if (base_version != 0 && base_version != slot_map_version_) {
+            return Status::new_error("Missed an update of the slot map");
+        }
+        update_slot_info(received_payload, base_version != 0);
+        slot_map_version_ = version;
+        slot_map_digest_ = 0;
+        return Status::new_ok();
+    }
+
     //This function is called to connect to a partner node and send it the instruction to migrate or import a slot
     Status Client::handle_slot_migration(uint16_t slot, const std::string& partner_ip, int partner_port, Instruction instruction) {
         std::string& partner_ip_port = slots_nodes_[slot];
@@ -668,4 +919,187 @@ namespace client {
         }
         }
     }
-}  // namespace client
\ No newline at end of file
+
+    observer_ptr<net::Connection> Client::get_node_connection(const std::string& ip_port) {
+        if (nodes_connections_.contains(ip_port)) {
+            return &nodes_connections_[ip_port];
+        }
+        size_t separator = ip_port.find(":");
+        if (separator == std::string::npos) {
+            return nullptr;
+        }
+        uint16_t port = std::stoi(ip_port.substr(separator + 1));
+        if (!connect_to_node(ip_port.substr(0, separator), port).is_ok()) {
+            return nullptr;
+        }
+        return &nodes_connections_[ip_port];
+    }
+
+    Status Client::request_payload(net::Connection& link, Instruction instruction, ByteArray& payload, const Command& command) {
+        send_instruction(link, command, instruction);
+
+        ResponseData response;
+        try {
+            response = get_response(link);
+        }
+        catch (std::exception& e) {
+            return Status::new_error(e.what());
+        }
+
+        MetaData& received_meta_data = std::get<to_integral(ResponseDataFields::c_METADATA)>(response);
+        ByteArray& received_payload = std::get<to_integral(ResponseDataFields::c_PAYLOAD)>(response);
+
+        switch (received_meta_data.instruction) {
+        case Instruction::c_ERROR_RESPONSE:
+        {
+            return Status::new_error(received_payload.to_string());
+        }
+        case Instruction::c_OK_RESPONSE:
+        {
+            payload = std::move(received_payload);
+            return Status::new_ok();
+        }
+        default:
+        {
+            return Status::new_unknown_response("Unknown response");
+        }
+        }
+    }
+
+    Status Client::get_cluster_load(std::vector<NodeLoadInfo>& nodes) {
+        observer_ptr<net::Connection> link = get_random_connection();
+        if (link == nullptr) {
+            return Status::new_error("Not connected to any node");
+        }
+
+        ByteArray payload{};
+        Status status = request_payload(*link, Instruction::c_GET_LOAD, payload);
+        if (!status.is_ok()) {
+            return status;
+        }
+
+        //One node per line, see protocol::serialize_load()
+        nodes.clear();
+        std::stringstream stream(payload.to_string());
+        std::string current_line;
+        while (std::getline(stream, current_line, '\n')) {
+            std::stringstream current_line_ss(current_line);
+            NodeLoadInfo node{};
+            current_line_ss >> node.name >> node.address >> node.num_slots_served
+                >> node.load.keys >> node.load.bytes >> node.load.ops_per_second >> node.load.bandwidth;
+            if (current_line_ss.fail()) {
+                return Status::new_error("Invalid load response");
+            }
+            nodes.push_back(std::move(node));
+        }
+        return Status::new_ok();
+    }
+
+    Status Client::get_slot_stats(const std::string& address, std::vector<node::cluster::SlotStats>& stats) {
+        observer_ptr<net::Connection> link = get_node_connection(address);
+        if (link == nullptr) {
+            return Status::new_error("Could not connect to node");
+        }
+
+        ByteArray payload{};
+        Status status = request_payload(*link, Instruction::c_GET_SLOT_STATS, payload);
+        if (!status.is_ok()) {
+            return status;
+        }
+
+        //One slot per line, see protocol::serialize_slot_stats()
+        stats.clear();
+        std::stringstream stream(payload.to_string());
+        std::string current_line;
+        while (std::getline(stream, current_line, '\n')) {
+            std::stringstream current_line_ss(current_line);
+            node::cluster::SlotStats slot{};
+            current_line_ss >> slot.slot >> slot.keys >> slot.bytes >> slot.ops_per_second >> slot.bandwidth;
+            if (current_line_ss.fail() || slot.slot >= node::cluster::CLUSTER_AMOUNT_OF_SLOTS) {
+                return Status::new_error("Invalid slot stats response");
+            }
+            stats.push_back(slot);
+        }
+        return Status::new_ok();
+    }
+
+    observer_ptr<net::Connection> Client::get_stale_read_connection(uint16_t slot_number) {
+        apply_slot_updates();
+        auto replicas = replicas_.find(slots_nodes_[slot_number]);
+        if (replicas == replicas_.end() || replicas->second.empty()) {
+            return nullptr;
+        }
+        static thread_local std::mt19937 random_engine(std::random_device{}());
+        //The owner takes its share of the reads as well
+        std::uniform_int_distribution<size_t> dist(0, replicas->second.size());
+        size_t index = dist(random_engine);
+        if (index == replicas->second.size()) {
+            return nullptr;
+        }
+
+        const std::string& address = replicas->second[index];
+        observer_ptr<net::Connection> link = get_node_connection(address);
+        if (link == nullptr || read_only_nodes_.contains(address)) {
+            return link;
+        }
+        ByteArray payload{};
+        if (!request_payload(*link, Instruction::c_READ_ONLY, payload).is_ok()) {
+            return nullptr;
+        }
+        read_only_nodes_.insert(address);
+        return link;
+    }
+
+    Status Client::replicate(const std::string& replica_address, const std::string& primary_name) {
+        observer_ptr<net::Connection> link = get_node_connection(replica_address);
+        if (link == nullptr) {
+            return Status::new_error("Could not connect to node");
+        }
+        ByteArray payload{};
+        return request_payload(*link, Instruction::c_REPLICATE, payload, Command{ primary_name });
+    }
+
+    Status Client::get_replication_info(const std::string& address, node::cluster::ReplicationInfo& info) {
+        observer_ptr<net::Connection> link = get_node_connection(address);
+        if (link == nullptr) {
+            return Status::new_error("Could not connect to node");
+        }
+
+        ByteArray payload{};
+        Status status = request_payload(*link, Instruction::c_GET_REPLICATION_INFO, payload);
+        if (!status.is_ok()) {
+            return status;
+        }
+
+        //One field per line, see protocol::serialize_replication_info()
+        info = node::cluster::ReplicationInfo{};
+        std::stringstream stream(payload.to_string());
+        std::string current_line;
+        while (std::getline(stream, current_line, '\n')) {
+            std::stringstream current_line_ss(current_line);
+            std::string field;
+            current_line_ss >> field;
+            if (field == "primary") {
+                current_line_ss >> info.primary;
+            }
+            else if (field == "replication_id") {
+                current_line_ss >> info.replication_id;
+            }
+            else if (field == "offset") {
+                current_line_ss >> info.offset;
+            }
+            else if (field == "synced") {
+                current_line_ss >> info.synced;
+            }
+            else if (field == "replica") {
+                node::cluster::ReplicaInfo replica{};
+                current_line_ss >> replica.name >> replica.acked_offset >> replica.lag >> replica.synced;
+                info.replicas.push_back(std::move(replica));
+            }
+            if (current_line_ss.fail()) {
+                return Status::new_error("Invalid replication info response");
+            }
+        }
+        return Status::new_ok();
+    }
+}  // namespace client
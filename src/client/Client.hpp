@@ -1,15 +1,30 @@
+#pragma once
+
+#include <optional>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "../net/Connection.hpp"
 #include "../node/Cluster.hpp"
 #include "../net/Socket.hpp"
+#include "../net/SharedMemoryChannel.hpp"
 #include "../utils/ByteArray.hpp"
 #include "../utils/Status.hpp"
 #include "../node/ProtocolHandler.hpp"
 
 namespace client {
 
+    //Load of a node as the asked node knows it from gossip
+    struct NodeLoadInfo {
+        std::string name;
+        //ip:port of its client connections
+        std::string address;
+        uint16_t num_slots_served = 0;
+        node::cluster::NodeLoad load{};
+    };
+
     class Client {
     public:
 
@@ -17,6 +32,15 @@ namespace client {
 
         Status connect_to_node(const std::string& ip, uint16_t port);
 
+        //Connects to a node on the same host over its unix domain socket
+        //The connection is used for the slots of the node with the given ip and client port, like a tcp connection to it
+        Status connect_to_node(const std::string& ip, uint16_t port, const std::string& unix_socket_path);
+
+        //Sets up a shared memory channel with a node on the same host through its unix domain socket
+        //Requests and responses are exchanged over rings in the shared segment, so GET payloads are copied straight out of it
+        Status connect_to_node_over_shared_memory(const std::string& ip, uint16_t port, const std::string& unix_socket_path,
+            uint64_t ring_size = net::shared_memory_default_ring_size);
+
         void disconnect_all();
 
         std::unordered_map<std::string, net::Connection>& get_nodes_connections() {
@@ -31,18 +55,62 @@ namespace client {
 
         Status erase_value(const std::string& key);
 
-        std::array<std::string, node::cluster::CLUSTER_AMOUNT_OF_SLOTS>& get_slot_nodes() {
+        //Gets the values of keys of any slots with one request, the node that gets it asks the owners of the other keys in parallel
+        //The values are in the order of the keys, nullopt for the ones that don't exist
+        Status get_values(const std::vector<std::string>& keys, std::vector<std::optional<ByteArray>>& values);
+
+        //Puts the values of keys of any slots with one request, the keys are written one by one,
+        //so some of them might be written if it fails
+        Status put_values(const std::vector<std::string>& keys, const std::vector<ByteArray>& values);
+
+        std::vector<std::string>& get_slot_nodes() {
             return slots_nodes_;
         }
 
         Status get_update_slot_info();
 
+        //Opens a connection to a random node that pushes the changes of the slot map, they are applied before the next request
+        //The client then follows migrations and failovers without being redirected once per slot
+        Status subscribe_slot_updates();
+
+        //Version of the slot map the subscription got last, 0 without one
+        uint64_t get_slot_map_version() const {
+            return slot_map_version_;
+        }
+
+        //Config epoch of the slot map get_update_slot_info() got last, the map is only sent again once it changed
+        uint64_t get_slot_map_epoch() const {
+            return slot_map_epoch_;
+        }
+
         Status migrate_slot(uint16_t slot, const std::string& importing_ip, int importing_port);
 
         Status import_slot(uint16_t slot, const std::string& migrating_ip, int migrating_port);
 
         Status add_node_to_cluster(const std::string& name, const std::string& ip, uint16_t client_port, uint16_t cluster_port);
 
+        //Loads of all nodes that didn't fail, asked from a random node
+        Status get_cluster_load(std::vector<NodeLoadInfo>& nodes);
+
+        //Statistics of the slots the node with the address serves, idle slots are left out
+        Status get_slot_stats(const std::string& address, std::vector<node::cluster::SlotStats>& stats);
+
+        //Makes the node with the address a replica of the named node, it must not serve any slots
+        Status replicate(const std::string& replica_address, const std::string& primary_name);
+
+        Status get_replication_info(const std::string& address, node::cluster::ReplicationInfo& info);
+
+        //GETs are spread over the owner of the slot and its replicas, which might answer with an older value
+        //The replicas are taken from the slot info, see get_update_slot_info()
+        void set_stale_reads(bool stale_reads) {
+            stale_reads_ = stale_reads;
+        }
+
+        //Addresses of the replicas by the address of their primary
+        std::unordered_map<std::string, std::vector<std::string>>& get_replicas() {
+            return replicas_;
+        }
+
     private:
 
         bool handle_move(node::protocol::Command& received_cmd, uint16_t slot);
@@ -61,14 +129,47 @@ namespace client {
 
         Status erase_value(observer_ptr<net::Connection> link, const std::string& key, bool asking);
 
+        //Sends an MGET or MSET to the owner of the first key, which serves the request for all of them
+        Status request_multi_key(node::protocol::Instruction instruction, const std::vector<std::string>& keys, const std::vector<ByteArray>& values,
+            node::protocol::ResponseData& response);
+
         observer_ptr<net::Connection> get_random_connection();
 
-        void update_slot_info(ByteArray& data);
+        //Connects to the node with the address if there is no connection yet, nullptr if that failed
+        observer_ptr<net::Connection> get_node_connection(const std::string& ip_port);
+
+        //Sends the instruction, the payload of the response is returned if it is ok
+        Status request_payload(net::Connection& link, node::protocol::Instruction instruction, ByteArray& payload,
+            const node::protocol::Command& command = {});
+
+        //The connection of a random replica or the owner of the slot, nullptr for the owner
+        //The replica is told to answer GETs of the connection first
+        observer_ptr<net::Connection> get_stale_read_connection(uint16_t slot_number);
+
+        //The replicas of the owners that aren't part of a partial update are kept
+        void update_slot_info(ByteArray& data, bool partial = false);
+
+        void update_slot_info(const node::protocol::SlotMap& map);
+
+        //Applies the updates the subscription received, without waiting for more
+        void apply_slot_updates();
+
+        Status apply_slot_update(node::protocol::ResponseData& response);
 
         Status handle_slot_migration(uint16_t slot, const std::string& partner_ip, int partner_port, node::protocol::Instruction instruction);
 
-        std::array<std::string, node::cluster::CLUSTER_AMOUNT_OF_SLOTS> slots_nodes_;
+        //Kept on the heap, with 16384 slots the table would be too large for a client on the stack
+        std::vector<std::string> slots_nodes_ = std::vector<std::string>(node::cluster::CLUSTER_AMOUNT_OF_SLOTS);
         std::unordered_map<std::string, net::Connection> nodes_connections_;
+        std::unordered_map<std::string, std::vector<std::string>> replicas_;
+        bool stale_reads_ = false;
+        std::optional<net::Connection> slot_updates_ = std::nullopt;
+        uint64_t slot_map_version_ = 0;
+        //Of the map get_update_slot_info() got last, 0 if the table changed since
+        uint64_t slot_map_epoch_ = 0;
+        uint64_t slot_map_digest_ = 0;
+        //Replicas whose connection was set to read only
+        std::unordered_set<std::string> read_only_nodes_;
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "Rebalancer.hpp"
+
+namespace client {
+
+    namespace {
+        struct Candidate {
+            double load;
+            const node::cluster::SlotStats* slot;
+        };
+
+        struct Totals {
+            double keys = 0;
+            double bytes = 0;
+            double ops_per_second = 0;
+            double bandwidth = 0;
+        };
+
+        double get_share(double value, double total) {
+            return total > 0 ? value / total : 0;
+        }
+
+        double get_slot_load(const node::cluster::SlotStats& slot, const Totals& totals, const RebalanceConfig& config) {
+            return config.keys_weight * get_share(static_cast<double>(slot.keys), totals.keys)
+                + config.bytes_weight * get_share(static_cast<double>(slot.bytes), totals.bytes)
+                + config.ops_weight * get_share(slot.ops_per_second, totals.ops_per_second)
+                + config.bandwidth_weight * get_share(slot.bandwidth, totals.bandwidth);
+        }
+
+        struct RunningMove {
+            SlotMove move;
+            std::chrono::steady_clock::time_point started;
+        };
+    }
+
+    std::vector<SlotMove> plan_rebalance(const std::vector<RebalanceNode>& nodes, const RebalanceConfig& config) {
+        std::vector<SlotMove> moves;
+        if (nodes.size() < 2) {
+            return moves;
+        }
+
+        //Each statistic is taken relative to its total, so they can be weighted against each other
+        Totals totals{};
+        for (const RebalanceNode& node : nodes) {
+            for (const node::cluster::SlotStats& slot : node.slots) {
+                totals.keys += static_cast<double>(slot.keys);
+                totals.bytes += static_cast<double>(slot.bytes);
+                totals.ops_per_second += slot.ops_per_second;
+                totals.bandwidth += slot.bandwidth;
+            }
+        }
+
+        std::vector<double> loads(nodes.size(), 0);
+        std::vector<std::vector<Candidate>> candidates(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++) {
+            for (const node::cluster::SlotStats& slot : nodes[i].slots) {
+                double load = get_slot_load(slot, totals, config);
+                loads[i] += load;
+                candidates[i].push_back(Candidate{ load, &slot });
+            }
+        }
+        double mean = 0;
+        for (double load : loads) {
+            mean += load;
+        }
+        mean /= static_cast<double>(nodes.size());
+        double limit = mean * (1 + config.tolerance);
+
+        while (moves.size() < config.max_moves) {
+            auto [coolest, hottest] = std::minmax_element(loads.begin(), loads.end());
+            size_t from = static_cast<size_t>(hottest - loads.begin());
+            size_t to = static_cast<size_t>(coolest - loads.begin());
+            if (loads[from] <= limit) {
+                break;
+            }
+
+            //Moving a slot with load l changes the gap between both nodes to |gap - 2l|
+            double gap = loads[from] - loads[to];
+            auto get_gain = [gap](double load) {
+                return gap - std::abs(gap - 2 * load);
+            };
+            double best_gain = 0;
+            for (const Candidate& candidate : candidates[from]) {
+                best_gain = std::max(best_gain, get_gain(candidate.load));
+            }
+            //Only slots that are too large or idle are left
+            if (best_gain <= 0) {
+                break;
+            }
+
+            //Slots that gain at least half as much are good enough, of those the one that moves the fewest bytes for its gain is taken
+            auto chosen = candidates[from].end();
+            double chosen_efficiency = 0;
+            for (auto candidate = candidates[from].begin(); candidate != candidates[from].end(); ++candidate) {
+                double gain = get_gain(candidate->load);
+                if (gain < best_gain / 2) {
+                    continue;
+                }
+                double efficiency = gain / static_cast<double>(candidate->slot->bytes + config.move_overhead_bytes);
+                if (chosen == candidates[from].end() || efficiency > chosen_efficiency) {
+                    chosen = candidate;
+                    chosen_efficiency = efficiency;
+                }
+            }
+
+            moves.push_back(SlotMove{ chosen->slot->slot, nodes[from].address, nodes[to].address, chosen->slot->bytes });
+            loads[from] -= chosen->load;
+            loads[to] += chosen->load;
+            //Not added to the candidates of the receiving node, it is never moved back
+            *chosen = candidates[from].back();
+            candidates[from].pop_back();
+        }
+        return moves;
+    }
+
+    Rebalancer::Rebalancer(Client& client, RebalanceConfig config) : client_(client), config_(config) {
+    }
+
+    Status Rebalancer::plan(std::vector<SlotMove>& moves) {
+        std::vector<NodeLoadInfo> loads;
+        Status status = client_.get_cluster_load(loads);
+        if (!status.is_ok()) {
+            return status;
+        }
+
+        //Nodes without slots can only receive some
+        std::vector<RebalanceNode> nodes;
+        for (const NodeLoadInfo& load : loads) {
+            RebalanceNode node{ load.address, {} };
+            if (load.num_slots_served > 0) {
+                status = client_.get_slot_stats(load.address, node.slots);
+                if (!status.is_ok()) {
+                    return status;
+                }
+            }
+            nodes.push_back(std::move(node));
+        }
+        moves = plan_rebalance(nodes, config_);
+        return Status::new_ok();
+    }
+
+    Status Rebalancer::start_move(const SlotMove& move) {
+        size_t separator = move.to.find(":");
+        std::string ip = move.to.substr(0, separator);
+        int port = std::stoi(move.to.substr(separator + 1));
+
+        Status status = client_.migrate_slot(move.slot, ip, port);
+        if (!status.is_ok()) {
+            return status;
+        }
+        return client_.import_slot(move.slot, ip, port);
+    }
+
+    Status Rebalancer::execute(const std::vector<SlotMove>& moves) {
+        Status status = client_.get_update_slot_info();
+        if (!status.is_ok()) {
+            return status;
+        }
+
+        size_t next_move = 0;
+        std::vector<RunningMove> running;
+        while (next_move < moves.size() || !running.empty()) {
+            while (running.size() < std::max<size_t>(config_.max_concurrent_moves, 1) && next_move < moves.size()) {
+                const SlotMove& move = moves[next_move++];
+                if (client_.get_slot_nodes()[move.slot] != move.from) {
+                    continue;
+                }
+                status = start_move(move);
+                if (!status.is_ok()) {
+                    return Status::new_error("Moving slot " + std::to_string(move.slot) + " failed: " + status.get_msg());
+                }
+                running.push_back(RunningMove{ move, std::chrono::steady_clock::now() });
+            }
+            if (running.empty()) {
+                continue;
+            }
+
+            //The nodes finish the migrations by themselves, the new owner is gossiped to the asked node
+            std::this_thread::sleep_for(config_.poll_interval);
+            status = client_.get_update_slot_info();
+            if (!status.is_ok()) {
+                return status;
+            }
+            auto now = std::chrono::steady_clock::now();
+            for (const RunningMove& running_move : running) {
+                if (client_.get_slot_nodes()[running_move.move.slot] != running_move.move.to && now - running_move.started > config_.move_timeout) {
+                    return Status::new_error("Moving slot " + std::to_string(running_move.move.slot) + " timed out");
+                }
+            }
+            std::erase_if(running, [this](const RunningMove& running_move) {
+                return client_.get_slot_nodes()[running_move.move.slot] == running_move.move.to;
+            });
+        }
+        return Status::new_ok();
+    }
+
+    Status Rebalancer::rebalance() {
+        std::vector<SlotMove> moves;
+        Status status = plan(moves);
+        if (!status.is_ok()) {
+            return status;
+        }
+        return execute(moves);
+    }
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Client.hpp"
+#include "../node/Cluster.hpp"
+#include "../node/Load.hpp"
+#include "../utils/Status.hpp"
+
+namespace client {
+
+    //The load of a slot is the weighted sum of its shares of the cluster totals of each statistic
+    struct RebalanceConfig {
+        double keys_weight;
+        double bytes_weight;
+        double ops_weight;
+        double bandwidth_weight;
+        //Nodes up to that fraction above the mean load are balanced enough
+        double tolerance;
+        //Added to the bytes of every move, so a few larger slots are preferred over many tiny ones
+        uint64_t move_overhead_bytes;
+        size_t max_moves;
+        //Slots migrating at the same time, the nodes stream the keys of all of them within their migration budget
+        size_t max_concurrent_moves;
+        std::chrono::milliseconds move_timeout;
+        //Pause between the checks whether the moves finished
+        std::chrono::milliseconds poll_interval;
+    };
+
+    constexpr RebalanceConfig REBALANCE_CONFIG{
+        0.1, 0.3, 0.3, 0.3, 0.1, 64 * 1024, 64, 2, std::chrono::seconds{ 60 }, std::chrono::milliseconds{ 50 }
+    };
+
+    //A node and the statistics of the slots it serves
+    struct RebalanceNode {
+        //ip:port of its client connections
+        std::string address;
+        std::vector<node::cluster::SlotStats> slots;
+    };
+
+    struct SlotMove {
+        uint16_t slot;
+        std::string from;
+        std::string to;
+        uint64_t bytes;
+    };
+
+    //Moves slots from the most to the least loaded node until the most loaded one is within the tolerance
+    //Of the slots that narrow the gap between both nodes the most, the one with the least bytes per gained balance is moved
+    //A slot is moved at most once, so the plan never moves data back and forth
+    std::vector<SlotMove> plan_rebalance(const std::vector<RebalanceNode>& nodes, const RebalanceConfig& config = REBALANCE_CONFIG);
+
+    //Balances the load of the cluster with the migrations of the nodes, instead of moving slots by hand
+    //The nodes are taken from the loads one node knows from gossip, the statistics of the slots are asked from each node that serves any
+    class Rebalancer {
+    public:
+        explicit Rebalancer(Client& client, RebalanceConfig config = REBALANCE_CONFIG);
+
+        //Collects the statistics of all nodes and plans the moves
+        Status plan(std::vector<SlotMove>& moves);
+
+        //Starts the moves with the migrate and import handshake, at most max_concurrent_moves at once
+        //Returns once all of them finished, moves of slots whose owner changed meanwhile are skipped
+        Status execute(const std::vector<SlotMove>& moves);
+
+        Status rebalance();
+
+    private:
+        Status start_move(const SlotMove& move);
+
+        Client& client_;
+        RebalanceConfig config_;
+    };
+
+}
@@ -1,6 +1,13 @@
 #include <sys/socket.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
 
 #include "Connection.hpp"
+#include "SharedMemoryChannel.hpp"
 
 namespace net {
 
@@ -11,13 +18,229 @@ namespace net {
         return send(fd, std::span<const char>(data, size));
     };
 
-    ssize_t receive(int fd, std::span<char> buf) {
-        return ::recv(fd, buf.data(), buf.size_bytes(), 0);
+    ssize_t send(int fd, std::span<iovec> data, int flags) {
+        ssize_t total_sent = 0;
+        size_t index = 0;
+        msghdr msg{};
+
+        while (index < data.size()) {
+            msg.msg_iov = data.data() + index;
+            msg.msg_iovlen = std::min<size_t>(data.size() - index, IOV_MAX);
+            ssize_t sent = ::sendmsg(fd, &msg, flags);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (sent < 0) {
+                return -1;
+            }
+            total_sent += sent;
+
+            //Skip the buffers that were sent completely and advance the partially sent one
+            while (index < data.size() && static_cast<size_t>(sent) >= data[index].iov_len) {
+                sent -= static_cast<ssize_t>(data[index].iov_len);
+                data[index].iov_len = 0;
+                ++index;
+            }
+            if (sent > 0) {
+                data[index].iov_base = static_cast<char*>(data[index].iov_base) + sent;
+                data[index].iov_len -= sent;
+            }
+        }
+        return total_sent;
+    }
+
+    ssize_t receive(int fd, std::span<char> buf, int flags) {
+        return ::recv(fd, buf.data(), buf.size_bytes(), flags);
     }
     ssize_t receive(int fd, char* buf, uint64_t size) {
         return receive(fd, std::span<char>(buf, size));
     }
 
+    OutputBuffer::OutputBuffer(OutputBufferLimits limits) {
+        limits_ = limits;
+    }
+
+    void OutputBuffer::append(std::span<const iovec> data) {
+        for (const auto& buffer : data) {
+            const char* begin = static_cast<const char*>(buffer.iov_base);
+            if (buffer.iov_len == 0) {
+                continue;
+            }
+
+            //Small writes are coalesced into the last chunk, large ones get their own
+            if (chunks_.empty() || chunks_.back().size() + buffer.iov_len > output_buffer_chunk_size) {
+                chunks_.emplace_back();
+                chunks_.back().reserve(std::max(buffer.iov_len, output_buffer_chunk_size));
+            }
+            chunks_.back().insert(chunks_.back().end(), begin, begin + buffer.iov_len);
+            size_ += buffer.iov_len;
+        }
+    }
+
+    ssize_t OutputBuffer::flush(int fd) {
+        std::array<iovec, output_buffer_max_flush_chunks> buffers;
+        size_t buffers_amount = get_buffers(buffers);
+
+        ssize_t sent = net::send(fd, std::span<iovec>(buffers.data(), buffers_amount), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            return -1;
+        }
+        consume(sent);
+        return sent;
+    }
+
+    ssize_t OutputBuffer::flush(SharedMemoryChannel& channel) {
+        std::array<iovec, output_buffer_max_flush_chunks> buffers;
+        size_t buffers_amount = get_buffers(buffers);
+
+        ssize_t sent = channel.send(std::span<iovec>(buffers.data(), buffers_amount), MSG_DONTWAIT);
+        if (sent < 0) {
+            return -1;
+        }
+        consume(sent);
+        return sent;
+    }
+
+    size_t OutputBuffer::get_buffers(std::span<iovec> buffers, uint64_t offset) const {
+        size_t buffers_amount = 0;
+        offset += front_offset_;
+        for (auto it = chunks_.begin(); it != chunks_.end() && buffers_amount < buffers.size(); ++it) {
+            if (offset >= it->size()) {
+                offset -= it->size();
+                continue;
+            }
+            buffers[buffers_amount++] = { const_cast<char*>(it->data()) + offset, it->size() - offset };
+            offset = 0;
+        }
+        return buffers_amount;
+    }
+
+    void OutputBuffer::consume(uint64_t size) {
+        //Drop the chunks that were sent completely
+        size_ -= size;
+        uint64_t remaining = size;
+        while (remaining > 0 && remaining >= chunks_.front().size() - front_offset_) {
+            remaining -= chunks_.front().size() - front_offset_;
+            chunks_.pop_front();
+            front_offset_ = 0;
+        }
+        front_offset_ += remaining;
+    }
+
+    bool OutputBuffer::limit_exceeded() {
+        if (limits_.hard_limit != 0 && size_ > limits_.hard_limit) {
+            return true;
+        }
+        if (limits_.soft_limit == 0 || size_ <= limits_.soft_limit) {
+            soft_limit_reached_ = std::nullopt;
+            return false;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (!soft_limit_reached_.has_value()) {
+            soft_limit_reached_ = now;
+        }
+        return now - *soft_limit_reached_ > limits_.soft_limit_duration;
+    }
+
+    void InputBuffer::reserve(uint64_t size) {
+        //Everything was read, start from the beginning again instead of growing
+        if (empty()) {
+            read_offset_ = 0;
+            write_offset_ = 0;
+        }
+        if (data_.size() - write_offset_ < size) {
+            data_.resize(std::max(write_offset_ + size, 2 * data_.size()));
+        }
+    }
+
+    void InputBuffer::append(std::span<const char> data) {
+        reserve(data.size());
+        std::memcpy(data_.data() + write_offset_, data.data(), data.size());
+        write_offset_ += data.size();
+    }
+
+    ssize_t InputBuffer::receive(int fd, uint64_t max_size, int flags) {
+        reserve(max_size);
+        ssize_t received = net::receive(fd, std::span<char>(data_.data() + write_offset_, max_size), flags);
+        if (received > 0) {
+            write_offset_ += received;
+        }
+        return received;
+    }
+
+    size_t InputBuffer::read(std::span<char> data) {
+        size_t amount = std::min<uint64_t>(data.size(), size());
+        std::memcpy(data.data(), data_.data() + read_offset_, amount);
+        read_offset_ += amount;
+        return amount;
+    }
+
+    void PendingOperation::suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+        connection_.pending_operation_ = this;
+    }
+
+    std::span<char> ReadExact::await_resume() const {
+        if (error_.has_value()) {
+            throw std::runtime_error(*error_);
+        }
+        return data_;
+    }
+
+    bool ReadExact::try_complete() {
+        while (received_ < data_.size()) {
+            std::span<char> rest = data_.subspan(received_);
+            if (connection_.has_received_data()) {
+                received_ += connection_.input_buffer_->read(rest);
+                continue;
+            }
+
+            //Without async io the operation blocks instead of suspending
+            ssize_t received;
+            bool read_ahead = false;
+            if (!connection_.async_io_) {
+                received = connection_.receive_data(rest, MSG_WAITALL);
+            }
+            else if (connection_.input_deferred_) {
+                return false;
+            }
+            //Reading ahead only saves syscalls, the shared memory rings don't need any
+            else if (rest.size() < read_ahead_size && !connection_.is_shared_memory()) {
+                received = connection_.input_buffer_->receive(connection_.fd(), read_ahead_size, MSG_DONTWAIT);
+                read_ahead = true;
+            }
+            else {
+                received = connection_.receive_data(rest, MSG_DONTWAIT);
+            }
+
+            if (received > 0) {
+                received_ += read_ahead ? 0 : received;
+                continue;
+            }
+            if (received == 0) {
+                error_ = "Connection closed by peer";
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
+            }
+            error_ = "Failed to receive: " + std::to_string(errno);
+            return true;
+        }
+        return true;
+    }
+
+    bool WriteAll::try_complete() {
+        return !connection_.async_io_ || connection_.pending_output_size() <= max_pending_output_;
+    }
+
     Connection::Connection(FileDescriptor&& fd, sockaddr_in client) {
         fd_ = std::make_shared<FileDescriptor>(std::move(fd));
         client_ = std::make_optional<sockaddr_in>(client);
@@ -27,20 +250,50 @@ namespace net {
         fd_ = std::make_shared<FileDescriptor>(std::move(fd));
     }
 
+    Connection::Connection(std::shared_ptr<SharedMemoryChannel> channel) {
+        channel_ = std::move(channel);
+    }
+
     int Connection::fd() const {
+        if (channel_ != nullptr) {
+            return channel_->notify_fd();
+        }
         return  fd_->unwrap();
     }
 
     bool Connection::is_connected() const {
-        return fd_.get() != nullptr && fd_->unwrap() != -1;
+        return channel_ != nullptr || (fd_.get() != nullptr && fd_->unwrap() != -1);
+    }
+
+    bool Connection::is_shared_memory() const {
+        return channel_ != nullptr;
+    }
+
+    ssize_t Connection::send_data(std::span<iovec> data, int flags) {
+        if (channel_ != nullptr) {
+            return channel_->send(data, flags);
+        }
+        return net::send(fd_->unwrap(), data, flags);
+    }
+
+    ssize_t Connection::receive_data(std::span<char> data, int flags) const {
+        if (channel_ != nullptr) {
+            return channel_->receive(data, flags);
+        }
+        return net::receive(fd_->unwrap(), data, flags);
     }
 
     ssize_t Connection::send(const std::string& data) {
-        return net::send(fd_->unwrap(), data.c_str(), data.size());
+        return send(std::span<const char>(data));
     }
 
     ssize_t Connection::send(const char* data, uint64_t size) {
-        auto sent = net::send(fd_->unwrap(), data, size);
+        if (output_buffer_ != nullptr) {
+            return send(std::span<const char>(data, size));
+        }
+
+        iovec buffer{ const_cast<char*>(data), size };
+        auto sent = send_data(std::span<iovec>(&buffer, 1));
         if (sent != size) {
             throw std::runtime_error("Failed to send all data: " + std::to_string(errno));
         }
@@ -48,15 +301,138 @@ namespace net {
     }
 
     ssize_t Connection::send(std::span<const char> data) {
+        if (output_buffer_ != nullptr) {
+            iovec buffer{ const_cast<char*>(data.data()), data.size() };
+            return send_buffered(std::span<iovec>(&buffer, 1));
+        }
+        if (channel_ != nullptr) {
+            iovec buffer{ const_cast<char*>(data.data()), data.size() };
+            return send_data(std::span<iovec>(&buffer, 1));
+        }
         return net::send(fd_->unwrap(), data);
     }
 
+    ssize_t Connection::send(std::span<iovec> data) {
+        if (output_buffer_ != nullptr) {
+            return send_buffered(data);
+        }
+
+        auto sent = send_data(data);
+        if (sent < 0) {
+            throw std::runtime_error("Failed to send all data: " + std::to_string(errno));
+        }
+        return sent;
+    }
+
+    ssize_t Connection::send_buffered(std::span<iovec> data) {
+        ssize_t total_size = 0;
+        for (const auto& buffer : data) {
+            total_size += static_cast<ssize_t>(buffer.iov_len);
+        }
+
+        //Queued data has to be sent first to keep the order, otherwise try to send directly
+        if (!output_deferred_ && output_buffer_->empty() && send_data(data, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            throw std::runtime_error("Failed to send data: " + std::to_string(errno));
+        }
+
+        output_buffer_->append(data);
+        if (output_buffer_->limit_exceeded()) {
+            throw std::runtime_error("Output buffer limit exceeded");
+        }
+        return total_size;
+    }
+
+    void Connection::enable_output_buffering(OutputBufferLimits limits) {
+        output_buffer_ = std::make_shared<OutputBuffer>(limits);
+    }
+
+    bool Connection::has_pending_output() const {
+        return output_buffer_ != nullptr && !output_buffer_->empty();
+    }
+
+    uint64_t Connection::pending_output_size() const {
+        return output_buffer_ != nullptr ? output_buffer_->size() : 0;
+    }
+
+    bool Connection::flush() {
+        if (!has_pending_output()) {
+            return true;
+        }
+        ssize_t flushed = channel_ != nullptr ? output_buffer_->flush(*channel_) : output_buffer_->flush(fd_->unwrap());
+        if (flushed < 0) {
+            throw std::runtime_error("Failed to flush output: " + std::to_string(errno));
+        }
+        if (output_buffer_->limit_exceeded()) {
+            throw std::runtime_error("Output buffer limit exceeded");
+        }
+        return output_buffer_->empty();
+    }
+
+    void Connection::set_output_deferred(bool deferred) {
+        output_deferred_ = deferred;
+    }
+
+    void Connection::set_input_deferred(bool deferred) {
+        input_deferred_ = deferred;
+    }
+
+    void Connection::enable_async_io() {
+        enable_input_buffering();
+        async_io_ = true;
+    }
+
+    void Connection::resume_waiting(Readiness readiness) {
+        if (pending_operation_ == nullptr || pending_operation_->waits_for_ != readiness || !pending_operation_->try_complete()) {
+            return;
+        }
+        std::coroutine_handle<> handle = pending_operation_->handle_;
+        pending_operation_ = nullptr;
+        handle.resume();
+    }
+
+    ReadExact Connection::read_exact(std::span<char> data) {
+        return ReadExact{ *this, data };
+    }
+
+    ReadExact Connection::read_exact(uint64_t size) {
+        return ReadExact{ *this, receive_buffer(size) };
+    }
+
+    WriteAll Connection::write_all(std::span<iovec> data) {
+        send(data);
+        return WriteAll{ *this };
+    }
+
+    WriteAll Connection::write_all(std::span<const char> data) {
+        iovec buffer{ const_cast<char*>(data.data()), data.size() };
+        return write_all(std::span<iovec>(&buffer, 1));
+    }
+
+    WriteAll Connection::drain() {
+        return WriteAll{ *this, 0 };
+    }
+
+    void Connection::enable_input_buffering() {
+        if (input_buffer_ == nullptr) {
+            input_buffer_ = std::make_shared<InputBuffer>();
+        }
+    }
+
+    void Connection::append_received_data(std::span<const char> data) {
+        enable_input_buffering();
+        input_buffer_->append(data);
+    }
+
+    bool Connection::has_received_data() const {
+        return input_buffer_ != nullptr && !input_buffer_->empty();
+    }
+
     ssize_t Connection::receive_all(std::ostream& stream) const {
         char buf[net::receive_all_buffer_size];
         std::span<char> data(buf, net::receive_all_buffer_size);
 
         ssize_t total_byte_received = 0;
-        while (ssize_t bytes_received = net::receive(fd_->unwrap(), data)) {
+        while (ssize_t bytes_received = receive(data)) {
             total_byte_received += bytes_received;
             stream.write(buf, net::receive_all_buffer_size);
         }
@@ -64,9 +440,30 @@ namespace net {
     }
 
     ssize_t Connection::receive(char* data, uint64_t size) const {
-        return net::receive(fd_->unwrap(), data, size);
+        return receive(std::span<char>(data, size));
     }
     ssize_t Connection::receive(std::span<char> data) const {
-        return net::receive(fd_->unwrap(), data);
+        //Empty reads would still detach file descriptors that are passed with the next data on unix domain sockets
+        if (data.empty()) {
+            return 0;
+        }
+        if (!has_received_data()) {
+            return receive_data(data);
+        }
+
+        //Data that was received by a reactor comes first, the rest is read from the socket
+        size_t buffered = input_buffer_->read(data);
+        if (buffered == data.size()) {
+            return static_cast<ssize_t>(buffered);
+        }
+        ssize_t received = receive_data(data.subspan(buffered));
+        return received < 0 ? received : static_cast<ssize_t>(buffered) + received;
+    }
+
+    std::span<char> Connection::receive_buffer(uint64_t size) {
+        if (receive_buffer_.size() < size) {
+            receive_buffer_.resize(std::max({ size, receive_buffer_initial_size, 2 * receive_buffer_.size() }));
+        }
+        return std::span<char>(receive_buffer_.data(), size);
     }
 }
\ No newline at end of file
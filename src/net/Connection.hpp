@@ -2,10 +2,15 @@
 
 #include <optional>
 #include <arpa/inet.h>
+#include <sys/uio.h>
+#include <chrono>
+#include <coroutine>
+#include <deque>
 #include <span>
 #include <string>
 #include <istream>
 #include <memory>
+#include <vector>
 
 #include "FileDescriptor.hpp"
 
@@ -13,31 +18,245 @@ namespace net {
 
     ssize_t send(int fd, std::span<const char> data);
     ssize_t send(int fd, const char* data, uint64_t size);
+    //Sends all buffers with as few sendmsg() calls as possible, the iovecs are advanced on partial sends
+    //With MSG_DONTWAIT it stops when the socket buffer is full, the iovecs then describe the data that wasn't sent
+    ssize_t send(int fd, std::span<iovec> data, int flags = 0);
 
-    ssize_t receive(int fd, std::span<char> buf);
+    ssize_t receive(int fd, std::span<char> buf, int flags = 0);
     ssize_t receive(int fd, char* buf, uint64_t size);
 
+    class SharedMemoryChannel;
+
     constexpr int receive_all_buffer_size = 256;
+    constexpr uint64_t receive_buffer_initial_size = 512;
+    constexpr uint64_t output_buffer_chunk_size = 16 * 1024;
+    constexpr int output_buffer_max_flush_chunks = 64;
+    //Reads smaller than this receive as much as is available, so a small request usually needs a single recv()
+    constexpr uint64_t read_ahead_size = 16 * 1024;
+    //write_all() suspends while more output than this is queued, so a slow peer throttles the coroutine
+    constexpr uint64_t write_all_max_pending_output = 1024 * 1024;
+
+    //Limits for the data that is queued for a connection because the peer doesn't read fast enough
+    //The connection is dropped if the hard limit is exceeded or if it stays above the soft limit for longer than the duration
+    //A limit of 0 disables it
+    struct OutputBufferLimits {
+        uint64_t hard_limit = 0;
+        uint64_t soft_limit = 0;
+        std::chrono::seconds soft_limit_duration{ 0 };
+    };
+
+    class OutputBuffer {
+    public:
+        explicit OutputBuffer(OutputBufferLimits limits);
+
+        //Copies all non-empty buffers into the queue
+        void append(std::span<const iovec> data);
+
+        //Sends as much queued data as possible without blocking, returns the amount of sent bytes or -1 on error
+        ssize_t flush(int fd);
+        ssize_t flush(SharedMemoryChannel& channel);
+
+        //Describes the queued data, starting at the given offset, with at most buffers.size() buffers
+        //Used for sends that complete asynchronously, the data stays valid until it is consumed
+        size_t get_buffers(std::span<iovec> buffers, uint64_t offset = 0) const;
+        //Drops sent data from the front of the queue
+        void consume(uint64_t size);
+
+        bool empty() const {
+            return size_ == 0;
+        }
+        uint64_t size() const {
+            return size_;
+        }
+        bool limit_exceeded();
+
+    private:
+        std::deque<std::vector<char>> chunks_;
+        uint64_t front_offset_ = 0;
+        uint64_t size_ = 0;
+        OutputBufferLimits limits_;
+        std::optional<std::chrono::steady_clock::time_point> soft_limit_reached_ = std::nullopt;
+    };
+
+    //Data that was already received from the socket, by a reactor or ahead of time, but not consumed by the connection yet
+    class InputBuffer {
+    public:
+        void append(std::span<const char> data);
+
+        //Receives up to max_size bytes from the socket at the end of the buffer, returns the result of recv()
+        ssize_t receive(int fd, uint64_t max_size, int flags);
+
+        //Moves up to data.size() bytes into data, returns the amount of moved bytes
+        size_t read(std::span<char> data);
+
+        bool empty() const {
+            return read_offset_ == write_offset_;
+        }
+        uint64_t size() const {
+            return write_offset_ - read_offset_;
+        }
+
+    private:
+        //Makes room for size more bytes at the end
+        void reserve(uint64_t size);
+
+        std::vector<char> data_;
+        uint64_t read_offset_ = 0;
+        uint64_t write_offset_ = 0;
+    };
+
+    class Connection;
+
+    enum class Readiness : uint8_t {
+        c_INPUT = 0,
+        c_OUTPUT = 1,
+        enum_size = 2
+    };
+
+    //Operation a coroutine is suspended on, it is continued by Connection::resume_waiting()
+    class PendingOperation {
+    public:
+        //Continues the operation, returns true if the coroutine can be resumed
+        virtual bool try_complete() = 0;
+
+    protected:
+        PendingOperation(Connection& connection, Readiness waits_for) : connection_(connection), waits_for_(waits_for) {}
+        ~PendingOperation() = default;
+
+        void suspend(std::coroutine_handle<> handle);
+
+        Connection& connection_;
+
+    private:
+        friend class Connection;
+
+        Readiness waits_for_;
+        std::coroutine_handle<> handle_;
+    };
+
+    //Awaitable that receives exactly data.size() bytes, throws if the connection was closed or failed
+    class ReadExact : public PendingOperation {
+    public:
+        ReadExact(Connection& connection, std::span<char> data) : PendingOperation(connection, Readiness::c_INPUT), data_(data) {}
+
+        bool await_ready() {
+            return try_complete();
+        }
+        void await_suspend(std::coroutine_handle<> handle) {
+            suspend(handle);
+        }
+        std::span<char> await_resume() const;
+
+        bool try_complete() override;
+
+    private:
+        std::span<char> data_;
+        uint64_t received_ = 0;
+        std::optional<std::string> error_ = std::nullopt;
+    };
+
+    //Awaitable that continues once the written data was sent or queued without exceeding write_all_max_pending_output
+    class WriteAll : public PendingOperation {
+    public:
+        explicit WriteAll(Connection& connection, uint64_t max_pending_output = write_all_max_pending_output)
+            : PendingOperation(connection, Readiness::c_OUTPUT), max_pending_output_(max_pending_output) {}
+
+        bool await_ready() {
+            return try_complete();
+        }
+        void await_suspend(std::coroutine_handle<> handle) {
+            suspend(handle);
+        }
+        void await_resume() const {}
+
+        bool try_complete() override;
+
+    private:
+        uint64_t max_pending_output_;
+    };
 
     class Connection {
     public:
         Connection() = default;
         Connection(FileDescriptor&& fd, sockaddr_in client);
         explicit Connection(FileDescriptor&& fd);
+        //The data is exchanged over the rings of the channel, fd() is its eventfd
+        explicit Connection(std::shared_ptr<SharedMemoryChannel> channel);
 
         int fd() const;
         bool is_connected() const;
+        bool is_shared_memory() const;
 
         ssize_t send(const std::string& data);
         ssize_t send(const char* data, uint64_t size);
         ssize_t send(std::span<const char> data);
+        ssize_t send(std::span<iovec> data);
 
         ssize_t receive_all(std::ostream& stream) const;
         ssize_t receive(char* data, uint64_t size) const;
         ssize_t receive(std::span<char> data) const;
 
+        //Returns a buffer owned by the connection with at least the given size, it only grows so it is reused between requests
+        std::span<char> receive_buffer(uint64_t size);
+
+        //After enabling, sends never block: data that doesn't fit into the socket buffer is queued and sent by flush()
+        void enable_output_buffering(OutputBufferLimits limits);
+        bool has_pending_output() const;
+        uint64_t pending_output_size() const;
+        //Returns true if no output is pending anymore
+        bool flush();
+
+        //Deferred output is never sent directly, only by flush() or a reactor that sends it asynchronously
+        void set_output_deferred(bool deferred);
+        std::shared_ptr<OutputBuffer> get_output_buffer() const {
+            return output_buffer_;
+        }
+
+        //Has to be enabled before the connection is copied, the copies share the received data
+        void enable_input_buffering();
+        //Adds data that was received by a reactor, receive() returns it before reading from the socket again
+        void append_received_data(std::span<const char> data);
+        bool has_received_data() const;
+
+        //Deferred input is never received from the socket by read_exact(), only a reactor receives it
+        void set_input_deferred(bool deferred);
+
+        //After enabling, read_exact() and write_all() suspend the coroutine instead of blocking and resume_waiting()
+        //has to be called whenever the connection becomes ready. It enables input buffering, see above.
+        void enable_async_io();
+        //Continues the operation the coroutine on this connection is suspended on, if it waits for the readiness
+        void resume_waiting(Readiness readiness);
+
+        [[nodiscard]] ReadExact read_exact(std::span<char> data);
+        //Receives into receive_buffer(size)
+        [[nodiscard]] ReadExact read_exact(uint64_t size);
+        //The data is sent or queued right away, awaiting the result applies the backpressure
+        [[nodiscard]] WriteAll write_all(std::span<iovec> data);
+        [[nodiscard]] WriteAll write_all(std::span<const char> data);
+        //Waits until all queued output was sent, e.g. before sending on the socket directly
+        [[nodiscard]] WriteAll drain();
+
     private:
+        friend class PendingOperation;
+        friend class ReadExact;
+        friend class WriteAll;
+
+        ssize_t send_buffered(std::span<iovec> data);
+
+        //Send and receive on the socket or the shared memory channel, with the semantics of net::send() and net::receive()
+        ssize_t send_data(std::span<iovec> data, int flags = 0);
+        ssize_t receive_data(std::span<char> data, int flags = 0) const;
+
         std::shared_ptr<FileDescriptor> fd_;
+        std::shared_ptr<SharedMemoryChannel> channel_;
+        std::shared_ptr<OutputBuffer> output_buffer_;
+        std::shared_ptr<InputBuffer> input_buffer_;
+        bool output_deferred_ = false;
+        bool input_deferred_ = false;
+        bool async_io_ = false;
+        //Only set on the instance the coroutine uses, copies don't share it
+        PendingOperation* pending_operation_ = nullptr;
+        std::vector<char> receive_buffer_;
         std::optional<sockaddr_in> client_ = std::nullopt;
     };
 }
\ No newline at end of file
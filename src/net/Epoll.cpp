@@ -10,7 +10,7 @@ namespace net {
     }
 
     void Epoll::add_event(FileDescriptor& fd, uint32_t events) {
-        add_event(fd.unwrap());
+        add_event(fd.unwrap(), events);
     }
 
     void Epoll::add_event(int fd, uint32_t events) {
@@ -21,6 +21,14 @@ namespace net {
         epoll_ctl(epoll_fd_.unwrap(), EPOLL_CTL_ADD, fd, &event);
     }
 
+    void Epoll::modify_event(int fd, uint32_t events) {
+        epoll_event event;
+        event.data.fd = fd;
+        event.events = events;
+
+        epoll_ctl(epoll_fd_.unwrap(), EPOLL_CTL_MOD, fd, &event);
+    }
+
     void Epoll::remove_event(FileDescriptor& fd) {
         epoll_ctl(epoll_fd_.unwrap(), EPOLL_CTL_DEL, fd.unwrap(), nullptr);
     }
@@ -47,6 +55,13 @@ namespace net {
         return events_[index].data.fd;
     }
 
+    uint32_t Epoll::get_event_flags(int index) const {
+        if (index >= events_.size()) {
+            return 0;
+        }
+        return events_[index].events;
+    }
+
     int Epoll::get_epoll_fd() const {
         return epoll_fd_.unwrap();
     }
@@ -15,6 +15,7 @@ namespace net {
 
         void add_event(int fd, uint32_t events = EPOLLIN | EPOLLET);
         void add_event(FileDescriptor& fd, uint32_t events = EPOLLIN | EPOLLET);
+        void modify_event(int fd, uint32_t events);
         void remove_event(FileDescriptor& fd);
         void remove_event(int fd);
         void reset_occurred_events();
@@ -22,6 +23,7 @@ namespace net {
         [[nodiscard]] int wait(int timeout = -1);
         [[nodiscard]] std::vector<epoll_event> get_events();
         [[nodiscard]] int get_event_fd(int index) const;
+        [[nodiscard]] uint32_t get_event_flags(int index) const;
         [[nodiscard]] int get_epoll_fd() const;
 
     private:
@@ -0,0 +1,107 @@
+#include <sys/socket.h>
+#include <cerrno>
+#include <stdexcept>
+
+#include "EpollReactor.hpp"
+#include "IoUringReactor.hpp"
+
+namespace net {
+
+    std::unique_ptr<IReactor> new_reactor(ReactorBackend backend) {
+        if (backend == ReactorBackend::c_IO_URING) {
+            try {
+                return std::make_unique<IoUringReactor>();
+            }
+            catch (const std::runtime_error& e) {
+                //io_uring is missing, disabled or lacks a required feature
+            }
+        }
+        return std::make_unique<EpollReactor>();
+    }
+
+    EpollReactor::EpollReactor(int max_events) : epoll_(max_events) {}
+
+    void EpollReactor::add_listener(int fd) {
+        listeners_.insert(fd);
+        epoll_.add_event(fd, EPOLLIN | EPOLLET);
+    }
+
+    void EpollReactor::remove_listener(int fd) {
+        listeners_.erase(fd);
+        epoll_.remove_event(fd);
+    }
+
+    void EpollReactor::add_connection(Connection& connection) {
+        epoll_.add_event(connection.fd(), EPOLLIN | EPOLLET);
+    }
+
+    void EpollReactor::remove_connection(int fd) {
+        epoll_.remove_event(fd);
+        waiting_for_output_.erase(fd);
+    }
+
+    //Edge triggered, so every signal is reported although the counter is never reset
+    void EpollReactor::add_notifier(int fd) {
+        epoll_.add_event(fd, EPOLLIN | EPOLLET);
+    }
+
+    void EpollReactor::remove_notifier(int fd) {
+        epoll_.remove_event(fd);
+    }
+
+    //Only waits for EPOLLOUT as long as output is left, the events are only modified if that changes
+    void EpollReactor::flush(Connection& connection) {
+        bool flushed = connection.flush();
+        bool waiting = waiting_for_output_.contains(connection.fd());
+        if (flushed == waiting) {
+            epoll_.modify_event(connection.fd(), flushed ? EPOLLIN | EPOLLET : EPOLLIN | EPOLLOUT | EPOLLET);
+        }
+
+        if (flushed) {
+            waiting_for_output_.erase(connection.fd());
+        }
+        else {
+            waiting_for_output_.insert(connection.fd());
+        }
+    }
+
+    int EpollReactor::wait(int timeout) {
+        events_.clear();
+        int num_ready = epoll_.wait(timeout);
+        if (num_ready < 0) {
+            return errno == EINTR ? 0 : -1;
+        }
+
+        for (int i = 0; i < num_ready; i++) {
+            int fd = epoll_.get_event_fd(i);
+            uint32_t flags = epoll_.get_event_flags(i);
+
+            if (listeners_.contains(fd)) {
+                accept_all(fd);
+                continue;
+            }
+            if (flags & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                events_.push_back({ fd, ReactorEvent::c_READABLE, {} });
+            }
+            if (flags & EPOLLOUT) {
+                events_.push_back({ fd, ReactorEvent::c_WRITABLE, {} });
+            }
+        }
+        return static_cast<int>(events_.size());
+    }
+
+    void EpollReactor::accept_all(int listener_fd) {
+        while (true) {
+            sockaddr_in client{};
+            socklen_t len{ sizeof(client) };
+            int fd = ::accept(listener_fd, reinterpret_cast<sockaddr*>(&client), &len);
+            if (fd < 0 && errno == EINTR) {
+                continue;
+            }
+            if (fd < 0) {
+                return;
+            }
+            events_.push_back({ listener_fd, ReactorEvent::c_ACCEPTED, Connection{ FileDescriptor{ fd }, client } });
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <unordered_set>
+
+#include "Epoll.hpp"
+#include "IReactor.hpp"
+
+namespace net {
+
+    constexpr int epoll_reactor_max_events = 10;
+
+    //Readiness based reactor, the handlers receive and send the data themselves
+    class EpollReactor : public IReactor {
+    public:
+        explicit EpollReactor(int max_events = epoll_reactor_max_events);
+
+        ReactorBackend get_backend() const override {
+            return ReactorBackend::c_EPOLL;
+        }
+
+        void add_listener(int fd) override;
+        void remove_listener(int fd) override;
+        void add_connection(Connection& connection) override;
+        void remove_connection(int fd) override;
+        void add_notifier(int fd) override;
+        void remove_notifier(int fd) override;
+        void flush(Connection& connection) override;
+
+        [[nodiscard]] int wait(int timeout = -1) override;
+
+    private:
+        //The listeners are edge triggered, so all pending connections are accepted at once
+        void accept_all(int listener_fd);
+
+        Epoll epoll_;
+        std::unordered_set<int> listeners_;
+        std::unordered_set<int> waiting_for_output_;
+    };
+}
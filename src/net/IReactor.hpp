@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Connection.hpp"
+
+namespace net {
+
+    enum class ReactorBackend : uint8_t {
+        c_EPOLL = 0,
+        c_IO_URING = 1,
+        enum_size = 2
+    };
+
+    enum class ReactorEvent : uint8_t {
+        //A listener accepted a connection, the event fd is the one of the listener
+        c_ACCEPTED = 0,
+        //Data can be received from the connection, it might already be stored in the connection
+        c_READABLE = 1,
+        //Pending output of the connection can be sent again or all of it was sent
+        c_WRITABLE = 2,
+        //The connection failed or was closed by the peer
+        c_CLOSED = 3,
+        enum_size = 4
+    };
+
+    struct OccurredEvent {
+        int fd;
+        ReactorEvent type;
+        Connection accepted_connection;
+    };
+
+    //Event loop the node runs on, the implementations differ in how the data is received and sent
+    class IReactor {
+    public:
+        IReactor() = default;
+        virtual ~IReactor() = default;
+
+        IReactor(const IReactor&) = delete;
+        IReactor& operator=(const IReactor&) = delete;
+
+        virtual ReactorBackend get_backend() const = 0;
+
+        //The listening socket has to be non-blocking, accepted connections are reported as c_ACCEPTED events
+        virtual void add_listener(int fd) = 0;
+        //The reactor doesn't use the listening socket anymore afterwards, so it can be closed
+        virtual void remove_listener(int fd) = 0;
+        //The connection needs to have output buffering enabled
+        virtual void add_connection(Connection& connection) = 0;
+        virtual void remove_connection(int fd) = 0;
+
+        //Reports a c_READABLE event whenever the eventfd is signaled, the reactor never reads the counter
+        virtual void add_notifier(int fd) = 0;
+        virtual void remove_notifier(int fd) = 0;
+
+        //Sends the pending output of the connection, a c_WRITABLE event occurs if something is left afterwards
+        //Throws if sending failed or the output buffer limit is exceeded
+        virtual void flush(Connection& connection) = 0;
+
+        //Returns the amount of occurred events or -1 on error
+        [[nodiscard]] virtual int wait(int timeout = -1) = 0;
+
+        [[nodiscard]] int get_event_fd(int index) const {
+            return events_[index].fd;
+        }
+        [[nodiscard]] ReactorEvent get_event_type(int index) const {
+            return events_[index].type;
+        }
+        [[nodiscard]] Connection get_accepted_connection(int index) const {
+            return events_[index].accepted_connection;
+        }
+
+    protected:
+        std::vector<OccurredEvent> events_;
+    };
+
+    //Falls back to epoll if io_uring is requested but not supported by the kernel
+    std::unique_ptr<IReactor> new_reactor(ReactorBackend backend);
+}
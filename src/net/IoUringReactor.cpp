@@ -0,0 +1,506 @@
+#include <sys/mman.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+
+#include "IoUringReactor.hpp"
+
+namespace net {
+
+    namespace {
+        //There is no liburing, the ring is used through the raw syscalls
+        int io_uring_setup(uint32_t entries, io_uring_params* params) {
+            return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+        }
+
+        int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags, void* arg, size_t arg_size) {
+            return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size));
+        }
+
+        int io_uring_register(int fd, uint32_t opcode, void* arg, uint32_t nr_args) {
+            return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+        }
+
+        //Linux 6.12, missing in older headers
+        constexpr uint32_t feature_min_timeout = 1U << 15;
+
+        template<typename T>
+        T* at_offset(void* base, uint32_t offset) {
+            return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+        }
+    }
+
+    IoUringReactor::IoUringReactor() {
+        io_uring_params params{};
+        //Deferred task running requires a single submitter, which is the thread that enables the ring in the first wait
+        params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED
+            | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_CQSIZE;
+        params.cq_entries = io_uring_entries * 4;
+
+        int fd = io_uring_setup(io_uring_entries, &params);
+        if (fd < 0) {
+            throw std::runtime_error("io_uring_setup failed: " + std::to_string(errno));
+        }
+        ring_fd_ = FileDescriptor{ fd };
+
+        try {
+            if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+                throw std::runtime_error("io_uring lacks required features");
+            }
+            min_timeout_supported_ = params.features & feature_min_timeout;
+
+            ring_size_ = std::max(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+                params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+            ring_ = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (ring_ == MAP_FAILED) {
+                ring_ = nullptr;
+                throw std::runtime_error("Failed to map io_uring: " + std::to_string(errno));
+            }
+            void* sqes = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED) {
+                throw std::runtime_error("Failed to map io_uring: " + std::to_string(errno));
+            }
+            sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+            sq_head_ = at_offset<uint32_t>(ring_, params.sq_off.head);
+            sq_tail_ = at_offset<uint32_t>(ring_, params.sq_off.tail);
+            sq_array_ = at_offset<uint32_t>(ring_, params.sq_off.array);
+            sq_mask_ = *at_offset<uint32_t>(ring_, params.sq_off.ring_mask);
+            sq_entries_ = params.sq_entries;
+            sq_local_tail_ = *sq_tail_;
+            cq_head_ = at_offset<uint32_t>(ring_, params.cq_off.head);
+            cq_tail_ = at_offset<uint32_t>(ring_, params.cq_off.tail);
+            cqes_ = at_offset<io_uring_cqe>(ring_, params.cq_off.cqes);
+            cq_mask_ = *at_offset<uint32_t>(ring_, params.cq_off.ring_mask);
+
+            //The kernel picks a buffer of this ring for every received chunk, so idle connections don't need one
+            void* buffer_ring = mmap(nullptr, io_uring_buffer_count * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (buffer_ring == MAP_FAILED) {
+                throw std::runtime_error("Failed to map buffer ring: " + std::to_string(errno));
+            }
+            buffer_ring_ = static_cast<io_uring_buf*>(buffer_ring);
+
+            io_uring_buf_reg registration{};
+            registration.ring_addr = reinterpret_cast<uint64_t>(buffer_ring_);
+            registration.ring_entries = io_uring_buffer_count;
+            registration.bgid = io_uring_buffer_group;
+            if (io_uring_register(fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+                throw std::runtime_error("Failed to register buffer ring: " + std::to_string(errno));
+            }
+
+            buffers_.resize(static_cast<size_t>(io_uring_buffer_count) * io_uring_buffer_size);
+            for (uint16_t buffer_id = 0; buffer_id < io_uring_buffer_count; buffer_id++) {
+                recycle_buffer(buffer_id);
+            }
+        }
+        catch (const std::runtime_error& e) {
+            unmap();
+            throw;
+        }
+    }
+
+    IoUringReactor::~IoUringReactor() {
+        unmap();
+    }
+
+    void IoUringReactor::unmap() {
+        if (buffer_ring_ != nullptr) {
+            munmap(buffer_ring_, io_uring_buffer_count * sizeof(io_uring_buf));
+            buffer_ring_ = nullptr;
+        }
+        if (sqes_ != nullptr) {
+            munmap(sqes_, sq_entries_ * sizeof(io_uring_sqe));
+            sqes_ = nullptr;
+        }
+        if (ring_ != nullptr) {
+            munmap(ring_, ring_size_);
+            ring_ = nullptr;
+        }
+    }
+
+    void IoUringReactor::enable() {
+        if (enabled_) {
+            return;
+        }
+        if (io_uring_register(ring_fd_.unwrap(), IORING_REGISTER_ENABLE_RINGS, nullptr, 0) < 0) {
+            throw std::runtime_error("Failed to enable io_uring: " + std::to_string(errno));
+        }
+        enabled_ = true;
+    }
+
+    void IoUringReactor::add_listener(int fd) {
+        accepts_to_arm_.push_back(fd);
+    }
+
+    //Waits until the multishot accept is canceled, otherwise the ring would keep the listening socket open
+    void IoUringReactor::remove_listener(int fd) {
+        std::erase(accepts_to_arm_, fd);
+        if (!armed_accepts_.contains(fd)) {
+            return;
+        }
+
+        io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = to_user_data(Operation::c_ACCEPT, fd);
+        sqe->user_data = to_user_data(Operation::c_CANCEL, fd);
+
+        while (armed_accepts_.contains(fd)) {
+            if (enter(true, -1) < 0 && errno != EINTR) {
+                return;
+            }
+            handle_completions();
+        }
+        std::erase(accepts_to_arm_, fd);
+    }
+
+    void IoUringReactor::add_connection(Connection& connection) {
+        connection.set_output_deferred(true);
+        connection.set_input_deferred(true);
+        connection.enable_input_buffering();
+
+        uint32_t id = next_id_++;
+        connections_[id] = ConnectionState{ connection };
+        fd_to_id_[connection.fd()] = id;
+        receives_to_arm_.push_back(id);
+    }
+
+    void IoUringReactor::remove_connection(int fd) {
+        auto it = fd_to_id_.find(fd);
+        if (it == fd_to_id_.end()) {
+            return;
+        }
+        uint32_t id = it->second;
+        fd_to_id_.erase(it);
+
+        //The ring holds a reference to the socket, so it is only closed after all operations on it completed
+        ConnectionState& state = connections_.at(id);
+        state.closing = true;
+        if (state.receiving) {
+            io_uring_sqe* sqe = get_sqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = to_user_data(Operation::c_RECEIVE, id);
+            sqe->user_data = to_user_data(Operation::c_CANCEL, id);
+        }
+        release_if_unused(id);
+    }
+
+    void IoUringReactor::add_notifier(int fd) {
+        uint32_t id = next_id_++;
+        notifiers_[id] = fd;
+        fd_to_notifier_id_[fd] = id;
+        polls_to_arm_.push_back(id);
+    }
+
+    void IoUringReactor::remove_notifier(int fd) {
+        auto it = fd_to_notifier_id_.find(fd);
+        if (it == fd_to_notifier_id_.end()) {
+            return;
+        }
+        uint32_t id = it->second;
+        fd_to_notifier_id_.erase(it);
+        notifiers_.erase(id);
+        std::erase(polls_to_arm_, id);
+
+        io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = to_user_data(Operation::c_POLL, id);
+        sqe->user_data = to_user_data(Operation::c_CANCEL, id);
+    }
+
+    void IoUringReactor::flush(Connection& connection) {
+        std::shared_ptr<OutputBuffer> output = connection.get_output_buffer();
+        auto it = fd_to_id_.find(connection.fd());
+        if (it == fd_to_id_.end() || output == nullptr) {
+            connection.flush();
+            return;
+        }
+        if (output->limit_exceeded()) {
+            throw std::runtime_error("Output buffer limit exceeded");
+        }
+
+        //The remaining output is submitted when the sends in flight completed
+        ConnectionState& state = connections_.at(it->second);
+        if (state.sends_in_flight > 0 || output->empty()) {
+            return;
+        }
+
+        std::array<iovec, io_uring_max_linked_sends> buffers;
+        size_t buffers_amount = output->get_buffers(buffers);
+
+        //A chain of linked sends must not be split between two submissions, otherwise the parts could be reordered
+        if (sq_space_left() < buffers_amount) {
+            enable();
+            enter(false, 0);
+        }
+        buffers_amount = std::min<size_t>(buffers_amount, sq_space_left());
+
+        for (size_t i = 0; i < buffers_amount; i++) {
+            io_uring_sqe* sqe = get_sqe();
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = connection.fd();
+            sqe->addr = reinterpret_cast<uint64_t>(buffers[i].iov_base);
+            sqe->len = static_cast<uint32_t>(buffers[i].iov_len);
+            //The kernel retries short sends itself with MSG_WAITALL
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+            sqe->flags = i + 1 < buffers_amount ? IOSQE_IO_LINK : 0;
+            sqe->user_data = to_user_data(Operation::c_SEND, it->second);
+        }
+        state.sends_in_flight += buffers_amount;
+        state.pending_operations += buffers_amount;
+        sends_to_submit_ += buffers_amount;
+    }
+
+    int IoUringReactor::wait(int timeout) {
+        events_.erase(events_.begin(), events_.begin() + reported_events_);
+        wait_count_++;
+        enable();
+
+        for (int listener_fd : accepts_to_arm_) {
+            arm_accept(listener_fd);
+        }
+        accepts_to_arm_.clear();
+        for (uint32_t id : receives_to_arm_) {
+            auto it = connections_.find(id);
+            if (it != connections_.end() && !it->second.closing && !it->second.receiving) {
+                arm_receive(id, it->second);
+            }
+        }
+        receives_to_arm_.clear();
+        for (uint32_t id : polls_to_arm_) {
+            arm_poll(id, notifiers_.at(id));
+        }
+        polls_to_arm_.clear();
+
+        if (enter(true, timeout) < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            reported_events_ = 0;
+            return -1;
+        }
+        handle_completions();
+
+        reported_events_ = events_.size();
+        return static_cast<int>(events_.size());
+    }
+
+    void IoUringReactor::handle_completions() {
+        uint32_t head = *cq_head_;
+        uint32_t tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            handle_completion(cqes_[head & cq_mask_]);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    uint64_t IoUringReactor::to_user_data(Operation operation, uint32_t id) {
+        return static_cast<uint64_t>(operation) << 56 | id;
+    }
+
+    uint32_t IoUringReactor::sq_space_left() const {
+        return sq_entries_ - (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE));
+    }
+
+    io_uring_sqe* IoUringReactor::get_sqe() {
+        //Only happens if a lot is submitted at once, the queued operations are submitted without waiting
+        if (sq_space_left() == 0) {
+            enable();
+            enter(false, 0);
+        }
+        if (sq_space_left() == 0) {
+            throw std::runtime_error("io_uring submission queue is full");
+        }
+
+        uint32_t index = sq_local_tail_ & sq_mask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        *sqe = io_uring_sqe{};
+        sq_array_[index] = index;
+        sq_local_tail_++;
+        return sqe;
+    }
+
+    //Submits all queued operations, with get_events it also waits for a completion until the timeout expires
+    int IoUringReactor::enter(bool get_events, int timeout) {
+        __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+        uint32_t to_submit = sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        uint32_t sends = sends_to_submit_;
+        sends_to_submit_ = 0;
+        if (!get_events) {
+            return io_uring_enter(ring_fd_.unwrap(), to_submit, 0, 0, nullptr, 0);
+        }
+
+        __kernel_timespec timespec{};
+        io_uring_getevents_arg arg{};
+        if (timeout > 0) {
+            timespec.tv_sec = timeout / 1000;
+            timespec.tv_nsec = static_cast<long long>(timeout % 1000) * 1000000;
+            arg.ts = reinterpret_cast<uint64_t>(&timespec);
+        }
+        uint32_t min_complete = timeout == 0 ? 0 : 1;
+        //Sends to a responsive peer complete during the submission, waiting only for those would cost another
+        //io_uring_enter() for the next request. With a minimum timeout the wait holds out for one more completion,
+        //but still returns the send completions after a short while if nothing else happens.
+        if (min_timeout_supported_ && min_complete > 0 && sends > 0) {
+            min_complete += sends;
+            arg.pad = io_uring_send_wait_usec;
+        }
+        return io_uring_enter(ring_fd_.unwrap(), to_submit, min_complete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    void IoUringReactor::arm_accept(int listener_fd) {
+        io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listener_fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->user_data = to_user_data(Operation::c_ACCEPT, listener_fd);
+        armed_accepts_.insert(listener_fd);
+    }
+
+    void IoUringReactor::arm_receive(uint32_t id, ConnectionState& state) {
+        io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = state.connection.fd();
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = io_uring_buffer_group;
+        sqe->user_data = to_user_data(Operation::c_RECEIVE, id);
+
+        state.receiving = true;
+        state.pending_operations++;
+    }
+
+    //A multishot poll completes on every wakeup of the eventfd, not only when it becomes readable
+    void IoUringReactor::arm_poll(uint32_t id, int fd) {
+        io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = to_user_data(Operation::c_POLL, id);
+    }
+
+    void IoUringReactor::handle_completion(const io_uring_cqe& cqe) {
+        auto operation = static_cast<Operation>(cqe.user_data >> 56);
+        auto id = static_cast<uint32_t>(cqe.user_data);
+
+        if (operation == Operation::c_ACCEPT) {
+            if (cqe.res >= 0) {
+                events_.push_back({ static_cast<int>(id), ReactorEvent::c_ACCEPTED, Connection{ FileDescriptor{ cqe.res } } });
+            }
+            if (cqe.flags & IORING_CQE_F_MORE) {
+                return;
+            }
+            //The multishot accept ends on errors, it is only armed again if the listener is still valid
+            armed_accepts_.erase(static_cast<int>(id));
+            if (cqe.res != -EBADF && cqe.res != -EINVAL && cqe.res != -ECANCELED) {
+                accepts_to_arm_.push_back(static_cast<int>(id));
+            }
+            return;
+        }
+        if (operation == Operation::c_CANCEL) {
+            return;
+        }
+        if (operation == Operation::c_POLL) {
+            auto it = notifiers_.find(id);
+            if (it == notifiers_.end()) {
+                return;
+            }
+            if (cqe.res > 0) {
+                events_.push_back({ it->second, ReactorEvent::c_READABLE, {} });
+            }
+            //The multishot poll ends on errors or overflows, it is only armed again if the eventfd is still valid
+            if (!(cqe.flags & IORING_CQE_F_MORE) && cqe.res != -EBADF && cqe.res != -EINVAL && cqe.res != -ECANCELED) {
+                polls_to_arm_.push_back(id);
+            }
+            return;
+        }
+
+        auto it = connections_.find(id);
+        if (it == connections_.end()) {
+            return;
+        }
+        if (operation == Operation::c_RECEIVE) {
+            handle_receive(id, it->second, cqe);
+        }
+        else {
+            handle_send(it->second, cqe);
+        }
+        release_if_unused(id);
+    }
+
+    void IoUringReactor::handle_receive(uint32_t id, ConnectionState& state, const io_uring_cqe& cqe) {
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            uint16_t buffer_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            if (cqe.res > 0 && !state.closing) {
+                const char* buffer = buffers_.data() + static_cast<size_t>(buffer_id) * io_uring_buffer_size;
+                state.connection.append_received_data(std::span<const char>(buffer, cqe.res));
+            }
+            recycle_buffer(buffer_id);
+        }
+
+        if (cqe.res > 0 && !state.closing && state.last_readable_wait != wait_count_) {
+            state.last_readable_wait = wait_count_;
+            events_.push_back({ state.connection.fd(), ReactorEvent::c_READABLE, {} });
+        }
+        if (cqe.flags & IORING_CQE_F_MORE) {
+            return;
+        }
+
+        //The multishot receive ended: the connection was closed, failed or there were no buffers left
+        state.receiving = false;
+        state.pending_operations--;
+        if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS)) {
+            report_closed(state);
+        }
+        else if (!state.closing) {
+            receives_to_arm_.push_back(id);
+        }
+    }
+
+    void IoUringReactor::handle_send(ConnectionState& state, const io_uring_cqe& cqe) {
+        state.sends_in_flight--;
+        state.pending_operations--;
+
+        //After a short send the rest of the chain is canceled, that data is still queued and sent again
+        std::shared_ptr<OutputBuffer> output = state.connection.get_output_buffer();
+        if (cqe.res > 0) {
+            output->consume(cqe.res);
+        }
+        if (cqe.res < 0 && cqe.res != -ECANCELED) {
+            report_closed(state);
+        }
+
+        //Also reported if everything was sent, a handler might wait until the output drained
+        if (state.sends_in_flight == 0 && !state.closing && !state.closed_reported) {
+            events_.push_back({ state.connection.fd(), ReactorEvent::c_WRITABLE, {} });
+        }
+    }
+
+    void IoUringReactor::report_closed(ConnectionState& state) {
+        if (state.closing || state.closed_reported) {
+            return;
+        }
+        state.closed_reported = true;
+        events_.push_back({ state.connection.fd(), ReactorEvent::c_CLOSED, {} });
+    }
+
+    void IoUringReactor::release_if_unused(uint32_t id) {
+        auto it = connections_.find(id);
+        if (it != connections_.end() && it->second.closing && it->second.pending_operations == 0) {
+            connections_.erase(it);
+        }
+    }
+
+    void IoUringReactor::recycle_buffer(uint16_t buffer_id) {
+        io_uring_buf& buffer = buffer_ring_[buffer_ring_tail_ & (io_uring_buffer_count - 1)];
+        buffer.addr = reinterpret_cast<uint64_t>(buffers_.data() + static_cast<size_t>(buffer_id) * io_uring_buffer_size);
+        buffer.len = io_uring_buffer_size;
+        buffer.bid = buffer_id;
+        buffer_ring_tail_++;
+        //The tail overlays the reserved field of the first entry
+        __atomic_store_n(&buffer_ring_[0].resv, buffer_ring_tail_, __ATOMIC_RELEASE);
+    }
+}
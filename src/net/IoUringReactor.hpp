@@ -0,0 +1,133 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "FileDescriptor.hpp"
+#include "IReactor.hpp"
+
+namespace net {
+
+    constexpr uint32_t io_uring_entries = 256;
+    //Has to be a power of two
+    constexpr uint16_t io_uring_buffer_count = 256;
+    constexpr uint32_t io_uring_buffer_size = 4096;
+    constexpr uint16_t io_uring_buffer_group = 0;
+    constexpr int io_uring_max_linked_sends = 16;
+    //How long a wait holds out for the next request after submitting responses, see IoUringReactor::enter
+    constexpr uint32_t io_uring_send_wait_usec = 50;
+
+    //Completion based reactor, requires Linux 6.1 (deferred task running, multishot receive, provided buffer rings)
+    //Listeners use a multishot accept and connections a multishot recv into buffers of a provided buffer ring,
+    //the received data is stored in the connection before the event is reported.
+    //Output is deferred and sent with linked sends that are submitted together with the next wait,
+    //so a request usually costs a single io_uring_enter() instead of epoll_wait() + recv() + send().
+    //Input is deferred as well, so read_exact() suspends until the ring received the rest of a request.
+    //Blocking receives still work: the ring only reads from the sockets while waiting, so the data stays in order.
+    class IoUringReactor : public IReactor {
+    public:
+        //Throws if io_uring or one of the required features isn't available
+        IoUringReactor();
+        ~IoUringReactor() override;
+
+        ReactorBackend get_backend() const override {
+            return ReactorBackend::c_IO_URING;
+        }
+
+        void add_listener(int fd) override;
+        void remove_listener(int fd) override;
+        void add_connection(Connection& connection) override;
+        void remove_connection(int fd) override;
+        void add_notifier(int fd) override;
+        void remove_notifier(int fd) override;
+        void flush(Connection& connection) override;
+
+        [[nodiscard]] int wait(int timeout = -1) override;
+
+    private:
+        enum class Operation : uint8_t {
+            c_ACCEPT = 0,
+            c_RECEIVE = 1,
+            c_SEND = 2,
+            c_CANCEL = 3,
+            c_POLL = 4,
+            enum_size = 5
+        };
+
+        struct ConnectionState {
+            Connection connection;
+            //Submitted operations that didn't complete yet, the state is kept until all did
+            uint32_t pending_operations = 0;
+            uint32_t sends_in_flight = 0;
+            bool receiving = false;
+            bool closing = false;
+            bool closed_reported = false;
+            //Several completions within one wait only cause a single event
+            uint64_t last_readable_wait = 0;
+        };
+
+        static uint64_t to_user_data(Operation operation, uint32_t id);
+
+        void unmap();
+        void enable();
+
+        uint32_t sq_space_left() const;
+        io_uring_sqe* get_sqe();
+        int enter(bool get_events, int timeout);
+
+        void arm_accept(int listener_fd);
+        void arm_receive(uint32_t id, ConnectionState& state);
+        void arm_poll(uint32_t id, int fd);
+        void handle_completions();
+        void handle_completion(const io_uring_cqe& cqe);
+        void handle_receive(uint32_t id, ConnectionState& state, const io_uring_cqe& cqe);
+        void handle_send(ConnectionState& state, const io_uring_cqe& cqe);
+        void report_closed(ConnectionState& state);
+        void release_if_unused(uint32_t id);
+        void recycle_buffer(uint16_t buffer_id);
+
+        std::vector<char> buffers_;
+        //Not accessed through io_uring_buf_ring, its flexible array has a different offset in C++
+        io_uring_buf* buffer_ring_ = nullptr;
+        uint16_t buffer_ring_tail_ = 0;
+
+        void* ring_ = nullptr;
+        size_t ring_size_ = 0;
+        io_uring_sqe* sqes_ = nullptr;
+        uint32_t* sq_head_ = nullptr;
+        uint32_t* sq_tail_ = nullptr;
+        uint32_t* sq_array_ = nullptr;
+        uint32_t sq_mask_ = 0;
+        uint32_t sq_entries_ = 0;
+        uint32_t sq_local_tail_ = 0;
+        uint32_t* cq_head_ = nullptr;
+        uint32_t* cq_tail_ = nullptr;
+        io_uring_cqe* cqes_ = nullptr;
+        uint32_t cq_mask_ = 0;
+        bool enabled_ = false;
+        bool min_timeout_supported_ = false;
+        //Sends queued since the last submission, their completions usually arrive right away
+        uint32_t sends_to_submit_ = 0;
+
+        std::unordered_map<uint32_t, ConnectionState> connections_;
+        std::unordered_map<int, uint32_t> fd_to_id_;
+        //Receives and accepts are only armed right before waiting, see above
+        std::vector<uint32_t> receives_to_arm_;
+        std::vector<int> accepts_to_arm_;
+        //Notifiers are identified by an id as well, so completions of a removed one are ignored
+        std::unordered_map<uint32_t, int> notifiers_;
+        std::unordered_map<int, uint32_t> fd_to_notifier_id_;
+        std::vector<uint32_t> polls_to_arm_;
+        std::unordered_set<int> armed_accepts_;
+        //Events that occurred outside of wait() are reported by the next one
+        size_t reported_events_ = 0;
+        uint32_t next_id_ = 0;
+        uint64_t wait_count_ = 0;
+
+        //Declared last so the ring is closed before the buffers are freed
+        FileDescriptor ring_fd_;
+    };
+}
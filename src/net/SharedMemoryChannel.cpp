@@ -0,0 +1,315 @@
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "SharedMemoryChannel.hpp"
+
+namespace net {
+
+    namespace {
+        //Start of the segment, the first ring carries the requests of the client and the second one the responses
+        struct SegmentHeader {
+            uint64_t ring_size;
+            SharedMemoryRingHeader rings[2];
+        };
+
+        bool is_valid_ring_size(uint64_t ring_size, uint64_t page_size) {
+            return ring_size >= shared_memory_min_ring_size && ring_size <= shared_memory_max_ring_size
+                && (ring_size & (ring_size - 1)) == 0 && ring_size % page_size == 0;
+        }
+
+        //Spinning only helps if the peer runs on another cpu meanwhile
+        int get_spin_count() {
+            static const int spin_count = std::thread::hardware_concurrency() > 1 ? shared_memory_spin_count : 0;
+            return spin_count;
+        }
+
+        uint64_t get_page_size() {
+            return static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        }
+
+        FileDescriptor new_eventfd() {
+            FileDescriptor fd{ eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) };
+            if (fd.unwrap() < 0) {
+                throw std::runtime_error("Failed to create eventfd: " + std::to_string(errno));
+            }
+            return fd;
+        }
+    }
+
+    std::shared_ptr<SharedMemoryChannel> SharedMemoryChannel::create(uint64_t ring_size) {
+        uint64_t page_size = get_page_size();
+        if (!is_valid_ring_size(ring_size, page_size)) {
+            throw std::runtime_error("Invalid ring size: " + std::to_string(ring_size));
+        }
+
+        FileDescriptor memory{ memfd_create("kvs-shared-memory", MFD_CLOEXEC) };
+        if (memory.unwrap() < 0) {
+            throw std::runtime_error("Failed to create shared memory: " + std::to_string(errno));
+        }
+        //The segment is zero filled, so the positions start at 0
+        if (ftruncate(memory.unwrap(), static_cast<off_t>(page_size + 2 * ring_size))) {
+            throw std::runtime_error("Failed to resize shared memory: " + std::to_string(errno));
+        }
+        if (pwrite(memory.unwrap(), &ring_size, sizeof(ring_size), 0) != sizeof(ring_size)) {
+            throw std::runtime_error("Failed to initialize shared memory: " + std::to_string(errno));
+        }
+
+        std::vector<FileDescriptor> file_descriptors;
+        file_descriptors.push_back(std::move(memory));
+        file_descriptors.push_back(new_eventfd());
+        file_descriptors.push_back(new_eventfd());
+        return std::shared_ptr<SharedMemoryChannel>(new SharedMemoryChannel(Side::c_NODE, std::move(file_descriptors), {}));
+    }
+
+    std::shared_ptr<SharedMemoryChannel> SharedMemoryChannel::attach(std::vector<FileDescriptor> file_descriptors, Connection control) {
+        if (file_descriptors.size() != shared_memory_file_descriptors) {
+            throw std::runtime_error("Expected " + std::to_string(shared_memory_file_descriptors) + " file descriptors for shared memory");
+        }
+        return std::shared_ptr<SharedMemoryChannel>(new SharedMemoryChannel(Side::c_CLIENT, std::move(file_descriptors), std::move(control)));
+    }
+
+    SharedMemoryChannel::SharedMemoryChannel(Side side, std::vector<FileDescriptor> file_descriptors, Connection control)
+        : side_(side), memory_(std::move(file_descriptors[0])), node_notify_(std::move(file_descriptors[1])),
+        client_notify_(std::move(file_descriptors[2])), control_(std::move(control)) {
+        try {
+            map();
+        }
+        catch (const std::runtime_error& e) {
+            unmap();
+            throw;
+        }
+    }
+
+    SharedMemoryChannel::~SharedMemoryChannel() {
+        unmap();
+    }
+
+    void SharedMemoryChannel::map() {
+        static_assert(sizeof(SegmentHeader) <= 4096, "The segment header has to fit into a page");
+        header_size_ = get_page_size();
+        void* header = mmap(nullptr, header_size_, PROT_READ | PROT_WRITE, MAP_SHARED, memory_.unwrap(), 0);
+        if (header == MAP_FAILED) {
+            throw std::runtime_error("Failed to map shared memory: " + std::to_string(errno));
+        }
+        header_mapping_ = header;
+        auto* segment = static_cast<SegmentHeader*>(header_mapping_);
+
+        //The size is read once, the peer can't change it afterwards
+        struct stat memory_stat{};
+        ring_size_ = segment->ring_size;
+        if (!is_valid_ring_size(ring_size_, header_size_) || fstat(memory_.unwrap(), &memory_stat)
+            || static_cast<uint64_t>(memory_stat.st_size) != header_size_ + 2 * ring_size_) {
+            ring_size_ = 0;
+            throw std::runtime_error("Invalid shared memory segment");
+        }
+
+        for (size_t i = 0; i < ring_mappings_.size(); i++) {
+            void* reserved = mmap(nullptr, 2 * ring_size_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (reserved == MAP_FAILED) {
+                throw std::runtime_error("Failed to reserve address space: " + std::to_string(errno));
+            }
+            ring_mappings_[i] = reserved;
+
+            //Both halves map the same part of the segment
+            off_t offset = static_cast<off_t>(header_size_ + i * ring_size_);
+            for (uint64_t half = 0; half < 2; half++) {
+                void* address = static_cast<char*>(reserved) + half * ring_size_;
+                if (mmap(address, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, memory_.unwrap(), offset) == MAP_FAILED) {
+                    throw std::runtime_error("Failed to map shared memory: " + std::to_string(errno));
+                }
+            }
+        }
+
+        Ring to_node{ &segment->rings[0], static_cast<char*>(ring_mappings_[0]) };
+        Ring to_client{ &segment->rings[1], static_cast<char*>(ring_mappings_[1]) };
+        inbound_ = side_ == Side::c_NODE ? to_node : to_client;
+        outbound_ = side_ == Side::c_NODE ? to_client : to_node;
+    }
+
+    void SharedMemoryChannel::unmap() {
+        for (void*& mapping : ring_mappings_) {
+            if (mapping != nullptr) {
+                munmap(mapping, 2 * ring_size_);
+                mapping = nullptr;
+            }
+        }
+        if (header_mapping_ != nullptr) {
+            munmap(header_mapping_, header_size_);
+            header_mapping_ = nullptr;
+        }
+    }
+
+    uint64_t SharedMemoryChannel::writable_size() const {
+        uint64_t used = outbound_.header->write_position.load(std::memory_order_relaxed)
+            - outbound_.header->read_position.load(std::memory_order_acquire);
+        if (used > ring_size_) {
+            throw std::runtime_error("Shared memory ring is corrupted");
+        }
+        return ring_size_ - used;
+    }
+
+    uint64_t SharedMemoryChannel::write(std::span<iovec> data) {
+        uint64_t write_position = outbound_.header->write_position.load(std::memory_order_relaxed);
+        uint64_t space = writable_size();
+        uint64_t written = 0;
+
+        for (auto& buffer : data) {
+            if (space == 0) {
+                break;
+            }
+            uint64_t amount = std::min<uint64_t>(buffer.iov_len, space);
+            std::memcpy(outbound_.data + ((write_position + written) & (ring_size_ - 1)), buffer.iov_base, amount);
+            buffer.iov_base = static_cast<char*>(buffer.iov_base) + amount;
+            buffer.iov_len -= amount;
+            written += amount;
+            space -= amount;
+        }
+        if (written == 0) {
+            return 0;
+        }
+
+        //The peer is only woken up if it sleeps, otherwise it finds the data while spinning or before its next wait
+        outbound_.header->write_position.store(write_position + written, std::memory_order_seq_cst);
+        if (outbound_.header->reader_waiting.load(std::memory_order_seq_cst) != 0 && outbound_.header->reader_waiting.exchange(0) != 0) {
+            notify_peer();
+        }
+        return written;
+    }
+
+    ssize_t SharedMemoryChannel::send(std::span<iovec> data, int flags) {
+        ssize_t total_sent = 0;
+        size_t index = 0;
+        int spins = 0;
+
+        while (true) {
+            while (index < data.size() && data[index].iov_len == 0) {
+                ++index;
+            }
+            if (index == data.size()) {
+                return total_sent;
+            }
+
+            uint64_t written = write(data.subspan(index));
+            if (written > 0) {
+                total_sent += static_cast<ssize_t>(written);
+                spins = 0;
+                continue;
+            }
+            if (!(flags & MSG_DONTWAIT) && spins < get_spin_count()) {
+                spins++;
+                continue;
+            }
+
+            //The flag is set before checking again, so the peer either sees it or this side sees the room it made
+            outbound_.header->writer_waiting.store(1, std::memory_order_seq_cst);
+            if (writable_size() > 0) {
+                continue;
+            }
+            if (flags & MSG_DONTWAIT) {
+                return total_sent;
+            }
+            if (!wait()) {
+                errno = EPIPE;
+                return -1;
+            }
+        }
+    }
+
+    ssize_t SharedMemoryChannel::receive(std::span<char> data, int flags) {
+        uint64_t received = 0;
+        int spins = 0;
+
+        while (received < data.size()) {
+            std::span<const char> available = readable();
+            if (!available.empty()) {
+                uint64_t amount = std::min<uint64_t>(available.size(), data.size() - received);
+                std::memcpy(data.data() + received, available.data(), amount);
+                consume(amount);
+                received += amount;
+                spins = 0;
+                continue;
+            }
+            if ((flags & MSG_DONTWAIT) && received > 0) {
+                break;
+            }
+            if (!(flags & MSG_DONTWAIT) && spins < get_spin_count()) {
+                spins++;
+                continue;
+            }
+
+            inbound_.header->reader_waiting.store(1, std::memory_order_seq_cst);
+            if (!readable().empty()) {
+                continue;
+            }
+            if (flags & MSG_DONTWAIT) {
+                errno = EAGAIN;
+                return -1;
+            }
+            //Like a closed socket, the data received so far is returned
+            if (!wait()) {
+                break;
+            }
+        }
+        return static_cast<ssize_t>(received);
+    }
+
+    std::span<const char> SharedMemoryChannel::readable() const {
+        uint64_t read_position = inbound_.header->read_position.load(std::memory_order_relaxed);
+        uint64_t size = inbound_.header->write_position.load(std::memory_order_seq_cst) - read_position;
+        if (size > ring_size_) {
+            throw std::runtime_error("Shared memory ring is corrupted");
+        }
+        return std::span<const char>(inbound_.data + (read_position & (ring_size_ - 1)), size);
+    }
+
+    void SharedMemoryChannel::consume(uint64_t size) {
+        uint64_t read_position = inbound_.header->read_position.load(std::memory_order_relaxed);
+        inbound_.header->read_position.store(read_position + size, std::memory_order_seq_cst);
+        if (inbound_.header->writer_waiting.load(std::memory_order_seq_cst) != 0 && inbound_.header->writer_waiting.exchange(0) != 0) {
+            notify_peer();
+        }
+    }
+
+    int SharedMemoryChannel::notify_fd() const {
+        return side_ == Side::c_NODE ? node_notify_.unwrap() : client_notify_.unwrap();
+    }
+
+    std::array<int, shared_memory_file_descriptors> SharedMemoryChannel::get_file_descriptors() const {
+        return { memory_.unwrap(), node_notify_.unwrap(), client_notify_.unwrap() };
+    }
+
+    bool SharedMemoryChannel::wait() const {
+        //A closed control connection means that the peer is gone, poll ignores the entry if there is none
+        std::array<pollfd, 2> fds{ {
+            { notify_fd(), POLLIN, 0 },
+            { control_.is_connected() ? control_.fd() : -1, POLLRDHUP, 0 }
+        } };
+        while (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno != EINTR) {
+                return false;
+            }
+        }
+        if (fds[1].revents & (POLLRDHUP | POLLHUP | POLLERR)) {
+            return false;
+        }
+
+        uint64_t count;
+        [[maybe_unused]] ssize_t result = ::read(notify_fd(), &count, sizeof(count));
+        return true;
+    }
+
+    void SharedMemoryChannel::notify_peer() const {
+        uint64_t count = 1;
+        [[maybe_unused]] ssize_t result = ::write(side_ == Side::c_NODE ? client_notify_.unwrap() : node_notify_.unwrap(), &count, sizeof(count));
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "FileDescriptor.hpp"
+#include "Connection.hpp"
+
+namespace net {
+
+    //Has to be a power of two, the limits are multiples of the page size
+    constexpr uint64_t shared_memory_default_ring_size = 1024 * 1024;
+    constexpr uint64_t shared_memory_min_ring_size = 64 * 1024;
+    constexpr uint64_t shared_memory_max_ring_size = 256 * 1024 * 1024;
+    //How often a blocking operation checks the ring again before sleeping, a fast peer usually answers within that time
+    //Ignored on a single cpu
+    constexpr int shared_memory_spin_count = 4000;
+    //The segment and the eventfds of both sides
+    constexpr size_t shared_memory_file_descriptors = 3;
+
+    //Positions of a ring, they only grow and are taken modulo the ring size
+    struct SharedMemoryRingHeader {
+        alignas(64) std::atomic<uint64_t> write_position;
+        alignas(64) std::atomic<uint64_t> read_position;
+        //Set by a side before it sleeps, the other side signals its eventfd after the next write or read
+        alignas(64) std::atomic<uint32_t> reader_waiting;
+        std::atomic<uint32_t> writer_waiting;
+    };
+
+    //A pair of single producer, single consumer rings in a memfd segment, one for each direction
+    //The data of a ring is mapped twice in a row, so every readable or writable range is contiguous
+    //send() and receive() behave like their socket counterparts, a blocking receive waits for all data though
+    class SharedMemoryChannel {
+    public:
+        enum class Side : uint8_t {
+            c_NODE = 0,
+            c_CLIENT = 1,
+            enum_size = 2
+        };
+
+        //Creates the segment and the eventfds for the node, get_file_descriptors() describes them for the client
+        static std::shared_ptr<SharedMemoryChannel> create(uint64_t ring_size);
+
+        //Maps a segment that was created by the node, the closing of the control connection is treated as closing of the channel
+        static std::shared_ptr<SharedMemoryChannel> attach(std::vector<FileDescriptor> file_descriptors, Connection control = {});
+
+        ~SharedMemoryChannel();
+
+        SharedMemoryChannel(const SharedMemoryChannel&) = delete;
+        SharedMemoryChannel& operator=(const SharedMemoryChannel&) = delete;
+
+        //Writes as much as fits, the iovecs are advanced like for net::send()
+        //Blocks until everything was written unless MSG_DONTWAIT is passed, returns -1 if the peer is gone
+        ssize_t send(std::span<iovec> data, int flags = 0);
+
+        //With MSG_DONTWAIT it returns the available data or -1 with EAGAIN if there is none, otherwise it waits until data is full
+        ssize_t receive(std::span<char> data, int flags = 0);
+
+        //Readable data that wasn't received yet, it can be read straight out of the segment until it is consumed
+        std::span<const char> readable() const;
+        void consume(uint64_t size);
+
+        //The eventfd of this side, it becomes readable whenever the peer wrote data or made room
+        int notify_fd() const;
+
+        std::array<int, shared_memory_file_descriptors> get_file_descriptors() const;
+
+        uint64_t ring_size() const {
+            return ring_size_;
+        }
+
+    private:
+        struct Ring {
+            SharedMemoryRingHeader* header = nullptr;
+            char* data = nullptr;
+        };
+
+        SharedMemoryChannel(Side side, std::vector<FileDescriptor> file_descriptors, Connection control);
+
+        void map();
+        void unmap();
+
+        uint64_t write(std::span<iovec> data);
+        uint64_t writable_size() const;
+
+        //Sleeps until this side is notified, returns false if the peer closed the control connection
+        bool wait() const;
+        void notify_peer() const;
+
+        Side side_;
+        uint64_t ring_size_ = 0;
+        FileDescriptor memory_;
+        FileDescriptor node_notify_;
+        FileDescriptor client_notify_;
+        Connection control_;
+
+        void* header_mapping_ = nullptr;
+        size_t header_size_ = 0;
+        std::array<void*, 2> ring_mappings_{};
+        Ring inbound_;
+        Ring outbound_;
+    };
+}
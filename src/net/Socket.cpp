@@ -1,6 +1,11 @@
 #include <sys/socket.h>
+#include <poll.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 #include <cerrno>
 #include <fcntl.h>
@@ -9,6 +14,18 @@
 
 namespace net {
 
+    namespace {
+        sockaddr_un to_unix_address(const std::string& path) {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+                throw std::runtime_error("invalid unix domain socket path: " + path);
+            }
+            std::copy(path.begin(), path.end(), address.sun_path);
+            return address;
+        }
+    }
+
     [[nodiscard]] bool is_listening(int fd) {
         int ret_val;
         socklen_t len = sizeof(ret_val);
@@ -18,7 +35,105 @@ namespace net {
         return is_listening(fd.unwrap());
     }
 
-    Socket::Socket() {
+    [[nodiscard]] ConnectState get_connect_state(int fd) {
+        pollfd poll_fd{ fd, POLLOUT, 0 };
+        int ready = ::poll(&poll_fd, 1, 0);
+        if (ready < 0) {
+            return ConnectState::c_FAILED;
+        }
+        if (ready == 0) {
+            return ConnectState::c_IN_PROGRESS;
+        }
+
+        //Writable either way, the pending error tells whether the connect succeeded
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0) {
+            return ConnectState::c_FAILED;
+        }
+        return ConnectState::c_CONNECTED;
+    }
+
+    [[nodiscard]] bool is_unix_socket(int fd) {
+        int domain;
+        socklen_t len = sizeof(domain);
+        return getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) != -1 && domain == AF_UNIX;
+    }
+
+    void send_file_descriptors(int fd, std::span<const int> file_descriptors) {
+        char data = 0;
+        iovec buffer{ &data, sizeof(data) };
+        std::vector<char> control(CMSG_SPACE(file_descriptors.size_bytes()));
+
+        msghdr msg{};
+        msg.msg_iov = &buffer;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        cmsghdr* header = CMSG_FIRSTHDR(&msg);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(file_descriptors.size_bytes());
+        std::memcpy(CMSG_DATA(header), file_descriptors.data(), file_descriptors.size_bytes());
+
+        ssize_t sent;
+        do {
+            sent = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        } while (sent < 0 && errno == EINTR);
+        if (sent != sizeof(data)) {
+            throw std::runtime_error("failed to send file descriptors: " + std::to_string(errno));
+        }
+    }
+
+    std::vector<FileDescriptor> receive_file_descriptors(int fd, size_t amount) {
+        char data;
+        iovec buffer{ &data, sizeof(data) };
+        std::vector<char> control(CMSG_SPACE(amount * sizeof(int)));
+
+        msghdr msg{};
+        msg.msg_iov = &buffer;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        ssize_t received;
+        do {
+            received = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+        } while (received < 0 && errno == EINTR);
+        if (received != sizeof(data)) {
+            throw std::runtime_error("failed to receive file descriptors: " + std::to_string(errno));
+        }
+
+        //Received descriptors are owned right away, so they are closed if something is missing
+        std::vector<FileDescriptor> file_descriptors;
+        for (cmsghdr* header = CMSG_FIRSTHDR(&msg); header != nullptr; header = CMSG_NXTHDR(&msg, header)) {
+            if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; i++) {
+                int received_fd;
+                std::memcpy(&received_fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+                file_descriptors.emplace_back(received_fd);
+            }
+        }
+        if (file_descriptors.size() != amount || (msg.msg_flags & MSG_CTRUNC)) {
+            throw std::runtime_error("received " + std::to_string(file_descriptors.size()) + " file descriptors instead of " + std::to_string(amount));
+        }
+        return file_descriptors;
+    }
+
+    Socket::Socket(SocketFamily family) : family_(family) {
+        if (family_ == SocketFamily::c_UNIX) {
+            fd_ = FileDescriptor(socket(AF_UNIX, SOCK_STREAM, 0));
+            if (fd_.unwrap() < 0) {
+                throw std::runtime_error("error creating socket: " + std::to_string(errno));
+            }
+            //Reusing addresses and ports only applies to inet sockets
+            return;
+        }
+
         fd_ = FileDescriptor(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
         if (fd_.unwrap() < 0) {
             throw std::runtime_error("error creating socket: " + std::to_string(errno));
@@ -35,6 +150,9 @@ namespace net {
     }
 
     void Socket::listen(uint16_t port, int queue_size) const {
+        if (family_ != SocketFamily::c_INET) {
+            throw std::runtime_error("only inet sockets can listen on a port");
+        }
         sockaddr_in server{};
         server.sin_family = AF_INET;
         server.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -48,6 +166,21 @@ namespace net {
         }
     }
 
+    void Socket::listen(const std::string& path, int queue_size) const {
+        if (family_ != SocketFamily::c_UNIX) {
+            throw std::runtime_error("only unix domain sockets can listen on a path");
+        }
+        sockaddr_un server = to_unix_address(path);
+        ::unlink(path.c_str());
+
+        if (::bind(fd_.unwrap(), reinterpret_cast<sockaddr*>(&server), sizeof(server))) {
+            throw std::runtime_error("failed to bind to server socket: " + std::to_string(errno));
+        }
+        if (::listen(fd_.unwrap(), queue_size)) {
+            throw std::runtime_error("failed to listen: " + std::to_string(errno));
+        }
+    }
+
     bool Socket::set_non_blocking() const {
         int flags = fcntl(fd_.unwrap(), F_GETFL, 0);
         if (flags == -1) {
@@ -79,6 +212,9 @@ namespace net {
     }
 
     Connection Socket::connect(const std::string& addr, uint16_t port) {
+        if (family_ != SocketFamily::c_INET) {
+            throw std::runtime_error("only inet sockets can connect to an address");
+        }
         sockaddr_in server{};
         server.sin_family = AF_INET;
         server.sin_addr.s_addr = inet_addr(addr.c_str());
@@ -91,10 +227,42 @@ namespace net {
         return Connection{ std::move(fd_) };
     }
 
+    Connection Socket::connect_non_blocking(const std::string& addr, uint16_t port) {
+        if (family_ != SocketFamily::c_INET) {
+            throw std::runtime_error("only inet sockets can connect to an address");
+        }
+        if (!set_non_blocking()) {
+            throw std::runtime_error("failed to make socket non-blocking: " + std::to_string(errno));
+        }
+        sockaddr_in server{};
+        server.sin_family = AF_INET;
+        server.sin_addr.s_addr = inet_addr(addr.c_str());
+        server.sin_port = htons(port);
+
+        if (::connect(fd_.unwrap(), reinterpret_cast<sockaddr*>(&server), sizeof(server)) && errno != EINPROGRESS) {
+            throw std::runtime_error("failed to connect to server: " + std::to_string(errno));
+        }
+
+        return Connection{ std::move(fd_) };
+    }
+
     Connection Socket::connect(uint16_t port) {
         return connect("127.0.0.1", port);
     }
 
+    Connection Socket::connect(const std::string& path) {
+        if (family_ != SocketFamily::c_UNIX) {
+            throw std::runtime_error("only unix domain sockets can connect to a path");
+        }
+        sockaddr_un server = to_unix_address(path);
+
+        if (::connect(fd_.unwrap(), reinterpret_cast<sockaddr*>(&server), sizeof(server))) {
+            throw std::runtime_error("failed to connect to server: " + std::to_string(errno));
+        }
+
+        return Connection{ std::move(fd_) };
+    }
+
     int Socket::fd() const {
         return fd_.unwrap();
     }
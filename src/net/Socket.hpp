@@ -1,7 +1,9 @@
 #pragma once
 
 #include <cstdint>
+#include <span>
 #include <string>
+#include <vector>
 
 #include "FileDescriptor.hpp"
 #include "Connection.hpp"
@@ -12,13 +14,42 @@ namespace net {
 
     [[nodiscard]] bool is_listening(FileDescriptor& fd);
 
+    [[nodiscard]] bool is_unix_socket(int fd);
+
+    //Passes the file descriptors to the peer of a unix domain socket, together with a single byte
+    //Everything sent before has to be sent already, otherwise the byte would overtake it
+    void send_file_descriptors(int fd, std::span<const int> file_descriptors);
+
+    //Blocks until the file descriptors sent by send_file_descriptors() are received, throws if there are fewer
+    std::vector<FileDescriptor> receive_file_descriptors(int fd, size_t amount);
+
+    enum class ConnectState : uint8_t {
+        c_IN_PROGRESS = 0,
+        c_CONNECTED = 1,
+        c_FAILED = 2,
+        enum_size = 3
+    };
+
+    //Checks without blocking whether a connect started by Socket::connect_non_blocking() finished
+    [[nodiscard]] ConnectState get_connect_state(int fd);
+
+    enum class SocketFamily : uint8_t {
+        c_INET = 0,
+        //Unix domain socket, for clients on the same host
+        c_UNIX = 1,
+        enum_size = 2
+    };
+
     class Socket {
     public:
-        Socket();
+        explicit Socket(SocketFamily family = SocketFamily::c_INET);
         ~Socket() = default;
 
         void listen(uint16_t port, int queue_size = 50) const;
 
+        //Only for unix domain sockets, a file left behind at the path by a previous listener is removed
+        void listen(const std::string& path, int queue_size = 50) const;
+
         bool set_non_blocking() const;
 
         bool set_keep_alive() const;
@@ -27,12 +58,20 @@ namespace net {
 
         Connection connect(const std::string &addr, uint16_t port);
 
+        //Returns right away, the connection can be used once get_connect_state() reports it as connected
+        //The socket stays non-blocking, throws only if the connect failed immediately
+        Connection connect_non_blocking(const std::string& addr, uint16_t port);
+
         //Connect to localhost
         Connection connect(uint16_t port);
 
+        //Only for unix domain sockets
+        Connection connect(const std::string& path);
+
         int fd() const;
 
     private:
         FileDescriptor fd_;
+        SocketFamily family_;
     };
 }
\ No newline at end of file
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace net {
+
+    template<typename T>
+    class Task;
+
+    namespace detail {
+
+        //Resumes the awaiting coroutine when the task finished, a task that isn't awaited just stays suspended
+        struct FinalAwaiter {
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                std::coroutine_handle<> continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        struct PromiseBase {
+            std::suspend_always initial_suspend() const noexcept {
+                return {};
+            }
+            FinalAwaiter final_suspend() const noexcept {
+                return {};
+            }
+            void unhandled_exception() {
+                exception = std::current_exception();
+            }
+
+            std::coroutine_handle<> continuation;
+            std::exception_ptr exception;
+        };
+
+        template<typename T>
+        struct Promise : PromiseBase {
+            Task<T> get_return_object();
+
+            void return_value(T value) {
+                result = std::move(value);
+            }
+
+            T get_result() {
+                if (exception) {
+                    std::rethrow_exception(exception);
+                }
+                return std::move(*result);
+            }
+
+            std::optional<T> result;
+        };
+
+        template<>
+        struct Promise<void> : PromiseBase {
+            Task<void> get_return_object();
+
+            void return_void() const noexcept {}
+
+            void get_result() const {
+                if (exception) {
+                    std::rethrow_exception(exception);
+                }
+            }
+        };
+    }
+
+    //Lazily started coroutine that owns its frame, awaiting it runs it until it finished
+    //Exceptions are rethrown to the awaiting coroutine
+    template<typename T = void>
+    class Task {
+    public:
+        using promise_type = detail::Promise<T>;
+
+        Task() = default;
+        explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+        ~Task() {
+            if (handle_) {
+                handle_.destroy();
+            }
+        }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+        Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                if (handle_) {
+                    handle_.destroy();
+                }
+                handle_ = std::exchange(other.handle_, nullptr);
+            }
+            return *this;
+        }
+
+        bool valid() const {
+            return static_cast<bool>(handle_);
+        }
+        bool done() const {
+            return handle_.done();
+        }
+
+        //Runs a task that isn't awaited by another coroutine until its first suspension
+        void start() {
+            handle_.resume();
+        }
+
+        //Only valid once the task is done, rethrows its exception
+        T get_result() {
+            return handle_.promise().get_result();
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            handle_.promise().continuation = awaiting;
+            return handle_;
+        }
+        T await_resume() {
+            return handle_.promise().get_result();
+        }
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    namespace detail {
+        template<typename T>
+        Task<T> Promise<T>::get_return_object() {
+            return Task<T>{ std::coroutine_handle<Promise<T>>::from_promise(*this) };
+        }
+
+        inline Task<void> Promise<void>::get_return_object() {
+            return Task<void>{ std::coroutine_handle<Promise<void>>::from_promise(*this) };
+        }
+    }
+
+    //Runs the task on the calling thread, for connections without async io that never suspend
+    template<typename T>
+    T sync_wait(Task<T> task) {
+        task.start();
+        if (!task.done()) {
+            throw std::logic_error("Task suspended outside of an event loop");
+        }
+        return task.get_result();
+    }
+}
@@ -0,0 +1,82 @@
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+
+#include "TimerQueue.hpp"
+
+namespace net {
+
+    TimerQueue::TimerQueue() {
+        //steady_clock is CLOCK_MONOTONIC, so the deadlines can be passed as absolute times
+        fd_ = FileDescriptor{ timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC) };
+        if (fd_.unwrap() < 0) {
+            throw std::runtime_error("Failed to create timerfd: " + std::to_string(errno));
+        }
+    }
+
+    TimerId TimerQueue::add(Clock::duration delay, Callback callback) {
+        TimerId id = next_id_++;
+        callbacks_.emplace(id, std::move(callback));
+        deadlines_.push(Entry{ Clock::now() + delay, id });
+        if (deadlines_.top().id == id) {
+            arm();
+        }
+        return id;
+    }
+
+    void TimerQueue::cancel(TimerId id) {
+        callbacks_.erase(id);
+    }
+
+    void TimerQueue::run_expired() {
+        //Resets the readiness of the timerfd, it might already be reset if it wasn't armed for an expired deadline
+        uint64_t expirations;
+        [[maybe_unused]] ssize_t result = ::read(fd_.unwrap(), &expirations, sizeof(expirations));
+        armed_for_ = Clock::time_point::max();
+
+        Clock::time_point now = Clock::now();
+        std::vector<Callback> expired;
+        while (!deadlines_.empty() && deadlines_.top().deadline <= now) {
+            auto callback = callbacks_.find(deadlines_.top().id);
+            if (callback != callbacks_.end()) {
+                expired.push_back(std::move(callback->second));
+                callbacks_.erase(callback);
+            }
+            deadlines_.pop();
+        }
+
+        //A callback might add a timer with a deadline that already passed, it must not run in this loop
+        for (Callback& callback : expired) {
+            callback();
+        }
+        arm();
+    }
+
+    void TimerQueue::arm() {
+        while (!deadlines_.empty() && !callbacks_.contains(deadlines_.top().id)) {
+            deadlines_.pop();
+        }
+
+        Clock::time_point deadline = deadlines_.empty() ? Clock::time_point::max() : deadlines_.top().deadline;
+        if (deadline == armed_for_) {
+            return;
+        }
+        armed_for_ = deadline;
+
+        //A zero value disarms the timer, a deadline in the past has to expire right away
+        itimerspec spec{};
+        if (deadline != Clock::time_point::max()) {
+            auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch());
+            spec.it_value.tv_sec = static_cast<time_t>(since_epoch.count() / 1000000000);
+            spec.it_value.tv_nsec = static_cast<long>(since_epoch.count() % 1000000000);
+            if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+                spec.it_value.tv_nsec = 1;
+            }
+        }
+        if (timerfd_settime(fd_.unwrap(), TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+            throw std::runtime_error("Failed to arm timerfd: " + std::to_string(errno));
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "FileDescriptor.hpp"
+
+namespace net {
+
+    using TimerId = uint64_t;
+
+    //Timers of an event loop, they share a timerfd that is armed for the earliest deadline
+    //The timerfd is registered as notifier of the reactor, run_expired() is called when it becomes readable
+    class TimerQueue {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using Callback = std::function<void()>;
+
+        TimerQueue();
+
+        //Runs the callback once after the delay, periodic jobs add themselves again
+        TimerId add(Clock::duration delay, Callback callback);
+
+        //Does nothing if the timer already ran
+        void cancel(TimerId id);
+
+        //Runs the callbacks of all expired timers, timers added by the callbacks run with the next call at the earliest
+        void run_expired();
+
+        int fd() const {
+            return fd_.unwrap();
+        }
+
+        size_t size() const {
+            return callbacks_.size();
+        }
+
+    private:
+        struct Entry {
+            Clock::time_point deadline;
+            TimerId id;
+
+            bool operator>(const Entry& other) const {
+                return deadline > other.deadline || (deadline == other.deadline && id > other.id);
+            }
+        };
+
+        //Sets the timerfd to the earliest deadline of a timer that wasn't cancelled
+        void arm();
+
+        FileDescriptor fd_;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<>> deadlines_;
+        //Cancelled timers are only removed here, their deadlines are dropped once they are reached
+        std::unordered_map<TimerId, Callback> callbacks_;
+        TimerId next_id_ = 0;
+        Clock::time_point armed_for_ = Clock::time_point::max();
+    };
+}
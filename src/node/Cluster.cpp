@@ -12,11 +12,17 @@
 
 namespace node::cluster {
 
-    ClusterNodeGossipData convert_node_to_network_order(ClusterNodeGossipData& node) {
+    ClusterNodeGossipData convert_node_to_network_order(const ClusterNodeGossipData& node) {
         ClusterNodeGossipData converted_node = node;
         converted_node.cluster_port = htons(node.cluster_port);
         converted_node.client_port = htons(node.client_port);
         converted_node.num_slots_served = htons(node.num_slots_served);
+        converted_node.config_epoch = htobe64(node.config_epoch);
+        converted_node.load.keys = htobe64(node.load.keys);
+        converted_node.load.bytes = htobe64(node.load.bytes);
+        converted_node.load.ops_per_second = htobe64(node.load.ops_per_second);
+        converted_node.load.bandwidth = htobe64(node.load.bandwidth);
+        converted_node.load.version = htobe64(node.load.version);
         return std::move(converted_node);
     }
 
@@ -25,190 +31,619 @@ namespace node::cluster {
         converted_node.cluster_port = ntohs(node.cluster_port);
         converted_node.client_port = ntohs(node.client_port);
         converted_node.num_slots_served = ntohs(node.num_slots_served);
+        converted_node.config_epoch = be64toh(node.config_epoch);
+        converted_node.load.keys = be64toh(node.load.keys);
+        converted_node.load.bytes = be64toh(node.load.bytes);
+        converted_node.load.ops_per_second = be64toh(node.load.ops_per_second);
+        converted_node.load.bandwidth = be64toh(node.load.bandwidth);
+        converted_node.load.version = be64toh(node.load.version);
         return std::move(converted_node);
     }
 
-    SlotGossipData get_slot_data(Slot& slot, uint16_t slot_number) {
-        SlotGossipData slot_data;
-        slot_data.amount_of_keys = slot.amount_of_keys;
-        slot_data.slot_number = slot_number;
-        slot_data.state = slot.state;
-
-        if (slot.migration_partner != nullptr) {
-            slot_data.migration_partner_name = slot.migration_partner->name;
+    SlotTable::SlotTable(const std::vector<Slot>& slots) {
+        resize(slots.size());
+        for (size_t slot = 0; slot < slots.size(); slot++) {
+            served_by_[slot] = slots[slot].served_by;
+            amount_of_keys_[slot] = slots[slot].amount_of_keys;
+            state_[slot] = slots[slot].state;
+            migration_partner_[slot] = slots[slot].migration_partner;
         }
-        else {
-            slot_data.migration_partner_name.fill(0);
+    }
+
+    SlotTable::operator std::vector<Slot>() const {
+        std::vector<Slot> slots;
+        slots.reserve(size());
+        for (size_t slot = 0; slot < size(); slot++) {
+            slots.emplace_back((*this)[slot]);
         }
+        return slots;
+    }
 
-        if (slot.served_by != nullptr) {
-            slot_data.served_by_name = slot.served_by->name;
+    void SlotTable::resize(size_t size) {
+        served_by_.resize(size, nullptr);
+        amount_of_keys_.resize(size, 0);
+        state_.resize(size, SlotState::c_NORMAL);
+        migration_partner_.resize(size, nullptr);
+    }
+
+    void copy_name(std::array<char, CLUSTER_NAME_LEN>& name, observer_ptr<const ClusterNode> node) {
+        if (node != nullptr) {
+            name = node->name;
         }
         else {
-            slot_data.served_by_name.fill(0);
+            name.fill(0);
         }
+    }
 
-        return slot_data;
+    std::vector<SlotRangeGossipData> get_slot_ranges(const SlotTable& slots) {
+        std::vector<SlotRangeGossipData> ranges;
+        const auto& served_by = slots.served_by();
+        const auto& states = slots.states();
+        const auto& migration_partners = slots.migration_partners();
+
+        for (size_t slot = 0; slot < slots.size(); slot++) {
+            bool extends_range = slot != 0 && served_by[slot] == served_by[slot - 1]
+                && states[slot] == states[slot - 1] && migration_partners[slot] == migration_partners[slot - 1];
+            if (extends_range) {
+                ranges.back().last_slot = static_cast<uint16_t>(slot);
+                continue;
+            }
+
+            SlotRangeGossipData range{};
+            range.first_slot = static_cast<uint16_t>(slot);
+            range.last_slot = static_cast<uint16_t>(slot);
+            range.state = states[slot];
+            copy_name(range.served_by_name, served_by[slot]);
+            copy_name(range.migration_partner_name, migration_partners[slot]);
+            ranges.emplace_back(range);
+        }
+        return ranges;
     }
 
-    void convert_slot_to_network_order(SlotGossipData& slot) {
-        slot.amount_of_keys = htobe64(slot.amount_of_keys);
-        slot.slot_number = htobe16(slot.slot_number);
+    void convert_slot_range_to_network_order(SlotRangeGossipData& range) {
+        range.first_slot = htobe16(range.first_slot);
+        range.last_slot = htobe16(range.last_slot);
         //No need to convert state since it's a uint8_t
     }
 
-    void convert_slot_to_host_order(SlotGossipData& slot) {
-        slot.amount_of_keys = be64toh(slot.amount_of_keys);
-        slot.slot_number = be16toh(slot.slot_number);
+    void convert_slot_range_to_host_order(SlotRangeGossipData& range) {
+        range.first_slot = be16toh(range.first_slot);
+        range.last_slot = be16toh(range.last_slot);
         //No need to convert state since it's a uint8_t
     }
 
-    void send_ping(ClusterState& state) {
-        if (state.size == 0) {
-            return;
+    //Stable hash of what a range says about its slots, FNV-1a with a final mix
+    uint64_t get_slot_range_hash(const SlotRangeGossipData& range) {
+        uint64_t hash = 0xcbf29ce484222325;
+        auto add = [&hash](const char* data, size_t size) {
+            for (size_t i = 0; i < size; i++) {
+                hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001b3;
+            }
+        };
+        add(reinterpret_cast<const char*>(&range.state), sizeof(range.state));
+        add(range.served_by_name.data(), range.served_by_name.size());
+        add(range.migration_partner_name.data(), range.migration_partner_name.size());
+
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+        return hash ^ (hash >> 31);
+    }
+
+    //Every slot adds the hash of its content weighted with its position, so the sum doesn't depend on how the slots are split
+    uint64_t get_slot_range_digest(uint16_t first_slot, uint16_t last_slot, uint64_t hash) {
+        uint64_t weight = (static_cast<uint64_t>(first_slot) + last_slot + 2) * (last_slot - first_slot + 1) / 2;
+        return hash * weight;
+    }
+
+    uint64_t get_slot_range_digest(const SlotRangeGossipData& range) {
+        return get_slot_range_digest(range.first_slot, range.last_slot, get_slot_range_hash(range));
+    }
+
+    uint64_t get_slot_ranges_digest(const std::vector<SlotRangeGossipData>& ranges) {
+        uint64_t digest = 0;
+        for (const SlotRangeGossipData& range : ranges) {
+            digest += get_slot_range_digest(range);
         }
+        return digest;
+    }
 
-        auto required_nodes = static_cast<uint16_t>(ceil(state.size / 10.0));
-        for (uint16_t i = 0; i < required_nodes; ++i) {
+    bool is_same_slot_range(const SlotRangeGossipData& lhs, const SlotRangeGossipData& rhs) {
+        return lhs.first_slot == rhs.first_slot && lhs.last_slot == rhs.last_slot && lhs.state == rhs.state
+            && lhs.served_by_name == rhs.served_by_name && lhs.migration_partner_name == rhs.migration_partner_name;
+    }
+
+    void PeerSlotRanges::clear() {
+        ranges_.clear();
+        digest_ = 0;
+        version = 0;
+    }
+
+    void PeerSlotRanges::assign(const SlotRangeGossipData& range) {
+        uint16_t first_slot = range.first_slot;
+        uint16_t last_slot = range.last_slot;
+
+        //Split the ranges that reach into the new one from the left and to the right, splitting doesn't change the digest
+        auto split = [this](uint16_t slot) {
+            auto next = ranges_.upper_bound(slot);
+            if (next == ranges_.begin()) {
+                return;
+            }
+            auto containing = std::prev(next);
+            if (containing->first < slot && containing->second.last_slot >= slot) {
+                Range tail = containing->second;
+                containing->second.last_slot = slot - 1;
+                ranges_.emplace(slot, tail);
+            }
+        };
+        split(first_slot);
+        if (last_slot < CLUSTER_MAX_AMOUNT_OF_SLOTS - 1) {
+            split(last_slot + 1);
+        }
+
+        for (auto it = ranges_.lower_bound(first_slot); it != ranges_.end() && it->first <= last_slot;) {
+            digest_ -= get_slot_range_digest(it->first, it->second.last_slot, it->second.hash);
+            it = ranges_.erase(it);
+        }
+
+        uint64_t hash = get_slot_range_hash(range);
+        ranges_.emplace(first_slot, Range{ last_slot, hash });
+        digest_ += get_slot_range_digest(first_slot, last_slot, hash);
+    }
+
+    std::shared_ptr<const ClusterSnapshot> make_snapshot(const ClusterState& state, uint64_t version, const ClusterSnapshot* previous) {
+        auto snapshot = std::make_shared<ClusterSnapshot>();
+        snapshot->version = version;
+        snapshot->myself = state.myself;
+        snapshot->size = state.size;
+        snapshot->part_of_cluster = state.part_of_cluster;
+
+        snapshot->nodes.reserve(state.nodes.size());
+        for (const auto& [name, node] : state.nodes) {
+            snapshot->nodes.emplace_back(node);
+        }
+        snapshot->slots = get_slot_ranges(state.slots);
+        snapshot->slot_digest = get_slot_ranges_digest(snapshot->slots);
+
+        //Both are sorted by the first slot
+        snapshot->slot_versions.assign(snapshot->slots.size(), version);
+        if (previous != nullptr) {
+            size_t previous_range = 0;
+            for (size_t range = 0; range < snapshot->slots.size(); range++) {
+                while (previous_range < previous->slots.size() && previous->slots[previous_range].first_slot < snapshot->slots[range].first_slot) {
+                    previous_range++;
+                }
+                if (previous_range < previous->slots.size() && is_same_slot_range(previous->slots[previous_range], snapshot->slots[range])) {
+                    snapshot->slot_versions[range] = previous->slot_versions[previous_range];
+                }
+            }
+        }
+        return snapshot;
+    }
+
+    ClusterGossipMsg build_ping(const ClusterSnapshot& snapshot, uint64_t base_version) {
+        auto required_nodes = static_cast<uint16_t>(ceil(snapshot.size / 10.0));
+        ClusterGossipMsg msg;
+        msg.sender = snapshot.myself.name;
+        msg.nodes.emplace_back(convert_node_to_network_order(snapshot.myself));
+
+        if (!snapshot.nodes.empty()) {
             std::mt19937 random_engine(std::random_device{}());
-            std::uniform_int_distribution<uint16_t> dist(0, state.size - 1); //Important: [a, b] both borders inclusive
-            uint16_t random_index = dist(random_engine);
-            ClusterNode& rand_node = std::next(state.nodes.begin(), random_index)->second;
+            std::uniform_int_distribution<size_t> dist(0, snapshot.nodes.size() - 1); //Important: [a, b] both borders inclusive
+            for (int i = 0; i < required_nodes; i++) {
+                msg.nodes.emplace_back(convert_node_to_network_order(snapshot.nodes[dist(random_engine)]));
+            }
+        }
 
-            if (rand_node.outgoing_link.is_connected() && rand_node.name != state.myself.name) {
-                send_ping(&rand_node.outgoing_link, state);
+        msg.version = snapshot.version;
+        msg.base_version = base_version;
+        msg.digest = snapshot.slot_digest;
+        for (size_t range = 0; range < snapshot.slots.size(); range++) {
+            if (base_version == 0 || snapshot.slot_versions[range] > base_version) {
+                SlotRangeGossipData range_data = snapshot.slots[range];
+                convert_slot_range_to_network_order(range_data);
+                msg.slots.emplace_back(range_data);
             }
         }
+        return msg;
+    }
+
+    void send_ping(net::Connection& link, const ClusterGossipMsg& msg) {
+        uint64_t nodes_size_bytes = msg.nodes.size() * sizeof(ClusterNodeGossipData);
+        uint64_t slots_size_bytes = msg.slots.size() * sizeof(SlotRangeGossipData);
+
+        //Nodes, slots and sender are sent as one payload with a single syscall
+        ssize_t sent = protocol::send_instruction(link,
+            protocol::Command{ std::to_string(msg.nodes.size()), std::to_string(msg.slots.size()),
+                std::to_string(msg.version), std::to_string(msg.base_version), std::to_string(msg.digest) },
+            protocol::Instruction::c_CLUSTER_PING,
+            {
+                std::span<const char>(reinterpret_cast<const char*>(msg.nodes.data()), nodes_size_bytes),
+                std::span<const char>(reinterpret_cast<const char*>(msg.slots.data()), slots_size_bytes),
+                std::span<const char>(msg.sender.data(), msg.sender.size())
+            }
+        );
+        if (sent < 0) {
+            throw std::runtime_error("Failed to send ping: " + std::to_string(errno));
+        }
     }
 
     void send_ping(observer_ptr<net::Connection> link, ClusterState& state) {
-        auto required_nodes = static_cast<uint16_t>(ceil(state.size / 10.0));
-        ClusterGossipMsg msg;
-        msg.sender = state.myself.name;
+        send_ping(*link, build_ping(*make_snapshot(state, 0)));
+    }
+
+    void send_ping(const ClusterSnapshot& snapshot, GossipLinks& links, net::OutputBufferLimits link_limits) {
+        //Links of nodes that left the cluster aren't needed anymore
+        std::erase_if(links, [&snapshot](const auto& link) {
+            return std::none_of(snapshot.nodes.begin(), snapshot.nodes.end(),
+                [&link](const ClusterNodeGossipData& node) { return link.first == node.name.data(); });
+        });
+        if (snapshot.size == 0 || snapshot.nodes.empty()) {
+            return;
+        }
 
+        auto required_nodes = static_cast<uint16_t>(ceil(snapshot.size / 10.0));
         std::mt19937 random_engine(std::random_device{}());
-        std::uniform_int_distribution<uint16_t> dist(0, state.size - 1); //Important: [a, b] both borders inclusive
-        msg.nodes.emplace_back(convert_node_to_network_order(state.myself));
+        std::uniform_int_distribution<size_t> dist(0, snapshot.nodes.size() - 1); //Important: [a, b] both borders inclusive
+        for (uint16_t i = 0; i < required_nodes; ++i) {
+            const ClusterNodeGossipData& rand_node = snapshot.nodes[dist(random_engine)];
+            if (rand_node.name == snapshot.myself.name) {
+                continue;
+            }
 
-        for (int i = 0; i < required_nodes; i++) {
-            uint16_t random_index = dist(random_engine);
-            ClusterNode& rand_node = std::next(state.nodes.begin(), random_index)->second;
-            ClusterNodeGossipData converted_node = convert_node_to_network_order(rand_node);
-            msg.nodes.emplace_back(converted_node);
+            //Whatever is left from earlier pings is flushed first
+            GossipLink& gossip_link = get_gossip_link(rand_node, links, link_limits);
+            if (gossip_link.link.update() == LinkState::c_DISCONNECTED) {
+                //The queued pings were dropped with the connection
+                gossip_link.sent_version = 0;
+                continue;
+            }
+            try {
+                send_ping(gossip_link.link.get_connection(), build_ping(snapshot, gossip_link.sent_version));
+                //The stream keeps the order, a ping that doesn't arrive breaks the link and the next one is sent in full
+                gossip_link.sent_version = snapshot.version;
+            }
+            catch (const std::runtime_error& e) {
+                gossip_link.link.fail();
+                gossip_link.sent_version = 0;
+            }
         }
+    }
 
-        for (uint16_t slot_number = 0; slot_number < CLUSTER_AMOUNT_OF_SLOTS; slot_number++) {
-            SlotGossipData slot_data = get_slot_data(state.slots[slot_number], slot_number);
-            convert_slot_to_network_order(slot_data);
-            msg.slots.emplace_back(std::move(slot_data));
+    GossipLink& get_gossip_link(const ClusterNodeGossipData& node, GossipLinks& links, net::OutputBufferLimits link_limits) {
+        std::string name(node.name.data());
+        auto link = links.find(name);
+        if (link == links.end()) {
+            link = links.emplace(name, GossipLink{ ClusterLink(node.ip.data(), node.cluster_port, link_limits) }).first;
         }
+        return link->second;
+    }
 
-        uint64_t nodes_size_bytes = (required_nodes + 1) * sizeof(ClusterNodeGossipData); //+1 for myself
-        uint64_t slots_size_bytes = CLUSTER_AMOUNT_OF_SLOTS * sizeof(SlotGossipData);
-        uint64_t total_size_bytes = nodes_size_bytes + slots_size_bytes;
+    ClusterLink::ClusterLink(std::string ip, uint16_t port, net::OutputBufferLimits limits)
+        : shared_(std::make_shared<Shared>()) {
+        shared_->ip = std::move(ip);
+        shared_->port = port;
+        shared_->limits = limits;
+    }
 
-        protocol::send_instruction(*link,
-            protocol::Command{ std::to_string(1 + required_nodes), std::to_string(CLUSTER_AMOUNT_OF_SLOTS) },
-            protocol::Instruction::c_CLUSTER_PING,
-            reinterpret_cast<char*>(msg.nodes.data()),
-            nodes_size_bytes
-        );
-        link->send(reinterpret_cast<char*>(msg.slots.data()), slots_size_bytes);
-        link->send(reinterpret_cast<char*>(msg.sender.data()), msg.sender.size());
+    ClusterLink::ClusterLink(net::Connection connection)
+        : shared_(std::make_shared<Shared>()) {
+        shared_->reconnect = false;
+        shared_->connection = std::move(connection);
+        shared_->state = shared_->connection.is_connected() ? LinkState::c_CONNECTED : LinkState::c_DISCONNECTED;
+    }
+
+    LinkState ClusterLink::update(std::chrono::steady_clock::time_point now) {
+        if (shared_ == nullptr) {
+            return LinkState::c_DISCONNECTED;
+        }
+        Shared& link = *shared_;
+
+        if (link.state == LinkState::c_DISCONNECTED) {
+            if (!link.reconnect || now < link.next_attempt) {
+                return link.state;
+            }
+            try {
+                link.connection = net::Socket{}.connect_non_blocking(link.ip, link.port);
+            }
+            catch (const std::runtime_error& e) {
+                fail(now);
+                return link.state;
+            }
+            //Everything sent until the connect finished is queued
+            link.connection.enable_output_buffering(link.limits);
+            link.connection.set_output_deferred(true);
+            link.state = LinkState::c_CONNECTING;
+        }
+
+        if (link.state == LinkState::c_CONNECTING) {
+            switch (net::get_connect_state(link.connection.fd())) {
+            case net::ConnectState::c_IN_PROGRESS:
+                return link.state;
+            case net::ConnectState::c_CONNECTED:
+                link.connection.set_output_deferred(false);
+                link.state = LinkState::c_CONNECTED;
+                link.failed_attempts = 0;
+                break;
+            default:
+                fail(now);
+                return link.state;
+            }
+        }
+
+        try {
+            link.connection.flush();
+        }
+        catch (const std::runtime_error& e) {
+            fail(now);
+        }
+        return link.state;
+    }
+
+    bool ClusterLink::send(const protocol::Command& command, protocol::Instruction instruction, std::span<const char> payload) {
+        if (update() == LinkState::c_DISCONNECTED) {
+            return false;
+        }
+        try {
+            if (protocol::send_instruction(shared_->connection, command, instruction, { payload }) < 0) {
+                fail();
+            }
+        }
+        catch (const std::runtime_error& e) {
+            fail();
+        }
+        return shared_->state != LinkState::c_DISCONNECTED;
+    }
+
+    net::Connection& ClusterLink::get_connection() {
+        if (shared_ == nullptr) {
+            throw std::runtime_error("Cluster link without connection");
+        }
+        return shared_->connection;
+    }
+
+    void ClusterLink::fail(std::chrono::steady_clock::time_point now) {
+        if (shared_ == nullptr) {
+            return;
+        }
+        Shared& link = *shared_;
+        link.connection = net::Connection{};
+        link.state = LinkState::c_DISCONNECTED;
+        link.failed_attempts++;
+        //Doubles with every failed attempt in a row
+        auto backoff = CLUSTER_RECONNECT_MIN_BACKOFF * (int64_t{ 1 } << std::min<uint32_t>(link.failed_attempts - 1, 16));
+        link.next_attempt = now + std::min<std::chrono::milliseconds>(backoff, CLUSTER_RECONNECT_MAX_BACKOFF);
+    }
+
+    bool ClusterLink::is_closed() const {
+        return shared_ == nullptr || (!shared_->reconnect && shared_->state == LinkState::c_DISCONNECTED);
+    }
+
+    LinkState ClusterLink::get_state() const {
+        return shared_ == nullptr ? LinkState::c_DISCONNECTED : shared_->state;
     }
 
     void update_node(const std::string& name, ClusterState& state, const ClusterNodeGossipData& node) {
         ClusterNode new_node = static_cast<ClusterNode>(node);
 
-        //Existing connection
-        if (state.nodes.contains(name) && state.nodes[name].outgoing_link.is_connected()) {
+        //Only the failure detection of this node decides that
+        if (state.nodes.contains(name)) {
+            new_node.failed = state.nodes[name].failed;
+            //Others might gossip an older measurement than the one that arrived before
+            if (node.load.version < state.nodes[name].load.version) {
+                new_node.load = state.nodes[name].load;
+            }
+        }
+        //The load and the key counts change with every ping, they aren't part of the slot map
+        if (!state.nodes.contains(name) || state.nodes[name].ip != new_node.ip || state.nodes[name].client_port != new_node.client_port
+            || state.nodes[name].primary != new_node.primary || state.nodes[name].config_epoch != new_node.config_epoch) {
+            state.slot_map_changed = true;
+        }
+        //The existing link keeps its connection or backoff, a new one connects in the background
+        if (state.nodes.contains(name) && !state.nodes[name].outgoing_link.is_closed()) {
             new_node.outgoing_link = std::move(state.nodes[name].outgoing_link);
         }
-        //New connection required
         else {
-            net::Socket socket{};
-            new_node.outgoing_link = socket.connect(node.ip.data(), node.cluster_port);
+            new_node.outgoing_link = ClusterLink(node.ip.data(), node.cluster_port);
+            new_node.outgoing_link.update();
         }
         state.nodes[name] = std::move(new_node);
     }
 
 
+    //Gossip about a node that still claims the slot with an older configuration must not undo a failover
+    bool is_claimed_by_newer_node(const ClusterState& state, size_t slot, const ClusterNode& node) {
+        observer_ptr<ClusterNode> current = state.slots[slot].served_by;
+        return current != nullptr && current != &node && current->served_slots.test(slot) && current->config_epoch > node.config_epoch;
+    }
+
     void update_served_slots_by_node(ClusterState& state, ClusterNode& node) {
         node.num_slots_served = node.served_slots.count();
-        for (int i = 0; i < CLUSTER_AMOUNT_OF_SLOTS; i++) {
-            if (node.served_slots.test(i)) {
+        for (size_t i = 0; i < std::min<size_t>(CLUSTER_AMOUNT_OF_SLOTS, state.slots.size()); i++) {
+            if (node.served_slots.test(i) && !is_claimed_by_newer_node(state, i, node) && state.slots[i].served_by != &node) {
                 state.slots[i].served_by = &node;
+                state.slot_map_changed = true;
             }
         }
     }
 
+    //Another node only claims slots of this one after it failed over, a primary that lost all of its slots replicates that node
+    void yield_slots_to_newer_node(ClusterState& state, ClusterNode& node) {
+        if (node.config_epoch <= state.myself.config_epoch || node.name == state.myself.name
+            || (node.served_slots & state.myself.served_slots).none()) {
+            return;
+        }
+        for (size_t i = 0; i < std::min<size_t>(CLUSTER_AMOUNT_OF_SLOTS, state.slots.size()); i++) {
+            //Migrating slots are only given up by the migration
+            if (node.served_slots.test(i) && state.myself.served_slots.test(i) && state.slots[i].state == SlotState::c_NORMAL) {
+                state.myself.served_slots[i] = false;
+                state.slots[i].served_by = &node;
+                state.slot_map_changed = true;
+            }
+        }
+        state.myself.num_slots_served = state.myself.served_slots.count();
+        if (state.myself.num_slots_served == 0 && state.myself.primary[0] == '\0') {
+            state.myself.primary = node.name;
+        }
+    }
 
-    void handle_ping(net::Connection& link, ClusterState& state, const protocol::Command& comand) {
-        uint16_t sent_nodes = std::stoi(comand[to_integral(protocol::CommandFieldsPing::c_NODES_AMOUNT)]);
-        uint16_t sent_slots = std::stoi(comand[to_integral(protocol::CommandFieldsPing::c_SLOTS_AMOUNT)]);
 
-        for (int i = 0; i < sent_nodes; i++) {
-            ClusterNodeGossipData cur;
-            protocol::get_payload(link, reinterpret_cast<char*>(&cur), sizeof(ClusterNodeGossipData));
-            std::string name(cur.name.begin());
-            update_node(name, state, convert_node_to_host_order(cur));
-            update_served_slots_by_node(state, state.nodes[name]);
+    net::Task<ClusterGossipMsg> read_ping(net::Connection& link, const protocol::CommandView& comand) {
+        uint16_t sent_nodes = protocol::field_to_uint64(comand[to_integral(protocol::CommandFieldsPing::c_NODES_AMOUNT)]);
+        if (comand.size() != to_integral(protocol::CommandFieldsPing::enum_size)) {
+            throw std::runtime_error("Wrong number of arguments for CLUSTER_PING");
+        }
+        uint64_t sent_ranges = protocol::field_to_uint64(comand[to_integral(protocol::CommandFieldsPing::c_SLOT_RANGES_AMOUNT)]);
+        if (sent_ranges > CLUSTER_MAX_AMOUNT_OF_SLOTS) {
+            throw std::runtime_error("Too many slot ranges in ping: " + std::to_string(sent_ranges));
         }
+        ClusterGossipMsg msg;
+        msg.version = protocol::field_to_uint64(comand[to_integral(protocol::CommandFieldsPing::c_VERSION)]);
+        msg.base_version = protocol::field_to_uint64(comand[to_integral(protocol::CommandFieldsPing::c_BASE_VERSION)]);
+        msg.digest = protocol::field_to_uint64(comand[to_integral(protocol::CommandFieldsPing::c_DIGEST)]);
 
-        //Receive all slots into a vector
-        std::vector<SlotGossipData> received_slots(sent_slots);
-        link.receive(reinterpret_cast<char*>(received_slots.data()), sent_slots * sizeof(SlotGossipData));
+        //Receive all nodes and slot ranges into vectors
+        msg.nodes.resize(sent_nodes);
+        co_await protocol::read_payload(link, reinterpret_cast<char*>(msg.nodes.data()), sent_nodes * sizeof(ClusterNodeGossipData));
+        msg.slots.resize(sent_ranges);
+        co_await protocol::read_payload(link, reinterpret_cast<char*>(msg.slots.data()), sent_ranges * sizeof(SlotRangeGossipData));
 
         //Get sender
-        std::array<char, CLUSTER_NAME_LEN> name;
-        link.receive(name.data(), CLUSTER_NAME_LEN);
-        std::string sender_name(name.data());
+        co_await protocol::read_payload(link, msg.sender.data(), CLUSTER_NAME_LEN);
+
+        for (ClusterNodeGossipData& node : msg.nodes) {
+            node = convert_node_to_host_order(node);
+        }
+        for (SlotRangeGossipData& range : msg.slots) {
+            convert_slot_range_to_host_order(range);
+            if (range.first_slot > range.last_slot || range.last_slot >= CLUSTER_MAX_AMOUNT_OF_SLOTS) {
+                throw std::runtime_error("Invalid slot range in ping");
+            }
+        }
+        co_return msg;
+    }
 
-        for (uint16_t slot_number = 0; slot_number < sent_slots; slot_number++) {
-            //Every node knows best about it's own slots
-            if(state.myself.served_slots.test(slot_number)){
+    bool apply_ping(ClusterState& state, const ClusterGossipMsg& msg) {
+        std::string sender_name(msg.sender.data());
+        for (const ClusterNodeGossipData& node : msg.nodes) {
+            std::string name(node.name.begin());
+            bool known = state.nodes.contains(name);
+            //Others might still gossip about an older configuration of the node, the node itself always knows best
+            if (known && name != sender_name && node.config_epoch < state.nodes[name].config_epoch) {
                 continue;
             }
 
-            convert_slot_to_host_order(received_slots[slot_number]);
-            SlotGossipData& slot_data = received_slots[slot_number];
+            bool slots_changed = !known || state.nodes[name].served_slots != node.served_slots;
+            update_node(name, state, node);
+            yield_slots_to_newer_node(state, state.nodes[name]);
+            if (slots_changed) {
+                update_served_slots_by_node(state, state.nodes[name]);
+            }
+        }
 
-            std::string served_by_name{ slot_data.served_by_name.data() };
+        //Only the ranges that changed since the last ping are sent, they have to continue where the last ping ended
+        PeerSlotRanges& peer = state.peer_slot_ranges[sender_name];
+        if (msg.base_version == 0) {
+            peer.clear();
+            peer.full_sync_requested = false;
+        }
+        bool in_sync = msg.base_version == 0 || msg.base_version == peer.version;
+
+        bool sent_by_myself = sender_name == std::string(state.myself.name.data());
+        for (const SlotRangeGossipData& range : msg.slots) {
+            if (in_sync) {
+                peer.assign(range);
+            }
+
+            std::string served_by_name{ range.served_by_name.data() };
+            observer_ptr<ClusterNode> served_by = nullptr;
             if (served_by_name.size() != 0 && state.nodes.contains(served_by_name)) {
-                state.slots[slot_number].served_by = &state.nodes[served_by_name];
+                served_by = &state.nodes[served_by_name];
             }
 
-            std::string migration_parner_name{ slot_data.migration_partner_name.data() };
+            std::string migration_parner_name{ range.migration_partner_name.data() };
+            observer_ptr<ClusterNode> migration_partner = nullptr;
             if (migration_parner_name.size() != 0 && state.nodes.contains(migration_parner_name)) {
-                state.slots[slot_number].migration_partner = &state.nodes[migration_parner_name];
+                migration_partner = &state.nodes[migration_parner_name];
             }
 
-            //Only the handling node can upate the slot info, because it knows best and the others don't care about this info
-            if (sender_name == std::string(state.myself.name.data())) {
-                state.slots[slot_number].amount_of_keys = slot_data.amount_of_keys;
-                state.slots[slot_number].state = slot_data.state;
+            //The range isn't sent again, so it has to be requested once the nodes are known
+            if ((served_by == nullptr && served_by_name.size() != 0) || (migration_partner == nullptr && migration_parner_name.size() != 0)) {
+                in_sync = false;
             }
+
+            size_t end = std::min<size_t>(range.last_slot + 1, state.slots.size());
+            for (size_t slot_number = range.first_slot; slot_number < end; slot_number++) {
+                //Every node knows best about it's own slots
+                if (state.myself.served_slots.test(slot_number)) {
+                    continue;
+                }
+
+                if (served_by != nullptr && !is_claimed_by_newer_node(state, slot_number, *served_by)
+                    && state.slots[slot_number].served_by != served_by) {
+                    state.slots[slot_number].served_by = served_by;
+                    state.slot_map_changed = true;
+                }
+                if (migration_partner != nullptr) {
+                    state.slots[slot_number].migration_partner = migration_partner;
+                }
+
+                //Only the handling node can upate the slot info, because it knows best and the others don't care about this info
+                if (sent_by_myself) {
+                    state.slots[slot_number].state = range.state;
+                }
+            }
+        }
+
+        if (msg.base_version == 0 || msg.base_version == peer.version) {
+            peer.version = msg.version;
         }
+        in_sync = in_sync && peer.digest() == msg.digest;
 
         state.size = state.nodes.size();
         state.part_of_cluster = true;
+
+        if (!in_sync) {
+            request_full_sync(state, sender_name);
+        }
+        return !in_sync;
+    }
+
+    uint64_t get_max_config_epoch(const ClusterState& state) {
+        uint64_t epoch = state.myself.config_epoch;
+        for (const auto& [name, node] : state.nodes) {
+            epoch = std::max(epoch, node.config_epoch);
+        }
+        return epoch;
+    }
+
+    void request_full_sync(ClusterState& state, const std::string& node_name) {
+        PeerSlotRanges& peer = state.peer_slot_ranges[node_name];
+        if (peer.full_sync_requested || !state.nodes.contains(node_name)) {
+            return;
+        }
+
+        //Requested again with the next ping if the link is down
+        peer.full_sync_requested = state.nodes[node_name].outgoing_link.send(
+            protocol::Command{ std::string(state.myself.name.data()) }, protocol::Instruction::c_CLUSTER_FULL_SYNC);
+    }
+
+    net::Task<> handle_ping(net::Connection& link, ClusterState& state, const protocol::CommandView& comand) {
+        ClusterGossipMsg msg = co_await read_ping(link, comand);
+        apply_ping(state, msg);
     }
 
 
     Status add_node(ClusterState& state, const std::string& name, const std::string& ip, uint16_t cluster_port, uint16_t client_port) {
-        net::Socket socket{};
         ClusterNode node{};
 
         if (state.nodes.contains(name)) {
             return Status::new_error("Node with name " + name + " already in cluster");
         }
 
-        try {
-            net::Connection link = socket.connect(ip, cluster_port);
-            node.outgoing_link = std::move(link);
-        }
-        catch (std::runtime_error& e) {
-            return Status::new_error("Could not connect to node: " + std::string(e.what()));
+        //Only a connect that fails right away is reported, otherwise it finishes in the background
+        node.outgoing_link = ClusterLink(ip, cluster_port);
+        if (node.outgoing_link.update() == LinkState::c_DISCONNECTED) {
+            return Status::new_error("Could not connect to node " + name);
         }
 
         node.cluster_port = cluster_port;
@@ -218,27 +653,24 @@ namespace node::cluster {
 
         state.nodes[std::string(node.name.begin())] = std::move(node);
         state.size = state.nodes.size();
+        state.slot_map_changed = true;
         return Status::new_ok();
     }
 
 
-    uint16_t get_key_hash(const std::string& key) {
-        // No hash tag
-        if (key.find('{') == std::string::npos || key.find('}') == std::string::npos) {
-            return std::hash<std::string>{}(key);
-        }
+    uint16_t get_key_slot(std::string_view key) {
+        return get_key_hash(key) % CLUSTER_AMOUNT_OF_SLOTS;
+    }
 
-        // Hash tag
-        auto start = key.find('{') + 1;
-        auto end = key.find('}', start);
-        if (start < end && end != std::string::npos) {
-            return std::hash<std::string>{}(key.substr(start, end - start));
+    void get_key_slots(std::span<const std::string_view> keys, std::span<uint16_t> slots) {
+        get_key_hashes(keys, slots);
+        for (size_t key = 0; key < keys.size(); key++) {
+            slots[key] %= CLUSTER_AMOUNT_OF_SLOTS;
         }
-        return std::hash<std::string>{}(key);
     }
 
-    bool check_key_slot_served_and_send_moved(const std::string& key, net::Connection& connection, cluster::ClusterState& state) {
-        uint16_t slot = get_key_hash(key) % CLUSTER_AMOUNT_OF_SLOTS;
+    bool check_key_slot_served_and_send_moved(std::string_view key, net::Connection& connection, cluster::ClusterState& state) {
+        uint16_t slot = get_key_slot(key);
         return check_slot_served_and_send_moved(slot, connection, state);
     }
 
@@ -247,8 +679,9 @@ namespace node::cluster {
             return true;
         }
 
-        if (slot < 0 || slot >= state.slots.size() || state.slots[slot].served_by == nullptr) {
-            protocol::send_instruction(connection, Status::new_error("Slot not served by any node"));
+        //Redirecting to a failed node would only make the client wait for a timeout
+        if (slot >= state.slots.size() || state.slots[slot].served_by == nullptr || state.slots[slot].served_by->failed) {
+            protocol::send_instruction(connection, get_slot_unavailable_status(slot, state));
         }
         else {
             ClusterNode& serving_node = *state.slots[slot].served_by;
@@ -260,4 +693,11 @@ namespace node::cluster {
         }
         return false;
     }
+
+    Status get_slot_unavailable_status(uint16_t slot, const cluster::ClusterState& state) {
+        if (slot >= state.slots.size() || state.slots[slot].served_by == nullptr) {
+            return Status::new_error("Slot not served by any node");
+        }
+        return Status::new_error("Slot " + std::to_string(slot) + " is served by failed node " + std::string(state.slots[slot].served_by->name.data()));
+    }
 }
\ No newline at end of file
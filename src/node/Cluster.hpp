@@ -1,30 +1,118 @@
 #pragma once
 
 #include <bitset>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 
 #include "../net/Connection.hpp"
+#include "../net/Task.hpp"
 #include "../utils/Status.hpp"
+#include "KeyHash.hpp"
 
 //This is required to avoid circular import
 namespace node::protocol {
     using Command = std::vector<std::string>;
+    class CommandView;
+    enum class Instruction : uint8_t;
 }
 
 
 template<typename T>
 using observer_ptr = T*;
 
+//Set by the CLUSTER_SLOTS cmake option, all nodes and clients of a cluster have to be built with the same value
+#ifndef KVS_CLUSTER_AMOUNT_OF_SLOTS
+#define KVS_CLUSTER_AMOUNT_OF_SLOTS 16384
+#endif
+
 namespace node::cluster {
 
-    constexpr uint16_t CLUSTER_AMOUNT_OF_SLOTS = 3;
+    constexpr uint16_t CLUSTER_MAX_AMOUNT_OF_SLOTS = 16384;
+    constexpr uint16_t CLUSTER_AMOUNT_OF_SLOTS = KVS_CLUSTER_AMOUNT_OF_SLOTS;
+    static_assert(CLUSTER_AMOUNT_OF_SLOTS > 0 && CLUSTER_AMOUNT_OF_SLOTS <= CLUSTER_MAX_AMOUNT_OF_SLOTS, "Invalid amount of slots");
     constexpr uint16_t CLUSTER_NAME_LEN = 40;
     constexpr uint16_t CLUSTER_IP_LEN = 15;
 
+    //Exponential backoff between the connect attempts of a cluster link
+    constexpr std::chrono::milliseconds CLUSTER_RECONNECT_MIN_BACKOFF{ 100 };
+    constexpr std::chrono::milliseconds CLUSTER_RECONNECT_MAX_BACKOFF{ 10000 };
+    constexpr net::OutputBufferLimits CLUSTER_LINK_OUTPUT_BUFFER_LIMITS{ 256 * 1024 * 1024, 64 * 1024 * 1024, std::chrono::seconds{ 60 } };
+
+    enum class LinkState : uint8_t {
+        c_DISCONNECTED = 0,
+        c_CONNECTING = 1,
+        c_CONNECTED = 2,
+        enum_size = 3
+    };
+
+    //Outgoing connection of the cluster bus, using it never blocks the loop for a connect or a slow peer
+    //The connect runs in the background, instructions sent meanwhile are queued and flushed once it is established
+    //After a failure the queued instructions are dropped and the next attempt waits for the backoff
+    //Copies share the connection and its state like copies of a net::Connection
+    class ClusterLink {
+    public:
+        ClusterLink() = default;
+        //Starts connecting with the first update()
+        ClusterLink(std::string ip, uint16_t port, net::OutputBufferLimits limits = CLUSTER_LINK_OUTPUT_BUFFER_LIMITS);
+        //Wraps an established connection, it isn't connected again once it failed
+        ClusterLink(net::Connection connection);
+
+        //Finishes or starts the connect when it is due and flushes the queued output
+        LinkState update(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+        //Sends or queues the instruction, returns false if the link is down and it was dropped
+        bool send(const protocol::Command& command, protocol::Instruction instruction, std::span<const char> payload = {});
+
+        //Only valid while the link isn't disconnected, a failed send has to be reported with fail()
+        net::Connection& get_connection();
+
+        //Closes the connection, the next attempt waits for the backoff
+        void fail(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+        LinkState get_state() const;
+
+        bool is_connected() const {
+            return get_state() == LinkState::c_CONNECTED;
+        }
+
+        //Neither connected nor going to connect again
+        bool is_closed() const;
+
+    private:
+        struct Shared {
+            std::string ip;
+            uint16_t port = 0;
+            net::OutputBufferLimits limits;
+            bool reconnect = true;
+            net::Connection connection;
+            LinkState state = LinkState::c_DISCONNECTED;
+            uint32_t failed_attempts = 0;
+            std::chrono::steady_clock::time_point next_attempt{};
+        };
+
+        std::shared_ptr<Shared> shared_;
+    };
+
     struct ClusterNodeGossipData;
     struct ClusterNode;
 
+    //Totals of the slots a node serves, measured by the node itself, see cluster::SlotLoad
+    struct NodeLoad {
+        uint64_t keys = 0;
+        uint64_t bytes = 0;
+        uint64_t ops_per_second = 0;
+        //Bytes of the values put and got per second
+        uint64_t bandwidth = 0;
+        //Time of the measurement in milliseconds since the epoch, an older load gossiped by others doesn't replace a newer one
+        uint64_t version = 0;
+    };
+
     struct ClusterNodeGossipData {
         std::array<char, CLUSTER_NAME_LEN> name;
         std::array<char, CLUSTER_IP_LEN> ip;
@@ -32,10 +120,17 @@ namespace node::cluster {
         uint16_t client_port;
         std::bitset<CLUSTER_AMOUNT_OF_SLOTS> served_slots;
         uint16_t num_slots_served;
+        //Raised by the node itself whenever the slots it serves change, older information about it is ignored
+        uint64_t config_epoch = 0;
+        NodeLoad load{};
+        //Name of the node this one replicates, empty for primaries
+        std::array<char, CLUSTER_NAME_LEN> primary{};
     };
 
     struct ClusterNode : public ClusterNodeGossipData {
-        net::Connection outgoing_link;
+        ClusterLink outgoing_link;
+        //Declared dead by the failure detection of this node, not gossiped
+        bool failed = false;
     };
 
     enum class SlotState : uint8_t {
@@ -52,39 +147,195 @@ namespace node::cluster {
         observer_ptr<ClusterNode> migration_partner = nullptr;
     };
 
-    struct SlotGossipData {
-        uint16_t slot_number;
-        uint64_t amount_of_keys;
+    //The slots as structure of arrays, so scanning one field like the serving node doesn't touch the others
+    class SlotTable {
+    public:
+        //Refers to the fields of a slot in the table, used like a Slot&
+        struct Ref {
+            observer_ptr<ClusterNode>& served_by;
+            uint64_t& amount_of_keys;
+            SlotState& state;
+            observer_ptr<ClusterNode>& migration_partner;
+
+            // NOLINTNEXTLINE
+            operator Slot() const {
+                return Slot{ served_by, amount_of_keys, state, migration_partner };
+            }
+        };
+
+        SlotTable() = default;
+
+        //Allows passing slots that were set up one by one
+        // NOLINTNEXTLINE
+        SlotTable(const std::vector<Slot>& slots);
+
+        // NOLINTNEXTLINE
+        operator std::vector<Slot>() const;
+
+        Ref operator[](size_t slot) {
+            return Ref{ served_by_[slot], amount_of_keys_[slot], state_[slot], migration_partner_[slot] };
+        }
+        Slot operator[](size_t slot) const {
+            return Slot{ served_by_[slot], amount_of_keys_[slot], state_[slot], migration_partner_[slot] };
+        }
+
+        size_t size() const {
+            return served_by_.size();
+        }
+        void resize(size_t size);
+
+        const std::vector<observer_ptr<ClusterNode>>& served_by() const {
+            return served_by_;
+        }
+        const std::vector<SlotState>& states() const {
+            return state_;
+        }
+        const std::vector<observer_ptr<ClusterNode>>& migration_partners() const {
+            return migration_partner_;
+        }
+
+    private:
+        std::vector<observer_ptr<ClusterNode>> served_by_;
+        std::vector<uint64_t> amount_of_keys_;
+        std::vector<SlotState> state_;
+        std::vector<observer_ptr<ClusterNode>> migration_partner_;
+    };
+
+    //Consecutive slots with the same serving node, state and migration partner
+    //Gossip sends these ranges instead of every slot, so the ping stays small with many slots
+    struct SlotRangeGossipData {
+        uint16_t first_slot;
+        uint16_t last_slot;
         SlotState state;
         std::array<char, CLUSTER_NAME_LEN> migration_partner_name;
         std::array<char, CLUSTER_NAME_LEN> served_by_name;
     };
 
+    //The slot ranges another node announced in its pings, only a hash of each range is kept
+    //Its digest has to match the one of the node, otherwise a ping was missed and the full ranges are requested
+    class PeerSlotRanges {
+    public:
+        void clear();
+
+        //Replaces the slots of the range
+        void assign(const SlotRangeGossipData& range);
+
+        uint64_t digest() const {
+            return digest_;
+        }
+
+        //Version of the last applied ping of the node
+        uint64_t version = 0;
+        //Set once the full ranges were requested, until they arrive
+        bool full_sync_requested = false;
+
+    private:
+        struct Range {
+            uint16_t last_slot;
+            uint64_t hash;
+        };
+
+        //By first slot
+        std::map<uint16_t, Range> ranges_;
+        uint64_t digest_ = 0;
+    };
+
     struct ClusterState {
         std::unordered_map<std::string, ClusterNode> nodes;
         uint16_t size;
-        std::vector<Slot> slots;
+        SlotTable slots;
         ClusterNode myself;
         bool part_of_cluster;
+        //By the name of the sending node
+        std::unordered_map<std::string, PeerSlotRanges> peer_slot_ranges;
+        //Set whenever the owner of a slot or a node of the slot map changed, cleared once the map was derived again
+        bool slot_map_changed = true;
     };
 
+    //Pings only carry the ranges that changed since the last ping on the same link
+    //base_version is the version of the sender the ranges are relative to, 0 if all ranges are sent
     struct ClusterGossipMsg {
         std::vector<ClusterNodeGossipData> nodes;
-        std::vector<SlotGossipData> slots;
+        std::vector<SlotRangeGossipData> slots;
         std::array<char, CLUSTER_NAME_LEN> sender;
+        uint64_t version = 0;
+        uint64_t base_version = 0;
+        //Digest of all slot ranges of the sender
+        uint64_t digest = 0;
     };
 
+    //Immutable copy of the cluster state for threads other than the data path, which is the only writer
+    //Nodes are referred to by name instead of pointers, so nothing dangles once the state changes
+    struct ClusterSnapshot {
+        uint64_t version;
+        ClusterNodeGossipData myself;
+        std::vector<ClusterNodeGossipData> nodes;
+        std::vector<SlotRangeGossipData> slots;
+        //Version in which each range got its current content
+        std::vector<uint64_t> slot_versions;
+        uint64_t slot_digest;
+        uint16_t size;
+        bool part_of_cluster;
+    };
+
+    //A link used for gossip and the version of the last ping sent on it
+    struct GossipLink {
+        ClusterLink link;
+        uint64_t sent_version = 0;
+    };
+
+    //Links by node name, owned by the thread that sends the pings
+    using GossipLinks = std::unordered_map<std::string, GossipLink>;
+
+    std::vector<SlotRangeGossipData> get_slot_ranges(const SlotTable& slots);
+
+    //Independent of how the slots are split into ranges, so it can be updated range by range
+    uint64_t get_slot_range_digest(const SlotRangeGossipData& range);
+    uint64_t get_slot_ranges_digest(const std::vector<SlotRangeGossipData>& ranges);
+
+    //Ranges that didn't change since the previous snapshot keep their version
+    std::shared_ptr<const ClusterSnapshot> make_snapshot(const ClusterState& state, uint64_t version,
+        const ClusterSnapshot* previous = nullptr);
+
+    //Myself, some random nodes and the slot ranges that changed after base_version in network order
+    ClusterGossipMsg build_ping(const ClusterSnapshot& snapshot, uint64_t base_version = 0);
+
+    void send_ping(net::Connection& link, const ClusterGossipMsg& msg);
     void send_ping(observer_ptr<net::Connection> link, ClusterState& state);
-    void send_ping(ClusterState& state);
+    //Pings random nodes without waiting for slow ones, their pings are queued within the limits
+    //Nodes whose link is down are skipped until it is connected again
+    void send_ping(const ClusterSnapshot& snapshot, GossipLinks& links, net::OutputBufferLimits link_limits);
+
+    //Creates the link to the node if there is none yet, it connects in the background
+    GossipLink& get_gossip_link(const ClusterNodeGossipData& node, GossipLinks& links, net::OutputBufferLimits link_limits);
 
-    void handle_ping(net::Connection& link, ClusterState& state, const protocol::Command& comand);
+    //Receiving and applying a ping are separate, so the cluster bus can receive it while the data path applies it
+    net::Task<ClusterGossipMsg> read_ping(net::Connection& link, const protocol::CommandView& comand);
+
+    //Returns true if the ranges of the sender are out of sync and have to be requested again
+    //A slot claimed by two nodes goes to the one with the higher config epoch, which is how a failover wins over the failed primary
+    bool apply_ping(ClusterState& state, const ClusterGossipMsg& msg);
+
+    //Highest config epoch of all known nodes, a node that takes over slots has to go above it
+    uint64_t get_max_config_epoch(const ClusterState& state);
+
+    //Asks the node to send all of its slot ranges with the next ping, unless that was already done
+    void request_full_sync(ClusterState& state, const std::string& node_name);
+
+    net::Task<> handle_ping(net::Connection& link, ClusterState& state, const protocol::CommandView& comand);
 
     Status add_node(ClusterState& state, const std::string& name, const std::string& ip, uint16_t cluster_port, uint16_t client_port);
 
-    bool check_key_slot_served_and_send_moved(const std::string& key, net::Connection& connection, cluster::ClusterState& state);
+    bool check_key_slot_served_and_send_moved(std::string_view key, net::Connection& connection, cluster::ClusterState& state);
 
     bool check_slot_served_and_send_moved(uint16_t slot, net::Connection& connection, cluster::ClusterState& state);
 
-    uint16_t get_key_hash(const std::string& key);
+    //Error for a slot that is served by no node a request could be sent to
+    Status get_slot_unavailable_status(uint16_t slot, const cluster::ClusterState& state);
+
+    uint16_t get_key_slot(std::string_view key);
+
+    //Slots of many keys at once, see get_key_hashes()
+    void get_key_slots(std::span<const std::string_view> keys, std::span<uint16_t> slots);
 
 }
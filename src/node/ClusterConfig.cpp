@@ -0,0 +1,205 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "ClusterConfig.hpp"
+#include "ProtocolHandler.hpp"
+
+namespace node::cluster {
+
+    namespace {
+        constexpr const char* no_name = "-";
+
+        template<size_t N>
+        std::string to_field(const std::array<char, N>& name) {
+            size_t size = strnlen(name.data(), name.size());
+            return size == 0 ? no_name : std::string(name.data(), size);
+        }
+
+        template<size_t N>
+        bool from_field(const std::string& field, std::array<char, N>& name) {
+            name.fill('\0');
+            if (field == no_name) {
+                return true;
+            }
+            if (field.size() > N) {
+                return false;
+            }
+            std::copy(field.begin(), field.end(), name.begin());
+            return true;
+        }
+
+        void write_node(std::string& config, const char* kind, const ClusterNodeGossipData& node) {
+            config += kind;
+            config += ' ' + to_field(node.name) + ' ' + to_field(node.ip) + ' ' + std::to_string(node.cluster_port) + ' '
+                + std::to_string(node.client_port) + ' ' + std::to_string(node.config_epoch) + ' ' + to_field(node.primary) + '\n';
+        }
+
+        bool read_node(std::istringstream& line, ClusterNodeGossipData& node) {
+            std::string name, ip, primary;
+            line >> name >> ip >> node.cluster_port >> node.client_port >> node.config_epoch >> primary;
+            return !line.fail() && name != no_name && from_field(name, node.name) && from_field(ip, node.ip) && from_field(primary, node.primary);
+        }
+
+        struct SlotRangeEntry {
+            uint16_t first_slot;
+            uint16_t last_slot;
+            SlotState state;
+            std::string served_by;
+            std::string migration_partner;
+        };
+
+        observer_ptr<ClusterNode> find_node(ClusterState& state, const std::string& name) {
+            if (name == state.myself.name.data()) {
+                return &state.myself;
+            }
+            auto node = state.nodes.find(name);
+            return node == state.nodes.end() ? nullptr : &node->second;
+        }
+    }
+
+    std::string serialize_cluster_config(const ClusterSnapshot& snapshot) {
+        std::string config;
+        write_node(config, "myself", snapshot.myself);
+        //Sorted, so the file is only written again if the content changed
+        std::vector<const ClusterNodeGossipData*> nodes;
+        for (const ClusterNodeGossipData& node : snapshot.nodes) {
+            //Others might have gossiped about myself
+            if (node.name != snapshot.myself.name) {
+                nodes.push_back(&node);
+            }
+        }
+        std::sort(nodes.begin(), nodes.end(), [](const ClusterNodeGossipData* lhs, const ClusterNodeGossipData* rhs) {
+            return lhs->name < rhs->name;
+        });
+        for (const ClusterNodeGossipData* node : nodes) {
+            write_node(config, "node", *node);
+        }
+        for (const SlotRangeGossipData& range : snapshot.slots) {
+            config += "slots " + std::to_string(range.first_slot) + ' ' + std::to_string(range.last_slot) + ' '
+                + std::to_string(protocol::to_integral(range.state)) + ' ' + to_field(range.served_by_name) + ' '
+                + to_field(range.migration_partner_name) + '\n';
+        }
+        return config;
+    }
+
+    Status save_cluster_config(const std::string& path, const std::string& config) {
+        std::string temporary_path = path + ".tmp";
+        int fd = ::open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return Status::new_error("Failed to open " + temporary_path + ": " + std::strerror(errno));
+        }
+        size_t written = 0;
+        while (written < config.size()) {
+            ssize_t result = ::write(fd, config.data() + written, config.size() - written);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result < 0) {
+                ::close(fd);
+                return Status::new_error("Failed to write " + temporary_path + ": " + std::strerror(errno));
+            }
+            written += static_cast<size_t>(result);
+        }
+        //The content has to be on disk before the rename makes it the config
+        if (::fsync(fd) < 0) {
+            ::close(fd);
+            return Status::new_error("Failed to sync " + temporary_path + ": " + std::strerror(errno));
+        }
+        ::close(fd);
+        if (::rename(temporary_path.c_str(), path.c_str()) < 0) {
+            return Status::new_error("Failed to replace " + path + ": " + std::strerror(errno));
+        }
+        return Status::new_ok();
+    }
+
+    Status load_cluster_config(const std::string& path, ClusterState& state) {
+        std::ifstream file(path);
+        if (!file) {
+            return errno == ENOENT ? Status::new_not_found("No cluster config at " + path)
+                : Status::new_error("Failed to open " + path + ": " + std::strerror(errno));
+        }
+
+        //Everything is checked before the state is changed
+        ClusterNodeGossipData myself{};
+        bool found_myself = false;
+        std::vector<ClusterNodeGossipData> nodes;
+        std::vector<SlotRangeEntry> ranges;
+        std::string text;
+        while (std::getline(file, text)) {
+            std::istringstream line(text);
+            std::string kind;
+            if (!(line >> kind)) {
+                continue;
+            }
+            if (kind == "myself" || kind == "node") {
+                ClusterNodeGossipData node{};
+                if (!read_node(line, node)) {
+                    return Status::new_error("Invalid node in cluster config: " + text);
+                }
+                if (kind == "node") {
+                    nodes.push_back(node);
+                    continue;
+                }
+                myself = node;
+                found_myself = true;
+            }
+            else if (kind == "slots") {
+                SlotRangeEntry range{};
+                int slot_state = 0;
+                line >> range.first_slot >> range.last_slot >> slot_state >> range.served_by >> range.migration_partner;
+                if (line.fail() || range.first_slot > range.last_slot || range.last_slot >= state.slots.size()
+                    || slot_state < 0 || slot_state >= protocol::to_integral(SlotState::enum_size)) {
+                    return Status::new_error("Invalid slot range in cluster config: " + text);
+                }
+                range.state = static_cast<SlotState>(slot_state);
+                ranges.push_back(std::move(range));
+            }
+            else {
+                return Status::new_error("Invalid entry in cluster config: " + text);
+            }
+        }
+        if (!found_myself || myself.name != state.myself.name) {
+            return Status::new_error("Cluster config at " + path + " belongs to another node");
+        }
+
+        state.myself.config_epoch = myself.config_epoch;
+        state.myself.primary = myself.primary;
+        for (const ClusterNodeGossipData& data : nodes) {
+            if (data.name == state.myself.name) {
+                continue;
+            }
+            ClusterNode node{};
+            static_cast<ClusterNodeGossipData&>(node) = data;
+            node.outgoing_link = ClusterLink(std::string(node.ip.data(), strnlen(node.ip.data(), node.ip.size())), node.cluster_port);
+            state.nodes[std::string(data.name.data(), strnlen(data.name.data(), data.name.size()))] = std::move(node);
+        }
+
+        //What each node serves follows from the slots, gossip replaces it with what the nodes announce
+        for (const SlotRangeEntry& range : ranges) {
+            observer_ptr<ClusterNode> served_by = find_node(state, range.served_by);
+            observer_ptr<ClusterNode> migration_partner = find_node(state, range.migration_partner);
+            for (size_t slot = range.first_slot; slot <= range.last_slot; slot++) {
+                state.slots[slot].served_by = served_by;
+                state.slots[slot].state = range.state;
+                state.slots[slot].migration_partner = migration_partner;
+                if (served_by != nullptr) {
+                    served_by->served_slots[slot] = true;
+                }
+            }
+        }
+        state.myself.num_slots_served = state.myself.served_slots.count();
+        for (auto& [name, node] : state.nodes) {
+            node.num_slots_served = node.served_slots.count();
+        }
+        state.size = state.nodes.size();
+        state.part_of_cluster = !state.nodes.empty() || state.myself.num_slots_served > 0;
+        return Status::new_ok();
+    }
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+#include "../utils/Status.hpp"
+#include "Cluster.hpp"
+
+namespace node::cluster {
+
+    //The part of the cluster state a restarted node needs to rejoin without being met again, one entry per line:
+    //  myself <name> <ip> <cluster port> <client port> <config epoch> <primary>
+    //  node <name> <ip> <cluster port> <client port> <config epoch> <primary>
+    //  slots <first slot> <last slot> <state> <served by> <migration partner>
+    //Missing names are written as '-', the keys, their counts and the load are left out
+    std::string serialize_cluster_config(const ClusterSnapshot& snapshot);
+
+    //Writes a temporary file next to the path and renames it over the old one once it is synced, so a crash leaves either of both
+    Status save_cluster_config(const std::string& path, const std::string& config);
+
+    //Returns a not found status if there is no file yet, which is the case for a node that never ran
+    //The file has to belong to myself, the nodes it lists get links that connect in the background
+    Status load_cluster_config(const std::string& path, ClusterState& state);
+
+}
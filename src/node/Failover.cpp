@@ -0,0 +1,137 @@
+#include <algorithm>
+
+#include "Failover.hpp"
+#include "ProtocolHandler.hpp"
+
+namespace node::cluster {
+
+    namespace {
+        //By the slots, a node might still claim slots that were taken over from it
+        bool serves_slots(const ClusterState& state, const ClusterNode& node) {
+            const std::vector<observer_ptr<ClusterNode>>& served_by = state.slots.served_by();
+            return std::find(served_by.begin(), served_by.end(), &node) != served_by.end();
+        }
+    }
+
+    Failover::Failover(FailoverConfig config) : config_(config) {
+    }
+
+    bool Failover::update(ClusterState& state, bool synced, FailoverClock::time_point now) {
+        std::string primary_name = state.myself.primary.data();
+        auto primary = state.nodes.find(primary_name);
+        if (primary_name.empty() || primary == state.nodes.end() || !primary->second.failed) {
+            reset();
+            return false;
+        }
+        ClusterNode& failed = primary->second;
+
+        if (!serves_slots(state, failed)) {
+            //Another replica won the election, this one replicates the winner instead
+            for (size_t slot = 0; slot < std::min<size_t>(CLUSTER_AMOUNT_OF_SLOTS, state.slots.size()); slot++) {
+                observer_ptr<ClusterNode> owner = state.slots[slot].served_by;
+                if (failed.served_slots.test(slot) && owner != nullptr && owner != &state.myself) {
+                    state.myself.primary = owner->name;
+                    state.slot_map_changed = true;
+                    reset();
+                    break;
+                }
+            }
+            return false;
+        }
+        if (!synced) {
+            return false;
+        }
+
+        if (primary_ != primary_name) {
+            reset();
+            primary_ = primary_name;
+            next_election_ = get_next_election(now, config_.delay);
+            return false;
+        }
+        if (election_epoch_ != 0 && votes_.size() >= needed_votes_) {
+            take_over(state, failed);
+            reset();
+            return true;
+        }
+        if (now >= next_election_) {
+            start_election(state, failed, now);
+        }
+        return false;
+    }
+
+    bool Failover::handle_vote_request(const std::string& candidate, uint64_t epoch, const std::string& primary, ClusterState& state) {
+        //Only primaries vote, each one once per epoch
+        if (state.myself.num_slots_served == 0 || epoch <= last_vote_epoch_) {
+            return false;
+        }
+        auto requester = state.nodes.find(candidate);
+        auto failed = state.nodes.find(primary);
+        if (requester == state.nodes.end() || failed == state.nodes.end()) {
+            return false;
+        }
+        if (!failed->second.failed || epoch <= failed->second.config_epoch || std::string(requester->second.primary.data()) != primary
+            || !serves_slots(state, failed->second)) {
+            return false;
+        }
+
+        last_vote_epoch_ = epoch;
+        requester->second.outgoing_link.send(protocol::Command{ std::string(state.myself.name.data()), std::to_string(epoch) },
+            protocol::Instruction::c_CLUSTER_FAILOVER_VOTE);
+        return true;
+    }
+
+    void Failover::handle_vote(const std::string& voter, uint64_t epoch) {
+        if (!primary_.empty() && epoch == election_epoch_) {
+            votes_.insert(voter);
+        }
+    }
+
+    void Failover::reset() {
+        primary_.clear();
+        election_epoch_ = 0;
+        needed_votes_ = 0;
+        votes_.clear();
+    }
+
+    void Failover::start_election(ClusterState& state, const ClusterNode& primary, FailoverClock::time_point now) {
+        election_epoch_ = std::max(get_max_config_epoch(state), election_epoch_) + 1;
+        votes_.clear();
+
+        std::string myself = state.myself.name.data();
+        size_t primaries = 0;
+        for (auto& [name, node] : state.nodes) {
+            if (node.num_slots_served == 0 || name == myself) {
+                continue;
+            }
+            primaries++;
+            if (!node.failed) {
+                node.outgoing_link.send(protocol::Command{ myself, std::to_string(election_epoch_), std::string(primary.name.data()) },
+                    protocol::Instruction::c_CLUSTER_FAILOVER_VOTE_REQUEST);
+            }
+        }
+        needed_votes_ = primaries / 2 + 1;
+        next_election_ = get_next_election(now, config_.election_timeout);
+    }
+
+    void Failover::take_over(ClusterState& state, ClusterNode& primary) {
+        for (size_t slot = 0; slot < std::min<size_t>(CLUSTER_AMOUNT_OF_SLOTS, state.slots.size()); slot++) {
+            //Slots the primary gave away before it failed might not be known here yet
+            if (state.slots[slot].served_by == &primary && primary.served_slots.test(slot)) {
+                state.slots[slot].served_by = &state.myself;
+                state.slots[slot].state = SlotState::c_NORMAL;
+                state.slots[slot].migration_partner = nullptr;
+                state.myself.served_slots[slot] = true;
+            }
+        }
+        state.myself.num_slots_served = state.myself.served_slots.count();
+        state.myself.primary.fill('\0');
+        state.myself.config_epoch = election_epoch_;
+        state.slot_map_changed = true;
+    }
+
+    FailoverClock::time_point Failover::get_next_election(FailoverClock::time_point now, std::chrono::milliseconds wait) {
+        std::uniform_int_distribution<int64_t> jitter(0, config_.delay.count());
+        return now + wait + std::chrono::milliseconds{ jitter(random_engine_) };
+    }
+
+}
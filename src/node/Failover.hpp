@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <unordered_set>
+
+#include "Cluster.hpp"
+
+namespace node::cluster {
+
+    using FailoverClock = std::chrono::steady_clock;
+
+    struct FailoverConfig {
+        //Time the primary has to be failed before its replicas start an election, up to as much again is added at random
+        //so the replicas of the same primary rarely ask for votes in the same epoch
+        std::chrono::milliseconds delay;
+        //Without a majority in that time a new election with a higher epoch is started
+        std::chrono::milliseconds election_timeout;
+    };
+
+    constexpr FailoverConfig CLUSTER_FAILOVER_CONFIG{ std::chrono::milliseconds{ 1000 }, std::chrono::milliseconds{ 2000 } };
+
+    //Replaces a primary serving slots that the failure detection declared dead by one of its replicas
+    //The replica asks the other primaries for their vote with an epoch above every config epoch it knows of
+    //A primary votes once per epoch, only for a replica of a primary it considers failed as well
+    //With the votes of a majority of the primaries, the failed one included, the replica takes over its slots with that epoch
+    //The slots go to the higher config epoch on every node, so the takeover wins over what is still gossiped about the failed primary
+    class Failover {
+    public:
+        explicit Failover(FailoverConfig config = CLUSTER_FAILOVER_CONFIG);
+
+        //Replica side, starts an election once the primary failed for long enough and took over its slots once it won
+        //Only a replica that finished a full sync of its primary is a candidate, the others follow the winner
+        //Returns true once this node took over
+        bool update(ClusterState& state, bool synced, FailoverClock::time_point now = FailoverClock::now());
+
+        //Primary side, answers with the vote, returns whether it was granted
+        bool handle_vote_request(const std::string& candidate, uint64_t epoch, const std::string& primary, ClusterState& state);
+
+        //Replica side, votes for an older election are ignored
+        void handle_vote(const std::string& voter, uint64_t epoch);
+
+        void set_config(FailoverConfig config) {
+            config_ = config;
+        }
+
+    private:
+        void reset();
+
+        void start_election(ClusterState& state, const ClusterNode& primary, FailoverClock::time_point now);
+
+        void take_over(ClusterState& state, ClusterNode& primary);
+
+        FailoverClock::time_point get_next_election(FailoverClock::time_point now, std::chrono::milliseconds wait);
+
+        FailoverConfig config_;
+        //The failed primary the election is for, empty while the primary is fine
+        std::string primary_;
+        FailoverClock::time_point next_election_{};
+        //0 until the first election was started
+        uint64_t election_epoch_ = 0;
+        size_t needed_votes_ = 0;
+        std::unordered_set<std::string> votes_;
+        uint64_t last_vote_epoch_ = 0;
+        std::mt19937 random_engine_{ std::random_device{}() };
+    };
+
+}
@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <cstring>
 
 #include "InstructionHandler.hpp"
+#include "../net/Socket.hpp"
 #include "Cluster.hpp"
+#include "Migration.hpp"
 
 using PutFields = node::protocol::CommandFieldsPut;
 using GetFields = node::protocol::CommandFieldsGet;
@@ -10,11 +13,15 @@ using MeetFields = node::protocol::CommandFieldsMeet;
 using MigrateFields = node::protocol::CommandFieldsMigrate;
 using ImportFields = node::protocol::CommandFieldsImport;
 using MigrationFinishedFields = node::protocol::CommandFieldsMigrationFinished;
+using SharedMemoryFields = node::protocol::CommandFieldsSharedMemory;
+using ReplicateFields = node::protocol::CommandFieldsReplicate;
+using MultiKeyFields = node::protocol::CommandFieldsMultiKey;
+using GetSlotMapFields = node::protocol::CommandFieldsGetSlotMap;
 using Instruction = node::protocol::Instruction;
 
 namespace node::instruction_handler {
 
-    Status check_argc(const protocol::Command& command, protocol::Instruction instruction) {
+    Status check_argc(const protocol::CommandView& command, protocol::Instruction instruction) {
         switch (instruction) {
         case Instruction::c_PUT:
             if (command.size() != to_integral(PutFields::enum_size)) {
@@ -56,80 +63,180 @@ namespace node::instruction_handler {
                 return Status::new_invalid_argument("Wrong number of arguments for GET_SLOTS");
             }
             break;
+        case Instruction::c_GET_SLOT_MAP:
+            if (command.size() != to_integral(GetSlotMapFields::enum_size)) {
+                return Status::new_invalid_argument("Wrong number of arguments for GET_SLOT_MAP");
+            }
+            break;
+        case Instruction::c_GET_LOAD:
+            if (command.size() != 0) {
+                return Status::new_invalid_argument("Wrong number of arguments for GET_LOAD");
+            }
+            break;
+        case Instruction::c_GET_SLOT_STATS:
+            if (command.size() != 0) {
+                return Status::new_invalid_argument("Wrong number of arguments for GET_SLOT_STATS");
+            }
+            break;
+        case Instruction::c_REPLICATE:
+            if (command.size() != to_integral(ReplicateFields::enum_size)) {
+                return Status::new_invalid_argument("Wrong number of arguments for REPLICATE");
+            }
+            break;
+        case Instruction::c_READ_ONLY:
+            if (command.size() != 0) {
+                return Status::new_invalid_argument("Wrong number of arguments for READ_ONLY");
+            }
+            break;
+        case Instruction::c_GET_REPLICATION_INFO:
+            if (command.size() != 0) {
+                return Status::new_invalid_argument("Wrong number of arguments for GET_REPLICATION_INFO");
+            }
+            break;
+        case Instruction::c_PROXY:
+            if (command.size() != 0) {
+                return Status::new_invalid_argument("Wrong number of arguments for PROXY");
+            }
+            break;
+        case Instruction::c_SUBSCRIBE_SLOTS:
+            if (command.size() != 0) {
+                return Status::new_invalid_argument("Wrong number of arguments for SUBSCRIBE_SLOTS");
+            }
+            break;
+        case Instruction::c_MGET:
+            if (command.size() != to_integral(MultiKeyFields::enum_size)) {
+                return Status::new_invalid_argument("Wrong number of arguments for MGET");
+            }
+            break;
+        case Instruction::c_MSET:
+            if (command.size() != to_integral(MultiKeyFields::enum_size)) {
+                return Status::new_invalid_argument("Wrong number of arguments for MSET");
+            }
+            break;
+        case Instruction::c_SHARED_MEMORY:
+            if (command.size() != to_integral(SharedMemoryFields::enum_size)) {
+                return Status::new_invalid_argument("Wrong number of arguments for SHARED_MEMORY");
+            }
+            break;
         default:
             return Status::new_invalid_argument("Unknown instruction");
         }
         return Status::new_ok();
     }
 
-    void send_ask_response(net::Connection& connection, uint16_t slot, cluster::ClusterState& cluster_state) {
+    net::WriteAll send_ask_response(net::Connection& connection, uint16_t slot, cluster::ClusterState& cluster_state) {
         cluster::ClusterNode& migration_partner = *cluster_state.slots[slot].migration_partner;
         protocol::Command ask_command{std::string(migration_partner.ip.data()), std::to_string(migration_partner.client_port)};
-        protocol::send_instruction(connection, ask_command, Instruction::c_ASK);
+        return protocol::write_instruction(connection, ask_command, Instruction::c_ASK);
     }
 
-    void handle_put(net::Connection& connection, const protocol::MetaData& meta_data,
-        const protocol::Command& command, key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state) {
+    net::Task<uint64_t> handle_put(net::Connection& connection, const protocol::MetaData& meta_data,
+        const protocol::CommandView& command, key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state) {
         Status argc_state = check_argc(command, Instruction::c_PUT);
         if (!argc_state.is_ok()) {
-            protocol::send_instruction(connection, {}, Instruction::c_ERROR_RESPONSE, argc_state.get_msg());
-            return;
+            co_await protocol::write_instruction(connection, {}, Instruction::c_ERROR_RESPONSE, argc_state.get_msg());
+            co_return 0;
         }
 
-        uint64_t cur_payload_size = std::stoull(command[to_integral(PutFields::c_CUR_PAYLOAD_SIZE)]);
-        uint64_t offset = std::stoull(command[to_integral(PutFields::c_OFFSET)]);
+        uint64_t cur_payload_size = protocol::field_to_uint64(command[to_integral(PutFields::c_CUR_PAYLOAD_SIZE)]);
+        uint64_t offset = protocol::field_to_uint64(command[to_integral(PutFields::c_OFFSET)]);
         uint64_t total_payload_size = std::max(meta_data.payload_size, offset + cur_payload_size);
-        const std::string& key = command[to_integral(PutFields::c_KEY)];
-        uint16_t slot = cluster::get_key_hash(key) % cluster::CLUSTER_AMOUNT_OF_SLOTS;
+        std::string_view key = command[to_integral(PutFields::c_KEY)];
+        uint16_t slot = cluster::get_key_slot(key);
 
         if (!cluster::check_key_slot_served_and_send_moved(key, connection, cluster_state)) {
-            return;
+            //The payload needs to be received to clear the connection buffer
+            co_await protocol::skip_payload(connection, cur_payload_size);
+            co_return 0;
         }
 
-        //key doesn't exist and slot is not migrating
-        if (!kvs.contains_key(key) && cluster_state.slots[slot].state != cluster::SlotState::c_MIGRATING) {
-            ByteArray payload = ByteArray::new_allocated_byte_array(total_payload_size);
-            protocol::get_payload(connection, payload.data(), cur_payload_size);
+        //key doesn't exist and slot is migrating, existing keys are still updated here and sent again by the migration
+        if (!kvs.contains_key(key) && cluster_state.slots[slot].state == cluster::SlotState::c_MIGRATING) {
+            co_await send_ask_response(connection, slot, cluster_state);
+            //The payload needs to be received to clear the connection buffer
+            co_await protocol::skip_payload(connection, cur_payload_size);
+            co_return 0;
+        }
 
-            Status state = kvs.put(key, payload);
-            protocol::send_instruction(connection, state);
-            cluster_state.slots[slot].amount_of_keys += 1;
-            return;
+        //Received on its own, the slot and the key might change while the connection waits for the payload
+        ByteArray chunk = ByteArray::new_allocated_byte_array(cur_payload_size);
+        co_await protocol::read_payload(connection, chunk.data(), cur_payload_size);
+
+        //Handed over meanwhile
+        if (!cluster::check_key_slot_served_and_send_moved(key, connection, cluster_state)) {
+            co_return 0;
         }
-        //key doesn't exist and slot is migrating
-        else if (cluster_state.slots[slot].state == cluster::SlotState::c_MIGRATING) {
-            send_ask_response(connection, slot, cluster_state);
-            //The payload needs to be received to clear the connection buffer
-            protocol::get_payload(connection, cur_payload_size);
-            return;
+        ByteArray value{};
+        bool created = !kvs.get(key, value).is_ok();
+        //Erased meanwhile or the slot started migrating, the importing node stores new keys
+        if (created && cluster_state.slots[slot].state == cluster::SlotState::c_MIGRATING) {
+            co_await send_ask_response(connection, slot, cluster_state);
+            co_return 0;
         }
 
-        //Update stored value
-        ByteArray existing{};
-        Status state = kvs.get(key, existing);
-        existing.resize(total_payload_size);
-        //Store the new payload in the existing payload
-        protocol::get_payload(connection, existing.data() + offset, cur_payload_size);
+        //Merged into the value as it is now, so a write of another connection in the meantime isn't lost
+        if (created && offset == 0 && cur_payload_size == total_payload_size) {
+            value = std::move(chunk);
+        }
+        else {
+            value.resize(total_payload_size);
+            std::memcpy(value.data() + offset, chunk.data(), cur_payload_size);
+        }
+        Status state = kvs.put(key, value);
+        if (created && state.is_ok()) {
+            cluster_state.slots[slot].amount_of_keys += 1;
+        }
 
-        protocol::send_instruction(connection, state);
+        co_await protocol::write_instruction(connection, state);
+        co_return cur_payload_size;
     }
 
-    void handle_get(net::Connection& connection, const protocol::Command& command,
-        key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state) {
+    bool is_served_by_primary(uint16_t slot, const cluster::ClusterState& cluster_state) {
+        observer_ptr<cluster::ClusterNode> served_by = cluster_state.slots[slot].served_by;
+        return cluster_state.myself.primary[0] != '\0' && served_by != nullptr && !served_by->failed
+            && std::string_view(served_by->name.data()) == cluster_state.myself.primary.data();
+    }
+
+    //A size of 0 asks for everything from the offset on, returns the amount of bytes sent
+    net::Task<uint64_t> send_value_range(net::Connection& connection, const ByteArray& value, uint64_t size, uint64_t offset) {
+        if (offset > value.size()) {
+            co_await protocol::write_instruction(connection, Status::new_invalid_argument("Offset is beyond the end of the value"));
+            co_return 0;
+        }
+        uint64_t available = value.size() - offset;
+        uint64_t sent = size == 0 ? available : std::min(size, available);
+        protocol::Command response_command{ std::to_string(sent), std::to_string(offset) };
+        co_await protocol::write_instruction(connection, response_command, Instruction::c_GET_RESPONSE, value.data() + offset, sent);
+        co_return sent;
+    }
+
+    net::Task<uint64_t> handle_get(net::Connection& connection, const protocol::CommandView& command,
+        key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state, bool read_only) {
         Status argc_state = check_argc(command, Instruction::c_GET);
         if (!argc_state.is_ok()) {
-            protocol::send_instruction(connection, argc_state);
-            return;
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return 0;
         }
 
-        const std::string& key = command[to_integral(GetFields::c_KEY)];
-        uint64_t current_size = std::stoull(command[to_integral(GetFields::c_SIZE)]);
-        uint64_t current_offset = std::stoull(command[to_integral(GetFields::c_OFFSET)]);
+        std::string_view key = command[to_integral(GetFields::c_KEY)];
+        uint64_t current_size = protocol::field_to_uint64(command[to_integral(GetFields::c_SIZE)]);
+        uint64_t current_offset = protocol::field_to_uint64(command[to_integral(GetFields::c_OFFSET)]);
         bool asking = command[to_integral(GetFields::c_ASKING)] == "true";
-        uint16_t slot = cluster::get_key_hash(key) % cluster::CLUSTER_AMOUNT_OF_SLOTS;
+        uint16_t slot = cluster::get_key_slot(key);
+
+        //The copy of the replica is all there is, the primary handles migrations
+        if (read_only && is_served_by_primary(slot, cluster_state)) {
+            ByteArray value{};
+            Status state = kvs.get(key, value);
+            if (!state.is_ok()) {
+                co_await protocol::write_instruction(connection, state);
+                co_return 0;
+            }
+            co_return co_await send_value_range(connection, value, current_size, current_offset);
+        }
 
         if (!cluster::check_slot_served_and_send_moved(slot, connection, cluster_state)) {
-            return;
+            co_return 0;
         }
 
         //Check if client has been redirected by asking command if slot is importing
@@ -139,7 +246,7 @@ namespace node::instruction_handler {
                 connection,
                 protocol::Command{ std::string(migration_partner->ip.data()), std::to_string(migration_partner->client_port)},
                 Instruction::c_NO_ASKING_ERROR);
-            return;
+            co_return 0;
         }
 
         ByteArray value{};
@@ -147,38 +254,31 @@ namespace node::instruction_handler {
 
         //Value not found and slot not migrating -> error
         if (state.is_not_found() && cluster_state.slots[slot].state != cluster::SlotState::c_MIGRATING) {
-            protocol::send_instruction(connection, state);
-            return;
+            co_await protocol::write_instruction(connection, state);
+            co_return 0;
         }
         //Migration in process, get value from other node
         else if (state.is_not_found() && cluster_state.slots[slot].state == cluster::SlotState::c_MIGRATING) {
-            send_ask_response(connection, slot, cluster_state);
-            return;
+            co_await send_ask_response(connection, slot, cluster_state);
+            co_return 0;
         }
 
-        //When size is set to 0, the whole value is sent
-        if (current_size == 0) {
-            current_size = value.size();
-        }
-        //Send retrieved value
-        protocol::Command response_command{std::to_string(current_size), std::to_string(current_offset)};
-        protocol::send_instruction(connection, response_command,
-            Instruction::c_GET_RESPONSE, value.data() + current_offset, value.size());
+        co_return co_await send_value_range(connection, value, current_size, current_offset);
     }
 
-    void handle_erase(net::Connection& connection, const protocol::Command& command,
+    net::Task<> handle_erase(net::Connection& connection, const protocol::CommandView& command,
         key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state) {
   
         Status argc_state = check_argc(command, Instruction::c_ERASE);
         if (!argc_state.is_ok()) {
-            protocol::send_instruction(connection, argc_state);
-            return;
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return;
         }
 
-        const std::string& key = command[to_integral(EraseFields::c_KEY)];
-        uint16_t slot = cluster::get_key_hash(key) % cluster::CLUSTER_AMOUNT_OF_SLOTS;
+        std::string_view key = command[to_integral(EraseFields::c_KEY)];
+        uint16_t slot = cluster::get_key_slot(key);
         if (!cluster::check_key_slot_served_and_send_moved(key, connection, cluster_state)) {
-            return;
+            co_return;
         }
 
         Status state = kvs.erase(key);
@@ -186,144 +286,346 @@ namespace node::instruction_handler {
 
         //Slot migrating and key not found -> respond with ask if not already asked, otherwise loop
         if (!asking && state.is_not_found() && cluster_state.slots[slot].state == cluster::SlotState::c_MIGRATING) {
-            send_ask_response(connection, slot, cluster_state);
-            return;
+            co_await send_ask_response(connection, slot, cluster_state);
+            co_return;
         }
 
         //Update slot state
         if (state.is_ok()) {
             cluster_state.slots[slot].amount_of_keys -= 1;
 
-            if (cluster_state.slots[slot].amount_of_keys == 0 && cluster_state.slots[slot].state == cluster::SlotState::c_MIGRATING) {
-                cluster::ClusterNode migration_partner = *cluster_state.slots[slot].migration_partner;
-
-                cluster_state.slots[slot].served_by = cluster_state.slots[slot].migration_partner;
-                cluster_state.slots[slot].state = cluster::SlotState::c_NORMAL;
-                cluster_state.slots[slot].migration_partner = nullptr;
-                cluster_state.myself.served_slots[slot] = false;
-                cluster_state.myself.num_slots_served = cluster_state.myself.served_slots.count();
-
-                protocol::send_instruction(migration_partner.outgoing_link, protocol::Command{std::to_string(slot)}, Instruction::c_CLUSTER_MIGRATION_FINISHED);
+            if (kvs.get_slot_size(slot) == 0 && cluster_state.slots[slot].state == cluster::SlotState::c_MIGRATING) {
+                cluster::finish_slot_migration(cluster_state, slot);
             }
         }
 
-        protocol::send_instruction(connection, state);
+        co_await protocol::write_instruction(connection, state);
     }
 
-    void handle_meet(net::Connection& connection, const protocol::Command& command, cluster::ClusterState& cluster_state) {
+    net::Task<> handle_meet(net::Connection& connection, const protocol::CommandView& command, cluster::ClusterState& cluster_state) {
         Status argc_state = check_argc(command, Instruction::c_MEET);
         if (!argc_state.is_ok()) {
-            protocol::send_instruction(connection, argc_state);
-            return;
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return;
         }
 
-        const std::string& ip = command[to_integral(MeetFields::c_IP)];
-        uint16_t port = std::stoul(command[to_integral(MeetFields::c_CLIENT_PORT)]);
-        uint16_t cluster_port = std::stoul(command[to_integral(MeetFields::c_CLUSTER_PORT)]);
-        const std::string& name = command[to_integral(MeetFields::c_NAME)];
+        std::string_view ip = command[to_integral(MeetFields::c_IP)];
+        uint16_t port = protocol::field_to_uint64(command[to_integral(MeetFields::c_CLIENT_PORT)]);
+        uint16_t cluster_port = protocol::field_to_uint64(command[to_integral(MeetFields::c_CLUSTER_PORT)]);
+        std::string_view name = command[to_integral(MeetFields::c_NAME)];
 
-        Status state = cluster::add_node(cluster_state, name, ip, cluster_port, port);
-        protocol::send_instruction(connection, state);
+        Status state = cluster::add_node(cluster_state, std::string(name), std::string(ip), cluster_port, port);
+        co_await protocol::write_instruction(connection, state);
     }
 
-    std::optional<cluster::ClusterNode*> get_partner_node_handle_errors(uint16_t slot, const std::string& ip, uint16_t port,
+    net::Task<std::optional<cluster::ClusterNode*>> get_partner_node_handle_errors(uint16_t slot, std::string_view ip, uint16_t port,
         net::Connection& connection, cluster::ClusterState& cluster_state) {
         //Already in process of migrating
         if (cluster_state.slots[slot].state != cluster::SlotState::c_NORMAL) {
-            protocol::send_instruction(connection, Status::new_not_supported("Slot already in process of migrating"));
-            return std::nullopt;
+            co_await protocol::write_instruction(connection, Status::new_not_supported("Slot already in process of migrating"));
+            co_return std::nullopt;
         }
 
         auto partner = std::find_if(cluster_state.nodes.begin(), cluster_state.nodes.end(),
             [&ip, &port](const auto& iterator) {
                 const cluster::ClusterNode& node = iterator.second;
-                return std::string(node.ip.data()) == ip && node.client_port == port;
+                return std::string_view(node.ip.data()) == ip && node.client_port == port;
             });
 
         //Node not in cluster
         if (partner == cluster_state.nodes.end()) {
-            protocol::send_instruction(connection, Status::new_error("Other node not part of the cluster"));
-            return std::nullopt;
+            co_await protocol::write_instruction(connection, Status::new_error("Other node not part of the cluster"));
+            co_return std::nullopt;
         }
 
-        return &(partner->second);
+        co_return &(partner->second);
     }
 
-    void handle_migrate_slot(net::Connection& connection, const protocol::Command& command, cluster::ClusterState& cluster_state) {
+    net::Task<> handle_migrate_slot(net::Connection& connection, const protocol::CommandView& command,
+        key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state) {
         Status argc_state = check_argc(command, Instruction::c_MIGRATE_SLOT);
         if (!argc_state.is_ok()) {
-            protocol::send_instruction(connection, argc_state);
-            return;
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return;
         }
 
-        uint16_t slot = std::stoul(command[to_integral(MigrateFields::c_SLOT)]);
-        const std::string& ip = command[to_integral(MigrateFields::c_OTHER_IP)];
-        uint16_t port = std::stoul(command[to_integral(MigrateFields::c_OTHER_CLIENT_PORT)]);
+        uint64_t slot_number = protocol::field_to_uint64(command[to_integral(MigrateFields::c_SLOT)]);
+        if (slot_number >= cluster::CLUSTER_AMOUNT_OF_SLOTS) {
+            co_await protocol::write_instruction(connection, Status::new_invalid_argument("Invalid slot"));
+            co_return;
+        }
+        uint16_t slot = static_cast<uint16_t>(slot_number);
+        std::string_view ip = command[to_integral(MigrateFields::c_OTHER_IP)];
+        uint16_t port = protocol::field_to_uint64(command[to_integral(MigrateFields::c_OTHER_CLIENT_PORT)]);
 
         //Not handled by this node
         if (!cluster::check_slot_served_and_send_moved(slot, connection, cluster_state)) {
-            return;
+            co_return;
         }
 
-        auto partner = get_partner_node_handle_errors(slot, ip, port, connection, cluster_state);
-        //Error occurred or no keys to migrate
+        auto partner = co_await get_partner_node_handle_errors(slot, ip, port, connection, cluster_state);
+        //Error occurred
         if (!partner.has_value()) {
-            return;
+            co_return;
         }
 
-        if (cluster_state.slots[slot].amount_of_keys != 0) {
-            cluster_state.slots[slot].migration_partner = partner.value();
+        cluster_state.slots[slot].migration_partner = partner.value();
+        if (kvs.get_slot_size(slot) == 0) {
+            //Nothing to stream, the partner gets the slot right away, whether it imports it already or not
+            cluster::finish_slot_migration(cluster_state, slot);
+        }
+        else {
             cluster_state.slots[slot].state = cluster::SlotState::c_MIGRATING;
+            //The keys are streamed once the partner imports the slot
+            cluster::request_migration_start(cluster_state, slot);
         }
 
-        protocol::send_instruction(connection, Status::new_ok());
+        co_await protocol::write_instruction(connection, Status::new_ok());
     }
 
-    void handle_import_slot(net::Connection& connection, const protocol::Command& command, cluster::ClusterState& cluster_state) {
+    net::Task<> handle_import_slot(net::Connection& connection, const protocol::CommandView& command, cluster::ClusterState& cluster_state) {
         Status argc_state = check_argc(command, Instruction::c_IMPORT_SLOT);
         if (!argc_state.is_ok()) {
-            protocol::send_instruction(connection, argc_state);
-            return;
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return;
         }
 
-        uint16_t slot = std::stoul(command[to_integral(ImportFields::c_SLOT)]);
-        const std::string& ip = command[to_integral(ImportFields::c_OTHER_IP)];
-        uint16_t port = std::stoul(command[to_integral(ImportFields::c_OTHER_CLIENT_PORT)]);
+        uint64_t slot_number = protocol::field_to_uint64(command[to_integral(ImportFields::c_SLOT)]);
+        if (slot_number >= cluster::CLUSTER_AMOUNT_OF_SLOTS) {
+            co_await protocol::write_instruction(connection, Status::new_invalid_argument("Invalid slot"));
+            co_return;
+        }
+        uint16_t slot = static_cast<uint16_t>(slot_number);
+        std::string_view ip = command[to_integral(ImportFields::c_OTHER_IP)];
+        uint16_t port = protocol::field_to_uint64(command[to_integral(ImportFields::c_OTHER_CLIENT_PORT)]);
+
+        if (cluster_state.myself.primary[0] != '\0') {
+            co_await protocol::write_instruction(connection, Status::new_not_supported("Replicas can't serve slots"));
+            co_return;
+        }
 
-        auto partner = get_partner_node_handle_errors(slot, ip, port, connection, cluster_state);
+        //Handed over already by a migrating node that had no keys to stream
+        if (cluster_state.slots[slot].served_by == &cluster_state.myself && cluster_state.slots[slot].state == cluster::SlotState::c_NORMAL) {
+            co_await protocol::write_instruction(connection, Status::new_ok());
+            co_return;
+        }
+
+        auto partner = co_await get_partner_node_handle_errors(slot, ip, port, connection, cluster_state);
         //Error occurred
         if (!partner.has_value()) {
-            return;
+            co_return;
         }
 
         cluster_state.slots[slot].migration_partner = partner.value();
         cluster_state.slots[slot].state = cluster::SlotState::c_IMPORTING;
         cluster_state.myself.served_slots[slot] = true;
         cluster_state.myself.num_slots_served = cluster_state.myself.served_slots.count();
-        protocol::send_instruction(connection, Status::new_ok());
+        //Lets the partner start streaming the keys if it migrates the slot already
+        cluster::send_migration_ack(cluster_state, *partner.value(), slot, 0);
+        co_await protocol::write_instruction(connection, Status::new_ok());
     }
 
-    void handle_migration_finished(const protocol::Command& command, cluster::ClusterState& cluster_state) {
+    void handle_migration_finished(const protocol::CommandView& command, cluster::ClusterState& cluster_state) {
         Status argc_state = check_argc(command, Instruction::c_CLUSTER_MIGRATION_FINISHED);
         if (!argc_state.is_ok()) {
             return;
         }
 
-        uint16_t slot = std::stoul(command[to_integral(MigrationFinishedFields::c_SLOT)]);
+        //Sent by another node, which isn't trusted any more than a client
+        uint64_t slot_number = protocol::field_to_uint64(command[to_integral(MigrationFinishedFields::c_SLOT)]);
+        if (slot_number >= cluster::CLUSTER_AMOUNT_OF_SLOTS) {
+            return;
+        }
+        uint16_t slot = static_cast<uint16_t>(slot_number);
         cluster_state.slots[slot].state = cluster::SlotState::c_NORMAL;
         cluster_state.slots[slot].migration_partner = nullptr;
         cluster_state.slots[slot].served_by = &cluster_state.myself;
         cluster_state.myself.served_slots[slot] = true;
         cluster_state.myself.num_slots_served = cluster_state.myself.served_slots.count();
+        //Raised once more when the state is published, so the claim is newer than what is still gossiped about the migrating node
+        cluster_state.myself.config_epoch = cluster::get_max_config_epoch(cluster_state);
+        cluster_state.slot_map_changed = true;
     }
 
-    void handle_get_slots(net::Connection& connection, const protocol::Command& command, cluster::ClusterState& cluster_state) {
+    net::Task<> handle_get_slots(net::Connection& connection, const protocol::CommandView& command, cluster::ClusterState& cluster_state) {
         Status argc_state = check_argc(command, Instruction::c_GET_SLOTS);
         if (!argc_state.is_ok()) {
-            protocol::send_instruction(connection, argc_state);
-            return;
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return;
+        }
+
+        co_await protocol::serialize_slots(cluster_state, connection);
+    }
+
+    net::Task<> handle_get_slot_map(net::Connection& connection, const protocol::CommandView& command, cluster::ClusterState& cluster_state,
+        std::string& slot_map) {
+        Status argc_state = check_argc(command, Instruction::c_GET_SLOT_MAP);
+        if (!argc_state.is_ok()) {
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return;
+        }
+
+        if (slot_map.empty()) {
+            slot_map = protocol::serialize_slot_map(cluster_state);
+        }
+        uint64_t digest = protocol::field_to_uint64(command[to_integral(GetSlotMapFields::c_DIGEST)]);
+        if (digest == protocol::get_slot_map_digest(slot_map)) {
+            co_await protocol::write_instruction(connection, {}, Instruction::c_OK_RESPONSE);
+            co_return;
+        }
+        co_await protocol::write_instruction(connection, {}, Instruction::c_OK_RESPONSE, slot_map);
+    }
+
+    net::Task<> handle_get_load(net::Connection& connection, const protocol::CommandView& command, cluster::ClusterState& cluster_state) {
+        Status argc_state = check_argc(command, Instruction::c_GET_LOAD);
+        if (!argc_state.is_ok()) {
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return;
+        }
+
+        co_await protocol::serialize_load(cluster_state, connection);
+    }
+
+    net::Task<> handle_get_slot_stats(net::Connection& connection, const protocol::CommandView& command,
+        key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state, const cluster::SlotLoad& slot_load) {
+        Status argc_state = check_argc(command, Instruction::c_GET_SLOT_STATS);
+        if (!argc_state.is_ok()) {
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return;
+        }
+
+        //Slots that are migrated already can't be moved and idle ones don't matter
+        std::vector<cluster::SlotStats> stats;
+        for (size_t slot = 0; slot < cluster_state.slots.size(); slot++) {
+            if (!cluster_state.myself.served_slots[slot] || cluster_state.slots.states()[slot] != cluster::SlotState::c_NORMAL) {
+                continue;
+            }
+            cluster::SlotStats slot_stats = slot_load.get_slot_stats(static_cast<uint16_t>(slot), kvs);
+            if (slot_stats.keys != 0 || slot_stats.ops_per_second != 0 || slot_stats.bandwidth != 0) {
+                stats.push_back(slot_stats);
+            }
+        }
+        co_await protocol::serialize_slot_stats(stats, connection);
+    }
+
+    net::Task<> handle_replicate(net::Connection& connection, const protocol::CommandView& command, cluster::ClusterState& cluster_state) {
+        Status argc_state = check_argc(command, Instruction::c_REPLICATE);
+        if (!argc_state.is_ok()) {
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return;
+        }
+
+        std::string_view name = command[to_integral(ReplicateFields::c_PRIMARY_NAME)];
+        auto primary = cluster_state.nodes.find(std::string(name));
+        if (name == cluster_state.myself.name.data()) {
+            co_await protocol::write_instruction(connection, Status::new_invalid_argument("A node can't replicate itself"));
+            co_return;
+        }
+        if (primary == cluster_state.nodes.end()) {
+            co_await protocol::write_instruction(connection, Status::new_error("Primary not part of the cluster"));
+            co_return;
+        }
+        //Its keys are replaced by the ones of the primary
+        if (cluster_state.myself.num_slots_served != 0) {
+            co_await protocol::write_instruction(connection, Status::new_not_supported("Nodes that serve slots can't become replicas"));
+            co_return;
+        }
+        if (primary->second.primary[0] != '\0') {
+            co_await protocol::write_instruction(connection, Status::new_not_supported("Replicas can't be replicated"));
+            co_return;
+        }
+
+        cluster_state.myself.primary = {};
+        std::copy(name.begin(), name.end(), cluster_state.myself.primary.begin());
+        cluster_state.slot_map_changed = true;
+        co_await protocol::write_instruction(connection, Status::new_ok());
+    }
+
+    net::Task<bool> handle_read_only(net::Connection& connection, const protocol::CommandView& command) {
+        Status argc_state = check_argc(command, Instruction::c_READ_ONLY);
+        co_await protocol::write_instruction(connection, argc_state);
+        co_return argc_state.is_ok();
+    }
+
+    net::Task<bool> handle_proxy(net::Connection& connection, const protocol::CommandView& command) {
+        Status argc_state = check_argc(command, Instruction::c_PROXY);
+        co_await protocol::write_instruction(connection, argc_state);
+        co_return argc_state.is_ok();
+    }
+
+    net::Task<bool> handle_subscribe_slots(net::Connection& connection, const protocol::CommandView& command) {
+        Status argc_state = check_argc(command, Instruction::c_SUBSCRIBE_SLOTS);
+        co_await protocol::write_instruction(connection, argc_state);
+        co_return argc_state.is_ok();
+    }
+
+    net::Task<std::optional<std::vector<cluster::MigratedKey>>> read_multi_key_request(net::Connection& connection,
+        const protocol::MetaData& meta_data, const protocol::CommandView& command) {
+        Status argc_state = check_argc(command, meta_data.instruction);
+        if (!argc_state.is_ok()) {
+            co_await protocol::skip_payload(connection, meta_data.payload_size);
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return std::nullopt;
+        }
+
+        ByteArray payload = ByteArray::new_allocated_byte_array(meta_data.payload_size);
+        co_await protocol::read_payload(connection, payload.data(), meta_data.payload_size);
+        std::vector<cluster::MigratedKey> keys;
+        try {
+            keys = cluster::parse_migrated_keys(std::span<const char>(payload.data(), payload.size()));
+        }
+        catch (const std::runtime_error& e) {
+            keys.clear();
+        }
+        if (keys.empty() || keys.size() != protocol::field_to_uint64(command[to_integral(MultiKeyFields::c_KEYS_AMOUNT)])) {
+            co_await protocol::write_instruction(connection, Status::new_invalid_argument("Invalid keys"));
+            co_return std::nullopt;
+        }
+        co_return keys;
+    }
+
+    net::Task<> handle_get_replication_info(net::Connection& connection, const protocol::CommandView& command,
+        const cluster::ReplicationInfo& info) {
+        Status argc_state = check_argc(command, Instruction::c_GET_REPLICATION_INFO);
+        if (!argc_state.is_ok()) {
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return;
+        }
+
+        co_await protocol::serialize_replication_info(info, connection);
+    }
+
+    net::Task<std::shared_ptr<net::SharedMemoryChannel>> handle_shared_memory(net::Connection& connection, const protocol::CommandView& command) {
+        Status argc_state = check_argc(command, Instruction::c_SHARED_MEMORY);
+        if (!argc_state.is_ok()) {
+            co_await protocol::write_instruction(connection, argc_state);
+            co_return nullptr;
+        }
+        //The file descriptors can only be passed over a unix domain socket, which also guarantees the client is on the same host
+        if (connection.is_shared_memory() || !net::is_unix_socket(connection.fd())) {
+            co_await protocol::write_instruction(connection, Status::new_not_supported("Shared memory requires a unix domain socket connection"));
+            co_return nullptr;
+        }
+
+        uint64_t ring_size = protocol::field_to_uint64(command[to_integral(SharedMemoryFields::c_RING_SIZE)]);
+        std::shared_ptr<net::SharedMemoryChannel> channel;
+        Status create_state = Status::new_ok();
+        try {
+            channel = net::SharedMemoryChannel::create(ring_size);
+        }
+        catch (const std::runtime_error& e) {
+            create_state = Status::new_error(e.what());
+        }
+        if (!create_state.is_ok()) {
+            co_await protocol::write_instruction(connection, create_state);
+            co_return nullptr;
         }
 
-        protocol::serialize_slots(cluster_state.slots, connection);
+        //The descriptors are sent on the socket directly, so the response has to be sent before
+        co_await protocol::write_instruction(connection, Status::new_ok());
+        co_await connection.drain();
+        std::array<int, net::shared_memory_file_descriptors> file_descriptors = channel->get_file_descriptors();
+        net::send_file_descriptors(connection.fd(), file_descriptors);
+        co_return channel;
     }
-}
\ No newline at end of file
+}
@@ -1,28 +1,78 @@
 #pragma once
 
+#include <optional>
+#include <vector>
+
 #include "ProtocolHandler.hpp"
 #include "../KVS/IKeyValueStore.hpp"
+#include "../net/SharedMemoryChannel.hpp"
+#include "../net/Task.hpp"
 #include "../utils/Status.hpp"
 #include "Cluster.hpp"
+#include "Load.hpp"
+#include "Migration.hpp"
+#include "Replication.hpp"
 
 namespace node::instruction_handler {
 
-    void handle_put(net::Connection& connection, const protocol::MetaData& metadata,
-        const protocol::Command& command, key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state);
+    //The handlers are coroutines that suspend while waiting for the rest of a request or for output to drain,
+    //so many connections can be interleaved on the node's thread. net::sync_wait() runs them on blocking connections.
+
+    //Whether a replica answers a read only GET for the slot from its copy
+    bool is_served_by_primary(uint16_t slot, const cluster::ClusterState& cluster_state);
+
+    //Returns the amount of bytes that were written, 0 if the request was redirected or invalid
+    net::Task<uint64_t> handle_put(net::Connection& connection, const protocol::MetaData& metadata,
+        const protocol::CommandView& command, key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state);
+
+    //Returns the size of the value that was sent, 0 if there was none
+    //A read only GET on a replica is answered from its copy if the slot belongs to its primary
+    net::Task<uint64_t> handle_get(net::Connection& connection, const protocol::CommandView& command,
+        key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state, bool read_only = false);
 
-    void handle_get(net::Connection& connection, const protocol::Command& command,
+    net::Task<> handle_erase(net::Connection& connection, const protocol::CommandView& command,
         key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state);
 
-    void handle_erase(net::Connection& connection, const protocol::Command& command,
+    net::Task<> handle_meet(net::Connection& connection, const protocol::CommandView& command, cluster::ClusterState& cluster_state);
+
+    net::Task<> handle_migrate_slot(net::Connection& connection, const protocol::CommandView& command,
         key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state);
 
-    void handle_meet(net::Connection& connection, const protocol::Command& command, cluster::ClusterState& cluster_state);
+    net::Task<> handle_import_slot(net::Connection& connection, const protocol::CommandView& command, cluster::ClusterState& cluster_state);
+
+    void handle_migration_finished(const protocol::CommandView& command, cluster::ClusterState& cluster_state);
+
+    net::Task<> handle_get_slots(net::Connection& connection, const protocol::CommandView& command, cluster::ClusterState& cluster_state);
+
+    //The map is serialized into the cache if it is empty, the payload is left out if the client has the same digest
+    net::Task<> handle_get_slot_map(net::Connection& connection, const protocol::CommandView& command, cluster::ClusterState& cluster_state,
+        std::string& slot_map);
+
+    net::Task<> handle_get_load(net::Connection& connection, const protocol::CommandView& command, cluster::ClusterState& cluster_state);
+
+    net::Task<> handle_get_slot_stats(net::Connection& connection, const protocol::CommandView& command,
+        key_value_store::IKeyValueStore& kvs, cluster::ClusterState& cluster_state, const cluster::SlotLoad& slot_load);
+
+    //Only sets the primary, the node attaches to it afterwards
+    net::Task<> handle_replicate(net::Connection& connection, const protocol::CommandView& command, cluster::ClusterState& cluster_state);
+
+    //Returns true if the connection accepts stale values from now on
+    net::Task<bool> handle_read_only(net::Connection& connection, const protocol::CommandView& command);
+
+    //Returns true if the connection belongs to a proxying node, its requests are answered with redirects from now on
+    net::Task<bool> handle_proxy(net::Connection& connection, const protocol::CommandView& command);
 
-    void handle_migrate_slot(net::Connection& connection, const protocol::Command& command, cluster::ClusterState& cluster_state);
+    //Returns true if the connection gets the changes of the slot map pushed from now on
+    net::Task<bool> handle_subscribe_slots(net::Connection& connection, const protocol::CommandView& command);
 
-    void handle_import_slot(net::Connection& connection, const protocol::Command& command, cluster::ClusterState& cluster_state);
+    //Receives the keys of an MGET or MSET, returns nullopt if the request was invalid, which the client was told already
+    net::Task<std::optional<std::vector<cluster::MigratedKey>>> read_multi_key_request(net::Connection& connection,
+        const protocol::MetaData& meta_data, const protocol::CommandView& command);
 
-    void handle_migration_finished(const protocol::Command& command, cluster::ClusterState& cluster_state);
+    net::Task<> handle_get_replication_info(net::Connection& connection, const protocol::CommandView& command,
+        const cluster::ReplicationInfo& info);
 
-    void handle_get_slots(net::Connection& connection, const protocol::Command& command, cluster::ClusterState& cluster_state);
+    //Creates the channel and passes it to the client, the node serves it afterwards
+    //Returns nullptr if the setup was refused, which the client was told already
+    net::Task<std::shared_ptr<net::SharedMemoryChannel>> handle_shared_memory(net::Connection& connection, const protocol::CommandView& command);
 }
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include <endian.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#include "KeyHash.hpp"
+
+namespace node::cluster {
+
+    namespace {
+        constexpr uint16_t crc16_polynomial = 0x1021;
+        constexpr size_t crc16_slices = 8;
+        constexpr size_t interleaved_keys = 4;
+
+        using Crc16Tables = std::array<std::array<uint16_t, 256>, crc16_slices>;
+
+        //tables[k][b] is the crc of the byte b followed by k zero bytes
+        //A block of 8 bytes then needs one lookup per byte, which don't depend on each other
+        constexpr Crc16Tables make_crc16_tables() {
+            Crc16Tables tables{};
+            for (uint32_t byte = 0; byte < 256; byte++) {
+                uint16_t crc = static_cast<uint16_t>(byte << 8);
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ crc16_polynomial) : static_cast<uint16_t>(crc << 1);
+                }
+                tables[0][byte] = crc;
+            }
+            for (size_t slice = 1; slice < crc16_slices; slice++) {
+                for (size_t byte = 0; byte < 256; byte++) {
+                    uint16_t previous = tables[slice - 1][byte];
+                    tables[slice][byte] = static_cast<uint16_t>((previous << 8) ^ tables[0][previous >> 8]);
+                }
+            }
+            return tables;
+        }
+
+        constexpr Crc16Tables crc16_tables = make_crc16_tables();
+
+        inline uint16_t crc16_update_byte(uint16_t crc, unsigned char byte) {
+            return static_cast<uint16_t>((crc << 8) ^ crc16_tables[0][(crc >> 8) ^ byte]);
+        }
+
+        inline uint16_t crc16_update_block(uint16_t crc, const char* data) {
+            //Loaded big endian, so the first byte of the block is the highest one
+            uint64_t block;
+            std::memcpy(&block, data, crc16_slices);
+            block = be64toh(block) ^ (static_cast<uint64_t>(crc) << 48);
+            return crc16_tables[7][block >> 56] ^ crc16_tables[6][(block >> 48) & 0xff]
+                ^ crc16_tables[5][(block >> 40) & 0xff] ^ crc16_tables[4][(block >> 32) & 0xff]
+                ^ crc16_tables[3][(block >> 24) & 0xff] ^ crc16_tables[2][(block >> 16) & 0xff]
+                ^ crc16_tables[1][(block >> 8) & 0xff] ^ crc16_tables[0][block & 0xff];
+        }
+
+        uint16_t crc16_update(uint16_t crc, std::string_view data) {
+            size_t offset = 0;
+            for (; offset + crc16_slices <= data.size(); offset += crc16_slices) {
+                crc = crc16_update_block(crc, data.data() + offset);
+            }
+            for (; offset < data.size(); offset++) {
+                crc = crc16_update_byte(crc, static_cast<unsigned char>(data[offset]));
+            }
+            return crc;
+        }
+    }
+
+    std::string_view get_hash_tag(std::string_view key) {
+        const char* begin = static_cast<const char*>(std::memchr(key.data(), '{', key.size()));
+        if (begin == nullptr) {
+            return key;
+        }
+
+        size_t start = begin - key.data() + 1;
+        const char* end = static_cast<const char*>(std::memchr(key.data() + start, '}', key.size() - start));
+        if (end == nullptr || end == key.data() + start) {
+            return key;
+        }
+        return key.substr(start, end - key.data() - start);
+    }
+
+    uint16_t crc16(std::string_view data) {
+        return crc16_update(0, data);
+    }
+
+    uint16_t get_key_hash(std::string_view key) {
+        return crc16(get_hash_tag(key));
+    }
+
+    void get_key_hashes(std::span<const std::string_view> keys, std::span<uint16_t> hashes) {
+        if (hashes.size() < keys.size()) {
+            throw std::invalid_argument("Not enough space for the hashes of the keys");
+        }
+
+        size_t key = 0;
+        for (; key + interleaved_keys <= keys.size(); key += interleaved_keys) {
+            std::array<std::string_view, interleaved_keys> tags;
+            std::array<uint16_t, interleaved_keys> crcs{};
+            size_t common_size = SIZE_MAX;
+            for (size_t lane = 0; lane < interleaved_keys; lane++) {
+                tags[lane] = get_hash_tag(keys[key + lane]);
+                common_size = std::min(common_size, tags[lane].size());
+            }
+
+            //The blocks all keys have in common are processed in lockstep, the rest of each key on its own
+            size_t offset = 0;
+            for (; offset + crc16_slices <= common_size; offset += crc16_slices) {
+                for (size_t lane = 0; lane < interleaved_keys; lane++) {
+                    crcs[lane] = crc16_update_block(crcs[lane], tags[lane].data() + offset);
+                }
+            }
+            for (size_t lane = 0; lane < interleaved_keys; lane++) {
+                hashes[key + lane] = crc16_update(crcs[lane], tags[lane].substr(offset));
+            }
+        }
+
+        for (; key < keys.size(); key++) {
+            hashes[key] = get_key_hash(keys[key]);
+        }
+    }
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace node::cluster {
+
+    //Keys are hashed with CRC16/XMODEM (polynomial 0x1021, initial value 0) like in redis cluster
+    //The result is specified, so clients and nodes built with different compilers or standard libraries agree on the slots
+    //If the key contains a hash tag, which is the part between the first '{' and the next '}', only the tag is hashed
+    //An empty tag is ignored and the whole key is hashed
+
+    //The part of the key that determines the slot
+    std::string_view get_hash_tag(std::string_view key);
+
+    //CRC16/XMODEM of the data, processes 8 bytes per step
+    uint16_t crc16(std::string_view data);
+
+    uint16_t get_key_hash(std::string_view key);
+
+    //Hashes the keys at once, hashes has to be at least as large as keys
+    //Up to 4 keys are hashed interleaved, so their independent lookups can overlap
+    void get_key_hashes(std::span<const std::string_view> keys, std::span<uint16_t> hashes);
+
+}
@@ -0,0 +1,44 @@
+#include <cmath>
+
+#include "Load.hpp"
+
+namespace node::cluster {
+
+    SlotLoad::SlotLoad() : slots_(CLUSTER_AMOUNT_OF_SLOTS) {
+    }
+
+    void SlotLoad::update(std::chrono::duration<double> elapsed) {
+        if (elapsed.count() <= 0) {
+            return;
+        }
+        for (Counters& counters : slots_) {
+            counters.ops_per_second += CLUSTER_LOAD_SMOOTHING * (counters.ops / elapsed.count() - counters.ops_per_second);
+            counters.bandwidth += CLUSTER_LOAD_SMOOTHING * (counters.bytes / elapsed.count() - counters.bandwidth);
+            counters.ops = 0;
+            counters.bytes = 0;
+        }
+    }
+
+    SlotStats SlotLoad::get_slot_stats(uint16_t slot, const key_value_store::IKeyValueStore& kvs) const {
+        return SlotStats{ slot, kvs.get_slot_size(slot), kvs.get_slot_bytes(slot), slots_[slot].ops_per_second, slots_[slot].bandwidth };
+    }
+
+    NodeLoad SlotLoad::get_node_load(const key_value_store::IKeyValueStore& kvs, const ClusterState& state) const {
+        NodeLoad load{};
+        double ops_per_second = 0;
+        double bandwidth = 0;
+        for (size_t slot = 0; slot < slots_.size(); slot++) {
+            if (!state.myself.served_slots[slot]) {
+                continue;
+            }
+            load.keys += kvs.get_slot_size(static_cast<uint16_t>(slot));
+            load.bytes += kvs.get_slot_bytes(static_cast<uint16_t>(slot));
+            ops_per_second += slots_[slot].ops_per_second;
+            bandwidth += slots_[slot].bandwidth;
+        }
+        load.ops_per_second = static_cast<uint64_t>(std::llround(ops_per_second));
+        load.bandwidth = static_cast<uint64_t>(std::llround(bandwidth));
+        return load;
+    }
+
+}
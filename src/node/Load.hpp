@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "../KVS/IKeyValueStore.hpp"
+#include "Cluster.hpp"
+
+namespace node::cluster {
+
+    //The rates are measured over that interval
+    constexpr std::chrono::milliseconds CLUSTER_LOAD_INTERVAL{ 1000 };
+    //Weight of the latest interval in the rates, older ones fade out, so a short burst doesn't make a slot look hot
+    constexpr double CLUSTER_LOAD_SMOOTHING = 0.3;
+
+    struct SlotStats {
+        uint16_t slot = 0;
+        uint64_t keys = 0;
+        uint64_t bytes = 0;
+        double ops_per_second = 0;
+        //Bytes of the values put and got per second
+        double bandwidth = 0;
+    };
+
+    //Counts the requests of every slot and turns them into rates once per interval
+    class SlotLoad {
+    public:
+        SlotLoad();
+
+        //Has to be called for every request of a slot this node serves, with the size of the value it put or got
+        void record(uint16_t slot, uint64_t bytes) {
+            slots_[slot].ops++;
+            slots_[slot].bytes += bytes;
+        }
+
+        //Has to be called once per interval with the time since the last call
+        void update(std::chrono::duration<double> elapsed);
+
+        SlotStats get_slot_stats(uint16_t slot, const key_value_store::IKeyValueStore& kvs) const;
+
+        //Totals of the slots the node serves, the version has to be set by the caller
+        NodeLoad get_node_load(const key_value_store::IKeyValueStore& kvs, const ClusterState& state) const;
+
+    private:
+        struct Counters {
+            //Of the current interval
+            uint64_t ops = 0;
+            uint64_t bytes = 0;
+            double ops_per_second = 0;
+            double bandwidth = 0;
+        };
+
+        std::vector<Counters> slots_;
+    };
+
+}
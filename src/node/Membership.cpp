@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <endian.h>
+#include <stdexcept>
+
+#include "Membership.hpp"
+#include "ProtocolHandler.hpp"
+
+namespace node::cluster {
+
+    Membership::Membership(std::string myself, uint64_t incarnation, MembershipConfig config)
+        : myself_(std::move(myself)), incarnation_(incarnation), config_(config) {
+    }
+
+    void Membership::set_members(const std::vector<std::string>& names) {
+        for (const std::string& name : names) {
+            if (name != myself_ && !members_.contains(name)) {
+                members_.emplace(name, Member{});
+                probe_order_.push_back(name);
+            }
+        }
+
+        std::erase_if(members_, [&names](const auto& member) {
+            return std::find(names.begin(), names.end(), member.first) == names.end();
+        });
+        std::erase_if(probe_order_, [this](const std::string& name) { return !members_.contains(name); });
+        std::erase_if(updates_, [this](const QueuedUpdate& queued) {
+            std::string name = queued.update.name.data();
+            return name != myself_ && !members_.contains(name);
+        });
+        if (probe_.has_value() && !members_.contains(probe_->target)) {
+            probe_.reset();
+        }
+    }
+
+    std::vector<MembershipMessage> Membership::tick(MembershipClock::time_point now) {
+        std::vector<MembershipMessage> messages;
+
+        //The direct probe wasn't answered in time, some other members try it as well
+        if (probe_.has_value() && !probe_->indirect_sent && now >= probe_->indirect_deadline) {
+            probe_->indirect_sent = true;
+            std::vector<std::string> helpers;
+            for (const auto& [name, member] : members_) {
+                if (name != probe_->target && member.state == MemberState::c_ALIVE) {
+                    helpers.push_back(name);
+                }
+            }
+            std::shuffle(helpers.begin(), helpers.end(), random_engine_);
+            helpers.resize(std::min(helpers.size(), config_.indirect_probes));
+            for (std::string& helper : helpers) {
+                messages.emplace_back(new_message(MembershipMessageType::c_PING_REQ, std::move(helper), probe_->target, probe_->sequence));
+            }
+        }
+
+        for (auto& [name, member] : members_) {
+            if (member.state == MemberState::c_SUSPECT && now >= member.suspicion_deadline) {
+                set_state(name, member, MemberState::c_DEAD, member.incarnation, now);
+            }
+        }
+        std::erase_if(forwarded_, [now](const auto& forwarded) { return now >= forwarded.second.deadline; });
+
+        if (now >= next_period_) {
+            //Nobody got an answer from the member during the whole period
+            if (probe_.has_value()) {
+                suspect(probe_->target, now);
+                probe_.reset();
+            }
+            start_probe(now, messages);
+            next_period_ = now + config_.probe_interval;
+        }
+        return messages;
+    }
+
+    void Membership::start_probe(MembershipClock::time_point now, std::vector<MembershipMessage>& messages) {
+        for (size_t checked = 0; checked < probe_order_.size(); checked++) {
+            if (probe_index_ >= probe_order_.size()) {
+                probe_index_ = 0;
+                std::shuffle(probe_order_.begin(), probe_order_.end(), random_engine_);
+            }
+            const std::string& target = probe_order_[probe_index_++];
+            if (members_[target].state == MemberState::c_DEAD) {
+                continue;
+            }
+
+            uint64_t sequence = next_sequence_++;
+            probe_ = Probe{ target, sequence, now + config_.probe_timeout };
+            messages.emplace_back(new_message(MembershipMessageType::c_PING, target, target, sequence));
+            return;
+        }
+    }
+
+    std::vector<MembershipMessage> Membership::handle(const MembershipMessage& message, MembershipClock::time_point now) {
+        for (const MemberUpdate& update : message.updates) {
+            apply(update, now);
+        }
+
+        //A member that came back after it was declared dead learns about it with the answer and refutes it
+        if (auto sender = members_.find(message.from); sender != members_.end() && sender->second.state == MemberState::c_DEAD) {
+            enqueue(sender->first, sender->second.incarnation, MemberState::c_DEAD);
+        }
+
+        std::vector<MembershipMessage> messages;
+        switch (message.type) {
+        case MembershipMessageType::c_PING:
+            messages.emplace_back(new_message(MembershipMessageType::c_ACK, message.from, myself_, message.sequence));
+            break;
+        case MembershipMessageType::c_PING_REQ:
+        {
+            uint64_t sequence = next_sequence_++;
+            forwarded_[sequence] = ForwardedProbe{ message.from, message.sequence, now + config_.probe_interval };
+            messages.emplace_back(new_message(MembershipMessageType::c_PING, message.target, message.target, sequence));
+            break;
+        }
+        case MembershipMessageType::c_ACK:
+            if (probe_.has_value() && probe_->sequence == message.sequence && probe_->target == message.target) {
+                probe_.reset();
+            }
+            else if (auto forwarded = forwarded_.find(message.sequence); forwarded != forwarded_.end()) {
+                messages.emplace_back(new_message(MembershipMessageType::c_ACK, forwarded->second.requester, message.target, forwarded->second.sequence));
+                forwarded_.erase(forwarded);
+            }
+            break;
+        default:
+            break;
+        }
+        return messages;
+    }
+
+    void Membership::apply(const MemberUpdate& update, MembershipClock::time_point now) {
+        std::string name(update.name.data());
+        if (name == myself_) {
+            //Refute by announcing a newer incarnation
+            if (update.state != MemberState::c_ALIVE) {
+                incarnation_ = std::max(incarnation_, update.incarnation + 1);
+                enqueue(myself_, incarnation_, MemberState::c_ALIVE);
+            }
+            return;
+        }
+
+        //Members are only added by the cluster state
+        auto it = members_.find(name);
+        if (it == members_.end()) {
+            return;
+        }
+        Member& member = it->second;
+
+        switch (update.state) {
+        case MemberState::c_ALIVE:
+            if (update.incarnation > member.incarnation) {
+                set_state(name, member, MemberState::c_ALIVE, update.incarnation, now);
+            }
+            break;
+        case MemberState::c_SUSPECT:
+            if (member.state != MemberState::c_DEAD && (update.incarnation > member.incarnation
+                || (update.incarnation == member.incarnation && member.state == MemberState::c_ALIVE))) {
+                set_state(name, member, MemberState::c_SUSPECT, update.incarnation, now);
+            }
+            break;
+        case MemberState::c_DEAD:
+            if (member.state != MemberState::c_DEAD && update.incarnation >= member.incarnation) {
+                set_state(name, member, MemberState::c_DEAD, update.incarnation, now);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    void Membership::suspect(const std::string& name, MembershipClock::time_point now) {
+        auto it = members_.find(name);
+        if (it != members_.end() && it->second.state == MemberState::c_ALIVE) {
+            set_state(name, it->second, MemberState::c_SUSPECT, it->second.incarnation, now);
+        }
+    }
+
+    void Membership::set_state(const std::string& name, Member& member, MemberState state, uint64_t incarnation, MembershipClock::time_point now) {
+        bool changed = member.state != state;
+        member.state = state;
+        member.incarnation = incarnation;
+        if (state == MemberState::c_SUSPECT) {
+            member.suspicion_deadline = now + config_.probe_interval * config_.suspicion_multiplier * get_log_members();
+        }
+        enqueue(name, incarnation, state);
+        if (changed) {
+            changes_.emplace_back(name, state);
+        }
+    }
+
+    void Membership::enqueue(const std::string& name, uint64_t incarnation, MemberState state) {
+        //Only the latest change of a member is worth spreading
+        std::erase_if(updates_, [&name](const QueuedUpdate& queued) { return name == queued.update.name.data(); });
+
+        MemberUpdate update{};
+        std::copy_n(name.begin(), std::min<size_t>(name.size(), CLUSTER_NAME_LEN - 1), update.name.begin());
+        update.incarnation = incarnation;
+        update.state = state;
+        updates_.push_back(QueuedUpdate{ update, config_.retransmit_multiplier * get_log_members() });
+    }
+
+    MembershipMessage Membership::new_message(MembershipMessageType type, std::string to, std::string target, uint64_t sequence) {
+        MembershipMessage message{ type, std::move(to), myself_, std::move(target), sequence, {} };
+
+        //The changes that were sent the least often go first
+        std::stable_sort(updates_.begin(), updates_.end(), [](const QueuedUpdate& lhs, const QueuedUpdate& rhs) {
+            return lhs.transmissions_left > rhs.transmissions_left;
+        });
+        for (size_t i = 0; i < updates_.size() && message.updates.size() < config_.max_piggybacked_updates; i++) {
+            message.updates.push_back(updates_[i].update);
+            updates_[i].transmissions_left--;
+        }
+        std::erase_if(updates_, [](const QueuedUpdate& queued) { return queued.transmissions_left <= 0; });
+        return message;
+    }
+
+    int Membership::get_log_members() const {
+        int log = 1;
+        while ((size_t{ 1 } << log) < members_.size() + 1) {
+            log++;
+        }
+        return log;
+    }
+
+    MembershipClock::time_point Membership::get_next_deadline() const {
+        MembershipClock::time_point deadline = next_period_;
+        if (probe_.has_value() && !probe_->indirect_sent) {
+            deadline = std::min(deadline, probe_->indirect_deadline);
+        }
+        for (const auto& [name, member] : members_) {
+            if (member.state == MemberState::c_SUSPECT) {
+                deadline = std::min(deadline, member.suspicion_deadline);
+            }
+        }
+        for (const auto& [sequence, forwarded] : forwarded_) {
+            deadline = std::min(deadline, forwarded.deadline);
+        }
+        return deadline;
+    }
+
+    std::optional<MemberState> Membership::get_state(const std::string& name) const {
+        auto it = members_.find(name);
+        if (it == members_.end()) {
+            return std::nullopt;
+        }
+        return it->second.state;
+    }
+
+    std::vector<std::pair<std::string, MemberState>> Membership::take_changes() {
+        std::vector<std::pair<std::string, MemberState>> changes;
+        changes.swap(changes_);
+        return changes;
+    }
+
+    void send_membership_message(net::Connection& link, const MembershipMessage& message) {
+        std::vector<MemberUpdate> updates = message.updates;
+        for (MemberUpdate& update : updates) {
+            update.incarnation = htobe64(update.incarnation);
+        }
+
+        ssize_t sent = protocol::send_instruction(link,
+            protocol::Command{ std::to_string(protocol::to_integral(message.type)), message.from, message.target,
+                std::to_string(message.sequence), std::to_string(updates.size()) },
+            protocol::Instruction::c_CLUSTER_PROBE,
+            { std::span<const char>(reinterpret_cast<const char*>(updates.data()), updates.size() * sizeof(MemberUpdate)) }
+        );
+        if (sent < 0) {
+            throw std::runtime_error("Failed to send probe: " + std::to_string(errno));
+        }
+    }
+
+    net::Task<MembershipMessage> read_membership_message(net::Connection& link, const protocol::CommandView& command) {
+        if (command.size() != protocol::to_integral(protocol::CommandFieldsProbe::enum_size)) {
+            throw std::runtime_error("Wrong number of arguments for CLUSTER_PROBE");
+        }
+        uint64_t type = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsProbe::c_TYPE)]);
+        uint64_t amount = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsProbe::c_UPDATES_AMOUNT)]);
+        if (type >= protocol::to_integral(MembershipMessageType::enum_size) || amount > CLUSTER_MEMBERSHIP_CONFIG.max_piggybacked_updates * 16) {
+            throw std::runtime_error("Invalid CLUSTER_PROBE");
+        }
+
+        MembershipMessage message;
+        message.type = static_cast<MembershipMessageType>(type);
+        message.from = command[protocol::to_integral(protocol::CommandFieldsProbe::c_FROM)];
+        message.target = command[protocol::to_integral(protocol::CommandFieldsProbe::c_TARGET)];
+        message.sequence = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsProbe::c_SEQUENCE)]);
+
+        message.updates.resize(amount);
+        co_await protocol::read_payload(link, reinterpret_cast<char*>(message.updates.data()), amount * sizeof(MemberUpdate));
+        for (MemberUpdate& update : message.updates) {
+            update.incarnation = be64toh(update.incarnation);
+            update.name.back() = '\0';
+            if (protocol::to_integral(update.state) >= protocol::to_integral(MemberState::enum_size)) {
+                throw std::runtime_error("Invalid member state in CLUSTER_PROBE");
+            }
+        }
+        co_return message;
+    }
+
+}
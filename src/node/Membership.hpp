@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../net/Connection.hpp"
+#include "../net/Task.hpp"
+#include "Cluster.hpp"
+
+namespace node::cluster {
+
+    using MembershipClock = std::chrono::steady_clock;
+
+    //Failure detection as described by SWIM
+    //Every protocol period one member is probed directly, if it doesn't answer in time k other members probe it
+    //Without any answer the member becomes suspect and dead once the suspicion timed out, unless it refutes that
+    //Changes are piggybacked on the probes, each one about log(n) times, so they infect the cluster in O(log n) periods
+    struct MembershipConfig {
+        std::chrono::milliseconds probe_interval;
+        //Time a direct probe has before the indirect probes start, less than the interval
+        std::chrono::milliseconds probe_timeout;
+        size_t indirect_probes;
+        //The suspicion timeout is that many probe intervals times log(n)
+        int suspicion_multiplier;
+        //Each change is piggybacked that many times log(n)
+        int retransmit_multiplier;
+        size_t max_piggybacked_updates;
+    };
+
+    constexpr MembershipConfig CLUSTER_MEMBERSHIP_CONFIG{
+        std::chrono::milliseconds{ 200 }, std::chrono::milliseconds{ 80 }, 3, 4, 3, 8
+    };
+
+    enum class MemberState : uint8_t {
+        c_ALIVE = 0,
+        c_SUSPECT = 1,
+        c_DEAD = 2,
+        enum_size = 3
+    };
+
+    //A change of a member, only the member itself raises its incarnation to refute a suspicion
+    struct MemberUpdate {
+        std::array<char, CLUSTER_NAME_LEN> name;
+        uint64_t incarnation;
+        MemberState state;
+    };
+
+    enum class MembershipMessageType : uint8_t {
+        c_PING = 0,
+        //Asks the receiver to probe the target on behalf of the sender
+        c_PING_REQ = 1,
+        c_ACK = 2,
+        enum_size = 3
+    };
+
+    struct MembershipMessage {
+        MembershipMessageType type;
+        //Receiver, not sent
+        std::string to;
+        std::string from;
+        //The probed member
+        std::string target;
+        uint64_t sequence;
+        std::vector<MemberUpdate> updates;
+    };
+
+    //The protocol without any io, the caller sends the returned messages and passes the received ones
+    class Membership {
+    public:
+        //The incarnation has to grow across restarts, otherwise a restarted member can't refute its death
+        Membership(std::string myself, uint64_t incarnation, MembershipConfig config = CLUSTER_MEMBERSHIP_CONFIG);
+
+        //Adds new members as alive and forgets the ones that left the cluster
+        void set_members(const std::vector<std::string>& names);
+
+        //Starts the next protocol period when it is due, sends indirect probes and expires suspicions
+        std::vector<MembershipMessage> tick(MembershipClock::time_point now);
+
+        std::vector<MembershipMessage> handle(const MembershipMessage& message, MembershipClock::time_point now);
+
+        //When tick() has to be called next
+        MembershipClock::time_point get_next_deadline() const;
+
+        std::optional<MemberState> get_state(const std::string& name) const;
+
+        //Members whose state changed since the last call
+        std::vector<std::pair<std::string, MemberState>> take_changes();
+
+        uint64_t get_incarnation() const {
+            return incarnation_;
+        }
+
+        const MembershipConfig& get_config() const {
+            return config_;
+        }
+
+    private:
+        struct Member {
+            MemberState state = MemberState::c_ALIVE;
+            uint64_t incarnation = 0;
+            MembershipClock::time_point suspicion_deadline{};
+        };
+
+        struct Probe {
+            std::string target;
+            uint64_t sequence;
+            MembershipClock::time_point indirect_deadline;
+            bool indirect_sent = false;
+        };
+
+        //A probe this member does for another one
+        struct ForwardedProbe {
+            std::string requester;
+            uint64_t sequence;
+            MembershipClock::time_point deadline;
+        };
+
+        struct QueuedUpdate {
+            MemberUpdate update;
+            int transmissions_left;
+        };
+
+        void start_probe(MembershipClock::time_point now, std::vector<MembershipMessage>& messages);
+
+        void apply(const MemberUpdate& update, MembershipClock::time_point now);
+
+        void suspect(const std::string& name, MembershipClock::time_point now);
+
+        void set_state(const std::string& name, Member& member, MemberState state, uint64_t incarnation, MembershipClock::time_point now);
+
+        void enqueue(const std::string& name, uint64_t incarnation, MemberState state);
+
+        MembershipMessage new_message(MembershipMessageType type, std::string to, std::string target, uint64_t sequence);
+
+        //Grows with log(n)
+        int get_log_members() const;
+
+        std::string myself_;
+        uint64_t incarnation_;
+        MembershipConfig config_;
+        std::unordered_map<std::string, Member> members_;
+        //Members are probed round robin in a random order
+        std::vector<std::string> probe_order_;
+        size_t probe_index_ = 0;
+        std::optional<Probe> probe_;
+        MembershipClock::time_point next_period_{};
+        std::unordered_map<uint64_t, ForwardedProbe> forwarded_;
+        std::vector<QueuedUpdate> updates_;
+        std::vector<std::pair<std::string, MemberState>> changes_;
+        uint64_t next_sequence_ = 1;
+        std::mt19937 random_engine_{ std::random_device{}() };
+    };
+
+    void send_membership_message(net::Connection& link, const MembershipMessage& message);
+
+    net::Task<MembershipMessage> read_membership_message(net::Connection& link, const protocol::CommandView& command);
+
+}
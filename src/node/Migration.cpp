@@ -0,0 +1,326 @@
+#include <endian.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "Migration.hpp"
+#include "ProtocolHandler.hpp"
+
+namespace node::cluster {
+
+    namespace {
+        //Value size of an erased key, it has no value
+        constexpr uint64_t migration_erased_size = UINT64_MAX;
+        //The budgets can't save up more than that, so an idle migration doesn't burst afterwards
+        constexpr double migration_burst_seconds = 0.1;
+
+        //Returns false if the link is down and the batch was dropped
+        bool send_migration_batch(ClusterState& state, ClusterNode& partner, uint16_t slot, uint64_t batch, uint64_t keys_amount,
+            std::span<const char> payload) {
+            return partner.outgoing_link.send(
+                protocol::Command{ std::string(state.myself.name.data()), std::to_string(slot), std::to_string(batch), std::to_string(keys_amount) },
+                protocol::Instruction::c_CLUSTER_MIGRATE_KEYS, payload);
+        }
+
+        bool is_migrating_to(const ClusterState& state, uint16_t slot, std::string_view partner) {
+            Slot current = state.slots[slot];
+            return current.state == SlotState::c_MIGRATING && current.migration_partner != nullptr
+                && partner == current.migration_partner->name.data();
+        }
+    }
+
+    uint64_t append_migrated_key(std::vector<char>& payload, std::string_view key, const char* value, uint64_t value_size, bool erased) {
+        std::array<uint64_t, 2> sizes{ htobe64(key.size()), htobe64(erased ? migration_erased_size : value_size) };
+        const char* sizes_data = reinterpret_cast<const char*>(sizes.data());
+        payload.insert(payload.end(), sizes_data, sizes_data + sizeof(sizes));
+        payload.insert(payload.end(), key.begin(), key.end());
+        uint64_t value_offset = payload.size();
+        if (!erased) {
+            payload.insert(payload.end(), value, value + value_size);
+        }
+        return value_offset;
+    }
+
+    std::vector<MigratedKey> parse_migrated_keys(std::span<const char> payload) {
+        std::vector<MigratedKey> keys;
+        uint64_t offset = 0;
+        while (offset < payload.size()) {
+            if (payload.size() - offset < 2 * sizeof(uint64_t)) {
+                throw std::runtime_error("Invalid key entries");
+            }
+            std::array<uint64_t, 2> sizes;
+            std::memcpy(sizes.data(), payload.data() + offset, sizeof(sizes));
+            offset += sizeof(sizes);
+            uint64_t key_size = be64toh(sizes[0]);
+            uint64_t value_size = be64toh(sizes[1]);
+            bool erased = value_size == migration_erased_size;
+            if (erased) {
+                value_size = 0;
+            }
+            if (key_size > payload.size() - offset || value_size > payload.size() - offset - key_size) {
+                throw std::runtime_error("Invalid key entries");
+            }
+
+            MigratedKey migrated{};
+            migrated.key.assign(payload.data() + offset, key_size);
+            offset += key_size;
+            migrated.erased = erased;
+            if (!erased) {
+                migrated.value = ByteArray::new_allocated_byte_array(value_size);
+                std::memcpy(migrated.value.data(), payload.data() + offset, value_size);
+                offset += value_size;
+            }
+            keys.push_back(std::move(migrated));
+        }
+        return keys;
+    }
+
+    SlotMigrator::SlotMigrator(MigrationConfig config) : config_(config) {
+    }
+
+    bool SlotMigrator::send_batches(key_value_store::IKeyValueStore& kvs, ClusterState& state, MigrationClock::time_point now) {
+        refill_budget(now);
+
+        bool ended = false;
+        for (auto it = migrations_.begin(); it != migrations_.end();) {
+            if (send_migration_batches(it->first, it->second, kvs, state, now)) {
+                ++it;
+                continue;
+            }
+            batches_in_flight_ -= it->second.in_flight.size();
+            it = migrations_.erase(it);
+            ended = true;
+        }
+        return ended;
+    }
+
+    bool SlotMigrator::send_migration_batches(uint16_t slot, Migration& migration, key_value_store::IKeyValueStore& kvs,
+        ClusterState& state, MigrationClock::time_point now) {
+        //Finished or aborted by someone else, like the erase of the last key
+        Slot current = state.slots[slot];
+        if (current.state != SlotState::c_MIGRATING || current.migration_partner == nullptr) {
+            return false;
+        }
+        ClusterNode& partner = *current.migration_partner;
+
+        //Batches without an answer might have been dropped with their link, their keys are sent again
+        for (auto it = migration.in_flight.begin(); it != migration.in_flight.end();) {
+            if (now - it->second.sent_at < CLUSTER_MIGRATION_ACK_TIMEOUT) {
+                ++it;
+                continue;
+            }
+            for (SentKey& key : it->second.keys) {
+                migration.pending.push_back(std::move(key.key));
+            }
+            it = migration.in_flight.erase(it);
+            batches_in_flight_--;
+        }
+
+        //A rate of 0 is unlimited, its budget isn't checked
+        while (!migration.pending.empty() && (config_.bytes_per_second == 0 || byte_budget_ >= 0)
+            && (config_.keys_per_second == 0 || key_budget_ >= 0)
+            && (config_.max_batches_in_flight == 0 || batches_in_flight_ < config_.max_batches_in_flight)) {
+            SentBatch batch{};
+            while (!migration.pending.empty() && (config_.batch_keys == 0 || batch.keys.size() < config_.batch_keys)
+                && (config_.batch_bytes == 0 || batch.payload.size() < config_.batch_bytes)) {
+                std::string key = std::move(migration.pending.front());
+                migration.pending.pop_front();
+
+                //Erased meanwhile, erase_key() told the importing node already
+                ByteArray value{};
+                if (!kvs.get(key, value).is_ok()) {
+                    continue;
+                }
+                uint64_t value_offset = append_migrated_key(batch.payload, key, value.data(), value.size(), false);
+                batch.keys.push_back(SentKey{ std::move(key), value_offset, value.size() });
+            }
+            if (batch.keys.empty()) {
+                break;
+            }
+
+            uint64_t id = migration.next_batch++;
+            if (!send_migration_batch(state, partner, slot, id, batch.keys.size(), batch.payload)) {
+                //The link is down, the keys are sent again once it is connected
+                for (auto key = batch.keys.rbegin(); key != batch.keys.rend(); ++key) {
+                    migration.pending.push_front(std::move(key->key));
+                }
+                break;
+            }
+
+            byte_budget_ -= static_cast<double>(batch.payload.size());
+            key_budget_ -= static_cast<double>(batch.keys.size());
+            batch.sent_at = now;
+            migration.in_flight.emplace(id, std::move(batch));
+            batches_in_flight_++;
+        }
+
+        if (migration.pending.empty() && migration.in_flight.empty()) {
+            //Keys that are still stored were missed, like a put that was suspended while the migration started
+            if (kvs.get_slot_size(slot) != 0) {
+                for (auto key = kvs.new_slot_iterator(slot); key->valid(); key->next()) {
+                    migration.pending.emplace_back(key->key());
+                }
+                return true;
+            }
+            finish_slot_migration(state, slot);
+            return false;
+        }
+        return true;
+    }
+
+    void SlotMigrator::refill_budget(MigrationClock::time_point now) {
+        double elapsed = std::chrono::duration<double>(now - last_refill_).count();
+        last_refill_ = now;
+
+        auto refill = [elapsed](double& budget, uint64_t per_second) {
+            if (per_second == 0) {
+                return;
+            }
+            double rate = static_cast<double>(per_second);
+            budget = std::min(budget + elapsed * rate, rate * migration_burst_seconds);
+        };
+        refill(byte_budget_, config_.bytes_per_second);
+        refill(key_budget_, config_.keys_per_second);
+    }
+
+    void SlotMigrator::handle_ack(const std::string& from, uint16_t slot, uint64_t batch, key_value_store::IKeyValueStore& kvs, ClusterState& state) {
+        if (slot >= state.slots.size() || !is_migrating_to(state, slot, from)) {
+            return;
+        }
+
+        auto migration = migrations_.find(slot);
+        //The partner imports the slot, all keys it has now are streamed
+        if (batch == 0) {
+            if (migration == migrations_.end()) {
+                Migration started{};
+                for (auto key = kvs.new_slot_iterator(slot); key->valid(); key->next()) {
+                    started.pending.emplace_back(key->key());
+                }
+                migrations_.emplace(slot, std::move(started));
+            }
+            return;
+        }
+        if (migration == migrations_.end()) {
+            return;
+        }
+
+        //Acks of batches that timed out and were sent again are ignored
+        auto sent = migration->second.in_flight.find(batch);
+        if (sent == migration->second.in_flight.end()) {
+            return;
+        }
+        for (SentKey& key : sent->second.keys) {
+            ByteArray value{};
+            if (!kvs.get(key.key, value).is_ok()) {
+                continue;
+            }
+            //Changed by a client after it was sent
+            if (value.size() != key.value_size || std::memcmp(value.data(), sent->second.payload.data() + key.value_offset, key.value_size) != 0) {
+                migration->second.pending.push_back(std::move(key.key));
+                continue;
+            }
+            kvs.erase(key.key);
+        }
+        state.slots[slot].amount_of_keys = kvs.get_slot_size(slot);
+        migration->second.in_flight.erase(sent);
+        batches_in_flight_--;
+    }
+
+    void SlotMigrator::erase_key(std::string_view key, key_value_store::IKeyValueStore& kvs, ClusterState& state) {
+        uint16_t slot = get_key_slot(key);
+        auto migration = migrations_.find(slot);
+        if (migration == migrations_.end() || !kvs.contains_key(key) || state.slots[slot].state != SlotState::c_MIGRATING
+            || state.slots[slot].migration_partner == nullptr) {
+            return;
+        }
+
+        //Not tracked, its ack is ignored
+        //If the link is down, the importing node keeps its copy
+        std::vector<char> payload;
+        append_migrated_key(payload, key, nullptr, 0, true);
+        send_migration_batch(state, *state.slots[slot].migration_partner, slot, migration->second.next_batch++, 1, payload);
+    }
+
+    void SlotImporter::record_client_write(std::string_view key, const ClusterState& state) {
+        uint16_t slot = get_key_slot(key);
+        if (state.slots[slot].state == SlotState::c_IMPORTING) {
+            client_writes_[slot].emplace(key);
+        }
+    }
+
+    void SlotImporter::handle_batch(const MigrationBatch& batch, key_value_store::IKeyValueStore& kvs, ClusterState& state) {
+        Slot current = state.slots[batch.slot];
+        if (current.state != SlotState::c_IMPORTING || current.migration_partner == nullptr || batch.from != current.migration_partner->name.data()) {
+            return;
+        }
+
+        const std::unordered_set<std::string>& written = client_writes_[batch.slot];
+        for (const MigratedKey& migrated : batch.keys) {
+            if (written.contains(migrated.key)) {
+                continue;
+            }
+            if (migrated.erased) {
+                kvs.erase(migrated.key);
+                continue;
+            }
+            kvs.put(migrated.key, migrated.value);
+        }
+        state.slots[batch.slot].amount_of_keys = kvs.get_slot_size(batch.slot);
+        send_migration_ack(state, *current.migration_partner, batch.slot, batch.batch);
+    }
+
+    void SlotImporter::drop_finished(const ClusterState& state) {
+        std::erase_if(client_writes_, [&state](const auto& writes) {
+            return state.slots[writes.first].state != SlotState::c_IMPORTING;
+        });
+    }
+
+    void request_migration_start(ClusterState& state, uint16_t slot) {
+        if (state.slots[slot].migration_partner != nullptr) {
+            send_migration_batch(state, *state.slots[slot].migration_partner, slot, 0, 0, {});
+        }
+    }
+
+    void finish_slot_migration(ClusterState& state, uint16_t slot) {
+        ClusterNode& migration_partner = *state.slots[slot].migration_partner;
+
+        state.slots[slot].served_by = &migration_partner;
+        state.slots[slot].state = SlotState::c_NORMAL;
+        state.slots[slot].migration_partner = nullptr;
+        state.myself.served_slots[slot] = false;
+        state.myself.num_slots_served = state.myself.served_slots.count();
+        state.slot_map_changed = true;
+
+        migration_partner.outgoing_link.send(protocol::Command{ std::to_string(slot) }, protocol::Instruction::c_CLUSTER_MIGRATION_FINISHED);
+    }
+
+    void send_migration_ack(ClusterState& state, ClusterNode& partner, uint16_t slot, uint64_t batch) {
+        partner.outgoing_link.send(protocol::Command{ std::string(state.myself.name.data()), std::to_string(slot), std::to_string(batch) },
+            protocol::Instruction::c_CLUSTER_MIGRATE_KEYS_ACK);
+    }
+
+    net::Task<MigrationBatch> read_migration_batch(net::Connection& link, const protocol::CommandView& command, uint64_t payload_size) {
+        if (command.size() != protocol::to_integral(protocol::CommandFieldsMigrateKeys::enum_size)) {
+            throw std::runtime_error("Wrong number of arguments for CLUSTER_MIGRATE_KEYS");
+        }
+        MigrationBatch batch{};
+        batch.from = command[protocol::to_integral(protocol::CommandFieldsMigrateKeys::c_NAME)];
+        uint64_t slot = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsMigrateKeys::c_SLOT)]);
+        batch.batch = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsMigrateKeys::c_BATCH)]);
+        uint64_t amount = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsMigrateKeys::c_KEYS_AMOUNT)]);
+        if (slot >= CLUSTER_AMOUNT_OF_SLOTS || amount > payload_size / (2 * sizeof(uint64_t))) {
+            throw std::runtime_error("Invalid CLUSTER_MIGRATE_KEYS");
+        }
+        batch.slot = static_cast<uint16_t>(slot);
+
+        std::vector<char> payload(payload_size);
+        co_await protocol::read_payload(link, payload.data(), payload_size);
+
+        batch.keys = parse_migrated_keys(payload);
+        if (batch.keys.size() != amount) {
+            throw std::runtime_error("Invalid CLUSTER_MIGRATE_KEYS");
+        }
+        co_return batch;
+    }
+
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "../KVS/IKeyValueStore.hpp"
+#include "../net/Connection.hpp"
+#include "../net/Task.hpp"
+#include "../utils/ByteArray.hpp"
+#include "Cluster.hpp"
+
+namespace node::cluster {
+
+    using MigrationClock = std::chrono::steady_clock;
+
+    //Limits of the slot migrations of a node, so they don't take the data path from the clients, 0 means unlimited
+    struct MigrationConfig {
+        size_t batch_keys;
+        uint64_t batch_bytes;
+        //Batches sent to the importing nodes that weren't acknowledged yet, of all migrations together
+        size_t max_batches_in_flight;
+        uint64_t bytes_per_second;
+        uint64_t keys_per_second;
+    };
+
+    constexpr MigrationConfig CLUSTER_MIGRATION_CONFIG{ 128, 1024 * 1024, 4, 64 * 1024 * 1024, 100000 };
+
+    //A batch that wasn't acknowledged in that time is sent again, its link might have failed
+    constexpr std::chrono::milliseconds CLUSTER_MIGRATION_ACK_TIMEOUT{ 5000 };
+
+    //A key of a migration batch, erased ones tell the importing node to drop the copy it got before
+    struct MigratedKey {
+        std::string key;
+        ByteArray value;
+        bool erased = false;
+    };
+
+    //Entry of the keys in a payload: key size | value size | key | value, the sizes in network order
+    //Returns the offset of the value in the payload
+    uint64_t append_migrated_key(std::vector<char>& payload, std::string_view key, const char* value, uint64_t value_size, bool erased);
+
+    //Throws std::runtime_error if the payload doesn't consist of whole entries
+    std::vector<MigratedKey> parse_migrated_keys(std::span<const char> payload);
+
+    //Batch 0 without keys is the handshake, the importing node acknowledges it once it imports the slot from the sender
+    struct MigrationBatch {
+        std::string from;
+        uint16_t slot = 0;
+        uint64_t batch = 0;
+        std::vector<MigratedKey> keys;
+    };
+
+    //Streams the keys of migrating slots to the importing nodes
+    //A key is only erased here once the importing node acknowledged it with the value it still has, otherwise it is sent again
+    //The migration finishes once all keys of the slot were acknowledged
+    class SlotMigrator {
+    public:
+        explicit SlotMigrator(MigrationConfig config = CLUSTER_MIGRATION_CONFIG);
+
+        //Sends as many batches as the budget allows and finishes the migrations that are done
+        //Returns true if a migration ended, the cluster state changed then
+        bool send_batches(key_value_store::IKeyValueStore& kvs, ClusterState& state, MigrationClock::time_point now = MigrationClock::now());
+
+        //Erases the acknowledged keys, starts streaming the slot if it was the handshake
+        void handle_ack(const std::string& from, uint16_t slot, uint64_t batch, key_value_store::IKeyValueStore& kvs, ClusterState& state);
+
+        //Has to be called before a client erases the key, a copy the importing node might have got is erased as well
+        //That is sent right away, so it arrives before the migration might finish with the erase
+        void erase_key(std::string_view key, key_value_store::IKeyValueStore& kvs, ClusterState& state);
+
+        bool is_migrating(uint16_t slot) const {
+            return migrations_.contains(slot);
+        }
+
+        bool empty() const {
+            return migrations_.empty();
+        }
+
+        const MigrationConfig& get_config() const {
+            return config_;
+        }
+
+    private:
+        //A key of a sent batch and where its value is in the payload
+        struct SentKey {
+            std::string key;
+            uint64_t value_offset;
+            uint64_t value_size;
+        };
+
+        struct SentBatch {
+            std::vector<char> payload;
+            std::vector<SentKey> keys;
+            MigrationClock::time_point sent_at;
+        };
+
+        struct Migration {
+            //Keys that weren't sent yet or have to be sent again
+            std::deque<std::string> pending;
+            std::map<uint64_t, SentBatch> in_flight;
+            uint64_t next_batch = 1;
+        };
+
+        //Returns false if the migration was dropped or finished
+        bool send_migration_batches(uint16_t slot, Migration& migration, key_value_store::IKeyValueStore& kvs,
+            ClusterState& state, MigrationClock::time_point now);
+
+        void refill_budget(MigrationClock::time_point now);
+
+        MigrationConfig config_;
+        std::map<uint16_t, Migration> migrations_;
+        size_t batches_in_flight_ = 0;
+        //Token buckets, sending is allowed while they aren't in debt
+        double byte_budget_ = 0;
+        double key_budget_ = 0;
+        MigrationClock::time_point last_refill_{};
+    };
+
+    //Applies the batches of slots this node imports
+    //Keys clients wrote here while importing are newer than anything the migrating node still sends, so those are kept
+    class SlotImporter {
+    public:
+        //Has to be called for every key a client puts or erases
+        void record_client_write(std::string_view key, const ClusterState& state);
+
+        //Stores the keys and acknowledges the batch, batches of slots that aren't imported from the sender are ignored
+        void handle_batch(const MigrationBatch& batch, key_value_store::IKeyValueStore& kvs, ClusterState& state);
+
+        //Forgets the writes of the slots that aren't imported anymore
+        void drop_finished(const ClusterState& state);
+
+    private:
+        std::unordered_map<uint16_t, std::unordered_set<std::string>> client_writes_;
+    };
+
+    //Sends the handshake for a slot that started migrating, its keys are streamed once the partner acknowledged it
+    void request_migration_start(ClusterState& state, uint16_t slot);
+
+    //Makes the migration partner the owner of the slot and tells it the migration finished
+    void finish_slot_migration(ClusterState& state, uint16_t slot);
+
+    //Acknowledges a batch or the handshake of a migration to the migrating node
+    void send_migration_ack(ClusterState& state, ClusterNode& partner, uint16_t slot, uint64_t batch);
+
+    net::Task<MigrationBatch> read_migration_batch(net::Connection& link, const protocol::CommandView& command, uint64_t payload_size);
+
+}
@@ -1,4 +1,13 @@
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <optional>
+#include <random>
+#include <stdexcept>
 
 #include "Node.hpp"
 #include "InstructionHandler.hpp"
@@ -6,14 +15,32 @@
 #include "../KVS/IKeyValueStore.hpp"
 #include "../KVS/InMemoryKVS.hpp"
 #include "../net/Connection.hpp"
+#include "../net/SharedMemoryChannel.hpp"
 #include "../net/Socket.hpp"
 
 using MetaData = node::protocol::MetaData;
-using command = node::protocol::Command;
+using command = node::protocol::CommandView;
 using Instruction = node::protocol::Instruction;
 
 namespace node {
 
+    namespace {
+        //Every ping goes to a tenth of the cluster, larger clusters are pinged less often to stay below the maximum rate
+        std::chrono::milliseconds get_ping_pause(uint16_t cluster_size) {
+            static thread_local std::mt19937 random_engine(std::random_device{}());
+            double pings = std::ceil(cluster_size / 10.0);
+            double pause = std::max<double>(NODE_PING_PAUSE, pings * 1000.0 / NODE_MAX_PINGS_PER_SECOND);
+            std::uniform_real_distribution<double> jitter(1.0 - NODE_PING_JITTER / 100.0, 1.0 + NODE_PING_JITTER / 100.0);
+            return std::chrono::milliseconds(static_cast<int64_t>(pause * jitter(random_engine)));
+        }
+
+        //Grows across restarts, so a restarted node overrides that it was declared dead
+        uint64_t get_initial_incarnation() {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+        }
+    }
+
     Node::~Node() {
         stop();
     }
@@ -24,9 +51,16 @@ namespace node {
         uint16_t cluster_port,
         std::array<char, cluster::CLUSTER_NAME_LEN> name,
         std::array<char, cluster::CLUSTER_IP_LEN> ip,
-        bool serve_all_slots
-    ) {
-        kvs_ = std::move(kvs);
+        bool serve_all_slots,
+        std::string cluster_config_path
+    ) : membership_(std::string(name.data(), strnlen(name.data(), name.size())), get_initial_incarnation()) {
+        kvs_ = std::make_unique<cluster::ReplicatedKVS>(std::move(kvs), replication_source_);
+        data_loop_.reactor = net::new_reactor(net::ReactorBackend::c_EPOLL);
+        cluster_loop_.reactor = net::new_reactor(net::ReactorBackend::c_EPOLL);
+        cluster_updates_notify_ = net::FileDescriptor{ eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) };
+        if (cluster_updates_notify_.unwrap() < 0) {
+            throw std::runtime_error("Failed to create eventfd: " + std::to_string(errno));
+        }
         client_port_ = client_port;
         cluster_port_ = cluster_port;
         name_ = name;
@@ -39,23 +73,33 @@ namespace node {
         cluster_state_.myself.ip = ip;
         cluster_state_.size = 0;
 
-        if (!serve_all_slots) {
-            return;
+        //A restarted node rejoins with the nodes and slots it knew, its ip and ports are the ones it runs with now
+        cluster_config_path_ = std::move(cluster_config_path);
+        if (!cluster_config_path_.empty()) {
+            Status status = cluster::load_cluster_config(cluster_config_path_, cluster_state_);
+            if (!status.is_ok() && !status.is_not_found()) {
+                throw std::runtime_error("Failed to load the cluster config: " + status.get_msg());
+            }
+            restored_cluster_config_ = status.is_ok();
         }
 
         //Only start serving slots if specified, used for the first node of the cluster
-        for (int slot = 0; slot < cluster::CLUSTER_AMOUNT_OF_SLOTS; slot++) {
-            cluster_state_.slots[slot].amount_of_keys = 0;
-            cluster_state_.slots[slot].migration_partner = nullptr;
-            cluster_state_.slots[slot].state = cluster::SlotState::c_NORMAL;
-            cluster_state_.slots[slot].served_by = &cluster_state_.myself;
-            cluster_state_.myself.served_slots[slot] = true;
+        if (serve_all_slots && !restored_cluster_config_) {
+            for (int slot = 0; slot < cluster::CLUSTER_AMOUNT_OF_SLOTS; slot++) {
+                cluster_state_.slots[slot].amount_of_keys = 0;
+                cluster_state_.slots[slot].migration_partner = nullptr;
+                cluster_state_.slots[slot].state = cluster::SlotState::c_NORMAL;
+                cluster_state_.slots[slot].served_by = &cluster_state_.myself;
+                cluster_state_.myself.served_slots[slot] = true;
+            }
+            cluster_state_.myself.num_slots_served = cluster::CLUSTER_AMOUNT_OF_SLOTS;
+            cluster_state_.part_of_cluster = true;
         }
-        cluster_state_.myself.num_slots_served = cluster::CLUSTER_AMOUNT_OF_SLOTS;
-        cluster_state_.part_of_cluster = true;
+        publish_cluster_state();
     }
 
-    Node Node::new_in_memory_node(std::string name, uint16_t client_port, uint16_t cluster_port, std::string ip, bool serve_all_slots) {
+    Node Node::new_in_memory_node(std::string name, uint16_t client_port, uint16_t cluster_port, std::string ip, bool serve_all_slots,
+        std::string cluster_config_path) {
         assert(name.size() <= cluster::CLUSTER_NAME_LEN);
         assert(ip.size() <= cluster::CLUSTER_IP_LEN);
 
@@ -65,7 +109,8 @@ namespace node {
         std::array<char, cluster::CLUSTER_IP_LEN> ip_arr{};
         std::copy(ip.begin(), ip.end(), ip_arr.begin());
 
-        return Node{ std::make_unique<key_value_store::InMemoryKVS>(), client_port, cluster_port, name_arr, ip_arr, serve_all_slots };
+        return Node{ std::make_unique<key_value_store::InMemoryKVS>(cluster::get_key_slot, cluster::CLUSTER_AMOUNT_OF_SLOTS), client_port, cluster_port, name_arr, ip_arr, serve_all_slots,
+            std::move(cluster_config_path) };
     }
 
     void Node::main_loop() {
@@ -80,101 +125,1125 @@ namespace node {
         client_socket.listen(client_port_);
         cluster_socket.listen(cluster_port_);
 
-        connections_epoll_.add_event(client_socket.fd(), EPOLLIN | EPOLLET);
-        connections_epoll_.add_event(cluster_socket.fd(), EPOLLIN | EPOLLET);
+        data_loop_.reactor->add_listener(client_socket.fd());
+        data_loop_.reactor->add_notifier(cluster_updates_notify_.unwrap());
+        data_loop_.reactor->add_notifier(data_loop_.timers.fd());
+
+        std::optional<net::Socket> unix_socket = std::nullopt;
+        if (!unix_socket_path_.empty()) {
+            unix_socket.emplace(net::SocketFamily::c_UNIX);
+            unix_socket->set_non_blocking();
+            unix_socket->listen(unix_socket_path_);
+            data_loop_.reactor->add_listener(unix_socket->fd());
+        }
 
+        //A joinable thread that is destroyed terminates the process, so it is stopped on every way out, before the socket closes
+        struct ClusterThreadGuard {
+            Node& node;
+            ~ClusterThreadGuard() {
+                if (node.cluster_thread_.joinable()) {
+                    node.running_ = false;
+                    node.cluster_thread_.join();
+                }
+            }
+        } cluster_thread_guard{ *this };
+        //Both sockets listen before the threads run, so nobody is refused in between
+        cluster_thread_ = std::thread(&Node::cluster_loop, this, cluster_socket.fd());
+
+        //The state might have been changed before the start
+        cluster_state_.slot_map_changed = true;
+        publish_cluster_state();
+        update_cluster_links();
+        //The importing node drives a migration, the migrating one streams again once asked, the keys imported before might be gone
+        if (restored_cluster_config_) {
+            for (uint16_t slot = 0; slot < cluster::CLUSTER_AMOUNT_OF_SLOTS; slot++) {
+                if (cluster_state_.slots[slot].state == cluster::SlotState::c_IMPORTING) {
+                    cluster::request_migration_start(cluster_state_, slot);
+                }
+            }
+            restored_cluster_config_ = false;
+        }
+        last_load_measurement_ = std::chrono::steady_clock::now();
+        data_loop_.timers.add(cluster::CLUSTER_LOAD_INTERVAL, [this]() { measure_load(); });
+        replicate();
         while (running_) {
-            int num_ready = connections_epoll_.wait(NODE_WAIT_TIMEOUT);
-            if (!running_) {
-                break;
+            poll(data_loop_, client_socket.fd(), ConnectionClass::c_CLIENT);
+            if (cluster_state_changed_) {
+                publish_cluster_state();
             }
+        }
+
+        cluster_thread_.join();
+        data_loop_.reactor->remove_notifier(data_loop_.timers.fd());
+        data_loop_.reactor->remove_notifier(cluster_updates_notify_.unwrap());
+        data_loop_.reactor->remove_listener(client_socket.fd());
+        if (unix_socket.has_value()) {
+            data_loop_.reactor->remove_listener(unix_socket->fd());
+            ::unlink(unix_socket_path_.c_str());
+        }
+    }
 
-            for (int i = 0; i < num_ready; i++) {
-                int fd = connections_epoll_.get_event_fd(i);
+    void Node::cluster_loop(int cluster_socket_fd) {
+        //Best effort, the cluster bus still has its own thread otherwise
+        [[maybe_unused]] int result = setpriority(PRIO_PROCESS, static_cast<id_t>(gettid()), NODE_CLUSTER_LOOP_NICE);
 
-                //New connection
-                if (fd == client_socket.fd() || fd == cluster_socket.fd() && !fd_to_connection_.contains(fd)) {
-                    net::Socket& receiving_socket = fd == client_socket.fd() ? client_socket : cluster_socket;
-                    try {
-                        net::Connection connection = receiving_socket.accept();
-                        connections_epoll_.add_event(connection.fd(), EPOLLIN | EPOLLET);
-                        fd_to_connection_[connection.fd()] = connection;
-                    }
-                    catch (std::exception& e) {
-                        continue;
-                    }
+        cluster_loop_.reactor->add_listener(cluster_socket_fd);
+        cluster_loop_.reactor->add_notifier(cluster_loop_.timers.fd());
+        gossip();
+        membership_tick();
+        while (running_) {
+            poll(cluster_loop_, cluster_socket_fd, ConnectionClass::c_CLUSTER);
+        }
+        cluster_loop_.reactor->remove_notifier(cluster_loop_.timers.fd());
+        cluster_loop_.reactor->remove_listener(cluster_socket_fd);
+    }
+
+    void Node::poll(EventLoop& loop, int listener_fd, ConnectionClass connection_class) {
+        int num_ready = loop.reactor->wait(NODE_WAIT_TIMEOUT);
+        if (!running_) {
+            return;
+        }
+
+        for (int i = 0; i < num_ready; i++) {
+            int fd = loop.reactor->get_event_fd(i);
+            net::ReactorEvent event = loop.reactor->get_event_type(i);
+
+            switch (event) {
+            case net::ReactorEvent::c_ACCEPTED:
+            {
+                //Connections from the unix domain socket are handled like client connections
+                ConnectionClass accepted_class = fd == listener_fd ? connection_class : ConnectionClass::c_CLIENT;
+                net::Connection connection = loop.reactor->get_accepted_connection(i);
+                connection.enable_output_buffering(output_buffer_limits_[protocol::to_integral(accepted_class)]);
+                connection.enable_async_io();
+                loop.reactor->add_connection(connection);
+
+                fd = connection.fd();
+                start_handler(loop, connection);
+                break;
+            }
+            case net::ReactorEvent::c_READABLE:
+                if (fd == cluster_updates_notify_.unwrap()) {
+                    apply_cluster_updates();
+                }
+                else if (fd == loop.timers.fd()) {
+                    loop.timers.run_expired();
                 }
+                else {
+                    resume_handler(loop, fd, net::Readiness::c_INPUT);
+                }
+                break;
+            case net::ReactorEvent::c_CLOSED:
+                if (loop.fd_to_connection.contains(fd)) {
+                    disconnect(loop, loop.fd_to_connection[fd]);
+                }
+                break;
+            default:
+                break;
+            }
 
-                //Existing connection
-                else if (connections_epoll_.get_events()[i].events & EPOLLIN) {
-                    net::Connection& connection = fd_to_connection_[fd];
-                    //std::unique_lock lock{cluster_state_mutex_};
-                    handle_connection(connection);
+            //The connection is gone if handling a request failed
+            if (loop.fd_to_connection.contains(fd) && (event == net::ReactorEvent::c_WRITABLE || loop.fd_to_connection[fd].has_pending_output())) {
+                flush_connection(loop, loop.fd_to_connection[fd]);
+                //A handler waiting in write_all() might continue now and write more
+                resume_handler(loop, fd, net::Readiness::c_OUTPUT);
+                if (loop.fd_to_connection.contains(fd) && loop.fd_to_connection[fd].has_pending_output()) {
+                    flush_connection(loop, loop.fd_to_connection[fd]);
                 }
             }
         }
     }
 
     void Node::gossip() {
-        while (gossiping_) {
-            if (cluster_state_.part_of_cluster) {
-                cluster::send_ping(cluster_state_);
+        if (!gossiping_) {
+            return;
+        }
+        //Key counts change with every PUT, so they are only published when the next ping needs them
+        post_cluster_update([this]() {
+            cluster_state_changed_ = true;
+        });
+
+        //Links that were connecting flush what was queued meanwhile
+        for (auto& [name, gossip_link] : gossip_links_) {
+            gossip_link.link.update();
+        }
+
+        std::shared_ptr<const cluster::ClusterSnapshot> snapshot = cluster_snapshot_.load();
+        if (snapshot->part_of_cluster) {
+            cluster::send_ping(*snapshot, gossip_links_, output_buffer_limits_[protocol::to_integral(ConnectionClass::c_CLUSTER)]);
+        }
+        cluster_loop_.timers.add(get_ping_pause(snapshot->size), [this]() { gossip(); });
+    }
+
+    void Node::update_cluster_links() {
+        if (!running_) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        for (auto& [name, node] : cluster_state_.nodes) {
+            node.outgoing_link.update(now);
+        }
+        data_loop_.timers.add(std::chrono::milliseconds{ NODE_PING_PAUSE }, [this]() { update_cluster_links(); });
+    }
+
+    void Node::membership_tick() {
+        if (!gossiping_) {
+            return;
+        }
+
+        cluster::MembershipClock::time_point now = cluster::MembershipClock::now();
+        std::shared_ptr<const cluster::ClusterSnapshot> snapshot = cluster_snapshot_.load();
+        if (snapshot->part_of_cluster) {
+            std::vector<std::string> names;
+            names.reserve(snapshot->nodes.size());
+            for (const cluster::ClusterNodeGossipData& node : snapshot->nodes) {
+                names.emplace_back(node.name.data());
+            }
+            membership_.set_members(names);
+            send_membership_messages(membership_.tick(now));
+            post_membership_changes();
+        }
+
+        //Deadlines added by the messages handled in between are noticed at most one probe interval late
+        auto delay = std::clamp<cluster::MembershipClock::duration>(membership_.get_next_deadline() - now,
+            std::chrono::milliseconds{ 1 }, membership_.get_config().probe_interval);
+        cluster_loop_.timers.add(delay, [this]() { membership_tick(); });
+    }
+
+    void Node::send_membership_messages(const std::vector<cluster::MembershipMessage>& messages) {
+        std::shared_ptr<const cluster::ClusterSnapshot> snapshot = cluster_snapshot_.load();
+        for (const cluster::MembershipMessage& message : messages) {
+            auto node = std::find_if(snapshot->nodes.begin(), snapshot->nodes.end(),
+                [&message](const cluster::ClusterNodeGossipData& node) { return message.to == node.name.data(); });
+            if (node == snapshot->nodes.end()) {
+                continue;
+            }
+            //A message that is lost counts as a failed probe
+            cluster::GossipLink& gossip_link = cluster::get_gossip_link(*node, gossip_links_, output_buffer_limits_[protocol::to_integral(ConnectionClass::c_CLUSTER)]);
+            if (gossip_link.link.update() == cluster::LinkState::c_DISCONNECTED) {
+                continue;
+            }
+            try {
+                cluster::send_membership_message(gossip_link.link.get_connection(), message);
+                gossip_link.link.update();
+            }
+            catch (const std::runtime_error& e) {
+                gossip_link.link.fail();
+                gossip_link.sent_version = 0;
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(NODE_PING_PAUSE));
         }
     }
 
-    void Node::execute_instruction(net::Connection& connection, const MetaData& meta_data, const command& command) {
+    void Node::post_membership_changes() {
+        for (auto& [name, state] : membership_.take_changes()) {
+            if (state == cluster::MemberState::c_SUSPECT) {
+                continue;
+            }
+            post_cluster_update([this, name = std::move(name), failed = state == cluster::MemberState::c_DEAD]() {
+                auto node = cluster_state_.nodes.find(name);
+                if (node != cluster_state_.nodes.end() && node->second.failed != failed) {
+                    node->second.failed = failed;
+                    cluster_state_.slot_map_changed = true;
+                    cluster_state_changed_ = true;
+                }
+            });
+        }
+    }
+
+    void Node::run_migrations() {
+        if (slot_migrator_.send_batches(get_kvs(), cluster_state_)) {
+            cluster_state_changed_ = true;
+        }
+        if (slot_migrator_.empty() || migrations_scheduled_ || !running_) {
+            return;
+        }
+        migrations_scheduled_ = true;
+        data_loop_.timers.add(std::chrono::milliseconds{ NODE_MIGRATION_PAUSE }, [this]() {
+            migrations_scheduled_ = false;
+            run_migrations();
+        });
+    }
+
+    void Node::measure_load() {
+        if (!running_) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        slot_load_.update(now - last_load_measurement_);
+        last_load_measurement_ = now;
+
+        cluster_state_.myself.load = slot_load_.get_node_load(get_kvs(), cluster_state_);
+        cluster_state_.myself.load.version = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        cluster_state_changed_ = true;
+        data_loop_.timers.add(cluster::CLUSTER_LOAD_INTERVAL, [this]() { measure_load(); });
+    }
+
+    void Node::record_load(std::string_view key, uint64_t bytes) {
+        uint16_t slot = cluster::get_key_slot(key);
+        if (cluster_state_.myself.served_slots[slot]) {
+            slot_load_.record(slot, bytes);
+        }
+    }
+
+    void Node::replicate() {
+        if (!running_) {
+            return;
+        }
+        auto now = cluster::ReplicationClock::now();
+        if (failover_.update(cluster_state_, replication_sink_.has_history(), now)) {
+            //Its other replicas continue from the offset they got from the failed primary
+            replication_source_.enable(replication_sink_.get_replication_id(), replication_sink_.get_offset());
+        }
+
+        std::string primary = cluster_state_.myself.primary.data();
+        if (primary != replication_sink_.get_primary()) {
+            replication_sink_.follow(primary);
+            if (!primary.empty()) {
+                replication_source_.disable();
+            }
+            cluster_state_changed_ = true;
+        }
+
+        replication_source_.send(get_kvs(), cluster_state_, now);
+        replication_sink_.update(cluster_state_, now);
+        data_loop_.timers.add(std::chrono::milliseconds{ NODE_REPLICATION_PAUSE }, [this]() { replicate(); });
+    }
+
+    cluster::ReplicationInfo Node::get_replication_info() const {
+        cluster::ReplicationInfo info{};
+        if (!replication_sink_.get_primary().empty()) {
+            info.primary = replication_sink_.get_primary();
+            info.replication_id = replication_sink_.get_replication_id();
+            info.offset = replication_sink_.get_offset();
+            info.synced = replication_sink_.is_synced();
+            return info;
+        }
+        info.replication_id = replication_source_.get_replication_id();
+        info.offset = replication_source_.get_offset();
+        info.synced = true;
+        info.replicas = replication_source_.get_replicas();
+        return info;
+    }
+
+    void Node::post_cluster_update(std::function<void()> update) {
+        {
+            std::lock_guard<std::mutex> lock(cluster_updates_mutex_);
+            cluster_updates_.push_back(std::move(update));
+        }
+        uint64_t count = 1;
+        [[maybe_unused]] ssize_t result = ::write(cluster_updates_notify_.unwrap(), &count, sizeof(count));
+    }
+
+    void Node::apply_cluster_updates() {
+        //Reset before taking the updates, a later post signals again
+        uint64_t count;
+        [[maybe_unused]] ssize_t result = ::read(cluster_updates_notify_.unwrap(), &count, sizeof(count));
+
+        std::vector<std::function<void()>> updates;
+        {
+            std::lock_guard<std::mutex> lock(cluster_updates_mutex_);
+            updates.swap(cluster_updates_);
+        }
+        for (auto& update : updates) {
+            try {
+                update();
+            }
+            catch (const std::exception& e) {
+                //A node that can't be reached is tried again with the next ping
+            }
+        }
+    }
+
+    void Node::publish_cluster_state() {
+        std::shared_ptr<const cluster::ClusterSnapshot> previous = cluster_snapshot_.load();
+        //Other nodes only accept the slots of this node from the newest configuration
+        if (previous != nullptr && (previous->myself.served_slots != cluster_state_.myself.served_slots
+            || previous->myself.primary != cluster_state_.myself.primary)) {
+            cluster_state_.myself.config_epoch++;
+            cluster_state_.slot_map_changed = true;
+        }
+        std::shared_ptr<const cluster::ClusterSnapshot> snapshot = cluster::make_snapshot(cluster_state_, ++cluster_state_version_, previous.get());
+        cluster_snapshot_.store(snapshot);
+        cluster_state_changed_ = false;
+        refresh_slot_map();
+
+        if (!cluster_config_path_.empty()) {
+            std::string config = cluster::serialize_cluster_config(*snapshot);
+            //A failed write is tried again with the next publish
+            if (config != saved_cluster_config_ && cluster::save_cluster_config(cluster_config_path_, config).is_ok()) {
+                saved_cluster_config_ = std::move(config);
+            }
+        }
+    }
+
+    net::Task<> Node::execute_instruction(net::Connection& connection, const MetaData& meta_data, const command& command) {
+        if (std::optional<cluster::ProxyRoute> route = get_proxy_route(connection, meta_data, command); route.has_value()) {
+            co_await proxy_request(connection, meta_data, command, std::move(*route));
+            co_return;
+        }
+
+        //Key counts changed by PUT are published with the next ping
         switch (meta_data.instruction) {
         case Instruction::c_PUT:
-            instruction_handler::handle_put(connection, meta_data, command, get_kvs(), cluster_state_);
+        {
+            //Recorded before, a migrated key applied while the payload is received must not override it
+            if (command.size() == protocol::to_integral(protocol::CommandFieldsPut::enum_size)) {
+                slot_importer_.record_client_write(command[protocol::to_integral(protocol::CommandFieldsPut::c_KEY)], cluster_state_);
+            }
+            //The fields are only trusted once the handler checked them
+            uint64_t bytes = co_await instruction_handler::handle_put(connection, meta_data, command, get_kvs(), cluster_state_);
+            if (command.size() == protocol::to_integral(protocol::CommandFieldsPut::enum_size)) {
+                record_load(command[protocol::to_integral(protocol::CommandFieldsPut::c_KEY)], bytes);
+            }
             break;
+        }
         case Instruction::c_GET:
-            instruction_handler::handle_get(connection, command, get_kvs(), cluster_state_);
+        {
+            //Replicas only answer once they have all keys of their primary
+            bool read_only = read_only_connections_.contains(connection.fd()) && replication_sink_.is_synced();
+            uint64_t bytes = co_await instruction_handler::handle_get(connection, command, get_kvs(), cluster_state_, read_only);
+            if (command.size() == protocol::to_integral(protocol::CommandFieldsGet::enum_size)) {
+                record_load(command[protocol::to_integral(protocol::CommandFieldsGet::c_KEY)], bytes);
+            }
             break;
+        }
         case Instruction::c_ERASE:
-            instruction_handler::handle_erase(connection, command, get_kvs(), cluster_state_);
+            if (command.size() == protocol::to_integral(protocol::CommandFieldsErase::enum_size)) {
+                std::string_view key = command[protocol::to_integral(protocol::CommandFieldsErase::c_KEY)];
+                slot_migrator_.erase_key(key, get_kvs(), cluster_state_);
+                slot_importer_.record_client_write(key, cluster_state_);
+                record_load(key, 0);
+            }
+            co_await instruction_handler::handle_erase(connection, command, get_kvs(), cluster_state_);
+            cluster_state_changed_ = true;
             break;
         case Instruction::c_MEET:
-            instruction_handler::handle_meet(connection, command, cluster_state_);
+            co_await instruction_handler::handle_meet(connection, command, cluster_state_);
+            cluster_state_changed_ = true;
             break;
         case Instruction::c_MIGRATE_SLOT:
-            instruction_handler::handle_migrate_slot(connection, command, cluster_state_);
+            co_await instruction_handler::handle_migrate_slot(connection, command, get_kvs(), cluster_state_);
+            cluster_state_changed_ = true;
             break;
         case Instruction::c_IMPORT_SLOT:
-            instruction_handler::handle_import_slot(connection, command, cluster_state_);
+            co_await instruction_handler::handle_import_slot(connection, command, cluster_state_);
+            cluster_state_changed_ = true;
+            break;
+        case Instruction::c_GET_SLOTS:
+            co_await instruction_handler::handle_get_slots(connection, command, cluster_state_);
+            break;
+        case Instruction::c_GET_SLOT_MAP:
+            //Changes made by requests are only published with the next ping
+            refresh_slot_map();
+            co_await instruction_handler::handle_get_slot_map(connection, command, cluster_state_, slot_map_);
+            break;
+        case Instruction::c_GET_LOAD:
+            co_await instruction_handler::handle_get_load(connection, command, cluster_state_);
+            break;
+        case Instruction::c_GET_SLOT_STATS:
+            co_await instruction_handler::handle_get_slot_stats(connection, command, get_kvs(), cluster_state_, slot_load_);
             break;
+        case Instruction::c_REPLICATE:
+            co_await instruction_handler::handle_replicate(connection, command, cluster_state_);
+            cluster_state_changed_ = true;
+            break;
+        case Instruction::c_READ_ONLY:
+            if (co_await instruction_handler::handle_read_only(connection, command)) {
+                read_only_connections_.insert(connection.fd());
+            }
+            break;
+        case Instruction::c_SUBSCRIBE_SLOTS:
+            if (co_await instruction_handler::handle_subscribe_slots(connection, command)) {
+                co_await subscribe_slot_updates(connection);
+            }
+            break;
+        case Instruction::c_MGET:
+        case Instruction::c_MSET:
+            co_await handle_multi_key(connection, meta_data, command);
+            break;
+        case Instruction::c_PROXY:
+            if (co_await instruction_handler::handle_proxy(connection, command)) {
+                proxied_connections_.insert(connection.fd());
+            }
+            break;
+        case Instruction::c_GET_REPLICATION_INFO:
+            co_await instruction_handler::handle_get_replication_info(connection, command, get_replication_info());
+            break;
+        case Instruction::c_CLUSTER_PING:
         case Instruction::c_CLUSTER_MIGRATION_FINISHED:
-            instruction_handler::handle_migration_finished(command, cluster_state_);
+            //The cluster loop applies these, a client must not change the cluster state behind its back
+            co_await protocol::skip_payload(connection, meta_data.payload_size);
+            co_await protocol::write_instruction(connection, Status::new_not_supported("Cluster bus instructions are only accepted on the cluster port"));
             break;
-        case Instruction::c_GET_SLOTS:
-            instruction_handler::handle_get_slots(connection, command, cluster_state_);
+        case Instruction::c_SHARED_MEMORY:
+        {
+            std::shared_ptr<net::SharedMemoryChannel> channel = co_await instruction_handler::handle_shared_memory(connection, command);
+            if (channel != nullptr) {
+                serve_shared_memory(connection.fd(), std::move(channel));
+            }
             break;
+        }
+        default:
+            co_await protocol::write_instruction(connection, Status::new_not_supported("Unknown instruction"));
+            break;
+        }
+    }
+
+    void Node::disconnect(EventLoop& loop, net::Connection& connection) {
+        if (connection.fd() == -1 || !loop.fd_to_connection.contains(connection.fd())) {
+            return;
+        }
+        int fd = connection.fd();
+        if (connection.is_shared_memory()) {
+            loop.reactor->remove_notifier(fd);
+            std::erase_if(socket_to_channel_fd_, [fd](const auto& entry) { return entry.second == fd; });
+        }
+        else {
+            loop.reactor->remove_connection(fd);
+        }
+        loop.fd_to_handler.erase(fd);
+        loop.fd_to_connection.erase(fd);
+
+        //Shared memory channels and read only clients only exist on the data loop
+        if (&loop != &data_loop_) {
+            return;
+        }
+        read_only_connections_.erase(fd);
+        proxied_connections_.erase(fd);
+        slot_subscribers_.erase(fd);
+        auto address = proxy_link_addresses_.find(fd);
+        if (address != proxy_link_addresses_.end()) {
+            std::string error = "Lost the connection to " + address->second;
+            auto link = proxy_links_.find(address->second);
+            proxy_link_addresses_.erase(address);
+            //The waiting requests might send new ones, they must not end up on the failed link
+            cluster::ProxyLink failed = std::move(link->second);
+            proxy_links_.erase(link);
+            for (int client_fd : failed.fail(error)) {
+                finish_proxied_response(client_fd);
+            }
+        }
+        auto channel = socket_to_channel_fd_.find(fd);
+        if (channel != socket_to_channel_fd_.end()) {
+            int channel_fd = channel->second;
+            socket_to_channel_fd_.erase(channel);
+            if (loop.fd_to_connection.contains(channel_fd)) {
+                disconnect(loop, loop.fd_to_connection[channel_fd]);
+            }
+        }
+    }
+
+    void Node::start_handler(EventLoop& loop, net::Connection connection) {
+        int fd = connection.fd();
+        loop.fd_to_connection[fd] = connection;
+        if (&loop == &cluster_loop_) {
+            loop.fd_to_handler[fd] = serve_cluster_connection(loop.fd_to_connection[fd]);
+        }
+        else {
+            loop.fd_to_handler[fd] = serve_connection(loop.fd_to_connection[fd]);
+        }
+        loop.fd_to_handler[fd].start();
+        if (loop.fd_to_handler[fd].done()) {
+            disconnect(loop, loop.fd_to_connection[fd]);
+        }
+    }
+
+    void Node::serve_shared_memory(int socket_fd, std::shared_ptr<net::SharedMemoryChannel> channel) {
+        //A channel that was set up before on the same socket is replaced
+        auto previous = socket_to_channel_fd_.find(socket_fd);
+        if (previous != socket_to_channel_fd_.end() && data_loop_.fd_to_connection.contains(previous->second)) {
+            disconnect(data_loop_, data_loop_.fd_to_connection[previous->second]);
+        }
+
+        net::Connection connection{ std::move(channel) };
+        connection.enable_output_buffering(output_buffer_limits_[protocol::to_integral(ConnectionClass::c_CLIENT)]);
+        connection.enable_async_io();
+        data_loop_.reactor->add_notifier(connection.fd());
+        socket_to_channel_fd_[socket_fd] = connection.fd();
+        start_handler(data_loop_, connection);
+    }
+
+    void Node::resume_handler(EventLoop& loop, int fd, net::Readiness readiness) {
+        if (!loop.fd_to_connection.contains(fd)) {
+            return;
+        }
+        loop.fd_to_connection[fd].resume_waiting(readiness);
+
+        //The handler only finishes if a request failed
+        if (loop.fd_to_handler[fd].done()) {
+            disconnect(loop, loop.fd_to_connection[fd]);
+        }
+    }
+
+    void Node::flush_connection(EventLoop& loop, net::Connection& connection) {
+        try {
+            //The client signals the eventfd when it made room in the ring, the reactor isn't involved
+            if (connection.is_shared_memory()) {
+                connection.flush();
+            }
+            else {
+                loop.reactor->flush(connection);
+            }
+        }
+        catch (const std::exception& e) {
+            disconnect(loop, connection);
+        }
+    }
+
+    net::Task<> Node::handle_request(net::Connection& connection) {
+        MetaData meta_data = co_await node::protocol::read_metadata(connection);
+        command command = co_await node::protocol::read_command(connection, meta_data.argc, meta_data.command_size);
+        co_await execute_instruction(connection, meta_data, command);
+    }
+
+    net::Task<> Node::handle_cluster_request(net::Connection& connection) {
+        MetaData meta_data = co_await node::protocol::read_metadata(connection);
+        command command = co_await node::protocol::read_command(connection, meta_data.argc, meta_data.command_size);
+
+        switch (meta_data.instruction) {
         case Instruction::c_CLUSTER_PING:
-            cluster::handle_ping(connection, cluster_state_, command);
+        {
+            cluster::ClusterGossipMsg msg = co_await cluster::read_ping(connection, command);
+            post_cluster_update([this, msg = std::move(msg)]() {
+                cluster::apply_ping(cluster_state_, msg);
+                cluster_state_changed_ = true;
+            });
+            break;
+        }
+        case Instruction::c_CLUSTER_FULL_SYNC:
+        {
+            //The links belong to this loop, the next ping on the link carries all slot ranges
+            if (command.size() != protocol::to_integral(protocol::CommandFieldsFullSync::enum_size)) {
+                throw std::runtime_error("Wrong number of arguments for CLUSTER_FULL_SYNC");
+            }
+            auto link = gossip_links_.find(std::string(command[protocol::to_integral(protocol::CommandFieldsFullSync::c_NAME)]));
+            if (link != gossip_links_.end()) {
+                link->second.sent_version = 0;
+            }
+            break;
+        }
+        case Instruction::c_CLUSTER_PROBE:
+        {
+            cluster::MembershipMessage message = co_await cluster::read_membership_message(connection, command);
+            send_membership_messages(membership_.handle(message, cluster::MembershipClock::now()));
+            post_membership_changes();
+            break;
+        }
+        case Instruction::c_CLUSTER_MIGRATION_FINISHED:
+            //The view points into the receive buffer, which is reused for the next request
+            post_cluster_update([this, owned_command = command.to_command()]() {
+                instruction_handler::handle_migration_finished(owned_command, cluster_state_);
+                slot_importer_.drop_finished(cluster_state_);
+                cluster_state_changed_ = true;
+            });
+            break;
+        case Instruction::c_CLUSTER_MIGRATE_KEYS:
+        {
+            cluster::MigrationBatch batch = co_await cluster::read_migration_batch(connection, command, meta_data.payload_size);
+            post_cluster_update([this, batch = std::move(batch)]() {
+                slot_importer_.handle_batch(batch, get_kvs(), cluster_state_);
+            });
+            break;
+        }
+        case Instruction::c_CLUSTER_MIGRATE_KEYS_ACK:
+        {
+            if (command.size() != protocol::to_integral(protocol::CommandFieldsMigrateKeysAck::enum_size)) {
+                throw std::runtime_error("Wrong number of arguments for CLUSTER_MIGRATE_KEYS_ACK");
+            }
+            uint64_t slot = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsMigrateKeysAck::c_SLOT)]);
+            if (slot >= cluster::CLUSTER_AMOUNT_OF_SLOTS) {
+                throw std::runtime_error("Invalid CLUSTER_MIGRATE_KEYS_ACK");
+            }
+            //Every ack makes room for another batch
+            post_cluster_update([this, from = std::string(command[protocol::to_integral(protocol::CommandFieldsMigrateKeysAck::c_NAME)]),
+                slot = static_cast<uint16_t>(slot),
+                batch = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsMigrateKeysAck::c_BATCH)])]() {
+                slot_migrator_.handle_ack(from, slot, batch, get_kvs(), cluster_state_);
+                run_migrations();
+            });
+            break;
+        }
+        case Instruction::c_CLUSTER_REPLICA_SYNC:
+        {
+            if (command.size() != protocol::to_integral(protocol::CommandFieldsReplicaSync::enum_size)) {
+                throw std::runtime_error("Wrong number of arguments for CLUSTER_REPLICA_SYNC");
+            }
+            post_cluster_update([this, replica = std::string(command[protocol::to_integral(protocol::CommandFieldsReplicaSync::c_NAME)]),
+                replication_id = std::string(command[protocol::to_integral(protocol::CommandFieldsReplicaSync::c_REPLICATION_ID)]),
+                offset = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsReplicaSync::c_OFFSET)])]() {
+                replication_source_.attach(replica, replication_id, offset, get_kvs(), cluster_state_);
+            });
+            break;
+        }
+        case Instruction::c_CLUSTER_REPLICATION_DATA:
+        {
+            cluster::ReplicationData data = co_await cluster::read_replication_data(connection, command, meta_data.payload_size);
+            post_cluster_update([this, data = std::move(data)]() {
+                replication_sink_.handle_data(data, get_kvs(), cluster_state_);
+            });
+            break;
+        }
+        case Instruction::c_CLUSTER_FAILOVER_VOTE_REQUEST:
+        {
+            if (command.size() != protocol::to_integral(protocol::CommandFieldsFailoverVoteRequest::enum_size)) {
+                throw std::runtime_error("Wrong number of arguments for CLUSTER_FAILOVER_VOTE_REQUEST");
+            }
+            post_cluster_update([this, candidate = std::string(command[protocol::to_integral(protocol::CommandFieldsFailoverVoteRequest::c_NAME)]),
+                epoch = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsFailoverVoteRequest::c_EPOCH)]),
+                primary = std::string(command[protocol::to_integral(protocol::CommandFieldsFailoverVoteRequest::c_PRIMARY_NAME)])]() {
+                failover_.handle_vote_request(candidate, epoch, primary, cluster_state_);
+            });
+            break;
+        }
+        case Instruction::c_CLUSTER_FAILOVER_VOTE:
+        {
+            if (command.size() != protocol::to_integral(protocol::CommandFieldsFailoverVote::enum_size)) {
+                throw std::runtime_error("Wrong number of arguments for CLUSTER_FAILOVER_VOTE");
+            }
+            post_cluster_update([this, voter = std::string(command[protocol::to_integral(protocol::CommandFieldsFailoverVote::c_NAME)]),
+                epoch = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsFailoverVote::c_EPOCH)])]() {
+                failover_.handle_vote(voter, epoch);
+            });
             break;
+        }
+        case Instruction::c_CLUSTER_REPLICA_ACK:
+        {
+            if (command.size() != protocol::to_integral(protocol::CommandFieldsReplicaAck::enum_size)) {
+                throw std::runtime_error("Wrong number of arguments for CLUSTER_REPLICA_ACK");
+            }
+            post_cluster_update([this, replica = std::string(command[protocol::to_integral(protocol::CommandFieldsReplicaAck::c_NAME)]),
+                replication_id = std::string(command[protocol::to_integral(protocol::CommandFieldsReplicaAck::c_REPLICATION_ID)]),
+                offset = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsReplicaAck::c_OFFSET)])]() {
+                replication_source_.handle_ack(replica, replication_id, offset);
+            });
+            break;
+        }
         default:
-            protocol::send_instruction(connection, Status::new_not_supported("Unknown instruction"));
+            //Everything else needs the key value store, which belongs to the data path
+            co_await protocol::write_instruction(connection, Status::new_not_supported("Only cluster bus instructions are accepted on the cluster port"));
+            co_await connection.drain();
+            throw std::runtime_error("Unexpected instruction on the cluster bus");
+        }
+    }
+
+    net::Task<> Node::serve_connection(net::Connection& connection) {
+        while (true) {
+            co_await handle_request(connection);
+        }
+    }
+
+    std::optional<cluster::ProxyRoute> Node::get_proxy_route(const net::Connection& connection, const MetaData& meta_data, const command& command) {
+        //Requests forwarded by another node are redirected, so two nodes that disagree about a slot don't forward them back and forth
+        if (!proxy_mode_ || proxied_connections_.contains(connection.fd())) {
+            return std::nullopt;
+        }
+
+        //Malformed requests are answered by their handlers
+        bool asking = false;
+        switch (meta_data.instruction) {
+        case Instruction::c_PUT:
+            if (command.size() != protocol::to_integral(protocol::CommandFieldsPut::enum_size)) {
+                return std::nullopt;
+            }
+            break;
+        case Instruction::c_GET:
+        {
+            if (command.size() != protocol::to_integral(protocol::CommandFieldsGet::enum_size)) {
+                return std::nullopt;
+            }
+            uint16_t slot = cluster::get_key_slot(command[protocol::to_integral(protocol::CommandFieldsGet::c_KEY)]);
+            bool read_only = read_only_connections_.contains(connection.fd()) && replication_sink_.is_synced();
+            if (read_only && instruction_handler::is_served_by_primary(slot, cluster_state_)) {
+                return std::nullopt;
+            }
+            asking = command[protocol::to_integral(protocol::CommandFieldsGet::c_ASKING)] == "true";
+            break;
+        }
+        case Instruction::c_ERASE:
+            if (command.size() != protocol::to_integral(protocol::CommandFieldsErase::enum_size)) {
+                return std::nullopt;
+            }
+            asking = command[protocol::to_integral(protocol::CommandFieldsErase::c_ASKING)] == "true";
             break;
+        default:
+            return std::nullopt;
+        }
+        //The key is the first field of all three
+        return cluster::get_proxy_route(meta_data.instruction, command[0], asking, get_kvs(), cluster_state_);
+    }
+
+    net::Task<> Node::proxy_request(net::Connection& connection, const MetaData& meta_data, const command& command, cluster::ProxyRoute route) {
+        //The view is only valid until the next request is received on the connection
+        protocol::Command forwarded = command.to_command();
+        ByteArray payload{};
+        if (meta_data.instruction == Instruction::c_PUT) {
+            uint64_t size = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsPut::c_CUR_PAYLOAD_SIZE)]);
+            payload = ByteArray::new_allocated_byte_array(size);
+            co_await protocol::read_payload(connection, payload.data(), size);
+        }
+
+        std::optional<cluster::ProxyResponse> response = std::nullopt;
+        std::string error;
+        for (int redirects = 0; redirects <= cluster::CLUSTER_PROXY_MAX_REDIRECTS; redirects++) {
+            if (meta_data.instruction == Instruction::c_GET) {
+                forwarded[protocol::to_integral(protocol::CommandFieldsGet::c_ASKING)] = route.asking ? "true" : "false";
+            }
+            else if (meta_data.instruction == Instruction::c_ERASE) {
+                forwarded[protocol::to_integral(protocol::CommandFieldsErase::c_ASKING)] = route.asking ? "true" : "false";
+            }
+
+            std::optional<cluster::ProxyLink::Receive> received = forward_request(route, forwarded, meta_data.instruction,
+                std::span<const char>(payload.data(), payload.size()), connection.fd());
+            if (!received.has_value()) {
+                error = "Could not connect to " + route.ip + ":" + std::to_string(route.client_port);
+                break;
+            }
+
+            cluster::ProxyLink::Receive& receive = *received;
+            try {
+                response = co_await receive;
+            }
+            catch (const std::exception& e) {
+                error = e.what();
+                response = std::nullopt;
+                break;
+            }
+            std::optional<cluster::ProxyRoute> redirect = cluster::get_redirect_route(response->meta_data, response->command);
+            if (!redirect.has_value()) {
+                break;
+            }
+            route = std::move(*redirect);
+        }
+
+        if (!response.has_value()) {
+            co_await protocol::write_instruction(connection, Status::new_error("Failed to forward the request: " + error));
+            co_return;
         }
+        //After too many redirects the last one goes to the client
+        co_await protocol::write_instruction(connection, response->command, response->meta_data.instruction,
+            response->payload.data(), response->payload.size());
     }
 
-    void Node::disconnect(net::Connection& connection) {
-        if (connection.fd() == -1 || !fd_to_connection_.contains(connection.fd())) {
+    std::optional<cluster::ProxyLink::Receive> Node::forward_request(const cluster::ProxyRoute& route, const protocol::Command& command,
+        Instruction instruction, std::span<const char> payload, int client_fd) {
+        observer_ptr<cluster::ProxyLink> link = get_proxy_link(route.ip, route.client_port);
+        if (link == nullptr) {
+            return std::nullopt;
+        }
+        net::Connection& link_connection = data_loop_.fd_to_connection[link->fd()];
+        bool sent = protocol::send_instruction(link_connection, command, instruction, payload.data(), payload.size()) >= 0;
+        cluster::ProxyLink::Receive received = link->receive(client_fd);
+        if (sent) {
+            try {
+                data_loop_.reactor->flush(link_connection);
+            }
+            catch (const std::exception& e) {
+                sent = false;
+            }
+        }
+        if (!sent) {
+            //The link is dropped by the event loop, which fails the requests waiting on it
+            ::shutdown(link->fd(), SHUT_RDWR);
+        }
+        return received;
+    }
+
+    net::Task<> Node::handle_multi_key(net::Connection& connection, const MetaData& meta_data, const command& command) {
+        std::optional<std::vector<cluster::MigratedKey>> keys = co_await instruction_handler::read_multi_key_request(connection, meta_data, command);
+        if (!keys.has_value()) {
+            co_return;
+        }
+        bool mset = meta_data.instruction == Instruction::c_MSET;
+        bool asking = command[protocol::to_integral(protocol::CommandFieldsMultiKey::c_ASKING)] == "true";
+        //The part of a request another node forwarded is answered with a redirect if a key isn't here
+        bool forwarding = !proxied_connections_.contains(connection.fd());
+
+        //Everything is checked before the first key is written
+        std::vector<std::string_view> names;
+        for (const cluster::MigratedKey& key : *keys) {
+            names.push_back(key.key);
+        }
+        std::vector<uint16_t> slots(names.size());
+        cluster::get_key_slots(names, slots);
+        std::vector<size_t> local;
+        std::vector<cluster::ProxyBatch> batches;
+        for (size_t i = 0; i < keys->size(); i++) {
+            std::optional<cluster::ProxyRoute> route = cluster::get_proxy_route(mset ? Instruction::c_PUT : Instruction::c_GET,
+                names[i], asking, get_kvs(), cluster_state_);
+            if (route.has_value() && !forwarding) {
+                protocol::Command redirect{ route->ip, std::to_string(route->client_port), std::to_string(slots[i]) };
+                co_await protocol::write_instruction(connection, redirect, route->asking ? Instruction::c_ASK : Instruction::c_MOVE);
+                co_return;
+            }
+            if (route.has_value()) {
+                cluster::add_to_proxy_batch(batches, *route, i);
+            }
+            else if (cluster_state_.myself.served_slots.test(slots[i])) {
+                local.push_back(i);
+            }
+            else {
+                co_await protocol::write_instruction(connection, cluster::get_slot_unavailable_status(slots[i], cluster_state_));
+                co_return;
+            }
+        }
+
+        std::vector<std::optional<ByteArray>> values(keys->size());
+        auto apply_locally = [&](size_t i) {
+            cluster::MigratedKey& key = (*keys)[i];
+            if (!mset) {
+                ByteArray value{};
+                if (get_kvs().get(key.key, value).is_ok()) {
+                    values[i] = std::move(value);
+                }
+                record_load(key.key, values[i].has_value() ? values[i]->size() : 0);
+                return;
+            }
+            slot_importer_.record_client_write(key.key, cluster_state_);
+            record_load(key.key, key.value.size());
+            if (!get_kvs().contains_key(key.key)) {
+                cluster_state_.slots[slots[i]].amount_of_keys += 1;
+            }
+            get_kvs().put(key.key, key.value);
+        };
+        for (size_t i : local) {
+            apply_locally(i);
+        }
+
+        //All batches are sent before a response is waited for, so the nodes work on them in parallel
+        std::string error;
+        while (!batches.empty() && error.empty()) {
+            std::vector<std::optional<cluster::ProxyLink::Receive>> received;
+            for (const cluster::ProxyBatch& batch : batches) {
+                std::vector<char> payload;
+                for (size_t i : batch.keys) {
+                    const cluster::MigratedKey& key = (*keys)[i];
+                    cluster::append_migrated_key(payload, key.key, key.value.data(), mset ? key.value.size() : 0, false);
+                }
+                protocol::Command forwarded{ std::to_string(batch.keys.size()), batch.route.asking ? "true" : "false" };
+                received.push_back(forward_request(batch.route, forwarded, meta_data.instruction, payload, connection.fd()));
+            }
+
+            std::vector<cluster::ProxyBatch> redirected;
+            for (size_t b = 0; b < batches.size() && error.empty(); b++) {
+                const cluster::ProxyBatch& batch = batches[b];
+                if (!received[b].has_value()) {
+                    error = "Could not connect to " + batch.route.ip + ":" + std::to_string(batch.route.client_port);
+                    break;
+                }
+                cluster::ProxyResponse response{};
+                cluster::ProxyLink::Receive& receive = *received[b];
+                try {
+                    response = co_await receive;
+                }
+                catch (const std::exception& e) {
+                    error = e.what();
+                    break;
+                }
+
+                //The keys of a batch might belong to several slots, only the one that was named moved for sure
+                //The keys of the other slots go where this node's slot map sends them now
+                std::optional<cluster::ProxyRoute> redirect = cluster::get_redirect_route(response.meta_data, response.command);
+                if (redirect.has_value()) {
+                    std::optional<uint16_t> moved = cluster::get_redirect_slot(response.command);
+                    if (batch.redirects >= cluster::CLUSTER_PROXY_MAX_REDIRECTS) {
+                        error = "Too many redirects";
+                        break;
+                    }
+                    for (size_t i : batch.keys) {
+                        std::optional<cluster::ProxyRoute> route = redirect;
+                        if (moved.has_value() && *moved != slots[i]) {
+                            route = cluster::get_proxy_route(mset ? Instruction::c_PUT : Instruction::c_GET, names[i], asking, get_kvs(), cluster_state_);
+                        }
+                        if (route.has_value()) {
+                            cluster::ProxyBatch& next = cluster::add_to_proxy_batch(redirected, *route, i);
+                            next.redirects = std::max(next.redirects, batch.redirects + 1);
+                        }
+                        else if (cluster_state_.myself.served_slots.test(slots[i])) {
+                            apply_locally(i);
+                        }
+                        else {
+                            error = cluster::get_slot_unavailable_status(slots[i], cluster_state_).get_msg();
+                            break;
+                        }
+                    }
+                    continue;
+                }
+
+                switch (response.meta_data.instruction) {
+                case Instruction::c_OK_RESPONSE:
+                    break;
+                case Instruction::c_MGET_RESPONSE:
+                {
+                    std::vector<cluster::MigratedKey> results;
+                    try {
+                        results = cluster::parse_migrated_keys(std::span<const char>(response.payload.data(), response.payload.size()));
+                    }
+                    catch (const std::runtime_error& e) {
+                        results.clear();
+                    }
+                    if (results.size() != batch.keys.size()) {
+                        error = "Invalid response of " + batch.route.ip + ":" + std::to_string(batch.route.client_port);
+                        break;
+                    }
+                    for (size_t j = 0; j < results.size(); j++) {
+                        if (!results[j].erased) {
+                            values[batch.keys[j]] = std::move(results[j].value);
+                        }
+                    }
+                    break;
+                }
+                case Instruction::c_ERROR_RESPONSE:
+                    error = response.payload.to_string();
+                    break;
+                default:
+                    error = "Unknown response of " + batch.route.ip + ":" + std::to_string(batch.route.client_port);
+                    break;
+                }
+            }
+            batches = std::move(redirected);
+        }
+
+        //The keys that were written already stay, like the ones of separate PUTs would
+        if (!error.empty()) {
+            co_await protocol::write_instruction(connection, Status::new_error("Failed to forward the keys: " + error));
+            co_return;
+        }
+        if (mset) {
+            co_await protocol::write_instruction(connection, Status::new_ok());
+            co_return;
+        }
+        std::vector<char> payload;
+        for (size_t i = 0; i < keys->size(); i++) {
+            const std::optional<ByteArray>& value = values[i];
+            cluster::append_migrated_key(payload, names[i], value.has_value() ? value->data() : nullptr,
+                value.has_value() ? value->size() : 0, !value.has_value());
+        }
+        protocol::Command response_command{ std::to_string(keys->size()) };
+        co_await protocol::write_instruction(connection, response_command, Instruction::c_MGET_RESPONSE, payload.data(), payload.size());
+    }
+
+    net::Task<> Node::subscribe_slot_updates(net::Connection& connection) {
+        //The others get the changes up to now first, so the whole map has the version they are at afterwards
+        refresh_slot_map();
+        if (slot_addresses_.empty()) {
+            update_slot_addresses();
+        }
+        slot_subscribers_.insert(connection.fd());
+        protocol::Command update{ std::to_string(slot_map_version_), "0" };
+        std::string slots = protocol::serialize_slot_changes(std::vector<std::string>{}, slot_addresses_);
+        co_await protocol::write_instruction(connection, update, Instruction::c_SLOT_MAP_UPDATE, slots);
+    }
+
+    void Node::push_slot_updates() {
+        if (slot_subscribers_.empty()) {
+            //Computed again for the next subscriber
+            slot_addresses_.clear();
             return;
         }
-        connections_epoll_.remove_event(connection.fd());
-        fd_to_connection_.erase(connection.fd());
+        std::string changes = update_slot_addresses();
+        if (changes.empty()) {
+            return;
+        }
+        protocol::Command update{ std::to_string(slot_map_version_), std::to_string(slot_map_version_ - 1) };
+        //A subscriber whose output buffer overflows is dropped while sending
+        std::vector<int> subscribers(slot_subscribers_.begin(), slot_subscribers_.end());
+        for (int fd : subscribers) {
+            auto connection = data_loop_.fd_to_connection.find(fd);
+            if (connection == data_loop_.fd_to_connection.end()) {
+                continue;
+            }
+            protocol::send_instruction(connection->second, update, Instruction::c_SLOT_MAP_UPDATE, changes);
+            flush_connection(data_loop_, connection->second);
+        }
+    }
+
+    void Node::refresh_slot_map() {
+        if (!cluster_state_.slot_map_changed) {
+            return;
+        }
+        cluster_state_.slot_map_changed = false;
+        slot_map_.clear();
+        push_slot_updates();
+    }
+
+    std::string Node::update_slot_addresses() {
+        std::vector<std::string> addresses = protocol::get_slot_addresses(cluster_state_);
+        std::string changes = protocol::serialize_slot_changes(slot_addresses_, addresses);
+        slot_addresses_ = std::move(addresses);
+        if (!changes.empty()) {
+            slot_map_version_++;
+        }
+        return changes;
+    }
+
+    observer_ptr<cluster::ProxyLink> Node::get_proxy_link(const std::string& ip, uint16_t client_port) {
+        std::string address = ip + ":" + std::to_string(client_port);
+        auto existing = proxy_links_.find(address);
+        if (existing != proxy_links_.end()) {
+            return &existing->second;
+        }
+
+        net::Connection connection;
+        try {
+            connection = net::Socket{}.connect_non_blocking(ip, client_port);
+        }
+        catch (const std::runtime_error& e) {
+            return nullptr;
+        }
+        //Requests sent until the connect finished are queued
+        connection.enable_output_buffering(output_buffer_limits_[protocol::to_integral(ConnectionClass::c_CLUSTER)]);
+        connection.enable_async_io();
+        data_loop_.reactor->add_connection(connection);
+        int fd = connection.fd();
+        data_loop_.fd_to_connection[fd] = connection;
+        proxy_link_addresses_[fd] = address;
+        cluster::ProxyLink& link = proxy_links_.try_emplace(address, fd).first->second;
+
+        protocol::send_instruction(data_loop_.fd_to_connection[fd], {}, Instruction::c_PROXY);
+        link.drop_response();
+        data_loop_.fd_to_handler[fd] = serve_proxy_link(data_loop_.fd_to_connection[fd]);
+        data_loop_.fd_to_handler[fd].start();
+        return &link;
+    }
+
+    net::Task<> Node::serve_proxy_link(net::Connection& connection) {
+        while (true) {
+            cluster::ProxyResponse response = co_await cluster::read_proxy_response(connection);
+            auto address = proxy_link_addresses_.find(connection.fd());
+            if (address == proxy_link_addresses_.end()) {
+                co_return;
+            }
+            finish_proxied_response(proxy_links_.at(address->second).complete(std::move(response)));
+        }
+    }
+
+    void Node::finish_proxied_response(int client_fd) {
+        if (client_fd < 0 || !data_loop_.fd_to_connection.contains(client_fd)) {
+            return;
+        }
+        //The events of the client were only looked at while its handler waited for the response
+        if (data_loop_.fd_to_handler[client_fd].done()) {
+            disconnect(data_loop_, data_loop_.fd_to_connection[client_fd]);
+            return;
+        }
+        if (data_loop_.fd_to_connection[client_fd].has_pending_output()) {
+            flush_connection(data_loop_, data_loop_.fd_to_connection[client_fd]);
+        }
+    }
+
+    net::Task<> Node::serve_cluster_connection(net::Connection& connection) {
+        while (true) {
+            co_await handle_cluster_request(connection);
+        }
     }
 
     void Node::handle_connection(net::Connection& connection) {
         try {
-            MetaData meta_data = node::protocol::get_metadata(connection, std::string(cluster_state_.myself.name.data()));
-            command command = node::protocol::get_command(connection, meta_data.argc, meta_data.command_size);
-            execute_instruction(connection, meta_data, command);
+            net::sync_wait(handle_request(connection));
         }
         catch (const std::exception& e) {
-            disconnect(connection);
+            disconnect(data_loop_, connection);
             return;
         }
     }
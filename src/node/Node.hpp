@@ -2,21 +2,69 @@
 
 #include <memory>
 #include <unordered_map>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include "../KVS/IKeyValueStore.hpp"
 #include "../KVS/InMemoryKVS.hpp"
 #include "../net/Connection.hpp"
-#include "../net/Epoll.hpp"
+#include "../net/IReactor.hpp"
+#include "../net/Task.hpp"
+#include "../net/TimerQueue.hpp"
 #include "ProtocolHandler.hpp"
 #include "Cluster.hpp"
+#include "Membership.hpp"
+#include "Migration.hpp"
+#include "Load.hpp"
+#include "Replication.hpp"
+#include "Failover.hpp"
+#include "ClusterConfig.hpp"
+#include "Proxy.hpp"
 
 namespace node {
 
     constexpr int NODE_WAIT_TIMEOUT = 1000;
     constexpr int NODE_PING_PAUSE = 50;
+    //Upper bound for the pings a node sends, the pause grows on large clusters instead of the cpu usage
+    constexpr int NODE_MAX_PINGS_PER_SECOND = 100;
+    //Maximum deviation of a pause from its interval in percent, so the nodes don't ping in lockstep
+    constexpr int NODE_PING_JITTER = 20;
+    //Pause before a migration that is limited by its budget or waits for acks tries to send more batches
+    constexpr int NODE_MIGRATION_PAUSE = 10;
+    //Pause between sending the writes to the replicas, also the longest a write waits before it is sent
+    constexpr int NODE_REPLICATION_PAUSE = 10;
+    //Nice value of the cluster bus thread, so gossip isn't starved by the data path, ignored without the privilege to raise it
+    constexpr int NODE_CLUSTER_LOOP_NICE = -10;
+
+    //Clients are unlimited by default because a single GET response can be arbitrarily large
+    constexpr net::OutputBufferLimits NODE_CLIENT_OUTPUT_BUFFER_LIMITS{ 0, 0, std::chrono::seconds{ 0 } };
+    constexpr net::OutputBufferLimits NODE_CLUSTER_OUTPUT_BUFFER_LIMITS = cluster::CLUSTER_LINK_OUTPUT_BUFFER_LIMITS;
+
+    //The listening socket a connection was accepted on, used to apply different limits
+    enum class ConnectionClass : uint8_t {
+        c_CLIENT = 0,
+        c_CLUSTER = 1,
+        enum_size = 2
+    };
+
+    //A reactor with the connections it serves, only used by the thread that runs it
+    struct EventLoop {
+        std::unique_ptr<net::IReactor> reactor;
+        std::unordered_map<int, net::Connection> fd_to_connection;
+        //Declared after the connections, the handlers refer to them
+        std::unordered_map<int, net::Task<>> fd_to_handler;
+        //Maintenance jobs that run between the events of the loop
+        net::TimerQueue timers;
+    };
 
     class Node {
     public:
@@ -29,45 +77,99 @@ namespace node {
         Node(Node&&) = delete;
         Node& operator=(Node&&) = delete;
 
-        static Node new_in_memory_node(std::string name, uint16_t client_port, uint16_t cluster_port, std::string ip, bool serve_all_slots = false);
+        //A node with a cluster config file takes the nodes and slots from it if it exists, serve_all_slots only applies otherwise
+        //The file is rewritten whenever they change, see cluster::serialize_cluster_config
+        static Node new_in_memory_node(std::string name, uint16_t client_port, uint16_t cluster_port, std::string ip, bool serve_all_slots = false,
+            std::string cluster_config_path = "");
 
         key_value_store::IKeyValueStore& get_kvs() const {
             return *kvs_;
         }
 
+        //The working copy of the data path, other threads have to use get_cluster_snapshot()
         cluster::ClusterState& get_cluster_state() {
             return cluster_state_;
         }
 
-        void execute_instruction(net::Connection& connection, const protocol::MetaData& meta_data, const protocol::Command& command);
+        //Latest published version, lags behind the working copy by at most one event loop iteration or a ping pause for key counts
+        std::shared_ptr<const cluster::ClusterSnapshot> get_cluster_snapshot() const {
+            return cluster_snapshot_.load();
+        }
+
+        net::Task<> execute_instruction(net::Connection& connection, const protocol::MetaData& meta_data, const protocol::CommandView& command);
 
+        net::Task<> handle_request(net::Connection& connection);
+
+        //Handles a request received on the cluster bus, cluster state changes are passed to the data path
+        net::Task<> handle_cluster_request(net::Connection& connection);
+
+        //Handles a single request on a blocking connection, the connection is dropped if that fails
         void handle_connection(net::Connection& connection);
 
         void start() {
             running_ = true;
             gossiping_ = true;
-            gossip_thread_ = std::thread(&Node::gossip, this);
             main_loop();
         }
 
         void stop() {
             running_ = false;
             gossiping_ = false;
-            if (gossip_thread_.joinable()) {
-                gossip_thread_.detach();
-            }
         }
 
         void stop_gossiping() {
             gossiping_ = false;
         }
 
-        net::Epoll& get_connections_epoll() {
-            return connections_epoll_;
+        net::IReactor& get_reactor() {
+            return *data_loop_.reactor;
+        }
+
+        //Has to be called before starting the node, falls back to epoll if io_uring isn't supported
+        void set_reactor_backend(net::ReactorBackend backend) {
+            data_loop_.reactor = net::new_reactor(backend);
+            cluster_loop_.reactor = net::new_reactor(backend);
         }
 
         void set_cluster_state(cluster::ClusterState cluster_state) {
             cluster_state_ = cluster_state;
+            cluster_state_.slot_map_changed = true;
+            publish_cluster_state();
+        }
+
+        //Has to be called before starting the node, connections accepted on the path are handled like client connections
+        void set_unix_socket_path(std::string path) {
+            unix_socket_path_ = std::move(path);
+        }
+
+        void set_output_buffer_limits(ConnectionClass connection_class, net::OutputBufferLimits limits) {
+            output_buffer_limits_[protocol::to_integral(connection_class)] = limits;
+        }
+
+        //Has to be called before starting the node
+        void set_membership_config(cluster::MembershipConfig config) {
+            membership_ = cluster::Membership(std::string(name_.data(), strnlen(name_.data(), name_.size())), membership_.get_incarnation(), config);
+        }
+
+        //Has to be called before starting the node
+        void set_migration_config(cluster::MigrationConfig config) {
+            slot_migrator_ = cluster::SlotMigrator(config);
+        }
+
+        //Has to be called before starting the node
+        void set_replication_config(cluster::ReplicationConfig config) {
+            replication_source_ = cluster::ReplicationSource(config);
+        }
+
+        //Has to be called before starting the node
+        void set_failover_config(cluster::FailoverConfig config) {
+            failover_.set_config(config);
+        }
+
+        //Has to be called before starting the node
+        //A proxying node forwards the requests of its clients for slots it doesn't serve to their owner instead of redirecting them
+        void set_proxy_mode(bool proxy_mode) {
+            proxy_mode_ = proxy_mode;
         }
 
     private:
@@ -76,24 +178,169 @@ namespace node {
             uint16_t cluster_port,
             std::array<char, cluster::CLUSTER_NAME_LEN> name,
             std::array<char, cluster::CLUSTER_IP_LEN> ip,
-            bool serve_all_slots = false);
+            bool serve_all_slots = false,
+            std::string cluster_config_path = "");
 
         void main_loop();
 
+        //Serves the cluster bus on its own thread, so large client requests don't delay gossip
+        void cluster_loop(int cluster_socket_fd);
+
+        //Waits for the events of the loop and continues the handlers they belong to
+        void poll(EventLoop& loop, int listener_fd, ConnectionClass connection_class);
+
+        //Pings some nodes from the latest snapshot and schedules itself again, runs on the cluster loop
         void gossip();
 
-        void disconnect(net::Connection& connection);
+        //Finishes the connects of the outgoing links of the data path and flushes them, schedules itself again
+        void update_cluster_links();
+
+        //Runs the failure detection of the members from the latest snapshot and schedules itself again, runs on the cluster loop
+        void membership_tick();
+
+        void send_membership_messages(const std::vector<cluster::MembershipMessage>& messages);
+
+        //Marks the nodes that died or came back in the working state
+        void post_membership_changes();
+
+        //Streams the keys of the migrating slots within the budget, schedules itself again while there are any
+        void run_migrations();
+
+        //Turns the requests counted since the last call into rates and updates the load this node gossips, schedules itself again
+        void measure_load();
+
+        //Counts the request for the load of the slot of the key if this node serves it
+        void record_load(std::string_view key, uint64_t bytes);
+
+        //Streams the writes to the replicas of this node or follows its primary, schedules itself again
+        //A replica takes over the slots of its primary once that failed and the other primaries voted for it
+        void replicate();
+
+        cluster::ReplicationInfo get_replication_info() const;
+
+        //Queues a change of the cluster state, the data path applies it before handling the next events
+        void post_cluster_update(std::function<void()> update);
+
+        void apply_cluster_updates();
+
+        //Replaces the snapshot with a copy of the working state, readers keep the old version until they drop it
+        void publish_cluster_state();
+
+        //Handles the requests of an accepted connection until one fails
+        net::Task<> serve_connection(net::Connection& connection);
+
+        //Where a request the client would be redirected for is forwarded to, nullopt if this node answers it
+        std::optional<cluster::ProxyRoute> get_proxy_route(const net::Connection& connection, const protocol::MetaData& meta_data,
+            const protocol::CommandView& command);
+
+        //Forwards the request and relays the response, the redirects the other nodes answer with are followed
+        net::Task<> proxy_request(net::Connection& connection, const protocol::MetaData& meta_data, const protocol::CommandView& command,
+            cluster::ProxyRoute route);
+
+        //Sends the request on the link to the node, the response is handed to the client's handler
+        //Returns nullopt if there is no link to the node
+        std::optional<cluster::ProxyLink::Receive> forward_request(const cluster::ProxyRoute& route, const protocol::Command& command,
+            protocol::Instruction instruction, std::span<const char> payload, int client_fd);
+
+        //Serves the keys of this node and forwards the others in one batch per node, the response has all of them in the order of the request
+        net::Task<> handle_multi_key(net::Connection& connection, const protocol::MetaData& meta_data, const protocol::CommandView& command);
+
+        //Sends the whole slot map to a new subscriber, it gets the changes from then on
+        net::Task<> subscribe_slot_updates(net::Connection& connection);
+
+        //Sends the slot ranges that changed since the last push to the subscribers
+        void push_slot_updates();
+
+        //Returns the slot ranges that changed since the last call, the version of the slot map is increased if there are any
+        std::string update_slot_addresses();
+
+        //Drops the cached slot map and pushes the changes to the subscribers if the cluster state marked it as changed
+        void refresh_slot_map();
+
+        //Returns the link to the node, a new one connects in the background, nullptr if connecting failed right away
+        observer_ptr<cluster::ProxyLink> get_proxy_link(const std::string& ip, uint16_t client_port);
+
+        //Hands the responses of the link to the waiting requests until it fails
+        net::Task<> serve_proxy_link(net::Connection& connection);
+
+        //Flushes the response that was relayed to the client, the connection is dropped if its handler finished meanwhile
+        void finish_proxied_response(int client_fd);
+
+        net::Task<> serve_cluster_connection(net::Connection& connection);
+
+        //Starts the handler of a new connection, it runs until it waits for the first request
+        void start_handler(EventLoop& loop, net::Connection connection);
+
+        //Serves the channel that was set up on the unix domain socket, it is closed together with the socket
+        void serve_shared_memory(int socket_fd, std::shared_ptr<net::SharedMemoryChannel> channel);
+
+        //Continues the handler of the connection if it waits for the readiness, the connection is dropped if it failed
+        void resume_handler(EventLoop& loop, int fd, net::Readiness readiness);
+
+        void disconnect(EventLoop& loop, net::Connection& connection);
+
+        void flush_connection(EventLoop& loop, net::Connection& connection);
 
         std::unique_ptr<key_value_store::IKeyValueStore> kvs_;
+        //Only changed by the data path, the cluster bus posts its changes
         cluster::ClusterState cluster_state_;
-        net::Epoll connections_epoll_;
-        std::unordered_map<int, net::Connection> fd_to_connection_;
+        std::atomic<std::shared_ptr<const cluster::ClusterSnapshot>> cluster_snapshot_;
+        uint64_t cluster_state_version_ = 0;
+        //Empty if the cluster state isn't persisted
+        std::string cluster_config_path_;
+        //Last content written to the file, it is only written again once that changes
+        std::string saved_cluster_config_;
+        //Set if the state came from the file, the slots that were importing are requested again once the node runs
+        bool restored_cluster_config_ = false;
+        //Set by the data path whenever a request or update changed the cluster state, it publishes once per iteration
+        bool cluster_state_changed_ = false;
+        //Only used by the cluster loop
+        cluster::GossipLinks gossip_links_;
+        cluster::Membership membership_;
+        //Only used by the data path
+        cluster::SlotMigrator slot_migrator_;
+        cluster::SlotImporter slot_importer_;
+        bool migrations_scheduled_ = false;
+        cluster::SlotLoad slot_load_;
+        std::chrono::steady_clock::time_point last_load_measurement_{};
+        //The store records its writes into the source, it keeps recording while the node is a primary
+        cluster::ReplicationSource replication_source_;
+        cluster::ReplicationSink replication_sink_;
+        cluster::Failover failover_;
+        //Client connections that accept stale values from a replica
+        std::unordered_set<int> read_only_connections_;
+        bool proxy_mode_ = false;
+        //Connections of the data loop to other nodes that requests are forwarded on, by ip and client port of the node
+        std::unordered_map<std::string, cluster::ProxyLink> proxy_links_;
+        std::unordered_map<int, std::string> proxy_link_addresses_;
+        //Connections of proxying nodes, they get redirects to follow themselves
+        std::unordered_set<int> proxied_connections_;
+        //Client connections the changes of the slot map are pushed to, and the map as it was pushed last
+        std::unordered_set<int> slot_subscribers_;
+        uint64_t slot_map_version_ = 0;
+        std::vector<std::string> slot_addresses_;
+        //Serialized for GET_SLOT_MAP on the first request after a change
+        std::string slot_map_;
+        //Serves the clients, owns the key value store and the cluster state
+        EventLoop data_loop_;
+        EventLoop cluster_loop_;
+        std::thread cluster_thread_;
+        std::mutex cluster_updates_mutex_;
+        std::vector<std::function<void()>> cluster_updates_;
+        //Signaled whenever an update was posted, registered as notifier of the data loop
+        net::FileDescriptor cluster_updates_notify_;
+        //Shared memory channels are identified by their eventfd
+        std::unordered_map<int, int> socket_to_channel_fd_;
+        std::array<net::OutputBufferLimits, protocol::to_integral(ConnectionClass::enum_size)> output_buffer_limits_{
+            NODE_CLIENT_OUTPUT_BUFFER_LIMITS, NODE_CLUSTER_OUTPUT_BUFFER_LIMITS
+        };
 
         uint16_t client_port_;
         uint16_t cluster_port_;
+        //Optional listener for clients on the same host, empty if disabled
+        std::string unix_socket_path_;
         std::atomic<bool> running_;
         std::atomic<bool> gossiping_;
-        std::thread gossip_thread_;
         std::array<char, cluster::CLUSTER_NAME_LEN> name_;
         std::array<char, cluster::CLUSTER_IP_LEN> ip_;
     };
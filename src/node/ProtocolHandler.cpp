@@ -1,52 +1,117 @@
+#include <algorithm>
 #include <stdexcept>
+#include <charconv>
 #include <cstring>
 #include <endian.h>
+#include <unordered_map>
 
 #include "ProtocolHandler.hpp"
 
 namespace node::protocol {
 
+    MetaData metadata_to_host_order(MetaData meta_data) {
+        meta_data.argc = ntohs(meta_data.argc);
+        meta_data.command_size = be64toh(meta_data.command_size);
+        meta_data.payload_size = be64toh(meta_data.payload_size);
+        return meta_data;
+    }
+
     MetaData get_metadata(net::Connection& connection, std::string debug_string) {
         MetaData meta_data;
         ssize_t received = connection.receive(reinterpret_cast<char*>(&meta_data), sizeof(MetaData));
         if (received != sizeof(MetaData)) {
             throw std::runtime_error("Failed to receive metadata, received " + std::to_string(received) + " bytes, errno: " + std::to_string(errno) + " " + debug_string + " data: " + std::string(reinterpret_cast<char*>(&meta_data), received));
         }
+        return metadata_to_host_order(meta_data);
+    }
 
-        //Convert to host byte order
-        meta_data.argc = ntohs(meta_data.argc);
-        meta_data.command_size = be64toh(meta_data.command_size);
-        meta_data.payload_size = be64toh(meta_data.payload_size);
+    net::Task<MetaData> read_metadata(net::Connection& connection) {
+        MetaData meta_data;
+        co_await connection.read_exact(std::span<char>(reinterpret_cast<char*>(&meta_data), sizeof(MetaData)));
+        co_return metadata_to_host_order(meta_data);
+    }
 
-        return meta_data;
+    CommandView::CommandView(const Command& command) {
+        for (const auto& field : command) {
+            push_back(field);
+        }
     }
 
-    Command get_command(net::Connection& connection, uint16_t argc, uint64_t command_size) {
-        if (argc == 0 || command_size == 0) {
-            return {};
+    void CommandView::push_back(std::string_view field) {
+        if (size_ >= MAX_COMMAND_ARGC) {
+            throw std::runtime_error("Too many command fields");
         }
+        fields_[size_++] = field;
+    }
 
-        char buf[command_size];
-        std::span<char> received_data(buf, command_size);
-        ssize_t received = connection.receive(received_data);
-        if (received != command_size) {
-            throw std::runtime_error("Failed to receive command");
+    Command CommandView::to_command() const {
+        return Command(begin(), end());
+    }
+
+    CommandView parse_command(std::span<const char> data, uint16_t argc) {
+        if (argc > MAX_COMMAND_ARGC) {
+            throw std::runtime_error("Too many command fields: " + std::to_string(argc));
         }
-        auto it = received_data.begin();
 
-        Command command(argc);
+        CommandView command{};
+        uint64_t offset = 0;
         for (int i = 0; i < argc; ++i) {
+            if (data.size() - offset < sizeof(uint64_t)) {
+                throw std::runtime_error("Malformed command");
+            }
             uint64_t size;
-            std::memcpy(&size, &(*it), sizeof(uint64_t));
+            std::memcpy(&size, data.data() + offset, sizeof(uint64_t));
             size = be64toh(size);
+            offset += sizeof(uint64_t);
 
-            it += sizeof(uint64_t);
-            command[i] = std::string(it, it + size);
-            it += size;
+            if (data.size() - offset < size) {
+                throw std::runtime_error("Malformed command");
+            }
+            command.push_back(std::string_view(data.data() + offset, size));
+            offset += size;
         }
         return command;
     }
 
+    void check_command_size(uint64_t command_size) {
+        if (command_size > MAX_COMMAND_SIZE) {
+            throw std::runtime_error("Command too large: " + std::to_string(command_size) + " bytes");
+        }
+    }
+
+    CommandView get_command(net::Connection& connection, uint16_t argc, uint64_t command_size) {
+        if (argc == 0 || command_size == 0) {
+            return {};
+        }
+        check_command_size(command_size);
+
+        std::span<char> received_data = connection.receive_buffer(command_size);
+        ssize_t received = connection.receive(received_data);
+        if (received < 0 || static_cast<uint64_t>(received) != command_size) {
+            throw std::runtime_error("Failed to receive command");
+        }
+        return parse_command(received_data, argc);
+    }
+
+    net::Task<CommandView> read_command(net::Connection& connection, uint16_t argc, uint64_t command_size) {
+        if (argc == 0 || command_size == 0) {
+            co_return CommandView{};
+        }
+        check_command_size(command_size);
+
+        std::span<char> received_data = co_await connection.read_exact(command_size);
+        co_return parse_command(received_data, argc);
+    }
+
+    uint64_t field_to_uint64(std::string_view field) {
+        uint64_t value = 0;
+        auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), value);
+        if (error != std::errc{} || end == field.data()) {
+            throw std::invalid_argument("Invalid numeric field: " + std::string(field));
+        }
+        return value;
+    }
+
     ByteArray get_payload(net::Connection& connection, uint64_t payload_size) {
         ByteArray payload = ByteArray::new_allocated_byte_array(payload_size);
         connection.receive(payload.data(), payload_size);
@@ -57,29 +122,75 @@ namespace node::protocol {
         connection.receive(dest, payload_size);
     }
 
-    ssize_t send_instruction(net::Connection& connection, const Command& command, Instruction i, const char* payload, uint64_t payload_size) {
-        uint64_t command_size = get_command_size(command);
+    net::ReadExact read_payload(net::Connection& connection, char* dest, uint64_t payload_size) {
+        return connection.read_exact(std::span<char>(dest, payload_size));
+    }
+
+    net::Task<> skip_payload(net::Connection& connection, uint64_t payload_size) {
+        std::array<char, net::receive_all_buffer_size> discarded;
+        while (payload_size > 0) {
+            uint64_t chunk_size = std::min<uint64_t>(payload_size, discarded.size());
+            co_await connection.read_exact(std::span<char>(discarded.data(), chunk_size));
+            payload_size -= chunk_size;
+        }
+    }
+
+    //metadata | size_1 | field_1 | ... | payload parts, described without copying the fields or the payload
+    struct InstructionBuffers {
         MetaData meta_data{};
-        meta_data.instruction = i;
-        meta_data.argc = htons(static_cast<uint16_t>(command.size()));
-        meta_data.command_size = htobe64(command_size);
-        meta_data.payload_size = htobe64(payload_size);
-        ssize_t total_sent = 0;
+        std::array<uint64_t, MAX_COMMAND_ARGC> field_sizes;
+        std::array<iovec, 1 + 2 * MAX_COMMAND_ARGC + MAX_PAYLOAD_PARTS> buffers;
+        size_t buffers_amount = 0;
+
+        InstructionBuffers(const Command& command, Instruction i, std::initializer_list<std::span<const char>> payload) {
+            if (command.size() > MAX_COMMAND_ARGC || payload.size() > MAX_PAYLOAD_PARTS) {
+                throw std::runtime_error("Too many command fields or payload parts");
+            }
 
-        //Concatenate metadata and command to save one send() syscall
-        uint64_t size_without_payload = sizeof(meta_data) + command_size;
-        char buf[size_without_payload];
-        std::span<char> data(buf, size_without_payload);
+            uint64_t payload_size = 0;
+            for (const auto& part : payload) {
+                payload_size += part.size();
+            }
+
+            meta_data.instruction = i;
+            meta_data.argc = htons(static_cast<uint16_t>(command.size()));
+            meta_data.command_size = htobe64(get_command_size(command));
+            meta_data.payload_size = htobe64(payload_size);
+
+            buffers[buffers_amount++] = { &meta_data, sizeof(meta_data) };
+            for (size_t field = 0; field < command.size(); ++field) {
+                field_sizes[field] = htobe64(command[field].size());
+                buffers[buffers_amount++] = { &field_sizes[field], sizeof(uint64_t) };
+                buffers[buffers_amount++] = { const_cast<char*>(command[field].data()), command[field].size() };
+            }
+            for (const auto& part : payload) {
+                if (!part.empty()) {
+                    buffers[buffers_amount++] = { const_cast<char*>(part.data()), part.size() };
+                }
+            }
+        }
 
-        std::memcpy(data.data(), &meta_data, sizeof(meta_data));
-        serialize_command(command, data.subspan(sizeof(meta_data)));
-        total_sent += connection.send(data);
+        //Not copyable, the first buffer points to the metadata
+        InstructionBuffers(const InstructionBuffers&) = delete;
+        InstructionBuffers& operator=(const InstructionBuffers&) = delete;
 
-        if (payload != nullptr && payload_size > 0) {
-            total_sent += connection.send(payload, payload_size);
+        std::span<iovec> get() {
+            return std::span<iovec>(buffers.data(), buffers_amount);
         }
+    };
 
-        return total_sent;
+    ssize_t send_instruction(net::Connection& connection, const Command& command, Instruction i,
+        std::initializer_list<std::span<const char>> payload) {
+        //Sent with a single sendmsg()
+        InstructionBuffers buffers{ command, i, payload };
+        return connection.send(buffers.get());
+    }
+
+    ssize_t send_instruction(net::Connection& connection, const Command& command, Instruction i, const char* payload, uint64_t payload_size) {
+        if (payload == nullptr) {
+            payload_size = 0;
+        }
+        return send_instruction(connection, command, i, { std::span<const char>(payload, payload_size) });
     }
 
     ssize_t send_instruction(net::Connection& connection, const  Status& state) {
@@ -95,6 +206,32 @@ namespace node::protocol {
         return send_instruction(connection, command, i, payload.data(), payload.size());
     }
 
+    net::WriteAll write_instruction(net::Connection& connection, const Command& command, Instruction i,
+        std::initializer_list<std::span<const char>> payload) {
+        InstructionBuffers buffers{ command, i, payload };
+        return connection.write_all(buffers.get());
+    }
+
+    net::WriteAll write_instruction(net::Connection& connection, const Command& command, Instruction i, const char* payload, uint64_t payload_size) {
+        if (payload == nullptr) {
+            payload_size = 0;
+        }
+        return write_instruction(connection, command, i, { std::span<const char>(payload, payload_size) });
+    }
+
+    net::WriteAll write_instruction(net::Connection& connection, const Status& state) {
+        if (state.is_ok()) {
+            return write_instruction(connection, {}, Instruction::c_OK_RESPONSE);
+        }
+
+        const std::string& error_msg = state.get_msg();
+        return write_instruction(connection, { }, Instruction::c_ERROR_RESPONSE, error_msg);
+    }
+
+    net::WriteAll write_instruction(net::Connection& connection, const Command& command, Instruction i, const std::string& payload) {
+        return write_instruction(connection, command, i, payload.data(), payload.size());
+    }
+
     uint64_t get_command_size(const Command& command) {
         uint64_t size = 0;
         for (const auto& c : command) {
@@ -116,63 +253,357 @@ namespace node::protocol {
         }
     }
 
-    void write_slot_to_buffer(observer_ptr<cluster::ClusterNode> node, std::span<char> data, uint64_t& offset, int slot_number) {
-        //Add end slot range
-        data.data()[offset++] = '\t';
-        std::string end_slot = std::to_string(slot_number - 1);
-        std::memcpy(data.data() + offset, end_slot.data(), end_slot.size());
-        offset += end_slot.size();
+    void write_slot_address(std::string& data, observer_ptr<cluster::ClusterNode> node,
+        const std::unordered_map<const cluster::ClusterNode*, std::string>& replicas) {
+        if (node == nullptr || (*node).failed) {
+            data += "NULL";
+            return;
+        }
+        data += (*node).ip.data();
+        data += ':';
+        data += std::to_string((*node).client_port);
+        auto node_replicas = replicas.find(node);
+        if (node_replicas != replicas.end()) {
+            data += node_replicas->second;
+        }
+    }
 
-        //Add ip
-        data.data()[offset++] = '\t';
-        std::string ip = "NULL";
-        if (node != nullptr) {
-            ip = std::string((*node).ip.data());
+    void write_slot_range(std::string& data, observer_ptr<cluster::ClusterNode> node, size_t first_slot, size_t last_slot,
+        const std::unordered_map<const cluster::ClusterNode*, std::string>& replicas) {
+        if (!data.empty()) {
+            data += '\n';
         }
-        std::memcpy(data.data() + offset, ip.data(), ip.size());
-        offset += ip.size();
+        data += std::to_string(first_slot);
+        data += '\t';
+        data += std::to_string(last_slot);
+        data += '\t';
+        write_slot_address(data, node, replicas);
+    }
 
-        //Add port
-        if (node != nullptr) {
-            data.data()[offset++] = ':';
-            std::string port = std::to_string((*node).client_port);
-            std::memcpy(data.data() + offset, port.data(), port.size());
-            offset += port.size();
+    //Tab separated addresses of the replicas by their primary, failed ones are left out
+    std::unordered_map<const cluster::ClusterNode*, std::string> get_replica_addresses(const cluster::ClusterState& state) {
+        std::unordered_map<const cluster::ClusterNode*, std::string> replicas;
+        auto add_replica = [&state, &replicas](const cluster::ClusterNode& replica) {
+            std::string primary_name(replica.primary.data(), strnlen(replica.primary.data(), replica.primary.size()));
+            if (primary_name.empty() || replica.failed) {
+                return;
+            }
+            const cluster::ClusterNode* primary = nullptr;
+            if (primary_name == state.myself.name.data()) {
+                primary = &state.myself;
+            }
+            else if (state.nodes.contains(primary_name)) {
+                primary = &state.nodes.at(primary_name);
+            }
+            if (primary == nullptr) {
+                return;
+            }
+            std::string& addresses = replicas[primary];
+            addresses += '\t';
+            addresses += replica.ip.data();
+            addresses += ':';
+            addresses += std::to_string(replica.client_port);
+        };
+        add_replica(state.myself);
+        for (const auto& [name, node] : state.nodes) {
+            if (name != state.myself.name.data()) {
+                add_replica(node);
+            }
         }
+        return replicas;
     }
 
-    //<Slot-begin>\t<Slot-end>\t<ip:port>\n
-    void serialize_slots(const std::vector<cluster::Slot>& slots, net::Connection& connection) {
-        uint64_t offset = 0;
-        char buf[(5 + 1 + 5 + 1 + 15 + 1 + 5 + 1) * slots.size()];
-        std::span<char> data(buf, sizeof(buf));
-        observer_ptr<cluster::ClusterNode> prev_node = nullptr;
-
-        for (uint16_t slot_number = 0; slot_number < slots.size(); ++slot_number) {
-            const auto& slot = slots[slot_number];
-            if (slot_number == 0) {
-                data.data()[offset++] = '0';
-                prev_node = slot.served_by;
-            }
-            //The last slot always needs to be written
-            if (slot.served_by == prev_node) {
+    //<Slot-begin>\t<Slot-end>\t<ip:port>[\t<replica ip:port>...]\n
+    net::WriteAll serialize_slots(const cluster::ClusterState& state, net::Connection& connection) {
+        //Only the owner of a slot matters here, so one line per range of slots with the same owner
+        std::string data;
+        std::unordered_map<const cluster::ClusterNode*, std::string> replicas = get_replica_addresses(state);
+        const auto& served_by = state.slots.served_by();
+        size_t first_slot = 0;
+        for (size_t slot_number = 1; slot_number <= served_by.size(); ++slot_number) {
+            if (slot_number < served_by.size() && served_by[slot_number] == served_by[first_slot]) {
+                continue;
+            }
+            write_slot_range(data, served_by[first_slot], first_slot, slot_number - 1, replicas);
+            first_slot = slot_number;
+        }
+
+        return protocol::write_instruction(connection, {}, protocol::Instruction::c_OK_RESPONSE, data.data(), data.size());
+    }
+
+    std::vector<std::string> get_slot_addresses(const cluster::ClusterState& state) {
+        std::unordered_map<const cluster::ClusterNode*, std::string> replicas = get_replica_addresses(state);
+        const auto& served_by = state.slots.served_by();
+        std::vector<std::string> addresses(served_by.size());
+        for (size_t slot_number = 0; slot_number < served_by.size(); ++slot_number) {
+            if (slot_number > 0 && served_by[slot_number] == served_by[slot_number - 1]) {
+                addresses[slot_number] = addresses[slot_number - 1];
+                continue;
+            }
+            write_slot_address(addresses[slot_number], served_by[slot_number], replicas);
+        }
+        return addresses;
+    }
+
+    std::string serialize_slot_changes(const std::vector<std::string>& previous, const std::vector<std::string>& current) {
+        std::string data;
+        auto changed = [&previous, &current](size_t slot_number) {
+            return slot_number >= previous.size() || previous[slot_number] != current[slot_number];
+        };
+        size_t slot_number = 0;
+        while (slot_number < current.size()) {
+            if (!changed(slot_number)) {
+                ++slot_number;
+                continue;
+            }
+            size_t first_slot = slot_number;
+            while (slot_number + 1 < current.size() && changed(slot_number + 1) && current[slot_number + 1] == current[first_slot]) {
+                ++slot_number;
+            }
+            if (!data.empty()) {
+                data += '\n';
+            }
+            data += std::to_string(first_slot);
+            data += '\t';
+            data += std::to_string(slot_number);
+            data += '\t';
+            data += current[first_slot];
+            ++slot_number;
+        }
+        return data;
+    }
+
+    void append_slot_map_uint16(std::string& data, uint16_t value) {
+        uint16_t converted = htobe16(value);
+        data.append(reinterpret_cast<const char*>(&converted), sizeof(uint16_t));
+    }
+
+    void append_slot_map_field(std::string& data, const char* field, size_t max_size) {
+        size_t size = strnlen(field, max_size);
+        append_slot_map_uint16(data, static_cast<uint16_t>(size));
+        data.append(field, size);
+    }
+
+    uint16_t read_slot_map_uint16(std::span<const char> data, size_t& offset) {
+        if (data.size() - offset < sizeof(uint16_t)) {
+            throw std::runtime_error("Truncated slot map");
+        }
+        uint16_t value;
+        std::memcpy(&value, data.data() + offset, sizeof(uint16_t));
+        offset += sizeof(uint16_t);
+        return be16toh(value);
+    }
+
+    std::string read_slot_map_field(std::span<const char> data, size_t& offset) {
+        uint16_t size = read_slot_map_uint16(data, offset);
+        if (data.size() - offset < size) {
+            throw std::runtime_error("Truncated slot map");
+        }
+        std::string field(data.data() + offset, size);
+        offset += size;
+        return field;
+    }
+
+    //FNV-1a
+    uint64_t hash_slot_map(std::string_view data) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (char c : data) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ULL;
+        }
+        return hash == 0 ? 1 : hash;
+    }
+
+    std::string serialize_slot_map(const cluster::ClusterState& state) {
+        const auto& served_by = state.slots.served_by();
+        std::vector<const cluster::ClusterNode*> nodes;
+        std::unordered_map<const cluster::ClusterNode*, uint16_t> indices;
+        auto get_index = [&nodes, &indices](const cluster::ClusterNode* node) {
+            auto [index, inserted] = indices.emplace(node, static_cast<uint16_t>(nodes.size()));
+            if (inserted) {
+                nodes.push_back(node);
+            }
+            return index->second;
+        };
+
+        //One range per run of slots with the same owner, like serialize_slots()
+        std::vector<SlotMapRange> ranges;
+        size_t first_slot = 0;
+        for (size_t slot_number = 1; slot_number <= served_by.size(); ++slot_number) {
+            if (slot_number < served_by.size() && served_by[slot_number] == served_by[first_slot]) {
                 continue;
             }
+            observer_ptr<cluster::ClusterNode> owner = served_by[first_slot];
+            uint16_t node = owner == nullptr || (*owner).failed ? SLOT_MAP_NO_NODE : get_index(owner);
+            ranges.push_back(SlotMapRange{ static_cast<uint16_t>(first_slot), static_cast<uint16_t>(slot_number - 1), node });
+            first_slot = slot_number;
+        }
+
+        //Sorted by name, so the digest doesn't depend on the order of the nodes in the state
+        std::vector<std::pair<std::string, const cluster::ClusterNode*>> replicas;
+        auto add_replica = [&state, &indices, &replicas](const cluster::ClusterNode& replica) {
+            std::string primary_name(replica.primary.data(), strnlen(replica.primary.data(), replica.primary.size()));
+            if (primary_name.empty() || replica.failed) {
+                return;
+            }
+            const cluster::ClusterNode* primary = primary_name == state.myself.name.data() ? &state.myself
+                : state.nodes.contains(primary_name) ? &state.nodes.at(primary_name) : nullptr;
+            //Replicas of nodes without slots don't serve any
+            if (primary != nullptr && indices.contains(primary) && !indices.contains(&replica)) {
+                replicas.emplace_back(std::string(replica.name.data(), strnlen(replica.name.data(), replica.name.size())), &replica);
+            }
+        };
+        add_replica(state.myself);
+        for (const auto& [name, node] : state.nodes) {
+            if (name != state.myself.name.data()) {
+                add_replica(node);
+            }
+        }
+        std::sort(replicas.begin(), replicas.end());
+        for (const auto& [name, replica] : replicas) {
+            get_index(replica);
+        }
+
+        std::string data(SLOT_MAP_HEADER_SIZE, '\0');
+        append_slot_map_uint16(data, static_cast<uint16_t>(nodes.size()));
+        append_slot_map_uint16(data, static_cast<uint16_t>(ranges.size()));
+        for (const cluster::ClusterNode* node : nodes) {
+            std::string primary_name(node->primary.data(), strnlen(node->primary.data(), node->primary.size()));
+            uint16_t primary = SLOT_MAP_NO_NODE;
+            for (size_t index = 0; index < nodes.size() && !primary_name.empty(); ++index) {
+                if (primary_name == nodes[index]->name.data()) {
+                    primary = static_cast<uint16_t>(index);
+                }
+            }
+            append_slot_map_uint16(data, primary);
+            append_slot_map_uint16(data, node->client_port);
+            append_slot_map_field(data, node->name.data(), node->name.size());
+            append_slot_map_field(data, node->ip.data(), node->ip.size());
+        }
+        for (const SlotMapRange& range : ranges) {
+            append_slot_map_uint16(data, range.first_slot);
+            append_slot_map_uint16(data, range.last_slot);
+            append_slot_map_uint16(data, range.node);
+        }
+
+        uint64_t config_epoch = htobe64(cluster::get_max_config_epoch(state));
+        uint64_t digest = htobe64(hash_slot_map(std::string_view(data).substr(SLOT_MAP_HEADER_SIZE)));
+        std::memcpy(data.data(), &config_epoch, sizeof(uint64_t));
+        std::memcpy(data.data() + sizeof(uint64_t), &digest, sizeof(uint64_t));
+        return data;
+    }
+
+    SlotMap parse_slot_map(std::span<const char> data) {
+        if (data.size() < SLOT_MAP_HEADER_SIZE) {
+            throw std::runtime_error("Truncated slot map");
+        }
+        SlotMap map{};
+        std::memcpy(&map.config_epoch, data.data(), sizeof(uint64_t));
+        map.config_epoch = be64toh(map.config_epoch);
+        map.digest = get_slot_map_digest(std::string_view(data.data(), data.size()));
+
+        size_t offset = SLOT_MAP_HEADER_SIZE;
+        uint16_t nodes = read_slot_map_uint16(data, offset);
+        uint16_t ranges = read_slot_map_uint16(data, offset);
+        map.nodes.reserve(nodes);
+        for (uint16_t index = 0; index < nodes; ++index) {
+            SlotMapNode node{};
+            node.primary = read_slot_map_uint16(data, offset);
+            uint16_t client_port = read_slot_map_uint16(data, offset);
+            node.name = read_slot_map_field(data, offset);
+            node.address = read_slot_map_field(data, offset) + ':' + std::to_string(client_port);
+            if (node.primary != SLOT_MAP_NO_NODE && node.primary >= nodes) {
+                throw std::runtime_error("Slot map refers to an unknown node");
+            }
+            map.nodes.push_back(std::move(node));
+        }
+        map.ranges.reserve(ranges);
+        for (uint16_t index = 0; index < ranges; ++index) {
+            SlotMapRange range{};
+            range.first_slot = read_slot_map_uint16(data, offset);
+            range.last_slot = read_slot_map_uint16(data, offset);
+            range.node = read_slot_map_uint16(data, offset);
+            if (range.node != SLOT_MAP_NO_NODE && range.node >= nodes) {
+                throw std::runtime_error("Slot map refers to an unknown node");
+            }
+            map.ranges.push_back(range);
+        }
+        return map;
+    }
 
-            //New slot range begins, finish old one
-            write_slot_to_buffer(prev_node, data, offset, slot_number);
-            prev_node = slot.served_by;
+    uint64_t get_slot_map_digest(std::string_view data) {
+        if (data.size() < SLOT_MAP_HEADER_SIZE) {
+            return 0;
+        }
+        uint64_t digest;
+        std::memcpy(&digest, data.data() + sizeof(uint64_t), sizeof(uint64_t));
+        return be64toh(digest);
+    }
 
-            //Add start of next slot range
-            data.data()[offset++] = '\n';
-            std::string begin_slot = std::to_string(slot_number);
-            std::memcpy(data.data() + offset, begin_slot.data(), begin_slot.size());
-            offset += begin_slot.size();
+    void write_node_load(std::string& data, const cluster::ClusterNodeGossipData& node) {
+        if (!data.empty()) {
+            data += '\n';
         }
+        data += std::string(node.name.data(), strnlen(node.name.data(), node.name.size()));
+        data += '\t';
+        data += std::string(node.ip.data(), strnlen(node.ip.data(), node.ip.size()));
+        data += ':';
+        data += std::to_string(node.client_port);
+        data += '\t';
+        data += std::to_string(node.num_slots_served);
+        data += '\t';
+        data += std::to_string(node.load.keys);
+        data += '\t';
+        data += std::to_string(node.load.bytes);
+        data += '\t';
+        data += std::to_string(node.load.ops_per_second);
+        data += '\t';
+        data += std::to_string(node.load.bandwidth);
+    }
 
-        //Write last slot range
-        write_slot_to_buffer(prev_node, data, offset, slots.size());
+    net::WriteAll serialize_load(const cluster::ClusterState& state, net::Connection& connection) {
+        std::string data;
+        if (state.myself.primary[0] == '\0') {
+            write_node_load(data, state.myself);
+        }
+        for (const auto& [name, node] : state.nodes) {
+            //Slots can't be moved to failed nodes or replicas
+            if (!node.failed && node.primary[0] == '\0' && name != state.myself.name.data()) {
+                write_node_load(data, node);
+            }
+        }
+        return protocol::write_instruction(connection, {}, protocol::Instruction::c_OK_RESPONSE, data.data(), data.size());
+    }
 
-        protocol::send_instruction(connection, {}, protocol::Instruction::c_OK_RESPONSE, data.data(), offset);
+    net::WriteAll serialize_slot_stats(const std::vector<cluster::SlotStats>& stats, net::Connection& connection) {
+        std::string data;
+        for (const cluster::SlotStats& slot : stats) {
+            if (!data.empty()) {
+                data += '\n';
+            }
+            data += std::to_string(slot.slot);
+            data += '\t';
+            data += std::to_string(slot.keys);
+            data += '\t';
+            data += std::to_string(slot.bytes);
+            data += '\t';
+            data += std::to_string(slot.ops_per_second);
+            data += '\t';
+            data += std::to_string(slot.bandwidth);
+        }
+        return protocol::write_instruction(connection, {}, protocol::Instruction::c_OK_RESPONSE, data.data(), data.size());
+    }
+    net::WriteAll serialize_replication_info(const cluster::ReplicationInfo& info, net::Connection& connection) {
+        std::string data = info.primary.empty() ? "role\tprimary" : "role\treplica\nprimary\t" + info.primary;
+        if (!info.replication_id.empty()) {
+            data += "\nreplication_id\t" + info.replication_id;
+        }
+        data += "\noffset\t" + std::to_string(info.offset);
+        data += "\nsynced\t" + std::to_string(info.synced ? 1 : 0);
+        for (const cluster::ReplicaInfo& replica : info.replicas) {
+            data += "\nreplica\t" + replica.name + '\t' + std::to_string(replica.acked_offset) + '\t' + std::to_string(replica.lag)
+                + '\t' + std::to_string(replica.synced ? 1 : 0);
+        }
+        return protocol::write_instruction(connection, {}, protocol::Instruction::c_OK_RESPONSE, data.data(), data.size());
     }
 }
\ No newline at end of file
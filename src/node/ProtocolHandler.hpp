@@ -1,13 +1,20 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <string_view>
 #include <vector>
 
 #include "../net/FileDescriptor.hpp"
 #include "../net/Connection.hpp"
+#include "../net/Task.hpp"
 #include "../utils/ByteArray.hpp"
 #include "../utils/Status.hpp"
 #include "../node/Cluster.hpp"
+#include "../node/Load.hpp"
+#include "../node/Replication.hpp"
 
 namespace node {
 
@@ -36,7 +43,47 @@ namespace node {
             c_NO_ASKING_ERROR = 12,
             c_CLUSTER_MIGRATION_FINISHED = 13,
             c_GET_SLOTS = 14,
-            enum_size = 15
+            //Sets up a shared memory channel, only on unix domain socket connections
+            c_SHARED_MEMORY = 15,
+            //Asks a node to send all of its slot ranges with the next ping
+            c_CLUSTER_FULL_SYNC = 16,
+            //Failure detection messages between the nodes, see cluster::Membership
+            c_CLUSTER_PROBE = 17,
+            //Keys and values of a migrating slot, streamed to the importing node, see cluster::SlotMigrator
+            c_CLUSTER_MIGRATE_KEYS = 18,
+            c_CLUSTER_MIGRATE_KEYS_ACK = 19,
+            //Load of every node the receiver knows of, as gossiped by the nodes, see cluster::NodeLoad
+            c_GET_LOAD = 20,
+            //Statistics of the slots the receiver serves, see cluster::SlotStats
+            c_GET_SLOT_STATS = 21,
+            //Makes the receiver a replica of the named primary, see cluster::ReplicationSink
+            c_REPLICATE = 22,
+            //Replication between a primary and its replicas on the cluster bus, see cluster::ReplicationSource
+            c_CLUSTER_REPLICA_SYNC = 23,
+            c_CLUSTER_REPLICATION_DATA = 24,
+            c_CLUSTER_REPLICA_ACK = 25,
+            //Lets a replica answer the GETs of the connection for the slots of its primary, the values might be stale
+            c_READ_ONLY = 26,
+            //Role and offsets of the receiver, and the replicas of a primary with their lag
+            c_GET_REPLICATION_INFO = 27,
+            //Election of a replica whose primary failed, see cluster::Failover
+            c_CLUSTER_FAILOVER_VOTE_REQUEST = 28,
+            c_CLUSTER_FAILOVER_VOTE = 29,
+            //Sent first on the connections of a proxying node, their requests are answered with redirects instead of being forwarded again
+            c_PROXY = 30,
+            //Keys of any slots, the receiver serves its own and forwards the others to their owners
+            //The keys and values are entries of the payload like the ones of a migration batch, see cluster::append_migrated_key()
+            c_MGET = 31,
+            c_MSET = 32,
+            //Values in the order of the keys, missing keys are entries marked as erased
+            c_MGET_RESPONSE = 33,
+            //Makes the receiver push the changes of the slot map to the connection, starting with the whole map
+            c_SUBSCRIBE_SLOTS = 34,
+            //Slot ranges like the ones of GET_SLOTS that changed since the base version, all of them if that is 0
+            c_SLOT_MAP_UPDATE = 35,
+            //Binary slot map, see serialize_slot_map(), the payload is empty if the digest of the request is still current
+            c_GET_SLOT_MAP = 36,
+            enum_size = 37
         };
 
         struct MetaData {
@@ -110,14 +157,161 @@ namespace node {
 
         enum class CommandFieldsPing {
             c_NODES_AMOUNT = 0,
-            c_SLOTS_AMOUNT = 1,
+            c_SLOT_RANGES_AMOUNT = 1,
+            c_VERSION = 2,
+            c_BASE_VERSION = 3,
+            c_DIGEST = 4,
+            enum_size = 5
+        };
+
+        enum class CommandFieldsFullSync {
+            c_NAME = 0,
+            enum_size = 1
+        };
+
+        enum class CommandFieldsProbe {
+            c_TYPE = 0,
+            c_FROM = 1,
+            c_TARGET = 2,
+            c_SEQUENCE = 3,
+            c_UPDATES_AMOUNT = 4,
+            enum_size = 5
+        };
+
+        enum class CommandFieldsMigrateKeys {
+            c_NAME = 0,
+            c_SLOT = 1,
+            c_BATCH = 2,
+            c_KEYS_AMOUNT = 3,
+            enum_size = 4
+        };
+
+        enum class CommandFieldsMigrateKeysAck {
+            c_NAME = 0,
+            c_SLOT = 1,
+            c_BATCH = 2,
+            enum_size = 3
+        };
+
+        enum class CommandFieldsReplicate {
+            c_PRIMARY_NAME = 0,
+            enum_size = 1
+        };
+
+        //Empty replication id if the replica has nothing to continue from
+        enum class CommandFieldsReplicaSync {
+            c_NAME = 0,
+            c_REPLICATION_ID = 1,
+            c_OFFSET = 2,
+            enum_size = 3
+        };
+
+        enum class CommandFieldsReplicationData {
+            c_NAME = 0,
+            c_REPLICATION_ID = 1,
+            c_KIND = 2,
+            c_OFFSET = 3,
+            enum_size = 4
+        };
+
+        using CommandFieldsReplicaAck = CommandFieldsReplicaSync;
+
+        enum class CommandFieldsFailoverVoteRequest {
+            c_NAME = 0,
+            c_EPOCH = 1,
+            c_PRIMARY_NAME = 2,
+            enum_size = 3
+        };
+
+        enum class CommandFieldsFailoverVote {
+            c_NAME = 0,
+            c_EPOCH = 1,
             enum_size = 2
         };
 
         using CommandFieldsAsk = CommandFieldsMove;
 
+        //Asking applies to all keys, it is only set by nodes that forward a part of a request
+        enum class CommandFieldsMultiKey {
+            c_KEYS_AMOUNT = 0,
+            c_ASKING = 1,
+            enum_size = 2
+        };
+
+        //Redirect of a forwarded MGET or MSET, the slot is the one of the key that isn't on the node
+        enum class CommandFieldsMultiKeyMove {
+            c_OTHER_IP = 0,
+            c_OTHER_CLIENT_PORT = 1,
+            c_SLOT = 2,
+            enum_size = 3
+        };
+
+        enum class CommandFieldsMultiGetResponse {
+            c_KEYS_AMOUNT = 0,
+            enum_size = 1
+        };
+
+        enum class CommandFieldsSlotMapUpdate {
+            c_VERSION = 0,
+            c_BASE_VERSION = 1,
+            enum_size = 2
+        };
+
+        //Digest of the slot map the client has, 0 if it has none
+        enum class CommandFieldsGetSlotMap {
+            c_DIGEST = 0,
+            enum_size = 1
+        };
+
+        enum class CommandFieldsSharedMemory {
+            c_RING_SIZE = 0,
+            enum_size = 1
+        };
+
+        //Upper bounds for received commands, the sizes are sent by the peer and can't be trusted
+        constexpr uint16_t MAX_COMMAND_ARGC = 16;
+        constexpr uint64_t MAX_COMMAND_SIZE = 64 * 1024;
+        //Maximum amount of separate buffers the payload of a sent instruction can consist of
+        constexpr uint16_t MAX_PAYLOAD_PARTS = 4;
+
+        //Owning command, used to build instructions that are sent
         using Command = std::vector<std::string>;
 
+        //Non-owning command, used for received instructions
+        //The fields point into the receive buffer of the connection and are only valid until the next command is received on it
+        class CommandView {
+        public:
+            CommandView() = default;
+
+            //Allows passing an owning command wherever a received one is expected
+            // NOLINTNEXTLINE
+            CommandView(const Command& command);
+
+            std::string_view operator[](size_t index) const {
+                return fields_[index];
+            }
+            size_t size() const {
+                return size_;
+            }
+            bool empty() const {
+                return size_ == 0;
+            }
+            auto begin() const {
+                return fields_.begin();
+            }
+            auto end() const {
+                return fields_.begin() + size_;
+            }
+
+            void push_back(std::string_view field);
+
+            Command to_command() const;
+
+        private:
+            std::array<std::string_view, MAX_COMMAND_ARGC> fields_{};
+            uint16_t size_ = 0;
+        };
+
         using ResponseData = std::tuple<MetaData, Command, ByteArray>;
 
         enum class ResponseDataFields {
@@ -129,13 +323,28 @@ namespace node {
 
         MetaData get_metadata(net::Connection& connection, std::string debug_string = "");
 
-        Command get_command(net::Connection& connection, uint16_t argc, uint64_t command_size);
+        CommandView parse_command(std::span<const char> data, uint16_t argc);
+
+        CommandView get_command(net::Connection& connection, uint16_t argc, uint64_t command_size);
+
+        uint64_t field_to_uint64(std::string_view field);
 
         ByteArray get_payload(net::Connection& connection, uint64_t payload_size);
 
         void get_payload(net::Connection& connection, char* dest, uint64_t payload_size);
 
-        void get_payload(net::Connection& connection, char* dest, uint64_t payload_size);
+        //Awaitable versions used by the node, they suspend instead of blocking if the connection has async io enabled
+        net::Task<MetaData> read_metadata(net::Connection& connection);
+
+        net::Task<CommandView> read_command(net::Connection& connection, uint16_t argc, uint64_t command_size);
+
+        net::ReadExact read_payload(net::Connection& connection, char* dest, uint64_t payload_size);
+
+        //Receives and drops the payload, so the next request can be read
+        net::Task<> skip_payload(net::Connection& connection, uint64_t payload_size);
+
+        ssize_t send_instruction(net::Connection& connection, const Command& command, Instruction i,
+            std::initializer_list<std::span<const char>> payload);
 
         ssize_t send_instruction(net::Connection& connection, const Command& command, Instruction i,
             const char* payload = nullptr, uint64_t payload_size = 0);
@@ -144,10 +353,74 @@ namespace node {
 
         ssize_t send_instruction(net::Connection& connection, const Command& command, Instruction i, const std::string& payload);
 
+        //The instruction is sent or queued right away, awaiting the result waits until the output buffer drained enough
+        net::WriteAll write_instruction(net::Connection& connection, const Command& command, Instruction i,
+            std::initializer_list<std::span<const char>> payload);
+
+        net::WriteAll write_instruction(net::Connection& connection, const Command& command, Instruction i,
+            const char* payload = nullptr, uint64_t payload_size = 0);
+
+        net::WriteAll write_instruction(net::Connection& connection, const Status& state);
+
+        net::WriteAll write_instruction(net::Connection& connection, const Command& command, Instruction i, const std::string& payload);
+
         uint64_t get_command_size(const Command& command);
 
         void serialize_command(const Command& command, std::span<char> buf);
 
-        void serialize_slots(const std::vector<cluster::Slot>& slots, net::Connection& connection);
+        //<slot begin>\t<slot end>\t<ip:port>[\t<replica ip:port>...]\n
+        net::WriteAll serialize_slots(const cluster::ClusterState& state, net::Connection& connection);
+
+        //Owner and replicas of every slot as serialize_slots() writes them, NULL for the unserved ones
+        std::vector<std::string> get_slot_addresses(const cluster::ClusterState& state);
+
+        //Lines of serialize_slots() for the ranges of slots whose addresses differ from the previous ones, all slots if there are none
+        std::string serialize_slot_changes(const std::vector<std::string>& previous, const std::vector<std::string>& current);
+
+        //Index of a node in a slot map, used for unserved slots and nodes without a primary
+        constexpr uint16_t SLOT_MAP_NO_NODE = UINT16_MAX;
+        constexpr size_t SLOT_MAP_HEADER_SIZE = 2 * sizeof(uint64_t);
+
+        struct SlotMapNode {
+            std::string name;
+            //<ip:port> of the client port
+            std::string address;
+            uint16_t primary;
+        };
+
+        struct SlotMapRange {
+            uint16_t first_slot;
+            uint16_t last_slot;
+            uint16_t node;
+        };
+
+        struct SlotMap {
+            uint64_t config_epoch;
+            uint64_t digest;
+            std::vector<SlotMapNode> nodes;
+            std::vector<SlotMapRange> ranges;
+        };
+
+        //<config epoch:8><digest:8><nodes:2><ranges:2>, followed by the nodes and the ranges, the numbers are big endian
+        //Node: <primary:2><client port:2><name size:2><name><ip size:2><ip>, the owners by their first slot and then their replicas
+        //Range: <first slot:2><last slot:2><node:2>, SLOT_MAP_NO_NODE for the unserved slots and the ones of failed nodes
+        //The digest is a hash of everything after the header, so nodes that agree on the map send the same one, it is never 0
+        std::string serialize_slot_map(const cluster::ClusterState& state);
+
+        //Throws if the map is truncated or refers to nodes it doesn't contain
+        SlotMap parse_slot_map(std::span<const char> data);
+
+        //Digest from the header of a serialized slot map
+        uint64_t get_slot_map_digest(std::string_view data);
+
+        //<name>\t<ip:port>\t<slots served>\t<keys>\t<bytes>\t<ops per second>\t<bandwidth>\n for this node and the others that didn't fail, replicas are left out
+        net::WriteAll serialize_load(const cluster::ClusterState& state, net::Connection& connection);
+
+        //<slot>\t<keys>\t<bytes>\t<ops per second>\t<bandwidth>\n
+        net::WriteAll serialize_slot_stats(const std::vector<cluster::SlotStats>& stats, net::Connection& connection);
+
+        //<field>\t<value>\n for the role, primary, replication_id, offset and synced, fields without a value are left out
+        //Followed by replica\t<name>\t<acked offset>\t<lag>\t<synced>\n for every replica of a primary
+        net::WriteAll serialize_replication_info(const cluster::ReplicationInfo& info, net::Connection& connection);
     }
 }
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include "Proxy.hpp"
+
+using Instruction = node::protocol::Instruction;
+
+namespace node::cluster {
+
+    namespace {
+        std::optional<ProxyRoute> get_partner_route(const ClusterState& state, uint16_t slot, bool asking) {
+            observer_ptr<ClusterNode> partner = state.slots[slot].migration_partner;
+            if (partner == nullptr) {
+                return std::nullopt;
+            }
+            return ProxyRoute{ std::string(partner->ip.data()), partner->client_port, asking };
+        }
+    }
+
+    std::optional<ProxyRoute> get_proxy_route(Instruction instruction, std::string_view key, bool asking,
+        key_value_store::IKeyValueStore& kvs, const ClusterState& state) {
+        uint16_t slot = get_key_slot(key);
+        if (slot >= state.slots.size()) {
+            return std::nullopt;
+        }
+        const Slot& current = state.slots[slot];
+
+        //Unserved slots and the ones of failed nodes are answered with an error
+        if (!state.myself.served_slots.test(slot)) {
+            if (current.served_by == nullptr || current.served_by->failed) {
+                return std::nullopt;
+            }
+            return ProxyRoute{ std::string(current.served_by->ip.data()), current.served_by->client_port, false };
+        }
+
+        //The same cases the handlers redirect in while the slot is migrated
+        switch (instruction) {
+        case Instruction::c_PUT:
+            if (current.state == SlotState::c_MIGRATING && !kvs.contains_key(key)) {
+                return get_partner_route(state, slot, true);
+            }
+            break;
+        case Instruction::c_GET:
+            if (current.state == SlotState::c_IMPORTING && !asking) {
+                return get_partner_route(state, slot, false);
+            }
+            if (current.state == SlotState::c_MIGRATING && !kvs.contains_key(key)) {
+                return get_partner_route(state, slot, true);
+            }
+            break;
+        case Instruction::c_ERASE:
+            if (current.state == SlotState::c_MIGRATING && !asking && !kvs.contains_key(key)) {
+                return get_partner_route(state, slot, true);
+            }
+            break;
+        default:
+            break;
+        }
+        return std::nullopt;
+    }
+
+    std::optional<ProxyRoute> get_redirect_route(const protocol::MetaData& meta_data, const protocol::Command& command) {
+        //All three name the node by ip and client port, the ones of an MGET or MSET also the slot
+        if (command.size() != protocol::to_integral(protocol::CommandFieldsMove::enum_size)
+            && command.size() != protocol::to_integral(protocol::CommandFieldsMultiKeyMove::enum_size)) {
+            return std::nullopt;
+        }
+        bool asking = false;
+        switch (meta_data.instruction) {
+        case Instruction::c_MOVE:
+        case Instruction::c_NO_ASKING_ERROR:
+            break;
+        case Instruction::c_ASK:
+            asking = true;
+            break;
+        default:
+            return std::nullopt;
+        }
+        uint64_t port = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsMove::c_OTHER_CLIENT_PORT)]);
+        return ProxyRoute{ command[protocol::to_integral(protocol::CommandFieldsMove::c_OTHER_IP)], static_cast<uint16_t>(port), asking };
+    }
+
+    std::optional<uint16_t> get_redirect_slot(const protocol::Command& command) {
+        if (command.size() != protocol::to_integral(protocol::CommandFieldsMultiKeyMove::enum_size)) {
+            return std::nullopt;
+        }
+        uint64_t slot = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsMultiKeyMove::c_SLOT)]);
+        if (slot >= CLUSTER_AMOUNT_OF_SLOTS) {
+            return std::nullopt;
+        }
+        return static_cast<uint16_t>(slot);
+    }
+
+    ProxyBatch& add_to_proxy_batch(std::vector<ProxyBatch>& batches, const ProxyRoute& route, size_t key) {
+        //A request rarely spans more than a few nodes
+        auto batch = std::find_if(batches.begin(), batches.end(), [&route](const ProxyBatch& batch) {
+            return batch.route.ip == route.ip && batch.route.client_port == route.client_port && batch.route.asking == route.asking;
+        });
+        if (batch == batches.end()) {
+            batches.push_back(ProxyBatch{ route, {}, 0 });
+            batch = std::prev(batches.end());
+        }
+        batch->keys.push_back(key);
+        return *batch;
+    }
+
+    net::Task<ProxyResponse> read_proxy_response(net::Connection& connection) {
+        ProxyResponse response{};
+        response.meta_data = co_await protocol::read_metadata(connection);
+        protocol::CommandView command = co_await protocol::read_command(connection, response.meta_data.argc, response.meta_data.command_size);
+        response.command = command.to_command();
+        response.payload = ByteArray::new_allocated_byte_array(response.meta_data.payload_size);
+        if (response.meta_data.payload_size > 0) {
+            co_await protocol::read_payload(connection, response.payload.data(), response.meta_data.payload_size);
+        }
+        co_return response;
+    }
+
+    ProxyLink::Receive::~Receive() {
+        if (waiter_ != nullptr) {
+            waiter_->handle = nullptr;
+        }
+    }
+
+    ProxyResponse ProxyLink::Receive::await_resume() {
+        if (waiter_->error.has_value()) {
+            throw std::runtime_error(*waiter_->error);
+        }
+        return std::move(*waiter_->response);
+    }
+
+    ProxyLink::Receive ProxyLink::receive(int client_fd) {
+        auto waiter = std::make_shared<Waiter>();
+        waiter->client_fd = client_fd;
+        waiters_.push_back(waiter);
+        return Receive{ std::move(waiter) };
+    }
+
+    void ProxyLink::drop_response() {
+        waiters_.push_back(std::make_shared<Waiter>());
+    }
+
+    int ProxyLink::complete(ProxyResponse response) {
+        if (waiters_.empty()) {
+            throw std::runtime_error("Response on a proxy link without a request");
+        }
+        std::shared_ptr<Waiter> waiter = std::move(waiters_.front());
+        waiters_.pop_front();
+        waiter->response = std::move(response);
+        if (!waiter->handle) {
+            return -1;
+        }
+        std::exchange(waiter->handle, nullptr).resume();
+        return waiter->client_fd;
+    }
+
+    std::vector<int> ProxyLink::fail(const std::string& error) {
+        std::deque<std::shared_ptr<Waiter>> waiters = std::move(waiters_);
+        waiters_.clear();
+        std::vector<int> client_fds;
+        for (std::shared_ptr<Waiter>& waiter : waiters) {
+            //A request that was just sent sees the error once it waits
+            waiter->error = error;
+            if (!waiter->handle) {
+                continue;
+            }
+            std::exchange(waiter->handle, nullptr).resume();
+            client_fds.push_back(waiter->client_fd);
+        }
+        return client_fds;
+    }
+
+}
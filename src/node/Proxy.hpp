@@ -0,0 +1,123 @@
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../KVS/IKeyValueStore.hpp"
+#include "../net/Connection.hpp"
+#include "../net/Task.hpp"
+#include "../utils/ByteArray.hpp"
+#include "Cluster.hpp"
+#include "ProtocolHandler.hpp"
+
+namespace node::cluster {
+
+    //A request is forwarded again for each redirect the nodes answer with, the last one goes to the client
+    constexpr int CLUSTER_PROXY_MAX_REDIRECTS = 5;
+
+    //Node a request is forwarded to, asking is set if it has to be answered by an importing node
+    struct ProxyRoute {
+        std::string ip;
+        uint16_t client_port;
+        bool asking;
+    };
+
+    //Returns where a PUT, GET or ERASE of the key has to go to if this node would answer it with a MOVE, ASK or NO_ASKING_ERROR
+    //Requests this node answers itself, with the value or an error, return nullopt
+    std::optional<ProxyRoute> get_proxy_route(protocol::Instruction instruction, std::string_view key, bool asking,
+        key_value_store::IKeyValueStore& kvs, const ClusterState& state);
+
+    //Follows a MOVE, ASK or NO_ASKING_ERROR response, returns nullopt for every other response
+    std::optional<ProxyRoute> get_redirect_route(const protocol::MetaData& meta_data, const protocol::Command& command);
+
+    //Slot a redirect of an MGET or MSET names, nullopt if it names none
+    std::optional<uint16_t> get_redirect_slot(const protocol::Command& command);
+
+    //Keys of an MGET or MSET that are forwarded to the same node together, by their position in the request
+    struct ProxyBatch {
+        ProxyRoute route;
+        std::vector<size_t> keys;
+        int redirects = 0;
+    };
+
+    //Adds the key to the batch with the same node and asking flag, a new one is started for the first key of a route
+    //Returns the batch the key was added to
+    ProxyBatch& add_to_proxy_batch(std::vector<ProxyBatch>& batches, const ProxyRoute& route, size_t key);
+
+    struct ProxyResponse {
+        protocol::MetaData meta_data;
+        protocol::Command command;
+        ByteArray payload;
+    };
+
+    //Receives a complete response, the payload is owned so it can be relayed to a client on another connection
+    net::Task<ProxyResponse> read_proxy_response(net::Connection& connection);
+
+    //Pipelined connection of a proxying node to another node, the responses arrive in the order of the requests
+    //Every request that was sent gets a waiter, the responses are handed to the waiters in that order
+    class ProxyLink {
+    public:
+        struct Waiter {
+            //Empty if nobody waits for the response anymore, it is dropped then
+            std::coroutine_handle<> handle;
+            //Client connection of the waiting request, -1 for the responses that are dropped anyway
+            int client_fd = -1;
+            std::optional<ProxyResponse> response = std::nullopt;
+            std::optional<std::string> error = std::nullopt;
+        };
+
+        //Awaitable for the response of the request sent last, throws if the link failed before it arrived
+        //A coroutine destroyed while it waits leaves the response to be dropped
+        class Receive {
+        public:
+            explicit Receive(std::shared_ptr<Waiter> waiter) : waiter_(std::move(waiter)) {}
+            ~Receive();
+
+            Receive(const Receive&) = delete;
+            Receive& operator=(const Receive&) = delete;
+            Receive(Receive&&) = default;
+
+            bool await_ready() const noexcept {
+                return waiter_->response.has_value() || waiter_->error.has_value();
+            }
+            void await_suspend(std::coroutine_handle<> handle) noexcept {
+                waiter_->handle = handle;
+            }
+            ProxyResponse await_resume();
+
+        private:
+            std::shared_ptr<Waiter> waiter_;
+        };
+
+        //The connection is owned by the event loop, the link only keeps the order of its responses
+        explicit ProxyLink(int fd) : fd_(fd) {}
+
+        int fd() const {
+            return fd_;
+        }
+
+        //Has to be called right after the request was sent, before any other one is sent on the link
+        [[nodiscard]] Receive receive(int client_fd);
+
+        //The response of the request sent last isn't waited for
+        void drop_response();
+
+        //Hands the response to the waiter of the oldest request and continues it, returns its client connection or -1 if nobody waited
+        //Throws if no request waits for a response
+        int complete(ProxyResponse response);
+
+        //Continues all waiters with the error, returns their client connections
+        std::vector<int> fail(const std::string& error);
+
+    private:
+        int fd_;
+        std::deque<std::shared_ptr<Waiter>> waiters_;
+    };
+
+}
@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+#include "Replication.hpp"
+#include "ProtocolHandler.hpp"
+
+namespace node::cluster {
+
+    namespace {
+        constexpr size_t replication_id_len = 32;
+
+        //A new id for every history, a replica can only continue from an offset within the same one
+        std::string new_replication_id() {
+            static thread_local std::mt19937_64 random_engine(std::random_device{}());
+            constexpr std::string_view digits = "0123456789abcdef";
+            std::uniform_int_distribution<size_t> digit(0, digits.size() - 1);
+            std::string id(replication_id_len, '0');
+            for (char& c : id) {
+                c = digits[digit(random_engine)];
+            }
+            return id;
+        }
+
+        observer_ptr<ClusterNode> find_node(ClusterState& state, const std::string& name) {
+            auto node = state.nodes.find(name);
+            if (node == state.nodes.end()) {
+                return nullptr;
+            }
+            return &node->second;
+        }
+
+        //The key counts of the slots are kept like on the primary, so the replica can take over its slots
+        void apply_key(const MigratedKey& key, key_value_store::IKeyValueStore& kvs, ClusterState& state) {
+            uint16_t slot = get_key_slot(key.key);
+            if (key.erased) {
+                if (kvs.erase(key.key).is_ok() && state.slots[slot].amount_of_keys > 0) {
+                    state.slots[slot].amount_of_keys -= 1;
+                }
+                return;
+            }
+            if (!kvs.contains_key(key.key)) {
+                state.slots[slot].amount_of_keys += 1;
+            }
+            kvs.put(key.key, key.value);
+        }
+    }
+
+    ReplicationBacklog::ReplicationBacklog(uint64_t capacity) : buffer_(std::max<uint64_t>(capacity, 1)) {
+    }
+
+    void ReplicationBacklog::append(std::span<const char> data) {
+        //Only the tail of an entry larger than the ring is kept, reading it fails
+        if (data.size() > buffer_.size()) {
+            end_ += data.size() - buffer_.size();
+            data = data.subspan(data.size() - buffer_.size());
+        }
+        size_t position = end_ % buffer_.size();
+        size_t first = std::min(data.size(), buffer_.size() - position);
+        std::memcpy(buffer_.data() + position, data.data(), first);
+        std::memcpy(buffer_.data(), data.data() + first, data.size() - first);
+        end_ += data.size();
+    }
+
+    bool ReplicationBacklog::read(uint64_t offset, std::vector<char>& data) const {
+        if (offset > end_ || offset < get_start()) {
+            return false;
+        }
+        uint64_t size = end_ - offset;
+        size_t position = offset % buffer_.size();
+        size_t first = std::min<uint64_t>(size, buffer_.size() - position);
+        data.resize(size);
+        std::memcpy(data.data(), buffer_.data() + position, first);
+        std::memcpy(data.data() + first, buffer_.data(), size - first);
+        return true;
+    }
+
+    uint64_t ReplicationBacklog::get_start() const {
+        return std::max<uint64_t>(start_, end_ > buffer_.size() ? end_ - buffer_.size() : 0);
+    }
+
+    void ReplicationBacklog::reset(uint64_t offset) {
+        start_ = offset;
+        end_ = offset;
+    }
+
+    ReplicationSource::ReplicationSource(ReplicationConfig config)
+        : config_(config), replication_id_(new_replication_id()), backlog_(config.backlog_bytes) {
+    }
+
+    void ReplicationSource::record_put(std::string_view key, const ByteArray& value) {
+        record(key, value.data(), value.size(), false);
+    }
+
+    void ReplicationSource::record_erase(std::string_view key) {
+        record(key, nullptr, 0, true);
+    }
+
+    void ReplicationSource::record(std::string_view key, const char* value, uint64_t value_size, bool erased) {
+        if (!enabled_) {
+            return;
+        }
+        entry_.clear();
+        append_migrated_key(entry_, key, value, value_size, erased);
+        backlog_.append(entry_);
+    }
+
+    void ReplicationSource::attach(const std::string& replica, const std::string& replication_id, uint64_t offset,
+        const key_value_store::IKeyValueStore& kvs, ClusterState& state, ReplicationClock::time_point now) {
+        observer_ptr<ClusterNode> node = find_node(state, replica);
+        if (!enabled_ || node == nullptr) {
+            return;
+        }
+
+        Replica& attached = replicas_[replica];
+        attached = Replica{};
+        attached.last_ack = now;
+        if (replication_id == replication_id_ && offset >= backlog_.get_start() && offset <= backlog_.get_offset()) {
+            //Continues with the log after the offset, starting with the next send
+            attached.sent_offset = offset;
+            attached.acked_offset = offset;
+            return;
+        }
+        if (!start_full_sync(attached, *node, state.myself.name.data(), kvs, now)) {
+            replicas_.erase(replica);
+        }
+    }
+
+    bool ReplicationSource::start_full_sync(Replica& replica, ClusterNode& node, const std::string& myself,
+        const key_value_store::IKeyValueStore& kvs, ReplicationClock::time_point now) {
+        replica.sync_slots.clear();
+        replica.sync_keys.clear();
+        for (uint16_t slot = 0; slot < CLUSTER_AMOUNT_OF_SLOTS; slot++) {
+            if (kvs.get_slot_size(slot) != 0) {
+                replica.sync_slots.push_back(slot);
+            }
+        }
+        //Writes from here on are sent with the log, the snapshot only covers what is stored now
+        replica.sent_offset = backlog_.get_offset();
+        replica.acked_offset = replica.sent_offset;
+        replica.syncing = true;
+        replica.last_sent = now;
+        return send_data(node, myself, ReplicationDataKind::c_FULL_SYNC, replica.sent_offset, {});
+    }
+
+    void ReplicationSource::handle_ack(const std::string& replica, const std::string& replication_id, uint64_t offset, ReplicationClock::time_point now) {
+        auto attached = replicas_.find(replica);
+        if (attached == replicas_.end() || replication_id != replication_id_) {
+            return;
+        }
+        attached->second.acked_offset = std::clamp(offset, attached->second.acked_offset, attached->second.sent_offset);
+        attached->second.last_ack = now;
+    }
+
+    void ReplicationSource::send(const key_value_store::IKeyValueStore& kvs, ClusterState& state, ReplicationClock::time_point now) {
+        std::string myself = state.myself.name.data();
+        for (auto it = replicas_.begin(); it != replicas_.end();) {
+            observer_ptr<ClusterNode> node = find_node(state, it->first);
+            //It attaches again once it is back
+            if (node == nullptr || node->failed || now - it->second.last_ack > CLUSTER_REPLICATION_TIMEOUT
+                || !send_replica(it->second, *node, myself, kvs, now)) {
+                it = replicas_.erase(it);
+                continue;
+            }
+            ++it;
+        }
+    }
+
+    bool ReplicationSource::send_replica(Replica& replica, ClusterNode& node, const std::string& myself,
+        const key_value_store::IKeyValueStore& kvs, ReplicationClock::time_point now) {
+        if (replica.sent_offset < backlog_.get_offset()) {
+            std::vector<char> log;
+            //Fell behind further than the backlog reaches
+            if (!backlog_.read(replica.sent_offset, log)) {
+                return start_full_sync(replica, node, myself, kvs, now);
+            }
+            if (!send_data(node, myself, ReplicationDataKind::c_LOG, replica.sent_offset, log)) {
+                return false;
+            }
+            replica.sent_offset = backlog_.get_offset();
+            replica.last_sent = now;
+        }
+
+        //A value read now is newer than the log sent so far, so the snapshot has to wait until the log is sent completely
+        if (replica.syncing) {
+            std::vector<char> payload;
+            while (payload.size() < config_.sync_batch_bytes && (!replica.sync_keys.empty() || !replica.sync_slots.empty())) {
+                if (replica.sync_keys.empty()) {
+                    for (auto key = kvs.new_slot_iterator(replica.sync_slots.front()); key->valid(); key->next()) {
+                        replica.sync_keys.emplace_back(key->key());
+                    }
+                    replica.sync_slots.pop_front();
+                    continue;
+                }
+                std::string key = std::move(replica.sync_keys.front());
+                replica.sync_keys.pop_front();
+                //Erased meanwhile, the log told the replica already
+                ByteArray value{};
+                if (kvs.get(key, value).is_ok()) {
+                    append_migrated_key(payload, key, value.data(), value.size(), false);
+                }
+            }
+            if (!payload.empty() && !send_data(node, myself, ReplicationDataKind::c_SNAPSHOT, replica.sent_offset, payload)) {
+                return false;
+            }
+            if (replica.sync_keys.empty() && replica.sync_slots.empty()) {
+                if (!send_data(node, myself, ReplicationDataKind::c_SYNC_FINISHED, replica.sent_offset, {})) {
+                    return false;
+                }
+                replica.syncing = false;
+            }
+            replica.last_sent = now;
+        }
+
+        if (now - replica.last_sent >= CLUSTER_REPLICATION_HEARTBEAT) {
+            replica.last_sent = now;
+            return send_data(node, myself, ReplicationDataKind::c_LOG, replica.sent_offset, {});
+        }
+        return true;
+    }
+
+    bool ReplicationSource::send_data(ClusterNode& node, const std::string& myself, ReplicationDataKind kind, uint64_t offset, std::span<const char> payload) {
+        return node.outgoing_link.send(
+            protocol::Command{ myself, replication_id_, std::to_string(protocol::to_integral(kind)), std::to_string(offset) },
+            protocol::Instruction::c_CLUSTER_REPLICATION_DATA, payload);
+    }
+
+    void ReplicationSource::disable() {
+        enabled_ = false;
+        replicas_.clear();
+    }
+
+    void ReplicationSource::enable(const std::string& replication_id, uint64_t offset) {
+        if (enabled_) {
+            return;
+        }
+        enabled_ = true;
+        replication_id_ = replication_id.empty() ? new_replication_id() : replication_id;
+        backlog_.reset(replication_id.empty() ? 0 : offset);
+    }
+
+    std::vector<ReplicaInfo> ReplicationSource::get_replicas() const {
+        std::vector<ReplicaInfo> replicas;
+        for (const auto& [name, replica] : replicas_) {
+            replicas.push_back(ReplicaInfo{ name, replica.acked_offset, backlog_.get_offset() - replica.acked_offset, !replica.syncing });
+        }
+        std::sort(replicas.begin(), replicas.end(), [](const ReplicaInfo& a, const ReplicaInfo& b) { return a.name < b.name; });
+        return replicas;
+    }
+
+    void ReplicationSink::follow(const std::string& primary) {
+        if (primary == primary_) {
+            return;
+        }
+        //Keeps what it synced, a primary with the same history continues from the offset
+        primary_ = primary;
+        attached_ = false;
+        last_request_ = {};
+    }
+
+    void ReplicationSink::update(ClusterState& state, ReplicationClock::time_point now) {
+        if (primary_.empty()) {
+            return;
+        }
+        observer_ptr<ClusterNode> primary = find_node(state, primary_);
+        if (primary == nullptr) {
+            return;
+        }
+        if (attached_ && now - last_heard_ > CLUSTER_REPLICATION_TIMEOUT) {
+            attached_ = false;
+        }
+
+        std::string myself = state.myself.name.data();
+        if (!attached_) {
+            if (now - last_request_ < CLUSTER_REPLICATION_RETRY && last_request_ != ReplicationClock::time_point{}) {
+                return;
+            }
+            last_request_ = now;
+            //Keeps the keys it has until the primary decides whether it needs a full sync, which it does if the last one didn't finish
+            primary->outgoing_link.send(protocol::Command{ myself, synced_ ? replication_id_ : "", std::to_string(offset_) },
+                protocol::Instruction::c_CLUSTER_REPLICA_SYNC);
+            return;
+        }
+
+        if (now - last_ack_ >= CLUSTER_REPLICATION_ACK_INTERVAL) {
+            last_ack_ = now;
+            primary->outgoing_link.send(protocol::Command{ myself, replication_id_, std::to_string(offset_) },
+                protocol::Instruction::c_CLUSTER_REPLICA_ACK);
+        }
+    }
+
+    void ReplicationSink::handle_data(const ReplicationData& data, key_value_store::IKeyValueStore& kvs, ClusterState& state,
+        ReplicationClock::time_point now) {
+        if (data.from != primary_) {
+            return;
+        }
+
+        if (data.kind == ReplicationDataKind::c_FULL_SYNC) {
+            for (uint16_t slot = 0; slot < CLUSTER_AMOUNT_OF_SLOTS; slot++) {
+                std::vector<std::string> keys;
+                for (auto key = kvs.new_slot_iterator(slot); key->valid(); key->next()) {
+                    keys.emplace_back(key->key());
+                }
+                for (const std::string& key : keys) {
+                    kvs.erase(key);
+                }
+                state.slots[slot].amount_of_keys = 0;
+            }
+            replication_id_ = data.replication_id;
+            offset_ = data.offset;
+            attached_ = true;
+            synced_ = false;
+            last_heard_ = now;
+            return;
+        }
+
+        //Left over from an earlier attachment, or something was lost in between
+        if (data.replication_id != replication_id_ || data.offset != offset_) {
+            if (attached_) {
+                attached_ = false;
+                last_request_ = {};
+            }
+            return;
+        }
+        //The primary continues the log after the offset it was asked for
+        if (!attached_ && !synced_) {
+            return;
+        }
+        attached_ = true;
+        last_heard_ = now;
+
+        for (const MigratedKey& key : data.keys) {
+            apply_key(key, kvs, state);
+        }
+        if (data.kind == ReplicationDataKind::c_LOG) {
+            offset_ += data.size;
+        }
+        else if (data.kind == ReplicationDataKind::c_SYNC_FINISHED) {
+            synced_ = true;
+        }
+    }
+
+    ReplicatedKVS::ReplicatedKVS(std::unique_ptr<key_value_store::IKeyValueStore> store, ReplicationSource& source)
+        : store_(std::move(store)), source_(source) {
+    }
+
+    Status ReplicatedKVS::put(std::string_view key, const ByteArray& value, const WriteOptions& options) noexcept {
+        Status status = store_->put(key, value, options);
+        if (status.is_ok()) {
+            source_.record_put(key, value);
+        }
+        return status;
+    }
+
+    Status ReplicatedKVS::get(std::string_view key, ByteArray& value, const ReadOptions& options) const noexcept {
+        return store_->get(key, value, options);
+    }
+
+    Status ReplicatedKVS::erase(std::string_view key, const WriteOptions& options) noexcept {
+        Status status = store_->erase(key, options);
+        if (status.is_ok()) {
+            source_.record_erase(key);
+        }
+        return status;
+    }
+
+    bool ReplicatedKVS::contains_key(std::string_view key) const noexcept {
+        return store_->contains_key(key);
+    }
+
+    std::unique_ptr<key_value_store::IKeyIterator> ReplicatedKVS::new_slot_iterator(uint16_t slot, const ReadOptions& options) const {
+        return store_->new_slot_iterator(slot, options);
+    }
+
+    uint64_t ReplicatedKVS::get_slot_size(uint16_t slot) const {
+        return store_->get_slot_size(slot);
+    }
+
+    uint64_t ReplicatedKVS::get_slot_bytes(uint16_t slot) const {
+        return store_->get_slot_bytes(slot);
+    }
+
+    uint64_t ReplicatedKVS::get_size() const {
+        return store_->get_size();
+    }
+
+    net::Task<ReplicationData> read_replication_data(net::Connection& link, const protocol::CommandView& command, uint64_t payload_size) {
+        if (command.size() != protocol::to_integral(protocol::CommandFieldsReplicationData::enum_size)) {
+            throw std::runtime_error("Wrong number of arguments for CLUSTER_REPLICATION_DATA");
+        }
+        ReplicationData data{};
+        data.from = command[protocol::to_integral(protocol::CommandFieldsReplicationData::c_NAME)];
+        data.replication_id = command[protocol::to_integral(protocol::CommandFieldsReplicationData::c_REPLICATION_ID)];
+        uint64_t kind = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsReplicationData::c_KIND)]);
+        data.offset = protocol::field_to_uint64(command[protocol::to_integral(protocol::CommandFieldsReplicationData::c_OFFSET)]);
+        if (kind >= protocol::to_integral(ReplicationDataKind::enum_size)) {
+            throw std::runtime_error("Invalid CLUSTER_REPLICATION_DATA");
+        }
+        data.kind = static_cast<ReplicationDataKind>(kind);
+        data.size = payload_size;
+
+        std::vector<char> payload(payload_size);
+        co_await protocol::read_payload(link, payload.data(), payload_size);
+        data.keys = parse_migrated_keys(payload);
+        co_return data;
+    }
+
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../KVS/IKeyValueStore.hpp"
+#include "../net/Connection.hpp"
+#include "../net/Task.hpp"
+#include "../utils/ByteArray.hpp"
+#include "Cluster.hpp"
+#include "Migration.hpp"
+
+namespace node::cluster {
+
+    using ReplicationClock = std::chrono::steady_clock;
+
+    struct ReplicationConfig {
+        //Writes a replica can fall behind and still catch up from the log instead of a full sync
+        uint64_t backlog_bytes;
+        //Upper bound for the keys of a full sync sent at once
+        uint64_t sync_batch_bytes;
+    };
+
+    constexpr ReplicationConfig CLUSTER_REPLICATION_CONFIG{ 1024 * 1024, 1024 * 1024 };
+
+    //The primary sends an empty log entry after that silence, so the replica notices when it is gone
+    constexpr std::chrono::milliseconds CLUSTER_REPLICATION_HEARTBEAT{ 1000 };
+    //Without a message from the other side for that long, a replica attaches again and a primary forgets it
+    constexpr std::chrono::milliseconds CLUSTER_REPLICATION_TIMEOUT{ 5000 };
+    //Pause between the acks of a replica and between its attempts to attach
+    constexpr std::chrono::milliseconds CLUSTER_REPLICATION_ACK_INTERVAL{ 100 };
+    constexpr std::chrono::milliseconds CLUSTER_REPLICATION_RETRY{ 1000 };
+
+    enum class ReplicationDataKind : uint8_t {
+        //The replica drops its keys and continues from the offset, the snapshot follows
+        c_FULL_SYNC = 0,
+        c_SNAPSHOT = 1,
+        //Writes from the offset on, in the order the primary applied them
+        c_LOG = 2,
+        c_SYNC_FINISHED = 3,
+        enum_size = 4
+    };
+
+    struct ReplicationData {
+        std::string from;
+        std::string replication_id;
+        ReplicationDataKind kind = ReplicationDataKind::c_LOG;
+        uint64_t offset = 0;
+        //Of the payload, a log entry moves the offset of the replica by that much
+        uint64_t size = 0;
+        std::vector<MigratedKey> keys;
+    };
+
+    //Replica as its primary knows it
+    struct ReplicaInfo {
+        std::string name;
+        uint64_t acked_offset = 0;
+        //Bytes of the log the replica didn't acknowledge yet
+        uint64_t lag = 0;
+        bool synced = false;
+    };
+
+    //Role and progress of a node, for monitoring the lag of the replicas
+    struct ReplicationInfo {
+        //Empty for primaries
+        std::string primary;
+        //Empty for a replica that never finished a full sync
+        std::string replication_id;
+        uint64_t offset = 0;
+        //Replicas only, whether it has all keys of the primary
+        bool synced = false;
+        //Primaries only
+        std::vector<ReplicaInfo> replicas;
+    };
+
+    //The latest writes of the primary as a ring, the offsets count all bytes ever appended
+    class ReplicationBacklog {
+    public:
+        explicit ReplicationBacklog(uint64_t capacity);
+
+        void append(std::span<const char> data);
+
+        //Copies everything from the offset on, returns false if that isn't kept anymore
+        bool read(uint64_t offset, std::vector<char>& data) const;
+
+        uint64_t get_offset() const {
+            return end_;
+        }
+
+        //Offset of the oldest byte that is kept
+        uint64_t get_start() const;
+
+        //Drops everything, appending continues at the offset
+        void reset(uint64_t offset);
+
+    private:
+        std::vector<char> buffer_;
+        uint64_t start_ = 0;
+        uint64_t end_ = 0;
+    };
+
+    //Primary side, records the writes of the data path and streams them to the attached replicas
+    //A replica that attaches with an offset the backlog still has only gets the writes after it
+    //Otherwise it gets all keys slot by slot, interleaved with the log, so every key ends with its latest value
+    class ReplicationSource {
+    public:
+        explicit ReplicationSource(ReplicationConfig config = CLUSTER_REPLICATION_CONFIG);
+
+        void record_put(std::string_view key, const ByteArray& value);
+        void record_erase(std::string_view key);
+
+        //Answers the sync request of a replica, replicas that aren't known yet are ignored until they ask again
+        void attach(const std::string& replica, const std::string& replication_id, uint64_t offset,
+            const key_value_store::IKeyValueStore& kvs, ClusterState& state, ReplicationClock::time_point now = ReplicationClock::now());
+
+        void handle_ack(const std::string& replica, const std::string& replication_id, uint64_t offset, ReplicationClock::time_point now = ReplicationClock::now());
+
+        //Sends the new writes, the next keys of full syncs and the heartbeats
+        void send(const key_value_store::IKeyValueStore& kvs, ClusterState& state, ReplicationClock::time_point now = ReplicationClock::now());
+
+        //A node that becomes a replica stops recording, it takes the history of its primary
+        void disable();
+
+        //A replica that took over from its primary continues its history, so the other replicas only miss the writes after the offset
+        //Starts a new history if the id is empty
+        void enable(const std::string& replication_id, uint64_t offset);
+
+        bool is_enabled() const {
+            return enabled_;
+        }
+
+        bool has_replicas() const {
+            return !replicas_.empty();
+        }
+
+        const std::string& get_replication_id() const {
+            return replication_id_;
+        }
+
+        uint64_t get_offset() const {
+            return backlog_.get_offset();
+        }
+
+        std::vector<ReplicaInfo> get_replicas() const;
+
+    private:
+        struct Replica {
+            uint64_t sent_offset = 0;
+            uint64_t acked_offset = 0;
+            //Slots of the full sync that weren't started yet and the keys left of the current one
+            std::deque<uint16_t> sync_slots;
+            std::deque<std::string> sync_keys;
+            bool syncing = false;
+            ReplicationClock::time_point last_sent{};
+            ReplicationClock::time_point last_ack{};
+        };
+
+        void record(std::string_view key, const char* value, uint64_t value_size, bool erased);
+
+        //Returns false if the link is down, the replica has to be dropped then
+        bool start_full_sync(Replica& replica, ClusterNode& node, const std::string& myself,
+            const key_value_store::IKeyValueStore& kvs, ReplicationClock::time_point now);
+
+        bool send_replica(Replica& replica, ClusterNode& node, const std::string& myself,
+            const key_value_store::IKeyValueStore& kvs, ReplicationClock::time_point now);
+
+        bool send_data(ClusterNode& node, const std::string& myself, ReplicationDataKind kind, uint64_t offset, std::span<const char> payload);
+
+        ReplicationConfig config_;
+        bool enabled_ = true;
+        std::string replication_id_;
+        ReplicationBacklog backlog_;
+        std::unordered_map<std::string, Replica> replicas_;
+        //Reused for every entry, so recording a write doesn't allocate
+        std::vector<char> entry_;
+    };
+
+    //Replica side, attaches to the primary and applies what it sends
+    class ReplicationSink {
+    public:
+        //Stops following if the name is empty, the next update attaches to the new primary
+        void follow(const std::string& primary);
+
+        //Attaches when it isn't yet or the primary went silent, acknowledges the offset periodically
+        void update(ClusterState& state, ReplicationClock::time_point now = ReplicationClock::now());
+
+        //Data out of order makes it attach again, the primary continues from the last applied offset if it can
+        void handle_data(const ReplicationData& data, key_value_store::IKeyValueStore& kvs, ClusterState& state,
+            ReplicationClock::time_point now = ReplicationClock::now());
+
+        const std::string& get_primary() const {
+            return primary_;
+        }
+
+        const std::string& get_replication_id() const {
+            return replication_id_;
+        }
+
+        uint64_t get_offset() const {
+            return offset_;
+        }
+
+        //Has all keys of its primary, maybe some writes behind
+        bool is_synced() const {
+            return attached_ && synced_;
+        }
+
+        //Finished a full sync of the history it follows, even if the primary went silent since
+        bool has_history() const {
+            return synced_;
+        }
+
+    private:
+        std::string primary_;
+        std::string replication_id_;
+        uint64_t offset_ = 0;
+        bool attached_ = false;
+        //Finished the last full sync, so the offset can be continued
+        bool synced_ = false;
+        ReplicationClock::time_point last_heard_{};
+        ReplicationClock::time_point last_request_{};
+        ReplicationClock::time_point last_ack_{};
+    };
+
+    //Passes everything to the store and records its writes for the replicas
+    class ReplicatedKVS : public key_value_store::IKeyValueStore {
+    public:
+        ReplicatedKVS(std::unique_ptr<key_value_store::IKeyValueStore> store, ReplicationSource& source);
+
+        Status put(std::string_view key, const ByteArray& value, const WriteOptions& options = WriteOptions{}) noexcept override;
+        Status get(std::string_view key, ByteArray& value, const ReadOptions& options = ReadOptions{}) const noexcept override;
+        Status erase(std::string_view key, const WriteOptions& options = WriteOptions{}) noexcept override;
+        bool contains_key(std::string_view key) const noexcept override;
+
+        std::unique_ptr<key_value_store::IKeyIterator> new_slot_iterator(uint16_t slot, const ReadOptions& options = ReadOptions{}) const override;
+
+        uint64_t get_slot_size(uint16_t slot) const override;
+        uint64_t get_slot_bytes(uint16_t slot) const override;
+        uint64_t get_size() const override;
+
+    private:
+        std::unique_ptr<key_value_store::IKeyValueStore> store_;
+        ReplicationSource& source_;
+    };
+
+    net::Task<ReplicationData> read_replication_data(net::Connection& link, const protocol::CommandView& command, uint64_t payload_size);
+
+}
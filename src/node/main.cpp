@@ -1,5 +1,7 @@
 #include <boost/program_options.hpp>
 #include <iostream>
+#include <optional>
+#include <sstream>
 #include <string>
 #include <fstream>
 
@@ -12,6 +14,7 @@ namespace po = boost::program_options;
 uint16_t default_client_port{ 5000 };
 uint16_t default_cluster_port{ 15000 };
 bool default_serve_all_slots{ false };
+bool default_proxy{ false };
 
 
 std::string name;
@@ -19,6 +22,36 @@ std::string ip;
 uint16_t client_port;
 uint16_t cluster_port;
 bool serve_all_slots;
+bool proxy;
+std::string client_output_buffer_limit;
+std::string cluster_output_buffer_limit;
+std::string reactor;
+std::string unix_socket;
+std::string cluster_config_file;
+
+//Parses '<hard_limit_bytes> <soft_limit_bytes> <soft_limit_seconds>'
+std::optional<net::ReactorBackend> parse_reactor_backend(const std::string& value) {
+    if (value == "epoll") {
+        return net::ReactorBackend::c_EPOLL;
+    }
+    if (value == "io_uring") {
+        return net::ReactorBackend::c_IO_URING;
+    }
+    return std::nullopt;
+}
+
+std::optional<net::OutputBufferLimits> parse_output_buffer_limits(const std::string& value) {
+    std::istringstream stream{ value };
+    net::OutputBufferLimits limits{};
+    uint64_t soft_limit_seconds;
+
+    stream >> limits.hard_limit >> limits.soft_limit >> soft_limit_seconds;
+    if (stream.fail()) {
+        return std::nullopt;
+    }
+    limits.soft_limit_duration = std::chrono::seconds{ soft_limit_seconds };
+    return limits;
+}
 
 int main(int argc, char** argv) {
     po::options_description generic_options("Generic options");
@@ -32,7 +65,13 @@ int main(int argc, char** argv) {
         ("ip", po::value<std::string>(&ip), "IP of the node.")
         ("client_port", po::value<uint16_t>(&client_port)->default_value(default_client_port), "Port for the client")
         ("cluster_port", po::value<uint16_t>(&cluster_port)->default_value(default_cluster_port), "Port for the cluster")
-        ("serve_all_slots", po::value<bool>(&serve_all_slots)->default_value(default_serve_all_slots), "Specifies if the created node serves all slots (used for the first node of a cluster)");
+        ("serve_all_slots", po::value<bool>(&serve_all_slots)->default_value(default_serve_all_slots), "Specifies if the created node serves all slots (used for the first node of a cluster)")
+        ("proxy", po::value<bool>(&proxy)->default_value(default_proxy), "Forwards requests for keys of other nodes instead of redirecting the client")
+        ("client_output_buffer_limit", po::value<std::string>(&client_output_buffer_limit), "Output buffer limits for client connections: '<hard_bytes> <soft_bytes> <soft_seconds>', 0 disables a limit")
+        ("cluster_output_buffer_limit", po::value<std::string>(&cluster_output_buffer_limit), "Output buffer limits for cluster bus connections: '<hard_bytes> <soft_bytes> <soft_seconds>', 0 disables a limit")
+        ("reactor", po::value<std::string>(&reactor)->default_value("epoll"), "Event loop backend: 'epoll' or 'io_uring', falls back to epoll if io_uring isn't supported")
+        ("unix_socket", po::value<std::string>(&unix_socket), "Optional path of a unix domain socket for clients on the same host")
+        ("cluster_config_file", po::value<std::string>(&cluster_config_file), "Optional path where the node keeps the nodes and slots it knows, a restarted node rejoins the cluster with it");
 
     po::options_description cmd_line_options("Allowed options");
     cmd_line_options.add(generic_options).add(config_options);
@@ -87,8 +126,46 @@ int main(int argc, char** argv) {
         std::string value_string = vm["serve_all_slots"].as<bool>() ? "true" : "false";
         cout << "Option to serve all slots set to '" << value_string << "'." << std::endl;
     }
+    if (vm.count("proxy")) {
+        std::string value_string = vm["proxy"].as<bool>() ? "true" : "false";
+        cout << "Option to proxy requests set to '" << value_string << "'." << std::endl;
+    }
+
+
+    std::optional<net::OutputBufferLimits> client_limits = node::NODE_CLIENT_OUTPUT_BUFFER_LIMITS;
+    std::optional<net::OutputBufferLimits> cluster_limits = node::NODE_CLUSTER_OUTPUT_BUFFER_LIMITS;
+    if (vm.count("client_output_buffer_limit")) {
+        client_limits = parse_output_buffer_limits(client_output_buffer_limit);
+    }
+    if (vm.count("cluster_output_buffer_limit")) {
+        cluster_limits = parse_output_buffer_limits(cluster_output_buffer_limit);
+    }
+    if (!client_limits.has_value() || !cluster_limits.has_value()) {
+        cout << "Invalid output buffer limit, expected '<hard_bytes> <soft_bytes> <soft_seconds>'" << std::endl;
+        return 1;
+    }
+
+    std::optional<net::ReactorBackend> reactor_backend = parse_reactor_backend(reactor);
+    if (!reactor_backend.has_value()) {
+        cout << "Invalid reactor, expected 'epoll' or 'io_uring'" << std::endl;
+        return 1;
+    }
 
     cout << std::endl << "Starting node..." << std::endl;
-    auto node = Node::new_in_memory_node(name, client_port, cluster_port, ip, serve_all_slots);
+    if (vm.count("cluster_config_file")) {
+        cout << "Keeping the cluster config in '" << cluster_config_file << "'." << std::endl;
+    }
+    auto node = Node::new_in_memory_node(name, client_port, cluster_port, ip, serve_all_slots, cluster_config_file);
+    node.set_output_buffer_limits(node::ConnectionClass::c_CLIENT, *client_limits);
+    node.set_output_buffer_limits(node::ConnectionClass::c_CLUSTER, *cluster_limits);
+    node.set_reactor_backend(*reactor_backend);
+    node.set_proxy_mode(proxy);
+    if (vm.count("unix_socket")) {
+        cout << "Listening for local clients on '" << unix_socket << "'." << std::endl;
+        node.set_unix_socket_path(unix_socket);
+    }
+    if (node.get_reactor().get_backend() != *reactor_backend) {
+        cout << "io_uring is not supported by the kernel, using epoll instead." << std::endl;
+    }
     node.start();
 }
\ No newline at end of file
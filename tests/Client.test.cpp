@@ -5,6 +5,7 @@
 #include <sys/epoll.h>
 
 #include "client/Client.hpp"
+#include "client/Rebalancer.hpp"
 #include "node/Node.hpp"
 #include "net/Socket.hpp"
 #include "net/Connection.hpp"
@@ -29,7 +30,9 @@ TEST_CASE("Test connect") {
 
     uint16_t client_port0 = 8080, cluster_port0 = 8081;
     Client client0{};
-    Node node0 = Node::new_in_memory_node("node0", client_port0, cluster_port0, "127.0.0.1");
+    const std::string unix_socket_path = "/tmp/kvs_client_test.sock";
+    Node node0 = Node::new_in_memory_node("node0", client_port0, cluster_port0, "127.0.0.1", true);
+    node0.set_unix_socket_path(unix_socket_path);
 
     auto thread0 = std::thread(&Node::start, &node0);
     std::this_thread::sleep_for(100ms);
@@ -45,6 +48,39 @@ TEST_CASE("Test connect") {
         CHECK_EQ(client0.get_nodes_connections().size(), 1);
     }
 
+    SUBCASE("Client connect over unix domain socket") {
+        CHECK_FALSE(client0.connect_to_node("127.0.0.1", client_port0, "/tmp/kvs_missing.sock").is_ok());
+        CHECK(client0.connect_to_node("127.0.0.1", client_port0, unix_socket_path).is_ok());
+        CHECK_EQ(client0.get_nodes_connections().size(), 1);
+
+        //The requests are handled like the ones on the client port
+        CHECK(client0.put_value("key", std::string("value")).is_ok());
+        CHECK(node0.get_kvs().contains_key("key"));
+        ByteArray value = ByteArray::new_allocated_byte_array(0);
+        CHECK(client0.get_value("key", value).is_ok());
+        CHECK_EQ("value", value.to_string());
+    }
+
+    SUBCASE("Client connect over shared memory") {
+        CHECK_FALSE(client0.connect_to_node_over_shared_memory("127.0.0.1", client_port0, unix_socket_path, 1000).is_ok());
+        CHECK(client0.connect_to_node_over_shared_memory("127.0.0.1", client_port0, unix_socket_path, net::shared_memory_min_ring_size).is_ok());
+        CHECK_EQ(client0.get_nodes_connections().size(), 1);
+        CHECK(client0.get_nodes_connections().begin()->second.is_shared_memory());
+
+        //Values larger than the rings are streamed through them
+        std::string large_value(4 * net::shared_memory_min_ring_size + 1, 'v');
+        CHECK(client0.put_value("key", large_value).is_ok());
+        ByteArray value = ByteArray::new_allocated_byte_array(0);
+        CHECK(client0.get_value("key", value).is_ok());
+        CHECK_EQ(large_value, value.to_string());
+
+        //The channel is closed together with the client
+        client0.disconnect_all();
+        std::this_thread::sleep_for(100ms);
+        CHECK(client0.connect_to_node_over_shared_memory("127.0.0.1", client_port0, unix_socket_path).is_ok());
+        CHECK(client0.get_value("key", value).is_ok());
+    }
+
     node0.stop();
     if (thread0.joinable()) {
         thread0.join();
@@ -251,7 +287,7 @@ TEST_CASE("Test get") {
         auto status = client0.get_value("key", actual_value, 1, 2);
         CHECK(status.is_ok());
         CHECK_EQ("al", actual_value.to_string().substr(1, 2));
-        CHECK_EQ(5, actual_value.size());
+        CHECK_EQ(3, actual_value.size());
     }
 
     SUBCASE("Get value from wrong node, not successful") {
@@ -643,9 +679,15 @@ TEST_CASE("Test migrate slot") {
             node0.get_cluster_state().myself.served_slots[i] = true;
             node0.get_cluster_state().slots[i].state = cluster::SlotState::c_NORMAL;
             node0.get_cluster_state().slots[i].migration_partner = nullptr;
-            node0.get_cluster_state().slots[i].amount_of_keys = 1;
             client0.get_slot_nodes()[i] = "127.0.0.1:" + std::to_string(client_port0);
         }
+        //Slot 0 needs a key, otherwise it is handed over right away
+        std::string key = "key";
+        for (int i = 0; get_key_slot(key) != 0; i++) {
+            key = "key" + std::to_string(i);
+        }
+        node0.get_kvs().put(key, ByteArray::new_allocated_byte_array("value"));
+        node0.get_cluster_state().slots[0].amount_of_keys = 1;
 
         net::Socket socket{};
         net::Connection cluster_bus = socket.connect("127.0.0.1", cluster_port1);
@@ -794,3 +836,131 @@ TEST_CASE("Test add node") {
         thread1.join();
     }
 }
+
+TEST_CASE("Test rebalance plan") {
+    std::cout << "Test rebalance plan" << std::endl;
+
+    RebalanceNode node0{ "127.0.0.1:8080", {} };
+    RebalanceNode node1{ "127.0.0.1:8082", {} };
+    RebalanceConfig config = REBALANCE_CONFIG;
+
+    SUBCASE("Equal slots are split") {
+        for (uint16_t slot = 0; slot < 4; slot++) {
+            node0.slots.push_back(SlotStats{ slot, 100, 1000, 0, 0 });
+        }
+        std::vector<SlotMove> moves = plan_rebalance({ node0, node1 }, config);
+        REQUIRE_EQ(2, moves.size());
+        for (const SlotMove& move : moves) {
+            CHECK_EQ("127.0.0.1:8080", move.from);
+            CHECK_EQ("127.0.0.1:8082", move.to);
+            CHECK_EQ(1000, move.bytes);
+        }
+        CHECK_NE(moves[0].slot, moves[1].slot);
+    }
+
+    SUBCASE("Of equally loaded slots the smaller one is moved") {
+        config = RebalanceConfig{ 0, 0, 1, 0, 0.1, 64 * 1024, 64, 2, 60s, 50ms };
+        node0.slots.push_back(SlotStats{ 0, 10, 1024 * 1024, 50, 0 });
+        node0.slots.push_back(SlotStats{ 1, 10, 1024, 50, 0 });
+        std::vector<SlotMove> moves = plan_rebalance({ node0, node1 }, config);
+        REQUIRE_EQ(1, moves.size());
+        CHECK_EQ(1, moves[0].slot);
+    }
+
+    SUBCASE("Hot slots are moved first") {
+        config = RebalanceConfig{ 0, 0, 1, 0, 0.1, 64 * 1024, 64, 2, 60s, 50ms };
+        node0.slots.push_back(SlotStats{ 0, 10, 1024, 10, 0 });
+        node0.slots.push_back(SlotStats{ 1, 10, 1024, 30, 0 });
+        node0.slots.push_back(SlotStats{ 2, 10, 1024, 10, 0 });
+        std::vector<SlotMove> moves = plan_rebalance({ node0, node1 }, config);
+        REQUIRE_EQ(1, moves.size());
+        CHECK_EQ(1, moves[0].slot);
+        CHECK_EQ("127.0.0.1:8082", moves[0].to);
+    }
+
+    SUBCASE("Nothing to do") {
+        //A single slot can't be split and a balanced cluster stays as it is
+        node0.slots.push_back(SlotStats{ 0, 100, 1000, 100, 100 });
+        CHECK(plan_rebalance({ node0, node1 }, config).empty());
+
+        node1.slots.push_back(SlotStats{ 1, 100, 1000, 100, 100 });
+        CHECK(plan_rebalance({ node0, node1 }, config).empty());
+        CHECK(plan_rebalance({ node0 }, config).empty());
+    }
+
+    SUBCASE("The amount of moves is limited") {
+        for (uint16_t slot = 0; slot < 100; slot++) {
+            node0.slots.push_back(SlotStats{ slot, 100, 1000, 0, 0 });
+        }
+        config.max_moves = 10;
+        CHECK_EQ(10, plan_rebalance({ node0, node1 }, config).size());
+    }
+}
+
+TEST_CASE("Test rebalancer") {
+    std::cout << "Test rebalancer" << std::endl;
+
+    uint16_t client_port0 = 8086, cluster_port0 = 8087;
+    uint16_t client_port1 = 8088, cluster_port1 = 8089;
+    Node node0 = Node::new_in_memory_node("node0", client_port0, cluster_port0, "127.0.0.1", true);
+    Node node1 = Node::new_in_memory_node("node1", client_port1, cluster_port1, "127.0.0.1");
+
+    auto thread0 = std::thread{ &Node::start, &node0 };
+    auto thread1 = std::thread{ &Node::start, &node1 };
+    std::this_thread::sleep_for(100ms);
+
+    Client client{};
+    REQUIRE(client.connect_to_node("127.0.0.1", client_port0).is_ok());
+    REQUIRE(client.add_node_to_cluster("node1", "127.0.0.1", client_port1, cluster_port1).is_ok());
+    std::this_thread::sleep_for(500ms);
+    REQUIRE(client.get_update_slot_info().is_ok());
+
+    //Four slots with the same amount of keys, half of them belong on the new node
+    std::vector<std::string> tags{ "{a}", "{b}", "{c}", "{d}" };
+    for (const std::string& tag : tags) {
+        for (int i = 0; i < 20; i++) {
+            REQUIRE(client.put_value(tag + std::to_string(i), "value" + std::to_string(i)).is_ok());
+        }
+    }
+
+    std::vector<NodeLoadInfo> loads;
+    REQUIRE(client.get_cluster_load(loads).is_ok());
+    REQUIRE_EQ(2, loads.size());
+    uint16_t served_slots = 0;
+    for (const NodeLoadInfo& load : loads) {
+        served_slots += load.num_slots_served;
+    }
+    CHECK_EQ(CLUSTER_AMOUNT_OF_SLOTS, served_slots);
+
+    std::vector<SlotStats> stats;
+    REQUIRE(client.get_slot_stats("127.0.0.1:" + std::to_string(client_port0), stats).is_ok());
+    REQUIRE_EQ(tags.size(), stats.size());
+    for (const SlotStats& slot : stats) {
+        CHECK_EQ(20, slot.keys);
+    }
+
+    Rebalancer rebalancer{ client };
+    std::vector<SlotMove> moves;
+    REQUIRE(rebalancer.plan(moves).is_ok());
+    REQUIRE_EQ(2, moves.size());
+    Status status = rebalancer.execute(moves);
+    CHECK_MESSAGE(status.is_ok(), status.get_msg());
+
+    for (const SlotMove& move : moves) {
+        CHECK(node1.get_cluster_snapshot()->myself.served_slots[move.slot]);
+    }
+    CHECK_EQ(40, node0.get_kvs().get_size());
+    CHECK_EQ(40, node1.get_kvs().get_size());
+
+    ByteArray value{};
+    for (const std::string& tag : tags) {
+        status = client.get_value(tag + "7", value);
+        CHECK_MESSAGE(status.is_ok(), status.get_msg());
+        CHECK_EQ("value7", value.to_string());
+    }
+
+    node0.stop();
+    node1.stop();
+    thread0.join();
+    thread1.join();
+}
@@ -1,6 +1,7 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
+#include <filesystem>
 #include <future>
 #include <chrono>
 #include <sys/epoll.h>
@@ -13,6 +14,13 @@
 #include "net/Socket.hpp"
 #include "node/ProtocolHandler.hpp"
 #include "node/Node.hpp"
+#include "node/Migration.hpp"
+#include "node/Load.hpp"
+#include "node/Replication.hpp"
+#include "node/Failover.hpp"
+#include "node/ClusterConfig.hpp"
+#include "node/Proxy.hpp"
+#include "client/Client.hpp"
 #include "net/Epoll.hpp"
 
 using namespace std::chrono_literals; // NOLINT
@@ -58,10 +66,11 @@ void compare_slots(const std::vector<Slot>& lhs, const std::vector<Slot>& rhs) {
 }
 
 std::string get_key_with_target_slot(int slot, std::vector<std::string> distinct = {}) {
+    //A counter keeps the keys short, even if many have to be tried with a large amount of slots
     std::string key = "key";
-    while (node::cluster::get_key_hash(key) % node::cluster::CLUSTER_AMOUNT_OF_SLOTS != slot
-        || std::find(distinct.begin(), distinct.end(), key) != distinct.end()) {
-        key += "1";
+    for (uint64_t i = 0; node::cluster::get_key_hash(key) % node::cluster::CLUSTER_AMOUNT_OF_SLOTS != slot
+        || std::find(distinct.begin(), distinct.end(), key) != distinct.end(); i++) {
+        key = "key" + std::to_string(i);
     }
     return key;
 }
@@ -113,7 +122,7 @@ TEST_CASE("Test Gossip Ping") {
         //Receive metadata, because that is not handled by the handle_ping function
         auto meta_data = node::protocol::get_metadata(connection);
         auto command = node::protocol::get_command(connection, meta_data.argc, meta_data.command_size);
-        node::cluster::handle_ping(connection, state_receiver, command);
+        net::sync_wait(node::cluster::handle_ping(connection, state_receiver, command));
     };
 
 
@@ -158,30 +167,399 @@ TEST_CASE("Test Gossip Ping") {
 }
 
 
-TEST_CASE("Hashing") {
-    auto expected = static_cast<uint16_t>(std::hash<std::string>{}("test"));
-    auto actual = node::cluster::get_key_hash("test");
-    CHECK_EQ(expected, actual);
+TEST_CASE("Test cluster snapshot") {
+    Node server = Node::new_in_memory_node("node", 4200, 4201, "127.0.0.1", true);
+    std::shared_ptr<const ClusterSnapshot> first = server.get_cluster_snapshot();
+
+    CHECK(first->part_of_cluster);
+    CHECK_EQ(std::string("node"), first->myself.name.data());
+    //All slots are served by the node, so they form a single range
+    CHECK_EQ(1, first->slots.size());
+    CHECK_EQ(0, first->slots[0].first_slot);
+    CHECK_EQ(CLUSTER_AMOUNT_OF_SLOTS - 1, first->slots[0].last_slot);
+    CHECK_EQ(std::string("node"), first->slots[0].served_by_name.data());
+
+    //Writers publish a new version, readers keep the one they loaded
+    ClusterState state = server.get_cluster_state();
+    state.nodes["other"] = ClusterNode{ "other", "127.0.0.1", 4203, 4202 };
+    state.slots[2].served_by = &state.nodes["other"];
+    state.size = 1;
+    server.set_cluster_state(state);
+
+    std::shared_ptr<const ClusterSnapshot> second = server.get_cluster_snapshot();
+    CHECK_GT(second->version, first->version);
+    CHECK_EQ(1, second->nodes.size());
+    CHECK_EQ(3, second->slots.size());
+    CHECK_EQ(2, second->slots[1].first_slot);
+    CHECK_EQ(2, second->slots[1].last_slot);
+    CHECK_EQ(std::string("other"), second->slots[1].served_by_name.data());
+    CHECK(first->nodes.empty());
+    CHECK_EQ(1, first->slots.size());
+
+    //The ping is built from the snapshot alone
+    ClusterGossipMsg msg = build_ping(*second);
+    CHECK_EQ(2, msg.nodes.size());
+    CHECK_EQ(std::string("other"), msg.nodes[1].name.data());
+    CHECK_EQ(3, msg.slots.size());
+    CHECK_EQ(htobe16(3), msg.slots[2].first_slot);
+    CHECK_EQ(std::string("node"), msg.sender.data());
+}
+
+
+TEST_CASE("Test slot ranges") {
+    ClusterState state{};
+    state.nodes["node0"] = ClusterNode{ "node0", "127.0.0.1", 4301, 4300 };
+    state.nodes["node1"] = ClusterNode{ "node1", "127.0.0.1", 4303, 4302 };
+    state.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+    for (size_t slot = 0; slot < CLUSTER_AMOUNT_OF_SLOTS; slot++) {
+        state.slots[slot].served_by = &state.nodes[slot < CLUSTER_AMOUNT_OF_SLOTS / 2 ? "node0" : "node1"];
+    }
+
+    SUBCASE("Slot table") {
+        //The columns are stored separately, a slot is assembled on access
+        state.slots[5].amount_of_keys = 7;
+        Slot slot = state.slots[5];
+        CHECK_EQ(&state.nodes["node0"], slot.served_by);
+        CHECK_EQ(7, slot.amount_of_keys);
+        CHECK_EQ(SlotState::c_NORMAL, slot.state);
+        CHECK_EQ(nullptr, slot.migration_partner);
+
+        std::vector<Slot> slots = state.slots;
+        SlotTable table = slots;
+        CHECK_EQ(CLUSTER_AMOUNT_OF_SLOTS, table.size());
+        CHECK_EQ(7, table[5].amount_of_keys);
+        CHECK_EQ(&state.nodes["node1"], table.served_by().back());
+    }
+
+    SUBCASE("Ranges") {
+        state.slots[10].state = SlotState::c_MIGRATING;
+        state.slots[10].migration_partner = &state.nodes["node1"];
+        //The amount of keys is local information and doesn't split a range
+        state.slots[11].amount_of_keys = 3;
+
+        std::vector<SlotRangeGossipData> ranges = get_slot_ranges(state.slots);
+        CHECK_EQ(4, ranges.size());
+        CHECK_EQ(9, ranges[0].last_slot);
+        CHECK_EQ(10, ranges[1].first_slot);
+        CHECK_EQ(10, ranges[1].last_slot);
+        CHECK_EQ(SlotState::c_MIGRATING, ranges[1].state);
+        CHECK_EQ(std::string("node1"), ranges[1].migration_partner_name.data());
+        CHECK_EQ(std::string("node0"), ranges[2].served_by_name.data());
+        CHECK_EQ(CLUSTER_AMOUNT_OF_SLOTS / 2 - 1, ranges[2].last_slot);
+        CHECK_EQ(CLUSTER_AMOUNT_OF_SLOTS - 1, ranges[3].last_slot);
+        CHECK_EQ(std::string("node1"), ranges[3].served_by_name.data());
+        CHECK_EQ(0, ranges[3].migration_partner_name[0]);
+    }
+
+    SUBCASE("Ranges are applied to every slot") {
+        //The receiver connects to the nodes it learns about
+        net::Socket listener0{}, listener1{};
+        listener0.listen(4301);
+        listener1.listen(4303);
+
+        ClusterGossipMsg msg{};
+        msg.sender = state.nodes["node0"].name;
+        msg.slots = get_slot_ranges(state.slots);
+        msg.nodes.emplace_back(state.nodes["node0"]);
+        msg.nodes.emplace_back(state.nodes["node1"]);
+
+        ClusterState receiver{};
+        receiver.myself = ClusterNode{ "receiver", "127.0.0.1", 4305, 4304 };
+        receiver.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+        apply_ping(receiver, msg);
+
+        CHECK_EQ(&receiver.nodes["node0"], receiver.slots[0].served_by);
+        CHECK_EQ(&receiver.nodes["node0"], receiver.slots[CLUSTER_AMOUNT_OF_SLOTS / 2 - 1].served_by);
+        CHECK_EQ(&receiver.nodes["node1"], receiver.slots[CLUSTER_AMOUNT_OF_SLOTS / 2].served_by);
+        CHECK_EQ(&receiver.nodes["node1"], receiver.slots[CLUSTER_AMOUNT_OF_SLOTS - 1].served_by);
+    }
+}
+
+
+TEST_CASE("Test delta gossip") {
+    //The receiver connects to the nodes it learns about
+    net::Socket listener0{}, listener1{};
+    listener0.listen(4311);
+    listener1.listen(4313);
+
+    ClusterState state{};
+    state.nodes["node0"] = ClusterNode{ "node0", "127.0.0.1", 4311, 4310 };
+    state.nodes["node1"] = ClusterNode{ "node1", "127.0.0.1", 4313, 4312 };
+    state.myself = state.nodes["node0"];
+    state.size = 2;
+    state.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+    for (size_t slot = 0; slot < CLUSTER_AMOUNT_OF_SLOTS; slot++) {
+        state.slots[slot].served_by = &state.nodes[slot < CLUSTER_AMOUNT_OF_SLOTS / 2 ? "node0" : "node1"];
+    }
+
+    std::shared_ptr<const ClusterSnapshot> first = make_snapshot(state, 1);
+    state.slots[10].state = SlotState::c_MIGRATING;
+    state.slots[10].migration_partner = &state.nodes["node1"];
+    std::shared_ptr<const ClusterSnapshot> second = make_snapshot(state, 2, first.get());
+
+    //Only the split range got a new version
+    CHECK_EQ(4, second->slots.size());
+    std::vector<uint64_t> expected_versions{ 2, 2, 2, 1 };
+    CHECK_EQ(expected_versions, second->slot_versions);
+    CHECK_EQ(get_slot_ranges_digest(second->slots), second->slot_digest);
+    CHECK_NE(first->slot_digest, second->slot_digest);
+
+    //Pings are read in host order
+    auto receive = [](ClusterGossipMsg msg) {
+        for (auto& node : msg.nodes) {
+            node = convert_node_to_host_order(node);
+        }
+        for (auto& range : msg.slots) {
+            convert_slot_range_to_host_order(range);
+        }
+        return msg;
+    };
+
+    //The nodes are picked at random, the receiver has to know both before it can apply the ranges
+    ClusterGossipMsg full = receive(build_ping(*first));
+    full.nodes = { state.nodes["node0"], state.nodes["node1"] };
+    ClusterGossipMsg delta = receive(build_ping(*second, first->version));
+    CHECK_EQ(2, full.slots.size());
+    CHECK_EQ(3, delta.slots.size());
+    CHECK_EQ(2, delta.version);
+    CHECK_EQ(1, delta.base_version);
+
+    ClusterState receiver{};
+    receiver.myself = ClusterNode{ "receiver", "127.0.0.1", 4315, 4314 };
+    receiver.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+    CHECK_FALSE(apply_ping(receiver, full));
+    CHECK_EQ(first->slot_digest, receiver.peer_slot_ranges["node0"].digest());
+
+    SUBCASE("Delta is applied") {
+        CHECK_FALSE(apply_ping(receiver, delta));
+        CHECK_EQ(second->slot_digest, receiver.peer_slot_ranges["node0"].digest());
+        CHECK_EQ(2, receiver.peer_slot_ranges["node0"].version);
+        CHECK_EQ(&receiver.nodes["node1"], receiver.slots[10].migration_partner);
+        CHECK_EQ(&receiver.nodes["node0"], receiver.slots[10].served_by);
+        CHECK_EQ(nullptr, receiver.slots[11].migration_partner);
+
+        //Nothing changed, so nothing is sent
+        std::shared_ptr<const ClusterSnapshot> third = make_snapshot(state, 3, second.get());
+        ClusterGossipMsg empty = receive(build_ping(*third, second->version));
+        CHECK_EQ(0, empty.slots.size());
+        CHECK_FALSE(apply_ping(receiver, empty));
+    }
+
+    SUBCASE("Missed ping requests the full ranges") {
+        std::shared_ptr<const ClusterSnapshot> third = make_snapshot(state, 3, second.get());
+        ClusterGossipMsg skipped = receive(build_ping(*third, second->version));
+        CHECK(apply_ping(receiver, skipped));
+        CHECK(receiver.peer_slot_ranges["node0"].full_sync_requested);
+
+        net::Connection link = listener0.accept();
+        auto meta_data = protocol::get_metadata(link);
+        CHECK_EQ(protocol::Instruction::c_CLUSTER_FULL_SYNC, meta_data.instruction);
+
+        //A full ping brings the node back in sync
+        CHECK_FALSE(apply_ping(receiver, receive(build_ping(*third))));
+        CHECK_FALSE(receiver.peer_slot_ranges["node0"].full_sync_requested);
+        CHECK_EQ(third->slot_digest, receiver.peer_slot_ranges["node0"].digest());
+    }
+
+    SUBCASE("Only new owners and nodes change the slot map") {
+        CHECK(receiver.slot_map_changed);
+        receiver.slot_map_changed = false;
+        //The migration partner isn't part of the map
+        CHECK_FALSE(apply_ping(receiver, delta));
+        CHECK_FALSE(receiver.slot_map_changed);
+
+        ClusterGossipMsg gossip = full;
+        ClusterNodeGossipData node1_data = state.nodes["node1"];
+        node1_data.config_epoch = 5;
+        node1_data.served_slots[0] = true;
+        gossip.nodes = { node1_data };
+        apply_ping(receiver, gossip);
+        CHECK(receiver.slot_map_changed);
+        CHECK_EQ(&receiver.nodes["node1"], receiver.slots[0].served_by);
+    }
+
+    SUBCASE("Stale configurations are ignored") {
+        //Gossip of node0 about node1
+        ClusterGossipMsg gossip = full;
+        ClusterNodeGossipData node1_data = state.nodes["node1"];
+        node1_data.config_epoch = 5;
+        node1_data.served_slots[0] = true;
+        gossip.nodes = { node1_data };
+        apply_ping(receiver, gossip);
+        CHECK_EQ(5, receiver.nodes["node1"].config_epoch);
+
+        node1_data.config_epoch = 4;
+        node1_data.served_slots[0] = false;
+        gossip.nodes = { node1_data };
+        apply_ping(receiver, gossip);
+        CHECK_EQ(5, receiver.nodes["node1"].config_epoch);
+        CHECK(receiver.nodes["node1"].served_slots[0]);
+    }
+}
+
+
+TEST_CASE("Test cluster bus") {
+    uint16_t client_port = 4100, cluster_port = 4101, sender_cluster_port = 4102;
+    Node server = Node::new_in_memory_node("node", client_port, cluster_port, "127.0.0.1");
+    server.stop_gossiping();
+    auto thread = std::thread(&Node::start, &server);
+
+    //The node connects back to the sender when it learns about it
+    net::Socket sender_socket{};
+    sender_socket.listen(sender_cluster_port);
+
+    ClusterState state_sender{};
+    state_sender.myself = ClusterNode{ "sender", "127.0.0.1", sender_cluster_port, 4103 };
+    state_sender.myself.served_slots[1] = true;
+    state_sender.myself.num_slots_served = 1;
+    state_sender.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+    state_sender.slots[1].served_by = &state_sender.myself;
+    state_sender.size = 0;
+
+    std::this_thread::sleep_for(100ms);
+    net::Connection link = net::Socket{}.connect(cluster_port);
+
+    SUBCASE("Ping is applied by the data path") {
+        node::cluster::send_ping(&link, state_sender);
+
+        //The update is applied asynchronously
+        for (int i = 0; i < 100 && !server.get_cluster_state().part_of_cluster; i++) {
+            std::this_thread::sleep_for(10ms);
+        }
+        CHECK(server.get_cluster_state().part_of_cluster);
+        CHECK(server.get_cluster_state().nodes.contains("sender"));
+        CHECK_EQ(&server.get_cluster_state().nodes["sender"], server.get_cluster_state().slots[1].served_by);
+    }
+
+    SUBCASE("Client instructions are refused") {
+        protocol::send_instruction(link, protocol::Command{ "key", "0", "0", "false" }, protocol::Instruction::c_GET);
+        auto meta_data = protocol::get_metadata(link);
+        protocol::get_command(link, meta_data.argc, meta_data.command_size);
+        ByteArray payload = protocol::get_payload(link, meta_data.payload_size);
+
+        CHECK_EQ(protocol::Instruction::c_ERROR_RESPONSE, meta_data.instruction);
+        CHECK_EQ("Only cluster bus instructions are accepted on the cluster port", payload.to_string());
+    }
+
+    SUBCASE("Cluster bus instructions are refused on the client port") {
+        net::Connection client = net::Socket{}.connect(client_port);
+        node::cluster::send_ping(&client, state_sender);
+        auto meta_data = protocol::get_metadata(client);
+        protocol::get_command(client, meta_data.argc, meta_data.command_size);
+        ByteArray payload = protocol::get_payload(client, meta_data.payload_size);
+
+        CHECK_EQ(protocol::Instruction::c_ERROR_RESPONSE, meta_data.instruction);
+        CHECK_EQ("Cluster bus instructions are only accepted on the cluster port", payload.to_string());
+        CHECK_FALSE(server.get_cluster_state().nodes.contains("sender"));
+    }
+
+    server.stop();
+    thread.join();
+}
+
+
+TEST_CASE("Test cluster link") {
+    uint16_t port = 4120;
+    auto start = std::chrono::steady_clock::now();
+
+    SUBCASE("Instructions are queued until the link is connected") {
+        net::Socket listener{};
+        listener.listen(port);
+
+        ClusterLink link("127.0.0.1", port);
+        CHECK(link.send(protocol::Command{ "node0" }, protocol::Instruction::c_CLUSTER_FULL_SYNC));
+        for (int i = 0; i < 100 && link.update() != LinkState::c_CONNECTED; i++) {
+            std::this_thread::sleep_for(1ms);
+        }
+        CHECK_EQ(LinkState::c_CONNECTED, link.get_state());
+
+        net::Connection accepted = listener.accept();
+        auto meta_data = protocol::get_metadata(accepted);
+        auto command = protocol::get_command(accepted, meta_data.argc, meta_data.command_size).to_command();
+        CHECK_EQ(protocol::Instruction::c_CLUSTER_FULL_SYNC, meta_data.instruction);
+        CHECK_EQ("node0", command[0]);
+    }
+
+    SUBCASE("Failed connects are retried with backoff") {
+        //Nobody listens on the port
+        ClusterLink link("127.0.0.1", port);
+        for (int i = 0; i < 100 && link.update(start) != LinkState::c_DISCONNECTED; i++) {
+            std::this_thread::sleep_for(1ms);
+        }
+        CHECK_EQ(LinkState::c_DISCONNECTED, link.get_state());
+        CHECK_FALSE(link.send(protocol::Command{ "node0" }, protocol::Instruction::c_CLUSTER_FULL_SYNC));
+        CHECK_EQ(LinkState::c_DISCONNECTED, link.update(start + CLUSTER_RECONNECT_MIN_BACKOFF - 1ms));
+
+        //The next attempt fails as well and doubles the backoff
+        auto retry = start + CLUSTER_RECONNECT_MIN_BACKOFF;
+        for (int i = 0; i < 100 && link.update(retry) != LinkState::c_DISCONNECTED; i++) {
+            std::this_thread::sleep_for(1ms);
+        }
+        CHECK_EQ(LinkState::c_DISCONNECTED, link.get_state());
+        CHECK_EQ(LinkState::c_DISCONNECTED, link.update(retry + 2 * CLUSTER_RECONNECT_MIN_BACKOFF - 1ms));
+        CHECK_FALSE(link.is_closed());
+    }
 
-    expected = static_cast<uint16_t>(std::hash<std::string>{}("test2"));
-    actual = node::cluster::get_key_hash("test2");
-    CHECK_EQ(expected, actual);
+    SUBCASE("Wrapped connections aren't connected again") {
+        net::Socket listener{};
+        listener.listen(port);
+        ClusterLink link = net::Socket{}.connect(port);
+        CHECK(link.is_connected());
 
-    expected = static_cast<uint16_t>(std::hash<std::string>{}("test"));
-    actual = node::cluster::get_key_hash("{test}3");
-    CHECK_EQ(expected, actual);
+        link.fail(start);
+        CHECK(link.is_closed());
+        CHECK_EQ(LinkState::c_DISCONNECTED, link.update(start + CLUSTER_RECONNECT_MAX_BACKOFF));
+    }
+}
 
-    expected = static_cast<uint16_t>(std::hash<std::string>{}("tes{t"));
-    actual = node::cluster::get_key_hash("{tes{t}{3}}}");
-    CHECK_EQ(expected, actual);
 
-    expected = static_cast<uint16_t>(std::hash<std::string>{}("tes}t{3"));
-    actual = node::cluster::get_key_hash("tes}t{3");
-    CHECK_EQ(expected, actual);
+TEST_CASE("Hashing") {
+    //Check value of CRC16/XMODEM and slots of redis cluster
+    CHECK_EQ(0x31C3, node::cluster::crc16("123456789"));
+    CHECK_EQ(0, node::cluster::crc16(""));
+    CHECK_EQ(12182, node::cluster::get_key_hash("foo") % 16384);
+    CHECK_EQ(11058, node::cluster::get_key_hash("somekey") % 16384);
+
+    auto expected = node::cluster::crc16("test");
+    CHECK_EQ(expected, node::cluster::get_key_hash("{test}3"));
+    CHECK_EQ(expected, node::cluster::get_key_hash("abc{test}{def}"));
+
+    expected = node::cluster::crc16("tes{t");
+    CHECK_EQ(expected, node::cluster::get_key_hash("{tes{t}{3}}}"));
+
+    expected = node::cluster::crc16("tes}t{3");
+    CHECK_EQ(expected, node::cluster::get_key_hash("tes}t{3"));
+
+    expected = node::cluster::crc16("3");
+    CHECK_EQ(expected, node::cluster::get_key_hash("tes}t{3}"));
+
+    //Empty tags are ignored
+    expected = node::cluster::crc16("{}3");
+    CHECK_EQ(expected, node::cluster::get_key_hash("{}3"));
+
+    SUBCASE("Batch") {
+        //Different lengths, so the interleaved keys end at different blocks
+        std::vector<std::string> keys;
+        for (int i = 0; i < 23; i++) {
+            keys.emplace_back(std::string(i * 3, 'a' + i) + std::to_string(i));
+        }
+        keys.emplace_back("{user1000}.following");
+        keys.emplace_back("{user1000}.followers");
+        std::vector<std::string_view> views(keys.begin(), keys.end());
+
+        std::vector<uint16_t> hashes(views.size());
+        node::cluster::get_key_hashes(views, hashes);
+        for (size_t i = 0; i < views.size(); i++) {
+            CHECK_EQ(node::cluster::get_key_hash(views[i]), hashes[i]);
+        }
+        CHECK_EQ(hashes[23], hashes[24]);
 
-    expected = static_cast<uint16_t>(std::hash<std::string>{}("3"));
-    actual = node::cluster::get_key_hash("tes}t{3}");
-    CHECK_EQ(expected, actual);
+        std::vector<uint16_t> slots(views.size());
+        node::cluster::get_key_slots(views, slots);
+        for (size_t i = 0; i < views.size(); i++) {
+            CHECK_EQ(node::cluster::get_key_slot(views[i]), slots[i]);
+        }
+    }
 }
 
 
@@ -230,7 +608,7 @@ TEST_CASE("test sharding") {
         node::protocol::send_instruction(connection, command, instruction, payload);
 
         auto received_metadata = protocol::get_metadata(connection);
-        auto received_command = protocol::get_command(connection, received_metadata.argc, received_metadata.command_size);
+        auto received_command = protocol::get_command(connection, received_metadata.argc, received_metadata.command_size).to_command();
         ByteArray received_payload = protocol::get_payload(connection, received_metadata.payload_size);
 
         return std::make_tuple(received_metadata, received_command, received_payload);
@@ -345,7 +723,7 @@ TEST_CASE("Test migrating slot") {
         node::protocol::send_instruction(connection, command, instruction, payload);
 
         auto received_metadata = protocol::get_metadata(connection);
-        auto received_command = protocol::get_command(connection, received_metadata.argc, received_metadata.command_size);
+        auto received_command = protocol::get_command(connection, received_metadata.argc, received_metadata.command_size).to_command();
         ByteArray received_payload = protocol::get_payload(connection, received_metadata.payload_size);
 
         return std::make_tuple(received_metadata, received_command, received_payload);
@@ -574,6 +952,220 @@ TEST_CASE("Test migrating slot") {
 }
 
 
+TEST_CASE("Test slot importer") {
+    key_value_store::InMemoryKVS kvs{ get_key_slot, CLUSTER_AMOUNT_OF_SLOTS };
+    ClusterState state{};
+    state.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+    state.nodes["node0"] = ClusterNode{ "node0", "127.0.0.1", 4311, 4310 };
+
+    std::string key = "key";
+    uint16_t slot = get_key_slot(key);
+    state.slots[slot].state = SlotState::c_IMPORTING;
+    state.slots[slot].migration_partner = &state.nodes["node0"];
+    state.myself.served_slots[slot] = true;
+
+    SlotImporter importer{};
+    MigrationBatch batch{};
+    batch.from = "node0";
+    batch.slot = slot;
+    batch.batch = 1;
+    batch.keys.push_back(MigratedKey{ key, ByteArray::new_allocated_byte_array("migrated") });
+
+    SUBCASE("Migrated keys are stored") {
+        importer.handle_batch(batch, kvs, state);
+        ByteArray value{};
+        REQUIRE(kvs.get(key, value).is_ok());
+        CHECK_EQ("migrated", value.to_string());
+        CHECK_EQ(1, state.slots[slot].amount_of_keys);
+
+        batch.keys[0].erased = true;
+        importer.handle_batch(batch, kvs, state);
+        CHECK_FALSE(kvs.contains_key(key));
+        CHECK_EQ(0, state.slots[slot].amount_of_keys);
+    }
+
+    SUBCASE("Keys written by clients are kept") {
+        importer.record_client_write(key, state);
+        kvs.put(key, ByteArray::new_allocated_byte_array("written"));
+
+        importer.handle_batch(batch, kvs, state);
+        batch.keys[0].erased = true;
+        importer.handle_batch(batch, kvs, state);
+        ByteArray value{};
+        REQUIRE(kvs.get(key, value).is_ok());
+        CHECK_EQ("written", value.to_string());
+    }
+
+    SUBCASE("Batches of other nodes are ignored") {
+        batch.from = "node1";
+        importer.handle_batch(batch, kvs, state);
+        CHECK_FALSE(kvs.contains_key(key));
+    }
+}
+
+TEST_CASE("Test slot migration") {
+    uint16_t client_port0 = 4300, cluster_port0 = 4301;
+    uint16_t client_port1 = 4302, cluster_port1 = 4303;
+    Node node0 = Node::new_in_memory_node("node0", client_port0, cluster_port0, "127.0.0.1", true);
+    Node node1 = Node::new_in_memory_node("node1", client_port1, cluster_port1, "127.0.0.1");
+
+    //Small batches, so the keys need many round trips
+    MigrationConfig config = CLUSTER_MIGRATION_CONFIG;
+    config.batch_keys = 16;
+    config.max_batches_in_flight = 2;
+    bool limited = false;
+    bool unlimited = false;
+    size_t amount = 500;
+
+    SUBCASE("Keys are streamed to the importing node") {
+    }
+
+    SUBCASE("A slot without keys is handed over") {
+        amount = 0;
+    }
+
+    SUBCASE("Keys are streamed within the budget") {
+        //The 500 keys take at least 0.4s after the burst
+        config.keys_per_second = 1000;
+        limited = true;
+    }
+
+    SUBCASE("Rates of 0 are unlimited") {
+        config.batch_keys = 1;
+        config.max_batches_in_flight = 0;
+        config.bytes_per_second = 0;
+        config.keys_per_second = 0;
+        unlimited = true;
+    }
+    node0.set_migration_config(config);
+
+    //All keys share the hash tag and with that the slot
+    uint16_t slot = get_key_slot("{migrated}");
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < amount; i++) {
+        keys.push_back("{migrated}" + std::to_string(i));
+        node0.get_kvs().put(keys.back(), ByteArray::new_allocated_byte_array("value" + std::to_string(i)));
+    }
+    node0.get_cluster_state().slots[slot].amount_of_keys = keys.size();
+
+    auto thread0 = std::thread(&Node::start, &node0);
+    auto thread1 = std::thread(&Node::start, &node1);
+    std::this_thread::sleep_for(100ms);
+
+    client::Client client{};
+    REQUIRE(client.connect_to_node("127.0.0.1", client_port0).is_ok());
+    REQUIRE(client.add_node_to_cluster("node1", "127.0.0.1", client_port1, cluster_port1).is_ok());
+    std::this_thread::sleep_for(500ms);
+    REQUIRE(client.get_update_slot_info().is_ok());
+
+    REQUIRE(client.migrate_slot(slot, "127.0.0.1", client_port1).is_ok());
+    auto started = std::chrono::steady_clock::now();
+    REQUIRE(client.import_slot(slot, "127.0.0.1", client_port1).is_ok());
+    for (int i = 0; i < 500 && node0.get_cluster_snapshot()->myself.served_slots[slot]; i++) {
+        std::this_thread::sleep_for(10ms);
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+
+    //The migration finished by itself
+    CHECK_FALSE(node0.get_cluster_snapshot()->myself.served_slots[slot]);
+    if (limited) {
+        CHECK_LE(400, duration.count());
+    }
+    //Not a single batch per migration pause, which would take 5s
+    if (unlimited) {
+        CHECK_GT(1000, duration.count());
+    }
+    std::this_thread::sleep_for(100ms);
+    CHECK_EQ(0, node0.get_kvs().get_size());
+    CHECK_EQ(keys.size(), node1.get_kvs().get_size());
+    CHECK_EQ(keys.size(), node1.get_cluster_state().slots[slot].amount_of_keys);
+    CHECK_EQ(SlotState::c_NORMAL, node1.get_cluster_state().slots[slot].state);
+    CHECK(node1.get_cluster_state().myself.served_slots[slot]);
+
+    if (!keys.empty()) {
+        ByteArray value{};
+        Status status = client.get_value(keys[42], value);
+        CHECK_MESSAGE(status.is_ok(), status.get_msg());
+        CHECK_EQ("value42", value.to_string());
+    }
+
+    node0.stop();
+    node1.stop();
+    thread0.join();
+    thread1.join();
+}
+
+TEST_CASE("Test slot load") {
+    key_value_store::InMemoryKVS kvs{ get_key_slot, CLUSTER_AMOUNT_OF_SLOTS };
+    std::string key0 = get_key_with_target_slot(0);
+    std::string key1 = get_key_with_target_slot(1);
+    kvs.put(key0, ByteArray::new_allocated_byte_array("value"));
+    kvs.put(key1, ByteArray::new_allocated_byte_array("value"));
+
+    SlotLoad load{};
+    for (int i = 0; i < 10; i++) {
+        load.record(0, 100);
+    }
+    load.update(1s);
+
+    SUBCASE("Rates are smoothed") {
+        SlotStats stats = load.get_slot_stats(0, kvs);
+        CHECK_EQ(0, stats.slot);
+        CHECK_EQ(1, stats.keys);
+        CHECK_EQ(key0.size() + 5, stats.bytes);
+        CHECK_EQ(doctest::Approx(10 * CLUSTER_LOAD_SMOOTHING), stats.ops_per_second);
+        CHECK_EQ(doctest::Approx(1000 * CLUSTER_LOAD_SMOOTHING), stats.bandwidth);
+
+        //Without requests the rate fades out
+        load.update(1s);
+        double faded = load.get_slot_stats(0, kvs).ops_per_second;
+        CHECK_LT(faded, stats.ops_per_second);
+        CHECK_LT(0, faded);
+    }
+
+    SUBCASE("Only served slots count for the node") {
+        ClusterState state{};
+        state.myself.served_slots[0] = true;
+        NodeLoad node_load = load.get_node_load(kvs, state);
+        CHECK_EQ(1, node_load.keys);
+        CHECK_EQ(key0.size() + 5, node_load.bytes);
+        CHECK_EQ(3, node_load.ops_per_second);
+        CHECK_EQ(300, node_load.bandwidth);
+
+        state.myself.served_slots[1] = true;
+        CHECK_EQ(2, load.get_node_load(kvs, state).keys);
+    }
+
+    SUBCASE("An older load isn't gossiped over a newer one") {
+        ClusterState state{};
+        state.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+        ClusterNodeGossipData node1{ "node1", "127.0.0.1", 3000, 4000 };
+        node1.load.keys = 10;
+        node1.load.version = 2;
+
+        ClusterGossipMsg msg{};
+        msg.nodes.push_back(node1);
+        msg.sender = { "node1" };
+        apply_ping(state, msg);
+        CHECK_EQ(10, state.nodes["node1"].load.keys);
+
+        //Another node still knows an older measurement
+        msg.nodes[0].load.keys = 5;
+        msg.nodes[0].load.version = 1;
+        msg.sender = { "node2" };
+        apply_ping(state, msg);
+        CHECK_EQ(10, state.nodes["node1"].load.keys);
+
+        msg.nodes[0].load.version = 3;
+        apply_ping(state, msg);
+        CHECK_EQ(5, state.nodes["node1"].load.keys);
+
+        //The load is converted like the rest of the node
+        ClusterNodeGossipData converted = convert_node_to_network_order(msg.nodes[0]);
+        CHECK_EQ(5, convert_node_to_host_order(converted).load.keys);
+    }
+}
+
 TEST_CASE("Test get slots") {
     uint16_t cluster_port = 3000, client_port = 4000;
     Node server = Node::new_in_memory_node("node", client_port, cluster_port, "127.0.0.1");
@@ -593,7 +1185,7 @@ TEST_CASE("Test get slots") {
         protocol::send_instruction(connection, protocol::Command{}, protocol::Instruction::c_GET_SLOTS, "");
 
         auto received_metadata = protocol::get_metadata(connection);
-        auto received_command = protocol::get_command(connection, received_metadata.argc, received_metadata.command_size);
+        auto received_command = protocol::get_command(connection, received_metadata.argc, received_metadata.command_size).to_command();
         ByteArray received_payload = protocol::get_payload(connection, received_metadata.payload_size);
 
         return std::make_tuple(received_metadata, received_command, received_payload);
@@ -631,3 +1223,900 @@ TEST_CASE("Test get slots") {
     std::string expected_payload = "0\t0\tNULL\n1\t1\t127.0.0.1:3001\n2\t2\t127.0.0.1:3002\n3\t3\t127.0.0.100:3003\n4\t4\tNULL";
     CHECK_EQ(actual_payload.to_string(), expected_payload);
 }
+
+TEST_CASE("Test replication backlog") {
+    ReplicationBacklog backlog{ 8 };
+    std::vector<char> data;
+    CHECK(backlog.read(0, data));
+    CHECK(data.empty());
+
+    backlog.append(std::string_view("abcdef"));
+    REQUIRE(backlog.read(2, data));
+    CHECK_EQ("cdef", std::string(data.begin(), data.end()));
+
+    //Wraps around and drops the oldest bytes
+    backlog.append(std::string_view("ghij"));
+    CHECK_EQ(10, backlog.get_offset());
+    CHECK_EQ(2, backlog.get_start());
+    CHECK_FALSE(backlog.read(1, data));
+    REQUIRE(backlog.read(2, data));
+    CHECK_EQ("cdefghij", std::string(data.begin(), data.end()));
+    CHECK_FALSE(backlog.read(11, data));
+
+    //Only the tail of an entry larger than the ring is kept
+    backlog.append(std::string_view("0123456789"));
+    CHECK_EQ(20, backlog.get_offset());
+    CHECK_FALSE(backlog.read(10, data));
+    REQUIRE(backlog.read(12, data));
+    CHECK_EQ("23456789", std::string(data.begin(), data.end()));
+}
+
+TEST_CASE("Test replication sink") {
+    key_value_store::InMemoryKVS kvs{ get_key_slot, CLUSTER_AMOUNT_OF_SLOTS };
+    ClusterState state{};
+    state.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+    kvs.put("stale", ByteArray::new_allocated_byte_array("value"));
+
+    ReplicationSink sink{};
+    sink.follow("node0");
+
+    ReplicationData data{};
+    data.from = "node0";
+    data.replication_id = "history";
+    data.kind = ReplicationDataKind::c_FULL_SYNC;
+    data.offset = 10;
+    sink.handle_data(data, kvs, state);
+    CHECK_FALSE(kvs.contains_key("stale"));
+    CHECK_EQ(10, sink.get_offset());
+    CHECK_FALSE(sink.is_synced());
+
+    data.kind = ReplicationDataKind::c_SNAPSHOT;
+    data.keys.push_back(MigratedKey{ "key", ByteArray::new_allocated_byte_array("snapshot") });
+    sink.handle_data(data, kvs, state);
+    CHECK_EQ(1, state.slots[get_key_slot("key")].amount_of_keys);
+    data.kind = ReplicationDataKind::c_SYNC_FINISHED;
+    data.keys.clear();
+    sink.handle_data(data, kvs, state);
+    CHECK(sink.is_synced());
+
+    //The log moves the offset by its size
+    data.kind = ReplicationDataKind::c_LOG;
+    data.keys.push_back(MigratedKey{ "key", ByteArray::new_allocated_byte_array("log") });
+    data.size = 30;
+    sink.handle_data(data, kvs, state);
+    CHECK_EQ(40, sink.get_offset());
+    ByteArray value{};
+    REQUIRE(kvs.get("key", value).is_ok());
+    CHECK_EQ("log", value.to_string());
+
+    SUBCASE("A gap detaches the replica until the log continues at its offset") {
+        data.keys[0].erased = true;
+        data.offset = 50;
+        sink.handle_data(data, kvs, state);
+        CHECK_FALSE(sink.is_synced());
+        CHECK(kvs.contains_key("key"));
+
+        data.offset = 40;
+        sink.handle_data(data, kvs, state);
+        CHECK(sink.is_synced());
+        CHECK_FALSE(kvs.contains_key("key"));
+        CHECK_EQ(0, state.slots[get_key_slot("key")].amount_of_keys);
+    }
+
+    SUBCASE("Data of other nodes and histories is ignored") {
+        data.offset = 40;
+        data.from = "node1";
+        data.keys[0].erased = true;
+        sink.handle_data(data, kvs, state);
+        data.from = "node0";
+        data.replication_id = "other";
+        sink.handle_data(data, kvs, state);
+        CHECK(kvs.contains_key("key"));
+        CHECK_EQ(40, sink.get_offset());
+    }
+}
+
+TEST_CASE("Test replication") {
+    uint16_t client_port0 = 4330, cluster_port0 = 4331;
+    uint16_t client_port1 = 4332, cluster_port1 = 4333;
+    Node node0 = Node::new_in_memory_node("node0", client_port0, cluster_port0, "127.0.0.1", true);
+    Node node1 = Node::new_in_memory_node("node1", client_port1, cluster_port1, "127.0.0.1");
+
+    //Stored before the replica attaches, so they are sent with the full sync
+    for (int i = 0; i < 100; i++) {
+        std::string key = "key" + std::to_string(i);
+        node0.get_kvs().put(key, ByteArray::new_allocated_byte_array("value" + std::to_string(i)));
+        node0.get_cluster_state().slots[get_key_slot(key)].amount_of_keys += 1;
+    }
+
+    auto thread0 = std::thread(&Node::start, &node0);
+    auto thread1 = std::thread(&Node::start, &node1);
+    std::this_thread::sleep_for(100ms);
+
+    client::Client client{};
+    REQUIRE(client.connect_to_node("127.0.0.1", client_port0).is_ok());
+    REQUIRE(client.add_node_to_cluster("node1", "127.0.0.1", client_port1, cluster_port1).is_ok());
+    std::this_thread::sleep_for(500ms);
+
+    std::string replica_address = "127.0.0.1:" + std::to_string(client_port1);
+    std::string primary_address = "127.0.0.1:" + std::to_string(client_port0);
+    CHECK(client.replicate(replica_address, "node1").is_error());
+    REQUIRE(client.replicate(replica_address, "node0").is_ok());
+
+    ReplicationInfo info{};
+    for (int i = 0; i < 500 && !info.synced; i++) {
+        std::this_thread::sleep_for(10ms);
+        REQUIRE(client.get_replication_info(replica_address, info).is_ok());
+    }
+    REQUIRE(info.synced);
+    CHECK_EQ("node0", info.primary);
+    CHECK_EQ(100, node1.get_kvs().get_size());
+
+    //Writes after the full sync are streamed with the log
+    REQUIRE(client.get_update_slot_info().is_ok());
+    for (int i = 100; i < 150; i++) {
+        REQUIRE(client.put_value("key" + std::to_string(i), "value" + std::to_string(i)).is_ok());
+    }
+    REQUIRE(client.erase_value("key0").is_ok());
+
+    ReplicationInfo primary_info{};
+    for (int i = 0; i < 500; i++) {
+        std::this_thread::sleep_for(10ms);
+        REQUIRE(client.get_replication_info(primary_address, primary_info).is_ok());
+        REQUIRE(client.get_replication_info(replica_address, info).is_ok());
+        if (primary_info.replicas.size() == 1 && primary_info.replicas[0].lag == 0 && info.offset == primary_info.offset) {
+            break;
+        }
+    }
+    CHECK(primary_info.primary.empty());
+    REQUIRE_EQ(1, primary_info.replicas.size());
+    CHECK_EQ("node1", primary_info.replicas[0].name);
+    CHECK_EQ(0, primary_info.replicas[0].lag);
+    CHECK_EQ(primary_info.replication_id, info.replication_id);
+    CHECK_EQ(primary_info.offset, info.offset);
+    CHECK_EQ(149, node1.get_kvs().get_size());
+    CHECK_FALSE(node1.get_kvs().contains_key("key0"));
+
+    //A replica only answers GETs of connections that accept stale values
+    auto get = [client_port1](bool read_only, const std::string& size = "0", const std::string& offset = "0") {
+        net::Connection connection = net::Socket{}.connect("127.0.0.1", client_port1);
+        if (read_only) {
+            protocol::send_instruction(connection, protocol::Command{}, protocol::Instruction::c_READ_ONLY);
+            protocol::MetaData metadata = protocol::get_metadata(connection);
+            protocol::get_command(connection, metadata.argc, metadata.command_size);
+            protocol::get_payload(connection, metadata.payload_size);
+        }
+        protocol::send_instruction(connection, protocol::Command{ "key120", size, offset, "false" }, protocol::Instruction::c_GET);
+        protocol::MetaData metadata = protocol::get_metadata(connection);
+        protocol::get_command(connection, metadata.argc, metadata.command_size);
+        ByteArray payload = protocol::get_payload(connection, metadata.payload_size);
+        return std::make_pair(metadata.instruction, payload.to_string());
+    };
+    CHECK_EQ(protocol::Instruction::c_MOVE, get(false).first);
+    auto [instruction, value] = get(true);
+    CHECK_EQ(protocol::Instruction::c_GET_RESPONSE, instruction);
+    CHECK_EQ("value120", value);
+
+    //Parts of the value end with it
+    CHECK_EQ("ue1", get(true, "3", "3").second);
+    CHECK_EQ("120", get(true, "10", "5").second);
+    CHECK_EQ(protocol::Instruction::c_ERROR_RESPONSE, get(true, "0", "9").first);
+
+    //The replicas of the owner are part of the slot info once the role is gossiped
+    for (int i = 0; i < 100 && client.get_replicas()[primary_address].empty(); i++) {
+        std::this_thread::sleep_for(10ms);
+        REQUIRE(client.get_update_slot_info().is_ok());
+    }
+    REQUIRE_EQ(1, client.get_replicas()[primary_address].size());
+    CHECK_EQ(replica_address, client.get_replicas()[primary_address][0]);
+    client.set_stale_reads(true);
+    for (int i = 1; i < 150; i++) {
+        ByteArray stale{};
+        Status status = client.get_value("key" + std::to_string(i), stale);
+        CHECK_MESSAGE(status.is_ok(), status.get_msg());
+        CHECK_EQ("value" + std::to_string(i), stale.to_string());
+    }
+
+    node0.stop();
+    node1.stop();
+    thread0.join();
+    thread1.join();
+}
+
+TEST_CASE("Test failover election") {
+    //The replica node3 of the failed node0 and the primaries node1 and node2, which vote
+    auto new_state = [](const std::string& myself) {
+        ClusterState state{};
+        state.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+        for (int i = 0; i < 4; i++) {
+            std::string name = "node" + std::to_string(i);
+            state.nodes[name] = ClusterNode{ "", "127.0.0.1", static_cast<uint16_t>(4351 + 2 * i), static_cast<uint16_t>(4350 + 2 * i) };
+            std::copy(name.begin(), name.end(), state.nodes[name].name.begin());
+            state.nodes[name].config_epoch = i;
+        }
+        state.nodes["node3"].primary = state.nodes["node0"].name;
+        state.nodes["node0"].failed = true;
+        for (size_t slot = 0; slot < CLUSTER_AMOUNT_OF_SLOTS; slot++) {
+            ClusterNode& owner = state.nodes[slot == 1 ? "node1" : slot == 2 ? "node2" : "node0"];
+            owner.served_slots[slot] = true;
+            owner.num_slots_served = owner.served_slots.count();
+            state.slots[slot].served_by = &owner;
+        }
+        state.myself = state.nodes[myself];
+        state.nodes.erase(myself);
+        for (size_t slot = 0; slot < CLUSTER_AMOUNT_OF_SLOTS; slot++) {
+            if (state.myself.served_slots[slot]) {
+                state.slots[slot].served_by = &state.myself;
+            }
+        }
+        return state;
+    };
+
+    SUBCASE("A primary votes once per epoch for a replica of a failed primary") {
+        ClusterState state = new_state("node1");
+        Failover voter{};
+        CHECK(voter.handle_vote_request("node3", 5, "node0", state));
+        CHECK_FALSE(voter.handle_vote_request("node3", 5, "node0", state));
+        CHECK_FALSE(voter.handle_vote_request("node2", 6, "node0", state));
+        CHECK(voter.handle_vote_request("node3", 6, "node0", state));
+
+        state.nodes["node0"].failed = false;
+        CHECK_FALSE(voter.handle_vote_request("node3", 7, "node0", state));
+    }
+
+    SUBCASE("The replica takes over once a majority of the primaries voted") {
+        ClusterState state = new_state("node3");
+        Failover failover{ FailoverConfig{ 0ms, 1000ms } };
+        auto now = FailoverClock::now();
+        CHECK_FALSE(failover.update(state, false, now));
+        CHECK_FALSE(failover.update(state, true, now));
+        //Asks for the votes with an epoch above all known ones
+        CHECK_FALSE(failover.update(state, true, now));
+        uint64_t epoch = 4;
+
+        //Two of the three primaries are needed
+        failover.handle_vote("node1", epoch - 1);
+        failover.handle_vote("node1", epoch);
+        CHECK_FALSE(failover.update(state, true, now));
+        failover.handle_vote("node2", epoch);
+        CHECK(failover.update(state, true, now));
+
+        CHECK_EQ(epoch, state.myself.config_epoch);
+        CHECK_EQ(CLUSTER_AMOUNT_OF_SLOTS - 2, state.myself.num_slots_served);
+        CHECK_EQ('\0', state.myself.primary[0]);
+        CHECK_EQ(&state.myself, state.slots[0].served_by);
+        CHECK_EQ(&state.nodes["node1"], state.slots[1].served_by);
+    }
+
+    SUBCASE("Another replica follows the winner") {
+        ClusterState state = new_state("node3");
+        state.nodes["node4"] = ClusterNode{ "node4", "127.0.0.1", 4359, 4358 };
+        state.nodes["node4"].served_slots = state.nodes["node0"].served_slots;
+        for (size_t slot = 0; slot < CLUSTER_AMOUNT_OF_SLOTS; slot++) {
+            if (state.slots[slot].served_by == &state.nodes["node0"]) {
+                state.slots[slot].served_by = &state.nodes["node4"];
+            }
+        }
+        Failover failover{};
+        CHECK_FALSE(failover.update(state, true));
+        CHECK_EQ("node4", std::string(state.myself.primary.data()));
+    }
+}
+
+TEST_CASE("Test failover gossip") {
+    ClusterState state{};
+    state.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+    state.myself = ClusterNode{ "node0", "127.0.0.1", 4361, 4360 };
+    state.myself.config_epoch = 2;
+    for (size_t slot = 0; slot < 10; slot++) {
+        state.myself.served_slots[slot] = true;
+        state.slots[slot].served_by = &state.myself;
+    }
+    state.myself.num_slots_served = 10;
+
+    //node3 took over the slots of node0 while it was gone
+    ClusterNodeGossipData winner = ClusterNode{ "node3", "127.0.0.1", 4363, 4362 };
+    winner.served_slots = state.myself.served_slots;
+    winner.num_slots_served = 10;
+    winner.config_epoch = 5;
+    ClusterGossipMsg msg{};
+    msg.sender = winner.name;
+    msg.nodes.push_back(winner);
+
+    SUBCASE("The failed primary replicates the node that took its slots") {
+        apply_ping(state, msg);
+        CHECK_EQ(0, state.myself.num_slots_served);
+        CHECK_EQ("node3", std::string(state.myself.primary.data()));
+        CHECK_EQ(&state.nodes["node3"], state.slots[0].served_by);
+    }
+
+    SUBCASE("Older gossip about the failed primary doesn't undo the takeover") {
+        ClusterNodeGossipData failed = state.myself;
+        state.myself = ClusterNode{ "node1", "127.0.0.1", 4365, 4364 };
+        for (size_t slot = 0; slot < 10; slot++) {
+            state.slots[slot].served_by = nullptr;
+        }
+        apply_ping(state, msg);
+        REQUIRE_EQ(&state.nodes["node3"], state.slots[0].served_by);
+
+        ClusterGossipMsg stale{};
+        stale.sender = failed.name;
+        stale.nodes.push_back(failed);
+        SlotRangeGossipData range{ 0, 9, SlotState::c_NORMAL, {}, failed.name };
+        stale.slots.push_back(range);
+        apply_ping(state, stale);
+        CHECK_EQ(&state.nodes["node3"], state.slots[0].served_by);
+        CHECK_EQ(&state.nodes["node3"], state.slots[9].served_by);
+    }
+}
+
+//Polls the condition every 10ms for up to 5s, returns whether it held
+template <typename Condition>
+bool wait_until(Condition condition) {
+    for (int i = 0; i < 500; i++) {
+        if (condition()) {
+            return true;
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+    return condition();
+}
+
+//Whether the node's snapshot shows the slot served by the named node, with its migration finished
+bool is_served_by(const Node& node, uint16_t slot, const std::string& name) {
+    std::shared_ptr<const ClusterSnapshot> snapshot = node.get_cluster_snapshot();
+    for (const SlotRangeGossipData& range : snapshot->slots) {
+        if (range.first_slot <= slot && slot <= range.last_slot) {
+            return range.state == SlotState::c_NORMAL && name == range.served_by_name.data();
+        }
+    }
+    return false;
+}
+
+bool knows_node(const Node& node, const std::string& name) {
+    std::shared_ptr<const ClusterSnapshot> snapshot = node.get_cluster_snapshot();
+    return std::any_of(snapshot->nodes.begin(), snapshot->nodes.end(),
+        [&name](const ClusterNodeGossipData& other) { return name == other.name.data(); });
+}
+
+//node0 serves all slots, node1 joins it without any, they use four ports from the first one on
+struct TwoNodeCluster {
+    uint16_t client_port0;
+    uint16_t cluster_port0;
+    uint16_t client_port1;
+    uint16_t cluster_port1;
+    Node node0;
+    Node node1;
+    std::thread thread0;
+    std::thread thread1;
+    client::Client admin{};
+
+    explicit TwoNodeCluster(uint16_t first_port, std::string cluster_config_path1 = "")
+        : client_port0(first_port), cluster_port0(first_port + 1), client_port1(first_port + 2), cluster_port1(first_port + 3),
+        node0(Node::new_in_memory_node("node0", client_port0, cluster_port0, "127.0.0.1", true)),
+        node1(Node::new_in_memory_node("node1", client_port1, cluster_port1, "127.0.0.1", false, std::move(cluster_config_path1))) {
+    }
+
+    ~TwoNodeCluster() {
+        stop();
+    }
+
+    std::string get_address(uint16_t client_port) const {
+        return "127.0.0.1:" + std::to_string(client_port);
+    }
+
+    //Starts both nodes, returns once node1 is part of the cluster
+    void start() {
+        thread0 = std::thread(&Node::start, &node0);
+        thread1 = std::thread(&Node::start, &node1);
+        client::Client probe{};
+        REQUIRE(wait_until([this, &probe]() {
+            return admin.connect_to_node("127.0.0.1", client_port0).is_ok() && probe.connect_to_node("127.0.0.1", client_port1).is_ok();
+        }));
+        REQUIRE(admin.add_node_to_cluster("node1", "127.0.0.1", client_port1, cluster_port1).is_ok());
+        REQUIRE(wait_until([this]() { return knows_node(node0, "node1") && knows_node(node1, "node0"); }));
+    }
+
+    //Moves the slot from node0 to node1, or back, without waiting for the keys to be streamed
+    void start_migration(uint16_t slot, bool to_node1 = true) {
+        uint16_t client_port = to_node1 ? client_port1 : client_port0;
+        REQUIRE(admin.get_update_slot_info().is_ok());
+        REQUIRE(admin.migrate_slot(slot, "127.0.0.1", client_port).is_ok());
+        REQUIRE(admin.import_slot(slot, "127.0.0.1", client_port).is_ok());
+    }
+
+    //Returns once both nodes agree that the migration finished
+    void migrate_slot(uint16_t slot, bool to_node1 = true) {
+        start_migration(slot, to_node1);
+        std::string owner = to_node1 ? "node1" : "node0";
+        REQUIRE(wait_until([this, slot, &owner]() { return is_served_by(node0, slot, owner) && is_served_by(node1, slot, owner); }));
+    }
+
+    void stop() {
+        node0.stop();
+        node1.stop();
+        if (thread0.joinable()) {
+            thread0.join();
+        }
+        if (thread1.joinable()) {
+            thread1.join();
+        }
+    }
+};
+
+TEST_CASE("Test failover") {
+    Node node0 = Node::new_in_memory_node("node0", 4340, 4341, "127.0.0.1", true);
+    Node node1 = Node::new_in_memory_node("node1", 4342, 4343, "127.0.0.1");
+    Node node2 = Node::new_in_memory_node("node2", 4344, 4345, "127.0.0.1");
+    Node node3 = Node::new_in_memory_node("node3", 4346, 4347, "127.0.0.1");
+    std::vector<Node*> nodes{ &node0, &node1, &node2, &node3 };
+    std::vector<std::thread> threads;
+    for (Node* node : nodes) {
+        node->set_membership_config(MembershipConfig{ 50ms, 20ms, 3, 2, 3, 8 });
+        node->set_failover_config(FailoverConfig{ 100ms, 1000ms });
+    }
+    for (int i = 0; i < 100; i++) {
+        std::string key = "key" + std::to_string(i);
+        nodes[0]->get_kvs().put(key, ByteArray::new_allocated_byte_array("value" + std::to_string(i)));
+        nodes[0]->get_cluster_state().slots[get_key_slot(key)].amount_of_keys += 1;
+    }
+    for (Node* node : nodes) {
+        threads.emplace_back(&Node::start, node);
+    }
+    std::this_thread::sleep_for(100ms);
+
+    //Whether every node knows the gossiped node with the slot, an empty name only waits for all nodes
+    auto all_know = [&nodes](const std::string& name, int slot) {
+        for (Node* node : nodes) {
+            std::shared_ptr<const ClusterSnapshot> snapshot = node->get_cluster_snapshot();
+            size_t known = 0;
+            bool found = name.empty();
+            for (const ClusterNodeGossipData& other : snapshot->nodes) {
+                known += other.name != snapshot->myself.name;
+                found = found || (other.name.data() == name && other.served_slots[slot]);
+            }
+            if (known < nodes.size() - 1 || (!found && snapshot->myself.name.data() != name)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    auto wait_until_all_know = [&all_know](const std::string& name, int slot) {
+        for (int i = 0; i < 500 && !all_know(name, slot); i++) {
+            std::this_thread::sleep_for(10ms);
+        }
+        return all_know(name, slot);
+    };
+
+    client::Client client{};
+    REQUIRE(client.connect_to_node("127.0.0.1", 4340).is_ok());
+    for (int i = 1; i < 4; i++) {
+        REQUIRE(client.add_node_to_cluster("node" + std::to_string(i), "127.0.0.1", 4340 + 2 * i, 4341 + 2 * i).is_ok());
+    }
+    REQUIRE(wait_until_all_know("", 0));
+
+    //node1 and node2 serve a slot each, so there are three primaries to vote
+    REQUIRE(client.get_update_slot_info().is_ok());
+    uint16_t slots[2] = { get_key_slot("{a}"), get_key_slot("{b}") };
+    REQUIRE(slots[0] != slots[1]);
+    for (int i = 0; i < 2; i++) {
+        REQUIRE(client.migrate_slot(slots[i], "127.0.0.1", 4342 + 2 * i).is_ok());
+        REQUIRE(client.import_slot(slots[i], "127.0.0.1", 4342 + 2 * i).is_ok());
+        REQUIRE(wait_until_all_know("node" + std::to_string(i + 1), slots[i]));
+    }
+
+    std::string replica_address = "127.0.0.1:4346";
+    REQUIRE(client.replicate(replica_address, "node0").is_ok());
+    ReplicationInfo info{};
+    for (int i = 0; i < 500 && !info.synced; i++) {
+        std::this_thread::sleep_for(10ms);
+        REQUIRE(client.get_replication_info(replica_address, info).is_ok());
+    }
+    REQUIRE(info.synced);
+
+    nodes[0]->stop();
+    threads[0].join();
+
+    //The replica wins the election and the other nodes learn the new owner from gossip
+    client::Client other{};
+    REQUIRE(other.connect_to_node("127.0.0.1", 4342).is_ok());
+    for (int i = 0; i < 1000; i++) {
+        REQUIRE(other.get_update_slot_info().is_ok());
+        if (other.get_slot_nodes()[0] == replica_address) {
+            break;
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+    CHECK_EQ(replica_address, other.get_slot_nodes()[0]);
+    CHECK_EQ("127.0.0.1:4342", other.get_slot_nodes()[slots[0]]);
+    CHECK_EQ(CLUSTER_AMOUNT_OF_SLOTS - 2, nodes[3]->get_cluster_snapshot()->myself.num_slots_served);
+    CHECK_EQ('\0', nodes[3]->get_cluster_snapshot()->myself.primary[0]);
+
+    //The keys of the failed primary are served by the replica
+    for (int i = 0; i < 100; i++) {
+        ByteArray value{};
+        Status status = other.get_value("key" + std::to_string(i), value);
+        CHECK_MESSAGE(status.is_ok(), status.get_msg());
+        CHECK_EQ("value" + std::to_string(i), value.to_string());
+    }
+
+    for (int i = 1; i < 4; i++) {
+        nodes[i]->stop();
+        threads[i].join();
+    }
+}
+
+TEST_CASE("Test cluster config") {
+    std::string path = (std::filesystem::temp_directory_path() / "kvs_test_cluster_config.conf").string();
+    std::filesystem::remove(path);
+
+    ClusterState state{};
+    state.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+    state.nodes["node1"] = ClusterNode{ "node1", "127.0.0.1", 4371, 4370 };
+    state.nodes["node2"] = ClusterNode{ "node2", "127.0.0.1", 4373, 4372 };
+    state.nodes["node2"].primary = state.nodes["node1"].name;
+    state.nodes["node1"].config_epoch = 7;
+    state.myself = ClusterNode{ "node0", "127.0.0.1", 4369, 4368 };
+    state.myself.config_epoch = 3;
+    state.size = 2;
+    for (size_t slot = 0; slot < CLUSTER_AMOUNT_OF_SLOTS; slot++) {
+        state.slots[slot].served_by = slot < 100 ? &state.myself : &state.nodes["node1"];
+    }
+    state.slots[10].state = SlotState::c_MIGRATING;
+    state.slots[10].migration_partner = &state.nodes["node1"];
+
+    std::string config = serialize_cluster_config(*make_snapshot(state, 1));
+    ClusterState loaded{};
+    loaded.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+    loaded.myself = ClusterNode{ "node0", "127.0.0.1", 4369, 4368 };
+    CHECK(load_cluster_config(path, loaded).is_not_found());
+    REQUIRE(save_cluster_config(path, config).is_ok());
+    CHECK_FALSE(std::filesystem::exists(path + ".tmp"));
+
+    SUBCASE("The nodes, slots and epochs are restored") {
+        REQUIRE(load_cluster_config(path, loaded).is_ok());
+        CHECK_EQ(3, loaded.myself.config_epoch);
+        CHECK_EQ(100, loaded.myself.num_slots_served);
+        CHECK(loaded.part_of_cluster);
+        REQUIRE_EQ(2, loaded.nodes.size());
+        CHECK_EQ(7, loaded.nodes["node1"].config_epoch);
+        CHECK_EQ(CLUSTER_AMOUNT_OF_SLOTS - 100, loaded.nodes["node1"].num_slots_served);
+        CHECK_EQ("node1", std::string(loaded.nodes["node2"].primary.data()));
+        CHECK_EQ(4373, loaded.nodes["node2"].cluster_port);
+        CHECK_EQ(&loaded.myself, loaded.slots[0].served_by);
+        CHECK_EQ(&loaded.nodes["node1"], loaded.slots[100].served_by);
+        CHECK_EQ(SlotState::c_MIGRATING, loaded.slots[10].state);
+        CHECK_EQ(&loaded.nodes["node1"], loaded.slots[10].migration_partner);
+        CHECK_EQ(config, serialize_cluster_config(*make_snapshot(loaded, 1)));
+    }
+
+    SUBCASE("The config of another node is refused") {
+        loaded.myself = ClusterNode{ "node1", "127.0.0.1", 4371, 4370 };
+        CHECK(load_cluster_config(path, loaded).is_error());
+        CHECK(loaded.nodes.empty());
+    }
+
+    SUBCASE("Invalid configs are refused") {
+        REQUIRE(save_cluster_config(path, config + "slots 5 2 0 node0 -\n").is_ok());
+        CHECK(load_cluster_config(path, loaded).is_error());
+        CHECK(loaded.nodes.empty());
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Test node restart") {
+    std::string path = (std::filesystem::temp_directory_path() / "kvs_test_node_restart.conf").string();
+    std::filesystem::remove(path);
+    TwoNodeCluster cluster{ 4374, path };
+    uint16_t slot = get_key_slot("{restart}");
+    cluster.start();
+    cluster.migrate_slot(slot);
+    uint64_t epoch = cluster.node1.get_cluster_snapshot()->myself.config_epoch;
+    cluster.stop();
+
+    //The restarted node knows the cluster before it runs
+    Node node1 = Node::new_in_memory_node("node1", cluster.client_port1, cluster.cluster_port1, "127.0.0.1", false, path);
+    ClusterState& state = node1.get_cluster_state();
+    CHECK(state.part_of_cluster);
+    REQUIRE(state.nodes.contains("node0"));
+    CHECK_EQ(epoch, state.myself.config_epoch);
+    CHECK_EQ(1, state.myself.num_slots_served);
+    CHECK_EQ(&state.myself, state.slots[slot].served_by);
+    CHECK_EQ(&state.nodes["node0"], state.slots[(slot + 1) % CLUSTER_AMOUNT_OF_SLOTS].served_by);
+
+    //Clients of the restarted node are sent to the owners of the slots right away
+    auto thread0 = std::thread(&Node::start, &cluster.node0);
+    auto thread1 = std::thread(&Node::start, &node1);
+    client::Client client{};
+    REQUIRE(wait_until([&client, &cluster]() { return client.connect_to_node("127.0.0.1", cluster.client_port1).is_ok(); }));
+    REQUIRE(client.get_update_slot_info().is_ok());
+    CHECK_EQ(cluster.get_address(cluster.client_port1), client.get_slot_nodes()[slot]);
+    CHECK_EQ(cluster.get_address(cluster.client_port0), client.get_slot_nodes()[(slot + 1) % CLUSTER_AMOUNT_OF_SLOTS]);
+    REQUIRE(client.put_value("{restart}key", "value").is_ok());
+    REQUIRE(client.put_value("other", "value").is_ok());
+    CHECK(node1.get_kvs().contains_key("{restart}key"));
+    CHECK(cluster.node0.get_kvs().contains_key("other"));
+
+    cluster.node0.stop();
+    node1.stop();
+    thread0.join();
+    thread1.join();
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Test proxy route") {
+    key_value_store::InMemoryKVS kvs{};
+    ClusterState state{};
+    state.slots.resize(CLUSTER_AMOUNT_OF_SLOTS);
+    state.nodes["node1"] = ClusterNode{ "node1", "127.0.0.1", 4381, 4380 };
+    state.myself = ClusterNode{ "node0", "127.0.0.1", 4379, 4378 };
+    uint16_t mine = get_key_slot("{mine}");
+    uint16_t other = get_key_slot("{other}");
+    for (size_t slot = 0; slot < CLUSTER_AMOUNT_OF_SLOTS; slot++) {
+        state.slots[slot].served_by = slot == other ? &state.nodes["node1"] : &state.myself;
+        state.myself.served_slots[slot] = slot != other;
+    }
+
+    SUBCASE("Keys of other nodes go to their owner") {
+        std::optional<ProxyRoute> route = get_proxy_route(protocol::Instruction::c_GET, "{other}key", false, kvs, state);
+        REQUIRE(route.has_value());
+        CHECK_EQ("127.0.0.1", route->ip);
+        CHECK_EQ(4380, route->client_port);
+        CHECK_FALSE(route->asking);
+        CHECK_FALSE(get_proxy_route(protocol::Instruction::c_PUT, "{mine}key", false, kvs, state).has_value());
+
+        //Failed nodes are reported to the client
+        state.nodes["node1"].failed = true;
+        CHECK_FALSE(get_proxy_route(protocol::Instruction::c_ERASE, "{other}key", false, kvs, state).has_value());
+    }
+
+    SUBCASE("Missing keys of migrating slots go to the importing node") {
+        state.slots[mine].state = SlotState::c_MIGRATING;
+        state.slots[mine].migration_partner = &state.nodes["node1"];
+        kvs.put("{mine}kept", ByteArray::new_allocated_byte_array("value"));
+        CHECK_FALSE(get_proxy_route(protocol::Instruction::c_GET, "{mine}kept", false, kvs, state).has_value());
+        CHECK_FALSE(get_proxy_route(protocol::Instruction::c_PUT, "{mine}kept", false, kvs, state).has_value());
+        std::optional<ProxyRoute> route = get_proxy_route(protocol::Instruction::c_PUT, "{mine}moved", false, kvs, state);
+        REQUIRE(route.has_value());
+        CHECK_EQ(4380, route->client_port);
+        CHECK(route->asking);
+    }
+
+    SUBCASE("Importing slots send requests that don't ask to the migrating node") {
+        state.slots[mine].state = SlotState::c_IMPORTING;
+        state.slots[mine].migration_partner = &state.nodes["node1"];
+        CHECK_FALSE(get_proxy_route(protocol::Instruction::c_GET, "{mine}key", true, kvs, state).has_value());
+        std::optional<ProxyRoute> route = get_proxy_route(protocol::Instruction::c_GET, "{mine}key", false, kvs, state);
+        REQUIRE(route.has_value());
+        CHECK_FALSE(route->asking);
+    }
+
+    SUBCASE("Keys for the same node are batched") {
+        std::vector<ProxyBatch> batches;
+        add_to_proxy_batch(batches, ProxyRoute{ "127.0.0.1", 4380, false }, 0);
+        add_to_proxy_batch(batches, ProxyRoute{ "127.0.0.1", 4382, false }, 1);
+        add_to_proxy_batch(batches, ProxyRoute{ "127.0.0.1", 4380, true }, 2);
+        add_to_proxy_batch(batches, ProxyRoute{ "127.0.0.1", 4380, false }, 3);
+        REQUIRE_EQ(3, batches.size());
+        std::vector<size_t> first{ 0, 3 };
+        CHECK_EQ(first, batches[0].keys);
+        CHECK_EQ(1, batches[1].keys.size());
+        CHECK(batches[2].route.asking);
+    }
+
+    SUBCASE("Redirects are followed") {
+        protocol::MetaData meta_data{};
+        meta_data.instruction = protocol::Instruction::c_ASK;
+        std::optional<ProxyRoute> route = get_redirect_route(meta_data, protocol::Command{ "127.0.0.1", "4380" });
+        REQUIRE(route.has_value());
+        CHECK_EQ(4380, route->client_port);
+        CHECK(route->asking);
+        meta_data.instruction = protocol::Instruction::c_MOVE;
+        CHECK_FALSE(get_redirect_route(meta_data, protocol::Command{ "127.0.0.1", "4380" })->asking);
+        meta_data.instruction = protocol::Instruction::c_OK_RESPONSE;
+        CHECK_FALSE(get_redirect_route(meta_data, protocol::Command{}).has_value());
+
+        //The ones of multi key requests also name the slot
+        meta_data.instruction = protocol::Instruction::c_ASK;
+        protocol::Command multi_key{ "127.0.0.1", "4380", std::to_string(mine) };
+        CHECK(get_redirect_route(meta_data, multi_key).has_value());
+        CHECK_EQ(mine, get_redirect_slot(multi_key).value());
+        CHECK_FALSE(get_redirect_slot(protocol::Command{ "127.0.0.1", "4380" }).has_value());
+        CHECK_FALSE(get_redirect_slot(protocol::Command{ "127.0.0.1", "4380", std::to_string(CLUSTER_AMOUNT_OF_SLOTS) }).has_value());
+    }
+}
+
+TEST_CASE("Test proxy mode") {
+    TwoNodeCluster cluster{ 4378 };
+    cluster.node0.set_proxy_mode(true);
+    uint16_t slot = get_key_slot("{proxied}");
+    cluster.start();
+    cluster.migrate_slot(slot);
+
+    //The client only knows node0 and is never redirected
+    client::Client client{};
+    REQUIRE(client.connect_to_node("127.0.0.1", cluster.client_port0).is_ok());
+    for (int i = 0; i < 10; i++) {
+        REQUIRE(client.put_value("{proxied}key" + std::to_string(i), "value" + std::to_string(i)).is_ok());
+    }
+    ByteArray value{};
+    REQUIRE(client.get_value("{proxied}key3", value).is_ok());
+    CHECK_EQ("value3", value.to_string());
+    REQUIRE(client.erase_value("{proxied}key0").is_ok());
+    CHECK_FALSE(client.get_value("{proxied}key0", value).is_ok());
+    CHECK(client.get_slot_nodes()[slot].empty());
+    CHECK(cluster.node1.get_kvs().contains_key("{proxied}key9"));
+    CHECK_FALSE(cluster.node0.get_kvs().contains_key("{proxied}key9"));
+
+    //Clients of node1 are still redirected
+    client::Client other{};
+    REQUIRE(other.connect_to_node("127.0.0.1", cluster.client_port1).is_ok());
+    REQUIRE(other.put_value("unproxied", "value").is_ok());
+    CHECK(cluster.node0.get_kvs().contains_key("unproxied"));
+    CHECK_EQ(cluster.get_address(cluster.client_port0), other.get_slot_nodes()[get_key_slot("unproxied")]);
+}
+
+TEST_CASE("Test proxy mode during a migration") {
+    TwoNodeCluster cluster{ 4394 };
+    cluster.node0.set_proxy_mode(true);
+    //One key per second keeps the slot migrating while the client writes
+    MigrationConfig config = CLUSTER_MIGRATION_CONFIG;
+    config.batch_keys = 1;
+    config.keys_per_second = 1;
+    cluster.node0.set_migration_config(config);
+    uint16_t slot = get_key_slot("{proxied}");
+    for (int i = 0; i < 10; i++) {
+        cluster.node0.get_kvs().put("{proxied}key" + std::to_string(i), ByteArray::new_allocated_byte_array("old"));
+    }
+    cluster.node0.get_cluster_state().slots[slot].amount_of_keys = 10;
+    cluster.start();
+    cluster.start_migration(slot);
+
+    //Existing keys are updated on the migrating node, the client never sees an ASK
+    client::Client client{};
+    REQUIRE(client.connect_to_node("127.0.0.1", cluster.client_port0).is_ok());
+    REQUIRE(client.put_value("{proxied}key9", "new").is_ok());
+    ByteArray value{};
+    REQUIRE(client.get_value("{proxied}key9", value).is_ok());
+    CHECK_EQ("new", value.to_string());
+    CHECK_EQ(1, client.get_nodes_connections().size());
+    CHECK(client.get_slot_nodes()[slot].empty());
+}
+
+TEST_CASE("Test multi key requests") {
+    TwoNodeCluster cluster{ 4382 };
+    uint16_t slot = get_key_slot("{remote}");
+    cluster.start();
+    cluster.migrate_slot(slot);
+
+    //Keys of both nodes in one request, each node coordinates it for the clients that only know it
+    std::vector<std::string> keys;
+    std::vector<ByteArray> values;
+    for (int i = 0; i < 20; i++) {
+        keys.push_back((i % 2 == 0 ? "{remote}key" : "local") + std::to_string(i));
+        values.push_back(ByteArray::new_allocated_byte_array("value" + std::to_string(i)));
+    }
+    client::Client client{};
+    REQUIRE(client.connect_to_node("127.0.0.1", cluster.client_port0).is_ok());
+    REQUIRE(client.put_values(keys, values).is_ok());
+    CHECK(cluster.node1.get_kvs().contains_key("{remote}key0"));
+    CHECK(cluster.node0.get_kvs().contains_key("local1"));
+    CHECK_FALSE(cluster.node0.get_kvs().contains_key("{remote}key0"));
+
+    client::Client other{};
+    REQUIRE(other.connect_to_node("127.0.0.1", cluster.client_port1).is_ok());
+    keys.push_back("missing");
+    std::vector<std::optional<ByteArray>> received;
+    REQUIRE(other.get_values(keys, received).is_ok());
+    REQUIRE_EQ(keys.size(), received.size());
+    for (int i = 0; i < 20; i++) {
+        REQUIRE(received[i].has_value());
+        CHECK_EQ("value" + std::to_string(i), received[i]->to_string());
+    }
+    CHECK_FALSE(received[20].has_value());
+    CHECK(client.get_slot_nodes()[slot].empty());
+
+    //Invalid requests are refused
+    CHECK(client.put_values({ "key" }, {}).is_invalid_argument());
+    CHECK(client.get_values({}, received).is_invalid_argument());
+}
+
+TEST_CASE("Test slot map subscription") {
+    TwoNodeCluster cluster{ 4386 };
+    uint16_t slot = get_key_slot("{pushed}");
+    cluster.start();
+
+    std::string address0 = cluster.get_address(cluster.client_port0);
+    std::string address1 = cluster.get_address(cluster.client_port1);
+    client::Client client{};
+    REQUIRE(client.connect_to_node("127.0.0.1", cluster.client_port0).is_ok());
+    REQUIRE(client.subscribe_slot_updates().is_ok());
+    uint64_t version = client.get_slot_map_version();
+    CHECK(version > 0);
+    CHECK_EQ(address0, client.get_slot_nodes()[slot]);
+
+    cluster.migrate_slot(slot);
+
+    //The change arrives without a request for the slot, the requests for other slots apply it
+    REQUIRE(wait_until([&client, &address1, slot]() {
+        return client.put_value("other", "value").is_ok() && client.get_slot_nodes()[slot] == address1;
+    }));
+    CHECK_EQ(address0, client.get_slot_nodes()[(slot + 1) % CLUSTER_AMOUNT_OF_SLOTS]);
+    CHECK(client.get_slot_map_version() > version);
+    CHECK_FALSE(client.get_nodes_connections().contains(address1));
+
+    //The first request for the slot goes to the new owner
+    REQUIRE(client.put_value("{pushed}key", "value").is_ok());
+    CHECK(cluster.node1.get_kvs().contains_key("{pushed}key"));
+    CHECK(client.get_nodes_connections().contains(address1));
+}
+
+TEST_CASE("Test slot map digest") {
+    TwoNodeCluster cluster{ 4390 };
+    uint16_t slot = get_key_slot("{mapped}");
+    cluster.start();
+
+    std::string address0 = cluster.get_address(cluster.client_port0);
+    std::string address1 = cluster.get_address(cluster.client_port1);
+    client::Client client{};
+    REQUIRE(client.connect_to_node("127.0.0.1", cluster.client_port0).is_ok());
+    REQUIRE(client.get_update_slot_info().is_ok());
+    CHECK_EQ(address0, client.get_slot_nodes()[slot]);
+    uint64_t epoch = client.get_slot_map_epoch();
+
+    //The map didn't change, so the node doesn't send it again and the table is kept as it is
+    client.get_slot_nodes()[slot] = "";
+    REQUIRE(client.get_update_slot_info().is_ok());
+    CHECK_EQ("", client.get_slot_nodes()[slot]);
+    client.get_slot_nodes()[slot] = address0;
+
+    cluster.migrate_slot(slot);
+    REQUIRE(client.get_update_slot_info().is_ok());
+    CHECK_EQ(address1, client.get_slot_nodes()[slot]);
+    CHECK_EQ(address0, client.get_slot_nodes()[(slot + 1) % CLUSTER_AMOUNT_OF_SLOTS]);
+    CHECK(client.get_slot_map_epoch() > epoch);
+}
+
+TEST_CASE("Test multi key requests during a migration") {
+    TwoNodeCluster cluster{ 4398 };
+    //One key per second keeps the slot migrating back while the requests are answered
+    MigrationConfig config = CLUSTER_MIGRATION_CONFIG;
+    config.batch_keys = 1;
+    config.keys_per_second = 1;
+    cluster.node1.set_migration_config(config);
+    uint16_t back = get_key_slot("{back}");
+    uint16_t stays = get_key_slot("{stays}");
+    for (int i = 0; i < 10; i++) {
+        cluster.node0.get_kvs().put("{back}key" + std::to_string(i), ByteArray::new_allocated_byte_array("value"));
+    }
+    cluster.node0.get_cluster_state().slots[back].amount_of_keys = 10;
+    cluster.node0.get_kvs().put("{stays}key", ByteArray::new_allocated_byte_array("stays"));
+    cluster.node0.get_cluster_state().slots[stays].amount_of_keys = 1;
+    cluster.start();
+    cluster.migrate_slot(back);
+    cluster.migrate_slot(stays);
+
+    //Only the slot of the first key goes back to node0, both slots are in the batch node0 forwards to node1
+    cluster.start_migration(back, false);
+
+    client::Client client{};
+    REQUIRE(client.connect_to_node("127.0.0.1", cluster.client_port0).is_ok());
+    std::vector<std::string> keys{ "{back}missing", "{stays}key", "{back}key0" };
+    std::vector<std::optional<ByteArray>> received;
+    REQUIRE(client.get_values(keys, received).is_ok());
+    REQUIRE_EQ(keys.size(), received.size());
+    CHECK_FALSE(received[0].has_value());
+    REQUIRE(received[1].has_value());
+    CHECK_EQ("stays", received[1]->to_string());
+    REQUIRE(received[2].has_value());
+    CHECK_EQ("value", received[2]->to_string());
+
+    //The new key of the migrating slot is stored on the importing node, the other one stays where its slot is
+    std::vector<std::string> written{ "{back}new", "{stays}new" };
+    std::vector<ByteArray> values{ ByteArray::new_allocated_byte_array("new"), ByteArray::new_allocated_byte_array("new") };
+    REQUIRE(client.put_values(written, values).is_ok());
+    CHECK(cluster.node0.get_kvs().contains_key("{back}new"));
+    CHECK(cluster.node1.get_kvs().contains_key("{stays}new"));
+    CHECK_FALSE(cluster.node0.get_kvs().contains_key("{stays}new"));
+    CHECK(client.get_slot_nodes()[back].empty());
+}
@@ -5,6 +5,8 @@
 #include "utils/Status.hpp"
 #include "KVS/InMemoryKVS.hpp"
 
+#include <set>
+
 std::string test_string = "ABCDEFGHI";
 int test_string_length = 1 + test_string.size();
 
@@ -55,4 +57,69 @@ TEST_CASE("Test InMemoryKeyValueStore") {
         CHECK_EQ(kvs.get_size(), 0);
         CHECK(status.is_not_found());
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Test slot iterator") {
+    //The slot is the first character of the key
+    key_value_store::InMemoryKVS kvs{ [](std::string_view key) -> uint16_t { return key[0] - 'a'; }, 3 };
+    ByteArray value = ByteArray::new_allocated_byte_array(test_string);
+    for (std::string key : { "a1", "a2", "a3", "b1", "c1", "c2" }) {
+        kvs.put(key, value);
+    }
+
+    auto get_slot_keys = [&kvs](uint16_t slot) {
+        std::set<std::string> keys;
+        for (auto it = kvs.new_slot_iterator(slot); it->valid(); it->next()) {
+            keys.emplace(it->key());
+            CHECK_EQ(test_string, it->value().to_string());
+        }
+        return keys;
+    };
+
+    SUBCASE("Keys of a slot") {
+        CHECK_EQ(3, kvs.get_slot_size(0));
+        CHECK_EQ(1, kvs.get_slot_size(1));
+        CHECK_EQ(2, kvs.get_slot_size(2));
+        CHECK_EQ(std::set<std::string>({ "a1", "a2", "a3" }), get_slot_keys(0));
+        CHECK_EQ(std::set<std::string>({ "c1", "c2" }), get_slot_keys(2));
+        CHECK_FALSE(kvs.new_slot_iterator(3)->valid());
+        CHECK_EQ(0, kvs.get_slot_size(3));
+    }
+
+    SUBCASE("Erased and overwritten keys") {
+        //First, middle and last of the list
+        kvs.erase("a3");
+        kvs.erase("a1");
+        kvs.put("a2", value);
+        CHECK_EQ(1, kvs.get_slot_size(0));
+        CHECK_EQ(std::set<std::string>({ "a2" }), get_slot_keys(0));
+
+        kvs.erase("a2");
+        kvs.erase("b1");
+        CHECK_FALSE(kvs.new_slot_iterator(0)->valid());
+        CHECK_FALSE(kvs.new_slot_iterator(1)->valid());
+        CHECK_EQ(std::set<std::string>({ "c1", "c2" }), get_slot_keys(2));
+        CHECK_EQ(2, kvs.get_size());
+    }
+}
+
+TEST_CASE("Test slot bytes") {
+    key_value_store::InMemoryKVS kvs{ [](std::string_view key) -> uint16_t { return key[0] - 'a'; }, 2 };
+    kvs.put("a1", ByteArray::new_allocated_byte_array("value"));
+    kvs.put("a2", ByteArray::new_allocated_byte_array("val"));
+    kvs.put("b1", ByteArray::new_allocated_byte_array("v"));
+    CHECK_EQ(12, kvs.get_slot_bytes(0));
+    CHECK_EQ(3, kvs.get_slot_bytes(1));
+
+    //Overwriting accounts for the difference
+    kvs.put("a1", ByteArray::new_allocated_byte_array("a longer value"));
+    CHECK_EQ(21, kvs.get_slot_bytes(0));
+    kvs.put("a1", ByteArray::new_allocated_byte_array("v"));
+    CHECK_EQ(8, kvs.get_slot_bytes(0));
+
+    kvs.erase("a2");
+    kvs.erase("b1");
+    CHECK_EQ(3, kvs.get_slot_bytes(0));
+    CHECK_EQ(0, kvs.get_slot_bytes(1));
+    CHECK_EQ(0, kvs.get_slot_bytes(2));
+}
@@ -1,6 +1,7 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
+#include <functional>
 #include <future>
 #include <chrono>
 #include <numeric>
@@ -56,7 +57,7 @@ TEST_CASE("Test put") {
         c.send(v.c_str(), v.size());
 
         auto metadata = protocol::get_metadata(c);
-        auto command = protocol::get_command(c, 0, metadata.command_size);
+        auto command = protocol::get_command(c, 0, metadata.command_size).to_command();
         ByteArray payload = protocol::get_payload(c, metadata.payload_size);
 
         return std::make_tuple(metadata, command, payload);
@@ -68,7 +69,22 @@ TEST_CASE("Test put") {
             server.listen(port);
         }
         net::Connection c = server.accept();
-        instruction_handler::handle_put(c, meta_data, command, kvs, cluster_state);
+        net::sync_wait(instruction_handler::handle_put(c, meta_data, command, kvs, cluster_state));
+    };
+
+    //The state is changed while the handler waits for the payload
+    auto send_payload_after = [&](std::string v, const std::function<void()>& change) {
+        net::Socket client{};
+        net::Connection c = client.connect(port);
+        std::this_thread::sleep_for(100ms);
+        change();
+        c.send(v.c_str(), v.size());
+
+        auto metadata = protocol::get_metadata(c);
+        auto command = protocol::get_command(c, 0, metadata.command_size).to_command();
+        ByteArray payload = protocol::get_payload(c, metadata.payload_size);
+
+        return std::make_tuple(metadata, command, payload);
     };
 
     SUBCASE("Insert first time") {
@@ -146,6 +162,69 @@ TEST_CASE("Test put") {
         //Check payload
         CHECK_EQ(0, actual_payload.size());
     }
+
+    SUBCASE("Key erased while the payload is received") {
+        uint16_t slot = cluster::get_key_slot("key");
+        kvs.put("key", ByteArray::new_allocated_byte_array("old"));
+        protocol::Command command{ "key", "5", "0" };
+        auto [_, meta_data] = get_command_and_metadata(protocol::Instruction::c_PUT, command, "value");
+        auto processed = std::async(process_command, command, meta_data);
+        std::this_thread::sleep_for(100ms);
+        auto sent = std::async(send_payload_after, "value", [&]() {
+            kvs.erase("key");
+        });
+
+        processed.get();
+        auto [actual_metadata, actual_command, actual_payload] = sent.get();
+
+        //Stored again instead of being acknowledged without a key
+        CHECK_EQ(protocol::Instruction::c_OK_RESPONSE, actual_metadata.instruction);
+        REQUIRE(kvs.get("key", ba).is_ok());
+        CHECK_EQ("value", ba.to_string());
+        CHECK_EQ(1, cluster_state.slots[slot].amount_of_keys);
+    }
+
+    SUBCASE("Key stored by another connection while the payload is received") {
+        uint16_t slot = cluster::get_key_slot("key");
+        protocol::Command command{ "key", "5", "0" };
+        auto [_, meta_data] = get_command_and_metadata(protocol::Instruction::c_PUT, command, "value");
+        auto processed = std::async(process_command, command, meta_data);
+        std::this_thread::sleep_for(100ms);
+        auto sent = std::async(send_payload_after, "value", [&]() {
+            kvs.put("key", ByteArray::new_allocated_byte_array("other"));
+            cluster_state.slots[slot].amount_of_keys += 1;
+        });
+
+        processed.get();
+        auto [actual_metadata, actual_command, actual_payload] = sent.get();
+
+        //Only counted once
+        CHECK_EQ(protocol::Instruction::c_OK_RESPONSE, actual_metadata.instruction);
+        REQUIRE(kvs.get("key", ba).is_ok());
+        CHECK_EQ("value", ba.to_string());
+        CHECK_EQ(1, cluster_state.slots[slot].amount_of_keys);
+    }
+
+    SUBCASE("Slot handed over while the payload is received") {
+        uint16_t slot = cluster::get_key_slot("key");
+        cluster::ClusterNode other{ "node1", "127.0.0.1", 4001, 3001 };
+        protocol::Command command{ "key", "5", "0" };
+        auto [_, meta_data] = get_command_and_metadata(protocol::Instruction::c_PUT, command, "value");
+        auto processed = std::async(process_command, command, meta_data);
+        std::this_thread::sleep_for(100ms);
+        auto sent = std::async(send_payload_after, "value", [&]() {
+            cluster_state.myself.served_slots[slot] = false;
+            cluster_state.slots[slot].served_by = &other;
+        });
+
+        processed.get();
+        auto [actual_metadata, actual_command, actual_payload] = sent.get();
+
+        //The client is sent to the new owner, the write isn't acknowledged here
+        CHECK_EQ(protocol::Instruction::c_MOVE, actual_metadata.instruction);
+        CHECK_FALSE(kvs.contains_key("key"));
+        CHECK_EQ(0, cluster_state.slots[slot].amount_of_keys);
+    }
 }
 
 
@@ -167,7 +246,7 @@ TEST_CASE("Test get") {
         net::Connection c = client.connect(port);
 
         auto metadata = protocol::get_metadata(c);
-        auto command = protocol::get_command(c, 2, metadata.command_size);
+        auto command = protocol::get_command(c, 2, metadata.command_size).to_command();
         ByteArray payload = protocol::get_payload(c, metadata.payload_size);
 
         return std::make_tuple(metadata, command, payload);
@@ -179,7 +258,7 @@ TEST_CASE("Test get") {
             server.listen(port);
         }
         net::Connection c = server.accept();
-        instruction_handler::handle_get(c, command, kvs, cluster_state);
+        net::sync_wait(instruction_handler::handle_get(c, command, kvs, cluster_state));
     };
 
     SUBCASE("Check for error when not found") {
@@ -259,7 +338,7 @@ TEST_CASE("Test erase") {
         net::Connection c = client.connect(port);
 
         auto metadata = protocol::get_metadata(c);
-        auto command = protocol::get_command(c, 0, metadata.command_size);
+        auto command = protocol::get_command(c, 0, metadata.command_size).to_command();
         ByteArray payload = protocol::get_payload(c, metadata.payload_size);
 
         return std::make_tuple(metadata, command, payload);
@@ -272,7 +351,7 @@ TEST_CASE("Test erase") {
         }
 
         net::Connection c = server.accept();
-        instruction_handler::handle_erase(c, command, kvs, cluster_state);
+        net::sync_wait(instruction_handler::handle_erase(c, command, kvs, cluster_state));
     };
 
     SUBCASE("Check for error when not found") {
@@ -343,7 +422,7 @@ TEST_CASE("Test meet") {
         net::Connection c = client.connect(receiver_cluster_port);
 
         auto metadata = protocol::get_metadata(c);
-        auto command = protocol::get_command(c, 0, metadata.command_size);
+        auto command = protocol::get_command(c, 0, metadata.command_size).to_command();
         ByteArray payload = protocol::get_payload(c, metadata.payload_size);
 
         return std::make_tuple(metadata, command, payload);
@@ -356,7 +435,7 @@ TEST_CASE("Test meet") {
         }
 
         net::Connection c = server.accept();
-        instruction_handler::handle_meet(c, command, cluster_state);
+        net::sync_wait(instruction_handler::handle_meet(c, command, cluster_state));
     };
 
     auto node_listener = [&](uint16_t port) {
@@ -423,6 +502,7 @@ TEST_CASE("check migrate / import slot") {
         {"node1", node1},
     };
     ClusterState cluster_state1{ nodes, 2, std::vector<Slot>(3), node1 };
+    key_value_store::InMemoryKVS kvs{};
 
     auto handle_request = [&](auto handler, protocol::Command& command, ClusterState& cluster_state) {
         net::Socket server{};
@@ -431,7 +511,11 @@ TEST_CASE("check migrate / import slot") {
         }
 
         net::Connection c = server.accept();
-        handler(c, command, cluster_state1);
+        net::sync_wait(handler(c, command, cluster_state1));
+    };
+
+    auto migrate_slot = [&](net::Connection& connection, const protocol::CommandView& command, ClusterState& cluster_state) {
+        return instruction_handler::handle_migrate_slot(connection, command, kvs, cluster_state);
     };
 
     auto get_response = [&]() {
@@ -439,7 +523,7 @@ TEST_CASE("check migrate / import slot") {
         net::Connection c = client.connect(client_port);
 
         auto metadata = protocol::get_metadata(c);
-        auto command = protocol::get_command(c, metadata.argc, metadata.command_size);
+        auto command = protocol::get_command(c, metadata.argc, metadata.command_size).to_command();
         ByteArray payload = protocol::get_payload(c, metadata.payload_size);
 
         return std::make_tuple(metadata, command, payload);
@@ -450,7 +534,7 @@ TEST_CASE("check migrate / import slot") {
         cluster_state1.slots[0].state = SlotState::c_MIGRATING;
 
         //Check migrate slot
-        auto processed = std::async(handle_request, instruction_handler::handle_migrate_slot, std::ref(command), std::ref(cluster_state1));
+        auto processed = std::async(handle_request, migrate_slot, std::ref(command), std::ref(cluster_state1));
         std::this_thread::sleep_for(100ms);
         auto response = std::async(get_response);
 
@@ -475,7 +559,7 @@ TEST_CASE("check migrate / import slot") {
         protocol::Command command{ "0", "127.0.0.1", "5000" };
 
         //Check migrate slot
-        auto processed = std::async(handle_request, instruction_handler::handle_migrate_slot, std::ref(command), std::ref(cluster_state1));
+        auto processed = std::async(handle_request, migrate_slot, std::ref(command), std::ref(cluster_state1));
         std::this_thread::sleep_for(100ms);
         auto response = std::async(get_response);
 
@@ -496,15 +580,31 @@ TEST_CASE("check migrate / import slot") {
         CHECK_EQ(expected_error, actual_payload.to_string());
     }
 
+    SUBCASE("Test failure invalid slot") {
+        protocol::Command command{ std::to_string(cluster::CLUSTER_AMOUNT_OF_SLOTS), "127.0.0.1", "5000" };
+
+        //Check migrate slot
+        auto processed = std::async(handle_request, migrate_slot, std::ref(command), std::ref(cluster_state1));
+        std::this_thread::sleep_for(100ms);
+        auto response = std::async(get_response);
+
+        auto [actual_metadata, actual_command, actual_payload] = response.get();
+        processed.get();
+
+        CHECK_EQ(protocol::Instruction::c_ERROR_RESPONSE, actual_metadata.instruction);
+        CHECK_EQ("Invalid slot", actual_payload.to_string());
+    }
+
     SUBCASE("Test correct migrating") {
         ClusterNode other_node{ "node2", "127.0.0.1", cluster_port, 5000 };
         cluster_state1.nodes["node2"] = other_node;
-        cluster_state1.slots[0].amount_of_keys = 1;
+        //All keys of the store are in slot 0
+        kvs.put("key", ByteArray::new_allocated_byte_array("value"));
         protocol::Command command{ "0", "127.0.0.1", "5000" };
 
 
         //Check migrate slot
-        auto processed = std::async(handle_request, instruction_handler::handle_migrate_slot, std::ref(command), std::ref(cluster_state1));
+        auto processed = std::async(handle_request, migrate_slot, std::ref(command), std::ref(cluster_state1));
         std::this_thread::sleep_for(100ms);
         auto response = std::async(get_response);
 
@@ -13,10 +13,11 @@ using namespace client;
 
 
 std::string get_key_with_target_slot(uint16_t slot, std::vector<std::string> distinct = {}) {
+    //A counter keeps the keys short, even if many have to be tried with a large amount of slots
     std::string key = "key";
-    while (cluster::get_key_hash(key) % cluster::CLUSTER_AMOUNT_OF_SLOTS != slot
-        || std::find(distinct.begin(), distinct.end(), key) != distinct.end()) {
-        key += "1";
+    for (uint64_t i = 0; cluster::get_key_hash(key) % cluster::CLUSTER_AMOUNT_OF_SLOTS != slot
+        || std::find(distinct.begin(), distinct.end(), key) != distinct.end(); i++) {
+        key = "key" + std::to_string(i);
     }
     return key;
 }
@@ -73,18 +74,29 @@ TEST_CASE("Integration test") {
     CHECK_MESSAGE(status.is_ok(), status.get_msg());
     CHECK_EQ(cluster::SlotState::c_MIGRATING, node0.get_cluster_state().slots[0].state);
 
-    //Import slot0 from node0 to node1
+    //Import slot0 from node0 to node1, node0 streams its keys and finishes the migration by itself
     status = client0.import_slot(0, node_ip1, client_port1);
     CHECK_MESSAGE(status.is_ok(), status.get_msg());
-    CHECK_EQ(cluster::SlotState::c_IMPORTING, node1.get_cluster_state().slots[0].state);
+    for (int i = 0; i < 100 && node0.get_cluster_snapshot()->myself.served_slots[0]; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    //Migration should be done
+    CHECK_FALSE(node0.get_cluster_snapshot()->myself.served_slots[0]);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK_EQ(cluster::SlotState::c_NORMAL, node0.get_cluster_state().slots[0].state);
+    CHECK_EQ(cluster::SlotState::c_NORMAL, node1.get_cluster_state().slots[0].state);
+    CHECK_EQ(0, node0.get_kvs().get_size());
+    CHECK_EQ(1, node1.get_kvs().get_size());
+    CHECK_EQ(1, node1.get_cluster_state().slots[0].amount_of_keys);
 
     //Put another value with slot0, should end up in node1
     std::string key0_1 = get_key_with_target_slot(0, { key0_0 });
     std::string value0_1 = "value0_1";
     status = client0.put_value(key0_1, value0_1);
     CHECK_MESSAGE(status.is_ok(), status.get_msg());
-    CHECK_EQ(1, node0.get_kvs().get_size());
-    CHECK_EQ(1, node1.get_kvs().get_size());
+    CHECK_EQ(0, node0.get_kvs().get_size());
+    CHECK_EQ(2, node1.get_kvs().get_size());
 
     //Get both values
     ByteArray byte_array{};
@@ -101,10 +113,6 @@ TEST_CASE("Integration test") {
     CHECK_EQ(0, node0.get_kvs().get_size());
     CHECK_EQ(1, node1.get_kvs().get_size());
 
-    //Migration should be done
-    CHECK_EQ(cluster::SlotState::c_NORMAL, node0.get_cluster_state().slots[0].state);
-    CHECK_EQ(cluster::SlotState::c_NORMAL, node1.get_cluster_state().slots[0].state);
-
 
     std::cout << "All tests completed" << std::endl;
     //Stop nodes
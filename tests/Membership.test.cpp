@@ -0,0 +1,275 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <thread>
+
+#include "node/Membership.hpp"
+#include "node/Node.hpp"
+#include "client/Client.hpp"
+
+using namespace std::chrono_literals; // NOLINT
+using namespace node::cluster; // NOLINT
+using namespace node; // NOLINT
+
+namespace {
+    constexpr MembershipConfig test_config{ 100ms, 40ms, 3, 2, 3, 8 };
+
+    MemberUpdate new_update(const std::string& name, uint64_t incarnation, MemberState state) {
+        MemberUpdate update{};
+        std::copy(name.begin(), name.end(), update.name.begin());
+        update.incarnation = incarnation;
+        update.state = state;
+        return update;
+    }
+
+    //Delivers the messages between members right away, except from or to the ones that are down
+    struct Network {
+        std::map<std::string, Membership> members;
+        std::set<std::string> down;
+
+        explicit Network(const std::vector<std::string>& names) {
+            for (const std::string& name : names) {
+                members.emplace(name, Membership(name, 0, test_config));
+                members.at(name).set_members(names);
+            }
+        }
+
+        void deliver(std::vector<MembershipMessage> messages, MembershipClock::time_point now) {
+            while (!messages.empty()) {
+                MembershipMessage message = std::move(messages.back());
+                messages.pop_back();
+                if (down.contains(message.from) || down.contains(message.to)) {
+                    continue;
+                }
+                std::vector<MembershipMessage> replies = members.at(message.to).handle(message, now);
+                messages.insert(messages.end(), replies.begin(), replies.end());
+            }
+        }
+
+        void run(MembershipClock::time_point begin, MembershipClock::duration duration) {
+            for (auto now = begin; now < begin + duration; now += 10ms) {
+                for (auto& [name, membership] : members) {
+                    if (!down.contains(name)) {
+                        deliver(membership.tick(now), now);
+                    }
+                }
+            }
+        }
+    };
+}
+
+TEST_CASE("Test membership probes") {
+    MembershipClock::time_point start{};
+
+    SUBCASE("Direct probe") {
+        Membership membership("a", 0, test_config);
+        membership.set_members({ "a", "b" });
+
+        std::vector<MembershipMessage> messages = membership.tick(start);
+        REQUIRE_EQ(1, messages.size());
+        CHECK_EQ(MembershipMessageType::c_PING, messages[0].type);
+        CHECK_EQ("b", messages[0].to);
+        CHECK_EQ("a", messages[0].from);
+
+        MembershipMessage ack{ MembershipMessageType::c_ACK, "a", "b", "b", messages[0].sequence, {} };
+        CHECK(membership.handle(ack, start + 10ms).empty());
+
+        //The probe was answered, so the next period just probes again
+        messages = membership.tick(start + 100ms);
+        REQUIRE_EQ(1, messages.size());
+        CHECK_EQ(MembershipMessageType::c_PING, messages[0].type);
+        CHECK_EQ(MemberState::c_ALIVE, membership.get_state("b"));
+        CHECK(membership.take_changes().empty());
+    }
+
+    SUBCASE("Answered ping") {
+        Membership membership("b", 0, test_config);
+        membership.set_members({ "a", "b" });
+
+        MembershipMessage ping{ MembershipMessageType::c_PING, "b", "a", "b", 7, {} };
+        std::vector<MembershipMessage> messages = membership.handle(ping, start);
+        REQUIRE_EQ(1, messages.size());
+        CHECK_EQ(MembershipMessageType::c_ACK, messages[0].type);
+        CHECK_EQ("a", messages[0].to);
+        CHECK_EQ("b", messages[0].target);
+        CHECK_EQ(7, messages[0].sequence);
+    }
+
+    SUBCASE("Indirect probe") {
+        Membership membership("a", 0, test_config);
+        membership.set_members({ "a", "b", "c", "d" });
+
+        std::vector<MembershipMessage> messages = membership.tick(start);
+        REQUIRE_EQ(1, messages.size());
+        std::string target = messages[0].target;
+        uint64_t sequence = messages[0].sequence;
+
+        //Not answered within the timeout, the other two members probe the target
+        CHECK(membership.tick(start + 20ms).empty());
+        messages = membership.tick(start + 40ms);
+        REQUIRE_EQ(2, messages.size());
+        for (const MembershipMessage& message : messages) {
+            CHECK_EQ(MembershipMessageType::c_PING_REQ, message.type);
+            CHECK_EQ(target, message.target);
+            CHECK_EQ(sequence, message.sequence);
+            CHECK_NE(target, message.to);
+        }
+
+        //The helper forwards the ack of the target
+        Membership helper(messages[0].to, 0, test_config);
+        helper.set_members({ "a", "b", "c", "d" });
+        std::vector<MembershipMessage> forwarded = helper.handle(messages[0], start + 40ms);
+        REQUIRE_EQ(1, forwarded.size());
+        CHECK_EQ(MembershipMessageType::c_PING, forwarded[0].type);
+        CHECK_EQ(target, forwarded[0].to);
+
+        MembershipMessage ack{ MembershipMessageType::c_ACK, messages[0].to, target, target, forwarded[0].sequence, {} };
+        std::vector<MembershipMessage> acks = helper.handle(ack, start + 50ms);
+        REQUIRE_EQ(1, acks.size());
+        CHECK_EQ(MembershipMessageType::c_ACK, acks[0].type);
+        CHECK_EQ("a", acks[0].to);
+        CHECK_EQ(sequence, acks[0].sequence);
+
+        membership.handle(acks[0], start + 60ms);
+        membership.tick(start + 100ms);
+        CHECK_EQ(MemberState::c_ALIVE, membership.get_state(target));
+        CHECK(membership.take_changes().empty());
+    }
+}
+
+TEST_CASE("Test failure detection") {
+    MembershipClock::time_point start{};
+    Network network({ "a", "b", "c" });
+
+    SUBCASE("Members that answer stay alive") {
+        network.run(start, 2s);
+        for (const auto& [name, membership] : network.members) {
+            for (const char* other : { "a", "b", "c" }) {
+                if (other != name) {
+                    CHECK_EQ(MemberState::c_ALIVE, membership.get_state(other));
+                }
+            }
+        }
+    }
+
+    SUBCASE("Unreachable member is suspected and declared dead") {
+        network.down.insert("b");
+        network.run(start, 2s);
+        CHECK_EQ(MemberState::c_DEAD, network.members.at("a").get_state("b"));
+        CHECK_EQ(MemberState::c_DEAD, network.members.at("c").get_state("b"));
+        CHECK_EQ(MemberState::c_ALIVE, network.members.at("a").get_state("c"));
+        CHECK_EQ(MemberState::c_ALIVE, network.members.at("c").get_state("a"));
+
+        std::vector<std::pair<std::string, MemberState>> changes = network.members.at("a").take_changes();
+        REQUIRE_EQ(2, changes.size());
+        CHECK_EQ(MemberState::c_SUSPECT, changes[0].second);
+        CHECK_EQ(MemberState::c_DEAD, changes[1].second);
+    }
+
+    SUBCASE("Member that comes back refutes its death") {
+        network.down.insert("b");
+        network.run(start, 2s);
+        REQUIRE_EQ(MemberState::c_DEAD, network.members.at("a").get_state("b"));
+
+        network.down.clear();
+        network.run(start + 2s, 2s);
+        CHECK_EQ(MemberState::c_ALIVE, network.members.at("a").get_state("b"));
+        CHECK_EQ(MemberState::c_ALIVE, network.members.at("c").get_state("b"));
+        CHECK_LT(0, network.members.at("b").get_incarnation());
+    }
+}
+
+TEST_CASE("Test membership updates") {
+    MembershipClock::time_point start{};
+    Membership a("a", 0, test_config);
+    a.set_members({ "a", "b", "c" });
+
+    SUBCASE("Suspicion is refuted") {
+        Membership b("b", 0, test_config);
+        b.set_members({ "a", "b", "c" });
+
+        MembershipMessage rumor{ MembershipMessageType::c_PING, "a", "c", "a", 1, { new_update("b", 0, MemberState::c_SUSPECT) } };
+        a.handle(rumor, start);
+        CHECK_EQ(MemberState::c_SUSPECT, a.get_state("b"));
+
+        //b hears about it and answers with a newer incarnation
+        MembershipMessage ping{ MembershipMessageType::c_PING, "b", "a", "b", 2, { new_update("b", 0, MemberState::c_SUSPECT) } };
+        std::vector<MembershipMessage> acks = b.handle(ping, start);
+        CHECK_EQ(1, b.get_incarnation());
+        REQUIRE_EQ(1, acks.size());
+        a.handle(acks[0], start);
+        CHECK_EQ(MemberState::c_ALIVE, a.get_state("b"));
+
+        //An old suspicion doesn't override that
+        a.handle(rumor, start);
+        CHECK_EQ(MemberState::c_ALIVE, a.get_state("b"));
+    }
+
+    SUBCASE("Dead overrides suspect") {
+        a.handle(MembershipMessage{ MembershipMessageType::c_PING, "a", "c", "a", 1, { new_update("b", 0, MemberState::c_SUSPECT) } }, start);
+        a.handle(MembershipMessage{ MembershipMessageType::c_PING, "a", "c", "a", 2, { new_update("b", 0, MemberState::c_DEAD) } }, start);
+        CHECK_EQ(MemberState::c_DEAD, a.get_state("b"));
+        //Only a newer incarnation revives it
+        a.handle(MembershipMessage{ MembershipMessageType::c_PING, "a", "c", "a", 3, { new_update("b", 0, MemberState::c_ALIVE) } }, start);
+        CHECK_EQ(MemberState::c_DEAD, a.get_state("b"));
+        a.handle(MembershipMessage{ MembershipMessageType::c_PING, "a", "c", "a", 4, { new_update("b", 1, MemberState::c_ALIVE) } }, start);
+        CHECK_EQ(MemberState::c_ALIVE, a.get_state("b"));
+    }
+
+    SUBCASE("Updates are piggybacked a limited number of times") {
+        //The retransmit multiplier times 2 for two other members, starting with the answer to the rumor
+        int sent = 0;
+        for (uint64_t sequence = 1; sequence < 20; sequence++) {
+            std::vector<MemberUpdate> updates;
+            if (sequence == 1) {
+                updates.push_back(new_update("b", 0, MemberState::c_SUSPECT));
+            }
+            for (const MembershipMessage& message : a.handle(MembershipMessage{ MembershipMessageType::c_PING, "a", "c", "a", sequence, updates }, start)) {
+                sent += static_cast<int>(message.updates.size());
+            }
+        }
+        CHECK_EQ(6, sent);
+    }
+}
+
+TEST_CASE("Test failed node") {
+    uint16_t client_port0 = 17000, cluster_port0 = 17001;
+    uint16_t client_port1 = 17002, cluster_port1 = 17003;
+    Node node0 = Node::new_in_memory_node("node0", client_port0, cluster_port0, "127.0.0.1", true);
+    Node node1 = Node::new_in_memory_node("node1", client_port1, cluster_port1, "127.0.0.1");
+    MembershipConfig config{ 50ms, 20ms, 3, 2, 3, 8 };
+    node0.set_membership_config(config);
+    node1.set_membership_config(config);
+
+    auto thread0 = std::thread(&Node::start, &node0);
+    auto thread1 = std::thread(&Node::start, &node1);
+    std::this_thread::sleep_for(100ms);
+
+    client::Client client{};
+    REQUIRE(client.connect_to_node("127.0.0.1", client_port0).is_ok());
+    REQUIRE(client.add_node_to_cluster("node1", "127.0.0.1", client_port1, cluster_port1).is_ok());
+    std::this_thread::sleep_for(500ms);
+    CHECK_FALSE(node1.get_cluster_snapshot()->nodes.empty());
+
+    //Both answer the probes, so neither is suspected for longer than a few periods
+    std::this_thread::sleep_for(1s);
+    CHECK_FALSE(node0.get_cluster_state().nodes["node1"].failed);
+    CHECK_FALSE(node1.get_cluster_state().nodes["node0"].failed);
+
+    //Once node0 is gone, node1 doesn't redirect to it anymore
+    node0.stop();
+    thread0.join();
+    std::this_thread::sleep_for(1s);
+
+    client::Client client1{};
+    REQUIRE(client1.connect_to_node("127.0.0.1", client_port1).is_ok());
+    Status status = client1.put_value("key", "value");
+    CHECK(status.is_error());
+    CHECK_EQ("Slot " + std::to_string(get_key_slot("key")) + " is served by failed node node0", status.get_msg());
+
+    node1.stop();
+    thread1.join();
+}
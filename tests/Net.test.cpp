@@ -1,16 +1,24 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fstream>
 #include <limits>
 #include <stdexcept>
 #include <future>
 #include <random>
 #include <chrono>
+#include <thread>
 
 #include "net/FileDescriptor.hpp"
 #include "net/Socket.hpp"
 #include "net/Connection.hpp"
 #include "net/Epoll.hpp"
+#include "net/IReactor.hpp"
+#include "net/Task.hpp"
+#include "net/SharedMemoryChannel.hpp"
+#include "net/TimerQueue.hpp"
 #include "NetworkingHelper.hpp"
 
 using namespace std::chrono_literals;
@@ -93,3 +101,444 @@ TEST_CASE("Test epoll") {
     connection.receive(buf, 100);
     CHECK_EQ(epoll.wait(1000), 0);
 }
+
+TEST_CASE("Test vectored send") {
+    net::Socket server_socket{}, client_socket{};
+    uint16_t port = 3000;
+    server_socket.listen(port);
+
+    net::Connection sender = client_socket.connect(port);
+    net::Connection receiver = server_socket.accept();
+
+    //Large enough to require several sendmsg() calls
+    std::string header = "header", body(4 * 1024 * 1024, 0);
+    for (uint64_t i = 0; i < body.size(); ++i) {
+        body[i] = static_cast<char>(i % 251);
+    }
+    std::array<iovec, 2> buffers{ iovec{ header.data(), header.size() }, iovec{ body.data(), body.size() } };
+
+    auto sent = std::async(std::launch::async, [&]() {
+        return sender.send(std::span<iovec>(buffers));
+    });
+
+    std::string received(header.size() + body.size(), 0);
+    uint64_t total_received = 0;
+    while (total_received < received.size()) {
+        ssize_t bytes = receiver.receive(received.data() + total_received, received.size() - total_received);
+        if (bytes <= 0) {
+            break;
+        }
+        total_received += bytes;
+    }
+
+    CHECK_EQ(sent.get(), header.size() + body.size());
+    CHECK_EQ(received, header + body);
+}
+
+TEST_CASE("Test output buffering") {
+    net::Socket server_socket{}, client_socket{};
+    uint16_t port = 3000;
+    server_socket.listen(port);
+
+    net::Connection receiver = client_socket.connect(port);
+    net::Connection sender = server_socket.accept();
+
+    std::string data(8 * 1024 * 1024, 0);
+    for (uint64_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i % 251);
+    }
+
+    SUBCASE("Send does not block and output is flushed later") {
+        sender.enable_output_buffering(net::OutputBufferLimits{});
+
+        //Nobody reads yet, so most of the data has to be queued
+        CHECK_EQ(sender.send(data.data(), data.size()), data.size());
+        CHECK(sender.has_pending_output());
+        CHECK(sender.pending_output_size() <= data.size());
+
+        auto received = std::async(std::launch::async, [&]() {
+            std::string result(data.size(), 0);
+            uint64_t total_received = 0;
+            while (total_received < result.size()) {
+                ssize_t bytes = receiver.receive(result.data() + total_received, result.size() - total_received);
+                if (bytes <= 0) {
+                    break;
+                }
+                total_received += bytes;
+            }
+            return result;
+        });
+
+        net::Epoll epoll{};
+        epoll.add_event(sender.fd(), EPOLLOUT | EPOLLET);
+        while (!sender.flush()) {
+            (void) epoll.wait(1000);
+        }
+
+        CHECK_FALSE(sender.has_pending_output());
+        CHECK_EQ(received.get(), data);
+    }
+
+    SUBCASE("Exceeding the hard limit fails") {
+        sender.enable_output_buffering(net::OutputBufferLimits{ 1024 * 1024, 0, std::chrono::seconds{ 0 } });
+
+        bool thrown = false;
+        try {
+            sender.send(data.data(), data.size());
+        }
+        catch (std::runtime_error& e) {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+}
+
+TEST_CASE("Test unix domain socket") {
+    const std::string path = "/tmp/kvs_net_test.sock";
+    net::Socket server_socket{ net::SocketFamily::c_UNIX }, client_socket{ net::SocketFamily::c_UNIX };
+    const auto fails = [](const auto& operation) {
+        try {
+            operation();
+        }
+        catch (std::runtime_error& e) {
+            return true;
+        }
+        return false;
+    };
+    CHECK(fails([&]() { server_socket.listen(3000); }));
+
+    //A file left at the path doesn't prevent listening
+    std::ofstream{ path } << "stale";
+    server_socket.listen(path);
+    CHECK(net::is_listening(server_socket.fd()));
+
+    net::Connection client = client_socket.connect(path);
+    net::Connection server = server_socket.accept();
+
+    client.send(std::string("request"));
+    std::string request(7, 0);
+    CHECK_EQ(server.receive(request.data(), request.size()), request.size());
+    CHECK_EQ(request, "request");
+
+    net::Socket inet_socket{};
+    CHECK(fails([&]() { inet_socket.connect(path); }));
+    net::Socket too_long{ net::SocketFamily::c_UNIX };
+    CHECK(fails([&]() { too_long.connect(std::string(200, 'a')); }));
+    ::unlink(path.c_str());
+}
+
+TEST_CASE("Test reactor") {
+    net::ReactorBackend backend = net::ReactorBackend::c_EPOLL;
+    SUBCASE("Epoll") {
+        backend = net::ReactorBackend::c_EPOLL;
+    }
+    SUBCASE("io_uring, falls back to epoll if not supported") {
+        backend = net::ReactorBackend::c_IO_URING;
+    }
+
+    std::unique_ptr<net::IReactor> reactor = net::new_reactor(backend);
+    net::Socket server_socket{}, client_socket{};
+    uint16_t port = 3000;
+    server_socket.set_non_blocking();
+    server_socket.listen(port);
+    reactor->add_listener(server_socket.fd());
+
+    //Accept
+    net::Connection client = client_socket.connect(port);
+    CHECK_EQ(reactor->wait(1000), 1);
+    CHECK_EQ(reactor->get_event_type(0), net::ReactorEvent::c_ACCEPTED);
+    CHECK_EQ(reactor->get_event_fd(0), server_socket.fd());
+
+    net::Connection server = reactor->get_accepted_connection(0);
+    server.enable_output_buffering(net::OutputBufferLimits{});
+    reactor->add_connection(server);
+
+    //Receive
+    client.send(std::string("request"));
+    CHECK_EQ(reactor->wait(1000), 1);
+    CHECK_EQ(reactor->get_event_type(0), net::ReactorEvent::c_READABLE);
+    CHECK_EQ(reactor->get_event_fd(0), server.fd());
+
+    std::string request(7, 0);
+    CHECK_EQ(server.receive(request.data(), request.size()), request.size());
+    CHECK_EQ(request, "request");
+    CHECK_FALSE(server.has_received_data());
+
+    //Send, io_uring only submits the output with the next wait
+    server.send(std::string("response"));
+    reactor->flush(server);
+    for (int i = 0; i < 10 && server.has_pending_output(); i++) {
+        (void) reactor->wait(100);
+    }
+    CHECK_FALSE(server.has_pending_output());
+
+    std::string response(8, 0);
+    CHECK_EQ(client.receive(response.data(), response.size()), response.size());
+    CHECK_EQ(response, "response");
+
+    //Close
+    client = net::Connection{};
+    CHECK_EQ(reactor->wait(1000), 1);
+    CHECK_EQ(reactor->get_event_fd(0), server.fd());
+    reactor->remove_connection(server.fd());
+    reactor->remove_listener(server_socket.fd());
+}
+
+TEST_CASE("Test shared memory channel") {
+    const auto fails = [](const auto& operation) {
+        try {
+            operation();
+        }
+        catch (std::runtime_error& e) {
+            return true;
+        }
+        return false;
+    };
+    CHECK(fails([]() { net::SharedMemoryChannel::create(1000); }));
+    CHECK(fails([]() { net::SharedMemoryChannel::create(2 * net::shared_memory_max_ring_size); }));
+
+    //The descriptors are passed like between the node and a client
+    int sockets[2];
+    REQUIRE_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    net::Connection node_control{ net::FileDescriptor{ sockets[0] } }, client_control{ net::FileDescriptor{ sockets[1] } };
+
+    std::shared_ptr<net::SharedMemoryChannel> node = net::SharedMemoryChannel::create(net::shared_memory_min_ring_size);
+    std::array<int, net::shared_memory_file_descriptors> file_descriptors = node->get_file_descriptors();
+    net::send_file_descriptors(node_control.fd(), file_descriptors);
+    std::shared_ptr<net::SharedMemoryChannel> client = net::SharedMemoryChannel::attach(
+        net::receive_file_descriptors(client_control.fd(), net::shared_memory_file_descriptors), client_control);
+    CHECK_EQ(client->ring_size(), net::shared_memory_min_ring_size);
+    CHECK_NE(client->notify_fd(), node->notify_fd());
+
+    SUBCASE("Data is exchanged in both directions") {
+        std::string request = "request", response = "response";
+        iovec request_buffer{ request.data(), request.size() };
+        CHECK_EQ(client->send(std::span<iovec>(&request_buffer, 1)), request.size());
+
+        std::string received(request.size(), 0);
+        CHECK_EQ(node->receive(received, MSG_DONTWAIT), request.size());
+        CHECK_EQ(received, request);
+        CHECK_EQ(node->receive(received, MSG_DONTWAIT), -1);
+        CHECK_EQ(errno, EAGAIN);
+
+        iovec response_buffer{ response.data(), response.size() };
+        CHECK_EQ(node->send(std::span<iovec>(&response_buffer, 1), MSG_DONTWAIT), response.size());
+        CHECK_EQ(client->readable().size(), response.size());
+        CHECK_EQ(std::string(client->readable().data(), response.size()), response);
+        client->consume(response.size());
+        CHECK(client->readable().empty());
+    }
+
+    SUBCASE("Non-blocking sends stop when the ring is full") {
+        std::string data = networkingHelper::get_random_string(2 * net::shared_memory_min_ring_size);
+        iovec buffer{ data.data(), data.size() };
+        CHECK_EQ(node->send(std::span<iovec>(&buffer, 1), MSG_DONTWAIT), net::shared_memory_min_ring_size);
+        CHECK_EQ(buffer.iov_len, net::shared_memory_min_ring_size);
+        CHECK_EQ(node->send(std::span<iovec>(&buffer, 1), MSG_DONTWAIT), 0);
+    }
+
+    SUBCASE("Data larger than the ring wraps around") {
+        std::string data = networkingHelper::get_random_string(16 * net::shared_memory_min_ring_size + 123);
+        auto sender = std::async(std::launch::async, [&]() {
+            iovec buffer{ data.data(), data.size() };
+            return client->send(std::span<iovec>(&buffer, 1));
+        });
+
+        std::string received(data.size(), 0);
+        CHECK_EQ(node->receive(received), data.size());
+        CHECK_EQ(sender.get(), data.size());
+        CHECK_EQ(received, data);
+    }
+
+    SUBCASE("The reactor is notified") {
+        net::ReactorBackend backend = net::ReactorBackend::c_EPOLL;
+        SUBCASE("Epoll") {
+            backend = net::ReactorBackend::c_EPOLL;
+        }
+        SUBCASE("io_uring, falls back to epoll if not supported") {
+            backend = net::ReactorBackend::c_IO_URING;
+        }
+        std::unique_ptr<net::IReactor> reactor = net::new_reactor(backend);
+        reactor->add_notifier(node->notify_fd());
+
+        //The node only gets notified once it waits for data
+        char data;
+        CHECK_EQ(node->receive(std::span<char>(&data, 1), MSG_DONTWAIT), -1);
+        for (int i = 0; i < 2; i++) {
+            iovec buffer{ &data, 1 };
+            CHECK_EQ(client->send(std::span<iovec>(&buffer, 1)), 1);
+            CHECK_EQ(reactor->wait(1000), 1);
+            CHECK_EQ(reactor->get_event_type(0), net::ReactorEvent::c_READABLE);
+            CHECK_EQ(reactor->get_event_fd(0), node->notify_fd());
+            CHECK_EQ(node->receive(std::span<char>(&data, 1), MSG_DONTWAIT), 1);
+            CHECK_EQ(node->receive(std::span<char>(&data, 1), MSG_DONTWAIT), -1);
+        }
+        reactor->remove_notifier(node->notify_fd());
+    }
+
+    SUBCASE("Closing the control connection ends blocking receives") {
+        auto receiver = std::async(std::launch::async, [&]() {
+            char data;
+            return client->receive(std::span<char>(&data, 1));
+        });
+        std::this_thread::sleep_for(50ms);
+        node_control = net::Connection{};
+        CHECK_EQ(receiver.get(), 0);
+    }
+}
+
+net::Task<std::string> read_message(net::Connection& connection) {
+    uint64_t size;
+    co_await connection.read_exact(std::span<char>(reinterpret_cast<char*>(&size), sizeof(size)));
+    std::span<char> data = co_await connection.read_exact(size);
+    co_return std::string(data.data(), data.size());
+}
+
+net::Task<> write_message(net::Connection& connection, const std::string& message) {
+    co_await connection.write_all(std::span<const char>(message));
+}
+
+TEST_CASE("Test timer queue") {
+    net::ReactorBackend backend = net::ReactorBackend::c_EPOLL;
+    SUBCASE("Epoll") {
+        backend = net::ReactorBackend::c_EPOLL;
+    }
+    SUBCASE("io_uring, falls back to epoll if not supported") {
+        backend = net::ReactorBackend::c_IO_URING;
+    }
+    std::unique_ptr<net::IReactor> reactor = net::new_reactor(backend);
+    net::TimerQueue timers{};
+    reactor->add_notifier(timers.fd());
+
+    std::vector<int> order;
+    timers.add(60ms, [&]() { order.push_back(3); });
+    timers.add(20ms, [&]() { order.push_back(1); });
+    net::TimerId cancelled = timers.add(30ms, [&]() { order.push_back(2); });
+    timers.add(40ms, [&]() {
+        order.push_back(4);
+        //Added by a callback, even without a delay it runs with the next expiration only
+        timers.add(0ms, [&]() { order.push_back(5); });
+    });
+    timers.cancel(cancelled);
+
+    auto start = std::chrono::steady_clock::now();
+    while (timers.size() > 0 && std::chrono::steady_clock::now() - start < 1s) {
+        int events = reactor->wait(1000);
+        for (int i = 0; i < events; i++) {
+            CHECK_EQ(reactor->get_event_fd(i), timers.fd());
+            timers.run_expired();
+        }
+    }
+    CHECK_EQ(order, std::vector<int>{ 1, 4, 5, 3 });
+    CHECK_LE(55ms, std::chrono::steady_clock::now() - start);
+
+    //Nothing is armed anymore
+    CHECK_EQ(reactor->wait(50), 0);
+    reactor->remove_notifier(timers.fd());
+}
+
+TEST_CASE("Test coroutine io") {
+    net::Socket server_socket{}, client_socket_1{}, client_socket_2{};
+    uint16_t port = 3000;
+    server_socket.listen(port);
+
+    net::Connection client_1 = client_socket_1.connect(port);
+    net::Connection server_1 = server_socket.accept();
+    net::Connection client_2 = client_socket_2.connect(port);
+    net::Connection server_2 = server_socket.accept();
+
+    SUBCASE("Partial reads are interleaved") {
+        server_1.enable_async_io();
+        server_2.enable_async_io();
+        net::Task<std::string> read_1 = read_message(server_1);
+        net::Task<std::string> read_2 = read_message(server_2);
+        read_1.start();
+        read_2.start();
+        CHECK_FALSE(read_1.done());
+        CHECK_FALSE(read_2.done());
+
+        uint64_t size = 5;
+        client_1.send(reinterpret_cast<char*>(&size), sizeof(size));
+        client_2.send(reinterpret_cast<char*>(&size), sizeof(size));
+        client_2.send(std::string("wor"));
+        std::this_thread::sleep_for(10ms);
+        server_1.resume_waiting(net::Readiness::c_INPUT);
+        server_2.resume_waiting(net::Readiness::c_INPUT);
+        CHECK_FALSE(read_1.done());
+        CHECK_FALSE(read_2.done());
+
+        client_2.send(std::string("ld"));
+        client_1.send(std::string("hello"));
+        std::this_thread::sleep_for(10ms);
+        server_2.resume_waiting(net::Readiness::c_INPUT);
+        CHECK(read_2.done());
+        CHECK_FALSE(read_1.done());
+        server_1.resume_waiting(net::Readiness::c_INPUT);
+        CHECK(read_1.done());
+
+        CHECK_EQ(read_1.get_result(), "hello");
+        CHECK_EQ(read_2.get_result(), "world");
+    }
+
+    SUBCASE("Closed connection fails the read") {
+        server_1.enable_async_io();
+        net::Task<std::string> read = read_message(server_1);
+        read.start();
+
+        client_1 = net::Connection{};
+        std::this_thread::sleep_for(10ms);
+        server_1.resume_waiting(net::Readiness::c_INPUT);
+        CHECK(read.done());
+
+        bool thrown = false;
+        try {
+            read.get_result();
+        }
+        catch (std::runtime_error& e) {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+
+    SUBCASE("Blocking connections don't suspend") {
+        uint64_t size = 5;
+        client_1.send(reinterpret_cast<char*>(&size), sizeof(size));
+        client_1.send(std::string("hello"));
+        CHECK_EQ(net::sync_wait(read_message(server_1)), "hello");
+    }
+
+    SUBCASE("write_all waits until the output drained") {
+        server_1.enable_output_buffering(net::OutputBufferLimits{});
+        server_1.enable_async_io();
+
+        //Much larger than the socket buffer
+        std::string data(32 * net::write_all_max_pending_output, 'x');
+        net::Task<> write = write_message(server_1, data);
+        write.start();
+        CHECK_FALSE(write.done());
+
+        auto received = std::async(std::launch::async, [&]() {
+            std::string result(data.size(), 0);
+            uint64_t total_received = 0;
+            while (total_received < result.size()) {
+                ssize_t bytes = client_1.receive(result.data() + total_received, result.size() - total_received);
+                if (bytes <= 0) {
+                    break;
+                }
+                total_received += bytes;
+            }
+            return result;
+        });
+
+        for (int i = 0; i < 1000 && !write.done(); i++) {
+            server_1.flush();
+            server_1.resume_waiting(net::Readiness::c_OUTPUT);
+            std::this_thread::sleep_for(1ms);
+        }
+        CHECK(write.done());
+        while (!server_1.flush()) {
+            std::this_thread::sleep_for(1ms);
+        }
+        CHECK_EQ(received.get(), data);
+    }
+}
@@ -87,7 +87,7 @@ TEST_CASE("Get Commands") {
     auto parse_command = [&]() {
         socket.listen(port);
         net::Connection c = socket.accept();
-        return node::protocol::get_command(c, 3, command_size);
+        return node::protocol::get_command(c, 3, command_size).to_command();
     };
 
     auto received = std::async(parse_command);
@@ -127,3 +127,111 @@ TEST_CASE("Get Payload") {
     CHECK_EQ(received_data.size(), expected_data.size());
     CHECK(memcmp(received_data.data(), expected_data.data(), expected_data.size()) == 0);
 }
+
+
+TEST_CASE("Parse Commands") {
+    node::protocol::Command command{ "key", "5", "0" };
+    std::vector<char> data(node::protocol::get_command_size(command));
+    node::protocol::serialize_command(command, data);
+
+    SUBCASE("Fields point into the buffer") {
+        auto parsed = node::protocol::parse_command(data, 3);
+        CHECK_EQ(parsed.size(), 3);
+        CHECK_EQ(parsed[0], "key");
+        CHECK_EQ(parsed[1], "5");
+        CHECK_EQ(parsed[2], "0");
+        CHECK(parsed[0].data() >= data.data());
+        CHECK(parsed[2].data() < data.data() + data.size());
+        CHECK_EQ(node::protocol::field_to_uint64(parsed[1]), 5);
+    }
+
+    SUBCASE("Reject truncated commands") {
+        CHECK_THROWS_AS(node::protocol::parse_command(std::span<const char>(data.data(), data.size() - 1), 3), std::runtime_error);
+    }
+
+    SUBCASE("Reject too many fields") {
+        CHECK_THROWS_AS(node::protocol::parse_command(data, node::protocol::MAX_COMMAND_ARGC + 1), std::runtime_error);
+    }
+
+    SUBCASE("Reject invalid numbers") {
+        CHECK_THROWS_AS(node::protocol::field_to_uint64("abc"), std::invalid_argument);
+    }
+}
+
+TEST_CASE("Serialize Slot Changes") {
+    std::vector<std::string> previous(10, "127.0.0.1:5000");
+    std::vector<std::string> current = previous;
+    CHECK(node::protocol::serialize_slot_changes(previous, current).empty());
+    CHECK_EQ(node::protocol::serialize_slot_changes({}, current), "0\t9\t127.0.0.1:5000");
+
+    current[2] = "127.0.0.1:5001";
+    current[3] = "127.0.0.1:5001";
+    current[4] = "NULL";
+    current[9] = "127.0.0.1:5001\t127.0.0.1:5002";
+    CHECK_EQ(node::protocol::serialize_slot_changes(previous, current),
+        "2\t3\t127.0.0.1:5001\n4\t4\tNULL\n9\t9\t127.0.0.1:5001\t127.0.0.1:5002");
+}
+
+TEST_CASE("Serialize Slot Map") {
+    auto set_field = [](auto& field, const std::string& value) {
+        field.fill('\0');
+        std::copy(value.begin(), value.end(), field.begin());
+    };
+    node::cluster::ClusterState state{};
+    state.myself = node::cluster::ClusterNode{};
+    set_field(state.myself.name, "node0");
+    set_field(state.myself.ip, "127.0.0.1");
+    state.myself.client_port = 5000;
+    state.myself.config_epoch = 3;
+    for (const auto& [name, port] : { std::pair<std::string, uint16_t>{ "node1", 5001 }, { "node2", 5002 } }) {
+        node::cluster::ClusterNode& node = state.nodes[name];
+        set_field(node.name, name);
+        set_field(node.ip, "127.0.0.1");
+        node.client_port = port;
+    }
+    state.nodes["node1"].config_epoch = 7;
+    set_field(state.nodes["node2"].primary, "node1");
+    state.slots.resize(10);
+    for (int i = 0; i < 5; ++i) {
+        state.slots[i].served_by = &state.myself;
+    }
+    for (int i = 5; i < 8; ++i) {
+        state.slots[i].served_by = &state.nodes["node1"];
+    }
+
+    std::string data = node::protocol::serialize_slot_map(state);
+    node::protocol::SlotMap map = node::protocol::parse_slot_map(data);
+    CHECK_EQ(map.config_epoch, 7);
+    CHECK_EQ(map.digest, node::protocol::get_slot_map_digest(data));
+    REQUIRE_EQ(map.nodes.size(), 3);
+    CHECK_EQ(map.nodes[0].address, "127.0.0.1:5000");
+    CHECK_EQ(map.nodes[1].name, "node1");
+    CHECK_EQ(map.nodes[1].primary, node::protocol::SLOT_MAP_NO_NODE);
+    CHECK_EQ(map.nodes[2].address, "127.0.0.1:5002");
+    CHECK_EQ(map.nodes[2].primary, 1);
+    REQUIRE_EQ(map.ranges.size(), 3);
+    CHECK_EQ(map.ranges[1].first_slot, 5);
+    CHECK_EQ(map.ranges[1].last_slot, 7);
+    CHECK_EQ(map.ranges[1].node, 1);
+    CHECK_EQ(map.ranges[2].node, node::protocol::SLOT_MAP_NO_NODE);
+
+    //Only the map itself is hashed, nodes that agree on it send the same digest
+    state.myself.config_epoch = 8;
+    std::string same = node::protocol::serialize_slot_map(state);
+    CHECK_EQ(node::protocol::parse_slot_map(same).config_epoch, 8);
+    CHECK_EQ(node::protocol::get_slot_map_digest(same), map.digest);
+
+    state.nodes["node1"].failed = true;
+    std::string failed = node::protocol::serialize_slot_map(state);
+    CHECK_NE(node::protocol::get_slot_map_digest(failed), map.digest);
+    CHECK_EQ(node::protocol::parse_slot_map(failed).ranges[1].node, node::protocol::SLOT_MAP_NO_NODE);
+
+    bool thrown = false;
+    try {
+        node::protocol::parse_slot_map(std::span<const char>(data.data(), data.size() - 1));
+    }
+    catch (std::runtime_error& e) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}